@@ -0,0 +1,517 @@
+/*
+ *
+ * Running the examples as benchmarks.
+ *
+ * Each program listed in benchmarks.def is run 'runs' times, after
+ * one run that is not counted, with a fixed file as its standard
+ * input and its output thrown away, and each of the loops taken
+ * from the examples into bench_kernels.c is called as many times in
+ * this process.  For every run the wall time from just before the
+ * program is started to its exit is taken with clock_gettime, and
+ * the cycles, instructions, cache misses and branch mispredictions
+ * in user space are counted by the processor, through
+ * perf_event_open, along with the most memory the program held.
+ *
+ * A program's counters are opened for it between fork and exec,
+ * while it waits on a pipe, and set to start at the exec, so they
+ * count the program and not the driver; they are inherited by any
+ * threads it starts.  Where a counter cannot be had, in a virtual
+ * machine without one, say, or where perf_event_paranoid forbids
+ * it, it is left out, and the wall time is still measured.  If the
+ * kernel had to share the counters out, the counts are scaled up
+ * by the time each was counting, as perf does.
+ *
+ * The median and least of the runs of each benchmark are written
+ * as JSON, or as CSV, one line per benchmark, labelled with -l, a
+ * commit, say, so that results can be kept and compared.  A
+ * summary goes to the standard error.  If any run of a program
+ * exits with another status than benchmarks.def gives, the first
+ * such status is the one reported, and once the results are
+ * written the driver exits with a failure.
+ *
+ * usage: bench-driver [-n runs] [-f json|csv] [-o file] [-l label]
+ *                     [-d program_dir] [-x fixture_dir] [name...]
+ *
+ *   -d  where the examples are, by default where bench-driver is
+ *   -x  where the fixtures are, by default ./fixtures
+ *   name  run only these benchmarks
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RUNS 10
+#define MAX_RUNS 100000
+#define MAX_ARGUMENTS 32
+#define PATH_SIZE 4096
+
+/* the processor's counters: name, and perf's number for it */
+#define COUNTERS(X)                                                          \
+  X(cycles, PERF_COUNT_HW_CPU_CYCLES)                                        \
+  X(instructions, PERF_COUNT_HW_INSTRUCTIONS)                                \
+  X(cache_misses, PERF_COUNT_HW_CACHE_MISSES)                                \
+  X(branch_misses, PERF_COUNT_HW_BRANCH_MISSES)
+
+#define COUNTER_ENUM(name, config) COUNTER_##name,
+enum counter { COUNTERS(COUNTER_ENUM) COUNTER_COUNT };
+
+/* what is kept of a run: the wall time, the counters, then the memory */
+enum { WALL_NS, FIRST_COUNTER, MAX_RSS_KB = FIRST_COUNTER + COUNTER_COUNT,
+       METRICS };
+
+#define COUNTER_NAME(name, config) #name,
+static const char *const metric_names[METRICS] = {
+    "wall_ns", COUNTERS(COUNTER_NAME) "max_rss_kb"};
+
+#define COUNTER_CONFIG(name, config) config,
+static const uint64_t counter_configs[COUNTER_COUNT] = {
+    COUNTERS(COUNTER_CONFIG)};
+
+enum kind { PROCESS, KERNEL };
+
+struct benchmark {
+  enum kind kind;
+  const char *name;
+  const char *fixture;   /* for a process; NULL for /dev/null */
+  const char *arguments; /* for a process, separated by spaces */
+  int status;            /* that a process should exit with */
+  void (*kernel)(void);
+};
+
+/* bench_kernels.c */
+#define PROCESS(program, fixture, arguments, status)
+#define KERNEL(name, function) void function(void);
+#include "benchmarks.def"
+#undef PROCESS
+#undef KERNEL
+
+#define PROCESS(program, fixture, arguments, status)                         \
+  {PROCESS, program, fixture, arguments, status, NULL},
+#define KERNEL(name, function) {KERNEL, name, NULL, NULL, 0, function},
+static const struct benchmark benchmarks[] = {
+#include "benchmarks.def"
+};
+#undef PROCESS
+#undef KERNEL
+
+/* the median and least of each metric over the runs: NAN if not had */
+struct result {
+  const struct benchmark *benchmark;
+  int status;
+  double median[METRICS];
+  double least[METRICS];
+};
+
+static bool counter_unavailable[COUNTER_COUNT];
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* -------- counters -------- */
+
+/*
+ * A counter of user-space events for pid, 0 for this process,
+ * stopped until it is enabled or, if 'on_exec', pid calls exec.
+ * -1 if it cannot be had, which is said once.
+ */
+static int open_counter(enum counter counter, pid_t pid, bool on_exec) {
+  if (counter_unavailable[counter])
+    return -1;
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = counter_configs[counter];
+  attr.disabled = 1;
+  attr.enable_on_exec = on_exec;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  int fd = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                        PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "%s: not counted: %s\n",
+            metric_names[FIRST_COUNTER + counter], strerror(errno));
+    counter_unavailable[counter] = true;
+  }
+  return fd;
+}
+
+static void open_counters(int *fds, pid_t pid, bool on_exec) {
+  for (int c = 0; c < COUNTER_COUNT; c++)
+    fds[c] = open_counter((enum counter)c, pid, on_exec);
+}
+
+/* the counts, scaled for any time the counters were not counting */
+static void read_counters(int *fds, double *values) {
+  for (int c = 0; c < COUNTER_COUNT; c++) {
+    uint64_t count[3]; /* value, time enabled, time running */
+    values[FIRST_COUNTER + c] = NAN;
+    if (fds[c] < 0)
+      continue;
+    if (read(fds[c], count, sizeof(count)) == (ssize_t)sizeof(count) &&
+        count[2] > 0)
+      values[FIRST_COUNTER + c] =
+          count[2] < count[1] ? (double)count[0] * count[1] / count[2]
+                              : (double)count[0];
+    close(fds[c]);
+  }
+}
+
+static void control_counters(int *fds, unsigned long request) {
+  for (int c = 0; c < COUNTER_COUNT; c++)
+    if (fds[c] >= 0)
+      ioctl(fds[c], request, 0);
+}
+
+/* -------- running -------- */
+
+/* the words of arguments after 'program', in argv, NULL-terminated */
+static void split_arguments(char *program, char *arguments, char **argv) {
+  int argc = 0;
+  argv[argc++] = program;
+  for (char *word = strtok(arguments, " "); word != NULL;
+       word = strtok(NULL, " "))
+    if (argc < MAX_ARGUMENTS - 1)
+      argv[argc++] = word;
+  argv[argc] = NULL;
+}
+
+/* one run of a program; its exit status, or 128 + the signal */
+static int run_process(const char *path, char **argv, const char *fixture,
+                       double *values) {
+  int input = open(fixture, O_RDONLY | O_CLOEXEC);
+  if (input < 0)
+    fail(fixture);
+  int go[2];
+  if (pipe(go) != 0)
+    fail("pipe");
+  pid_t pid = fork();
+  if (pid < 0)
+    fail("fork");
+  if (pid == 0) {
+    /* wait for the counters, then become the program */
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1)
+      _exit(EXIT_FAILURE);
+    close(go[0]);
+    int null = open("/dev/null", O_WRONLY);
+    if (null < 0 || dup2(input, STDIN_FILENO) < 0 ||
+        dup2(null, STDOUT_FILENO) < 0 || dup2(null, STDERR_FILENO) < 0)
+      _exit(EXIT_FAILURE);
+    execv(path, argv);
+    _exit(127);
+  }
+  close(go[0]);
+  close(input);
+
+  int fds[COUNTER_COUNT];
+  open_counters(fds, pid, true);
+  double start = now_ns();
+  if (write(go[1], "", 1) != 1)
+    fail("write");
+  close(go[1]);
+  int status;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) < 0)
+    if (errno != EINTR)
+      fail("wait4");
+  values[WALL_NS] = now_ns() - start;
+  read_counters(fds, values);
+  values[MAX_RSS_KB] = (double)usage.ru_maxrss;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static void run_kernel(void (*kernel)(void), double *values) {
+  int fds[COUNTER_COUNT];
+  open_counters(fds, 0, false);
+  control_counters(fds, PERF_EVENT_IOC_RESET);
+  control_counters(fds, PERF_EVENT_IOC_ENABLE);
+  double start = now_ns();
+  kernel();
+  values[WALL_NS] = now_ns() - start;
+  control_counters(fds, PERF_EVENT_IOC_DISABLE);
+  read_counters(fds, values);
+  /* the driver's own peak says nothing of the kernel */
+  values[MAX_RSS_KB] = NAN;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Run a benchmark runs + 1 times, keeping all but the first.  False
+ * if its program or fixture is not there, which is said.
+ */
+static bool run_benchmark(const struct benchmark *b, int runs,
+                          const char *program_dir, const char *fixture_dir,
+                          struct result *result) {
+  char path[PATH_SIZE], fixture[PATH_SIZE];
+  char arguments[PATH_SIZE];
+  char *argv[MAX_ARGUMENTS];
+  if (b->kind == PROCESS) {
+    if (snprintf(path, sizeof(path), "%s/%s", program_dir, b->name) >=
+            (int)sizeof(path) ||
+        access(path, X_OK) != 0) {
+      fprintf(stderr, "%s: not built, skipped\n", b->name);
+      return false;
+    }
+    int length = b->fixture != NULL
+                     ? snprintf(fixture, sizeof(fixture), "%s/%s",
+                                fixture_dir, b->fixture)
+                     : snprintf(fixture, sizeof(fixture), "/dev/null");
+    if (length >= (int)sizeof(fixture) || access(fixture, R_OK) != 0) {
+      fprintf(stderr, "%s: no %s, skipped\n", b->name, fixture);
+      return false;
+    }
+    snprintf(arguments, sizeof(arguments), "%s", b->arguments);
+    split_arguments(path, arguments, argv);
+  }
+
+  double *values = (double *)xmalloc((size_t)runs * METRICS * sizeof(double));
+  double warm_up[METRICS];
+  result->benchmark = b;
+  result->status = b->status;
+  for (int r = -1; r < runs; r++) {
+    double *run = r < 0 ? warm_up : values + (size_t)r * METRICS;
+    if (b->kind == PROCESS) {
+      int status = run_process(path, argv, fixture, run);
+      /* keep the first that is wrong */
+      if (result->status == b->status)
+        result->status = status;
+    } else
+      run_kernel(b->kernel, run);
+  }
+
+  double *column = (double *)xmalloc((size_t)runs * sizeof(double));
+  for (int m = 0; m < METRICS; m++) {
+    bool had = true;
+    for (int r = 0; r < runs; r++) {
+      column[r] = values[(size_t)r * METRICS + m];
+      had = had && !isnan(column[r]);
+    }
+    if (!had) {
+      result->median[m] = result->least[m] = NAN;
+      continue;
+    }
+    qsort(column, (size_t)runs, sizeof(double), compare_doubles);
+    result->median[m] =
+        runs % 2 ? column[runs / 2]
+                 : (column[runs / 2 - 1] + column[runs / 2]) / 2;
+    result->least[m] = column[0];
+  }
+  free(column);
+  free(values);
+
+  fprintf(stderr, "%-24s %-7s %10.3f ms", b->name,
+          b->kind == PROCESS ? "process" : "kernel",
+          result->median[WALL_NS] / 1e6);
+  if (!isnan(result->median[FIRST_COUNTER + COUNTER_cycles]) &&
+      !isnan(result->median[FIRST_COUNTER + COUNTER_instructions]))
+    fprintf(stderr, " %6.2f instructions per cycle",
+            result->median[FIRST_COUNTER + COUNTER_instructions] /
+                result->median[FIRST_COUNTER + COUNTER_cycles]);
+  if (b->kind == PROCESS && result->status != b->status)
+    fprintf(stderr, "   exit status %d, not %d", result->status, b->status);
+  fprintf(stderr, "\n");
+  return true;
+}
+
+/* -------- writing the results -------- */
+
+/* s as a JSON string, or CSV field, with its quotes */
+static void put_quoted(FILE *out, const char *s, bool json) {
+  putc('"', out);
+  for (; *s != 0; s++) {
+    if (*s == '"')
+      fputs(json ? "\\\"" : "\"\"", out);
+    else if (json && *s == '\\')
+      fputs("\\\\", out);
+    else if (json && (unsigned char)*s < 0x20)
+      fprintf(out, "\\u%04x", (unsigned char)*s);
+    else
+      putc(*s, out);
+  }
+  putc('"', out);
+}
+
+static void write_json(FILE *out, const char *label,
+                       const struct result *results, size_t count, int runs) {
+  fprintf(out, "{\n  \"label\": ");
+  if (label != NULL)
+    put_quoted(out, label, true);
+  else
+    fprintf(out, "null");
+  fprintf(out, ",\n  \"runs\": %d,\n  \"results\": [", runs);
+  for (size_t i = 0; i < count; i++) {
+    const struct result *r = &results[i];
+    fprintf(out, "%s\n    {\"name\": ", i ? "," : "");
+    put_quoted(out, r->benchmark->name, true);
+    fprintf(out, ", \"kind\": \"%s\"",
+            r->benchmark->kind == PROCESS ? "process" : "kernel");
+    if (r->benchmark->kind == PROCESS)
+      fprintf(out, ", \"status\": %d", r->status);
+    for (int m = 0; m < METRICS; m++) {
+      fprintf(out, ",\n     \"%s\": ", metric_names[m]);
+      if (isnan(r->median[m]))
+        fprintf(out, "null");
+      else
+        fprintf(out, "{\"median\": %.0f, \"min\": %.0f}", r->median[m],
+                r->least[m]);
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+}
+
+static void write_csv(FILE *out, const char *label,
+                      const struct result *results, size_t count, int runs) {
+  fprintf(out, "label,name,kind,status,runs");
+  for (int m = 0; m < METRICS; m++)
+    fprintf(out, ",%s_median,%s_min", metric_names[m], metric_names[m]);
+  fprintf(out, "\n");
+  for (size_t i = 0; i < count; i++) {
+    const struct result *r = &results[i];
+    if (label != NULL)
+      put_quoted(out, label, false);
+    putc(',', out);
+    put_quoted(out, r->benchmark->name, false);
+    fprintf(out, ",%s,",
+            r->benchmark->kind == PROCESS ? "process" : "kernel");
+    if (r->benchmark->kind == PROCESS)
+      fprintf(out, "%d", r->status);
+    fprintf(out, ",%d", runs);
+    for (int m = 0; m < METRICS; m++) {
+      if (isnan(r->median[m]))
+        fprintf(out, ",,");
+      else
+        fprintf(out, ",%.0f,%.0f", r->median[m], r->least[m]);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+/* -------- main -------- */
+
+/* the directory bench-driver is in, where the examples are built */
+static void own_directory(char *dir, size_t size) {
+  ssize_t n = readlink("/proc/self/exe", dir, size - 1);
+  if (n <= 0) {
+    snprintf(dir, size, ".");
+    return;
+  }
+  dir[n] = 0;
+  char *slash = strrchr(dir, '/');
+  if (slash != NULL)
+    *slash = 0;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n runs] [-f json|csv] [-o file] [-l label]\n"
+          "       [-d program_dir] [-x fixture_dir] [name...]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int runs = DEFAULT_RUNS;
+  bool json = true;
+  const char *output = NULL, *label = NULL, *fixture_dir = "fixtures";
+  char program_dir[PATH_SIZE];
+  own_directory(program_dir, sizeof(program_dir));
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:o:l:d:x:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'f':
+      if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0)
+        usage(argv[0]);
+      json = strcmp(optarg, "json") == 0;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    case 'd':
+      snprintf(program_dir, sizeof(program_dir), "%s", optarg);
+      break;
+    case 'x':
+      fixture_dir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (runs < 1 || runs > MAX_RUNS) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t total = sizeof(benchmarks) / sizeof(benchmarks[0]);
+  struct result *results =
+      (struct result *)xmalloc(total * sizeof(struct result));
+  size_t count = 0;
+  bool wrong_status = false;
+  for (size_t i = 0; i < total; i++) {
+    bool chosen = optind == argc;
+    for (int a = optind; a < argc && !chosen; a++)
+      chosen = strcmp(argv[a], benchmarks[i].name) == 0;
+    if (chosen && run_benchmark(&benchmarks[i], runs, program_dir,
+                                fixture_dir, &results[count])) {
+      if (results[count].status != benchmarks[i].status)
+        wrong_status = true;
+      count++;
+    }
+  }
+
+  FILE *out = stdout;
+  if (output != NULL && (out = fopen(output, "w")) == NULL)
+    fail(output);
+  if (json)
+    write_json(out, label, results, count, runs);
+  else
+    write_csv(out, label, results, count, runs);
+  if (out != stdout && fclose(out) != 0)
+    fail(output);
+  free(results);
+  exit(wrong_status ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,144 @@
+/*
+ *
+ * The loops of some examples, to be run by bench_driver.c in its
+ * own process.
+ *
+ * Each is the example's code as it stands, with its printing sent
+ * to /dev/null through a stream of its own and the sizes fixed, so
+ * that the counters measure the loop and not the starting and
+ * stopping of a program around it.
+ */
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STR_EQ_REPEATS 1000000
+#define MAXOF_REPEATS 1000000
+#define HANOI_DISKS 16
+
+static FILE *null_output(void) {
+  static FILE *null;
+  if (null == NULL) {
+    null = fopen("/dev/null", "w");
+    if (null == NULL) {
+      perror("/dev/null");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return null;
+}
+
+/* -------- example 1.2 -------- */
+
+void kernel_primes(void) {
+  FILE *out = null_output();
+  int32_t this_number = 3;
+
+  while (this_number < 10000) {
+    int32_t divisor = this_number / 2;
+    bool not_prime = false;
+    while (divisor > 1) {
+      if (this_number % divisor == 0) {
+        not_prime = true;
+        divisor = 0;
+      } else
+        divisor = divisor - 1;
+    }
+
+    if (not_prime == false)
+      fprintf(out, "%d is a prime number\n", this_number);
+    this_number = this_number + 1;
+  }
+  fflush(out);
+}
+
+/* -------- example 5.7 -------- */
+
+__attribute__((noinline)) static int32_t str_eq(const char *s1,
+                                                const char *s2) {
+  while (*s1 == *s2) {
+    if (*s1 == 0)
+      return 0;
+    s1++;
+    s2++;
+  }
+  return 1;
+}
+
+void kernel_str_eq(void) {
+  /* volatile, so that the calls are not worked out once and kept */
+  const char *volatile str1 = "str1";
+  const char *volatile str2 = "str2";
+  const char *volatile str3 = "str1";
+  int32_t sum = 0;
+  for (int32_t i = 0; i < STR_EQ_REPEATS; i++)
+    sum += str_eq(str1, str2) + str_eq(str1, str3) + str_eq(str2, str3);
+  if (sum != 2 * STR_EQ_REPEATS)
+    fprintf(stderr, "str_eq: results differ\n");
+}
+
+/* -------- example 8.6 -------- */
+
+static int i_var;
+
+static void func(FILE *out) { fprintf(out, "in func, i_var is %d\n", i_var); }
+
+void kernel_func_lines(void) {
+  FILE *out = null_output();
+  i_var = 0;
+  while (i_var != 10000) {
+    func(out);
+    i_var++;
+  }
+  fflush(out);
+}
+
+/* -------- example 9.6 -------- */
+
+__attribute__((noinline)) static int maxof(int n_args, ...) {
+  register int i;
+  int max, a;
+  va_list ap;
+
+  va_start(ap, n_args);
+  max = va_arg(ap, int);
+  for (i = 2; i <= n_args; i++) {
+    if ((a = va_arg(ap, int)) > max)
+      max = a;
+  }
+
+  va_end(ap);
+  return max;
+}
+
+void kernel_maxof(void) {
+  volatile int i = 5;
+  int j[256];
+  j[42] = 24;
+  int sum = 0;
+  for (int r = 0; r < MAXOF_REPEATS; r++)
+    sum += maxof(3, i, j[42], 0);
+  if (sum != 24 * MAXOF_REPEATS)
+    fprintf(stderr, "maxof: results differ\n");
+}
+
+/* -------- hanoi-recursive -------- */
+
+static void hanoi(FILE *out, int32_t numberOfDisks, int32_t source,
+                  int32_t temp, int32_t target) {
+  if (numberOfDisks == 1) {
+    fprintf(out, "Move from %d to %d\n", source, target);
+  } else {
+    hanoi(out, numberOfDisks - 1, source, target, temp);
+    hanoi(out, 1, source, temp, target);
+    hanoi(out, numberOfDisks - 1, temp, source, target);
+  }
+}
+
+void kernel_hanoi(void) {
+  FILE *out = null_output();
+  hanoi(out, HANOI_DISKS, 1, 2, 3);
+  fflush(out);
+}
@@ -0,0 +1,174 @@
+/*
+ *
+ * How long a program takes to start and stop.
+ *
+ * A program as short as example 1.1 spends most of its life being
+ * started: the dynamic loader maps the C library, relocates it and
+ * the program, and the library sets itself up, all before main, and
+ * much of it again in reverse at exit.  This runs each program it
+ * is given 'runs' times, taking turns so that anything else going on
+ * in the machine falls on all of them alike, after a few runs each
+ * that are not counted.  The time of a run is from just before the
+ * program is exec'ed, while the child waits on a pipe, to when the
+ * parent sees it exit; its output goes to /dev/null.
+ *
+ * For each program the least, median, 90th and 99th percentile of
+ * the times are printed, in microseconds, with the median of the
+ * most memory it held and of the minor page faults it took, which
+ * count the pages touched, most of them by the loader.
+ *
+ * Configured with -DMUSL=ON, the startup target runs this on the
+ * examples of STARTUP_EXAMPLES linked three ways: dynamically with
+ * the host's C library, dynamically with musl, and statically with
+ * musl, as the examples themselves then are.
+ *
+ * usage: startup-latency [-n runs] program...
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RUNS 2000
+#define MAX_RUNS 1000000
+#define WARM_UP_RUNS 20
+
+enum { MICROSECONDS, RSS_KB, MINOR_FAULTS, METRICS };
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* one run of program, into values; its exit status, or 128 + signal */
+static int run(const char *program, int null, double *values) {
+  int go[2];
+  if (pipe(go) != 0)
+    fail("pipe");
+  pid_t pid = fork();
+  if (pid < 0)
+    fail("fork");
+  if (pid == 0) {
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1)
+      _exit(EXIT_FAILURE);
+    close(go[0]);
+    if (dup2(null, STDIN_FILENO) < 0 || dup2(null, STDOUT_FILENO) < 0 ||
+        dup2(null, STDERR_FILENO) < 0)
+      _exit(EXIT_FAILURE);
+    execl(program, program, (char *)NULL);
+    _exit(127);
+  }
+  close(go[0]);
+  double start = now_ns();
+  if (write(go[1], "", 1) != 1)
+    fail("write");
+  close(go[1]);
+  int status;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) < 0)
+    if (errno != EINTR)
+      fail("wait4");
+  values[MICROSECONDS] = (now_ns() - start) / 1e3;
+  values[RSS_KB] = (double)usage.ru_maxrss;
+  values[MINOR_FAULTS] = (double)usage.ru_minflt;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* the q quantile of the n sorted values, 0 <= q <= 1 */
+static double quantile(const double *sorted, int n, double q) {
+  return sorted[(int)(q * (n - 1) + 0.5)];
+}
+
+int main(int argc, char *argv[]) {
+  int runs = DEFAULT_RUNS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n runs] program...\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  int programs = argc - optind;
+  if (runs < 1 || runs > MAX_RUNS || programs < 1) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  char **program = argv + optind;
+  for (int p = 0; p < programs; p++)
+    if (access(program[p], X_OK) != 0)
+      fail(program[p]);
+  int null = open("/dev/null", O_RDWR | O_CLOEXEC);
+  if (null < 0)
+    fail("/dev/null");
+
+  /* values[(p * METRICS + m) * runs + r] */
+  double *values =
+      (double *)xmalloc((size_t)programs * METRICS * runs * sizeof(double));
+  int *status = (int *)xmalloc((size_t)programs * sizeof(int));
+  double scratch[METRICS];
+  for (int r = -WARM_UP_RUNS; r < runs; r++) {
+    for (int p = 0; p < programs; p++) {
+      status[p] = run(program[p], null, scratch);
+      if (r < 0)
+        continue;
+      for (int m = 0; m < METRICS; m++)
+        values[((size_t)p * METRICS + m) * runs + r] = scratch[m];
+    }
+  }
+
+  printf("%d runs each\n", runs);
+  printf("%-40s %9s %9s %9s %9s %8s %7s\n", "", "min us", "median us",
+         "p90 us", "p99 us", "rss KB", "faults");
+  for (int p = 0; p < programs; p++) {
+    double *column[METRICS];
+    for (int m = 0; m < METRICS; m++) {
+      column[m] = values + ((size_t)p * METRICS + m) * runs;
+      qsort(column[m], (size_t)runs, sizeof(double), compare_doubles);
+    }
+    const char *slash = strrchr(program[p], '/');
+    printf("%-40s %9.1f %9.1f %9.1f %9.1f %8.0f %7.0f", slash ? slash + 1
+                                                              : program[p],
+           column[MICROSECONDS][0], quantile(column[MICROSECONDS], runs, 0.5),
+           quantile(column[MICROSECONDS], runs, 0.9),
+           quantile(column[MICROSECONDS], runs, 0.99),
+           quantile(column[RSS_KB], runs, 0.5),
+           quantile(column[MINOR_FAULTS], runs, 0.5));
+    if (status[p] != 0)
+      printf("   exit status %d", status[p]);
+    printf("\n");
+  }
+  free(status);
+  free(values);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,418 @@
+/*
+ *
+ * Segmented sieve of Eratosthenes.
+ *
+ * A fast companion to example 1.2.  Instead of trial division,
+ * the odd numbers below the limit are sieved one cache-sized
+ * segment at a time, one bit per odd number, and the segments
+ * are shared out between a pool of worker threads.  Primes are
+ * formatted by the workers and written out in segment order by
+ * the main thread.
+ *
+ * usage: example1.2-sieve [-b] [-c] [-t threads] [-s segment_kb] [limit]
+ *
+ *   -b  benchmark against the trial division loop of example 1.2
+ *   -c  only count the primes, don't print them
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KILOBYTE 1024
+#define DEFAULT_LIMIT 10000
+#define DEFAULT_SEGMENT_KB 32 /* a typical L1 data cache */
+#define MAX_THREADS 256
+#define SLOTS_PER_THREAD 2
+#define OUTPUT_BUFFER_SIZE (1024 * KILOBYTE)
+#define MAX_DIGITS 20
+#define TRIAL_DIVISION_LIMIT 100000
+
+/*
+ * Text for one segment, waiting to be written out.
+ * A slot may only be filled by the worker that owns
+ * 'segment', and only written by the main thread once
+ * 'ready' is set.  Its text grows to what the segments
+ * put in it need.
+ */
+struct output_slot {
+  char *text;
+  size_t capacity;
+  size_t length;
+  uint64_t segment;
+  bool ready;
+};
+
+struct sieve {
+  uint64_t limit;        /* find the primes below this */
+  uint32_t *base_primes; /* odd primes up to sqrt(limit) */
+  size_t base_count;
+  size_t segment_bits; /* one bit per odd number */
+  uint64_t segment_count;
+  bool print;
+
+  pthread_mutex_t lock;
+  pthread_cond_t slot_free;
+  pthread_cond_t slot_done;
+  uint64_t next_segment;
+  uint64_t prime_count;
+  struct output_slot *slots;
+  size_t slot_count;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t isqrt(uint64_t n) {
+  uint64_t r = 0;
+  for (uint64_t bit = (uint64_t)1 << 62; bit != 0; bit >>= 2) {
+    if (n >= r + bit) {
+      n -= r + bit;
+      r = (r >> 1) + bit;
+    } else
+      r >>= 1;
+  }
+  return r;
+}
+
+/*
+ * Simple sieve for the odd primes up to and including 'max'.
+ * These are the only primes needed to cross off every segment.
+ */
+static uint32_t *find_base_primes(uint64_t max, size_t *count) {
+  uint8_t *composite = (uint8_t *)xmalloc(max + 1);
+  memset(composite, 0, max + 1);
+  size_t n = 0;
+  for (uint64_t i = 3; i <= max; i += 2) {
+    if (composite[i])
+      continue;
+    n++;
+    for (uint64_t j = i * i; j <= max; j += 2 * i)
+      composite[j] = 1;
+  }
+  uint32_t *primes = (uint32_t *)xmalloc((n + 1) * sizeof(uint32_t));
+  n = 0;
+  for (uint64_t i = 3; i <= max; i += 2)
+    if (!composite[i])
+      primes[n++] = (uint32_t)i;
+  free(composite);
+  *count = n;
+  return primes;
+}
+
+/*
+ * Sieve one segment.  Bit i stands for the odd number
+ * low + 2i + 1 and is set when that number is composite.
+ * Returns the number of odd numbers in the segment.
+ */
+static size_t sieve_segment(const struct sieve *sv, uint64_t segment,
+                            uint64_t *bits) {
+  uint64_t low = segment * 2 * sv->segment_bits;
+  uint64_t high = low + 2 * sv->segment_bits;
+  if (high > sv->limit)
+    high = sv->limit;
+  size_t nbits = (high - low) / 2;
+
+  memset(bits, 0, (nbits + 63) / 64 * sizeof(uint64_t));
+  for (size_t k = 0; k < sv->base_count; k++) {
+    uint64_t p = sv->base_primes[k];
+    uint64_t start = p * p;
+    if (start >= high)
+      break;
+    if (start < low) {
+      start = (low + p - 1) / p * p;
+      if (start % 2 == 0)
+        start += p;
+    }
+    for (uint64_t i = (start - low) / 2; i < nbits; i += p)
+      bits[i >> 6] |= (uint64_t)1 << (i & 63);
+  }
+  if (segment == 0)
+    bits[0] |= 1; /* 1 is not a prime */
+  return nbits;
+}
+
+static uint64_t count_segment(const uint64_t *bits, size_t nbits) {
+  uint64_t count = 0;
+  size_t full_words = nbits / 64;
+  for (size_t w = 0; w < full_words; w++)
+    count += __builtin_popcountll(~bits[w]);
+  if (nbits % 64)
+    count += __builtin_popcountll(~bits[full_words] &
+                                  (((uint64_t)1 << (nbits % 64)) - 1));
+  return count;
+}
+
+static size_t decimal_length(uint64_t n) {
+  size_t len = 1;
+  while (n >= 10) {
+    n /= 10;
+    len++;
+  }
+  return len;
+}
+
+static size_t format_number(char *out, uint64_t n) {
+  char digits[MAX_DIGITS];
+  size_t len = 0;
+  do {
+    digits[MAX_DIGITS - ++len] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  memcpy(out, digits + MAX_DIGITS - len, len);
+  out[len] = '\n';
+  return len + 1;
+}
+
+static size_t format_segment(char *out, const uint64_t *bits, size_t nbits,
+                             uint64_t low) {
+  char *p = out;
+  for (size_t w = 0; w * 64 < nbits; w++) {
+    uint64_t primes = ~bits[w];
+    if (nbits - w * 64 < 64)
+      primes &= ((uint64_t)1 << (nbits - w * 64)) - 1;
+    while (primes) {
+      size_t i = w * 64 + __builtin_ctzll(primes);
+      p += format_number(p, low + 2 * i + 1);
+      primes &= primes - 1;
+    }
+  }
+  return p - out;
+}
+
+static void *worker(void *arg) {
+  struct sieve *sv = (struct sieve *)arg;
+  uint64_t *bits =
+      (uint64_t *)xmalloc((sv->segment_bits + 63) / 64 * sizeof(uint64_t));
+
+  for (;;) {
+    pthread_mutex_lock(&sv->lock);
+    if (sv->next_segment == sv->segment_count) {
+      pthread_mutex_unlock(&sv->lock);
+      break;
+    }
+    uint64_t segment = sv->next_segment++;
+    struct output_slot *slot = NULL;
+    if (sv->print) {
+      /* wait for the main thread to write out the previous owner */
+      slot = &sv->slots[segment % sv->slot_count];
+      while (slot->segment != segment)
+        pthread_cond_wait(&sv->slot_free, &sv->lock);
+    }
+    pthread_mutex_unlock(&sv->lock);
+
+    size_t nbits = sieve_segment(sv, segment, bits);
+    uint64_t count = count_segment(bits, nbits);
+    size_t length = 0;
+    if (slot) {
+      uint64_t low = segment * 2 * sv->segment_bits;
+      /* every prime takes at most the digits of the largest odd number */
+      size_t needed = count * (decimal_length(low + 2 * nbits - 1) + 1);
+      if (slot->capacity < needed) {
+        free(slot->text);
+        slot->text = (char *)xmalloc(needed);
+        slot->capacity = needed;
+      }
+      length = format_segment(slot->text, bits, nbits, low);
+    }
+
+    pthread_mutex_lock(&sv->lock);
+    sv->prime_count += count;
+    if (slot) {
+      slot->length = length;
+      slot->ready = true;
+      pthread_cond_broadcast(&sv->slot_done);
+    }
+    pthread_mutex_unlock(&sv->lock);
+  }
+  free(bits);
+  return NULL;
+}
+
+/* write the slots out in segment order as they become ready */
+static void write_segments(struct sieve *sv) {
+  for (uint64_t segment = 0; segment < sv->segment_count; segment++) {
+    struct output_slot *slot = &sv->slots[segment % sv->slot_count];
+    pthread_mutex_lock(&sv->lock);
+    while (!slot->ready)
+      pthread_cond_wait(&sv->slot_done, &sv->lock);
+    pthread_mutex_unlock(&sv->lock);
+
+    fwrite(slot->text, 1, slot->length, stdout);
+
+    pthread_mutex_lock(&sv->lock);
+    slot->ready = false;
+    slot->segment = segment + sv->slot_count;
+    pthread_cond_broadcast(&sv->slot_free);
+    pthread_mutex_unlock(&sv->lock);
+  }
+}
+
+/* returns the number of primes below 'limit' */
+static uint64_t run_sieve(uint64_t limit, int32_t threads, size_t segment_kb,
+                          bool print) {
+  if (limit <= 2)
+    return 0;
+
+  struct sieve sv;
+  memset(&sv, 0, sizeof(sv));
+  sv.limit = limit;
+  sv.base_primes = find_base_primes(isqrt(limit), &sv.base_count);
+  sv.segment_bits = segment_kb * KILOBYTE * 8;
+  sv.segment_count =
+      (limit + 2 * sv.segment_bits - 1) / (2 * sv.segment_bits);
+  sv.print = print;
+  pthread_mutex_init(&sv.lock, NULL);
+  pthread_cond_init(&sv.slot_free, NULL);
+  pthread_cond_init(&sv.slot_done, NULL);
+
+  if (print) {
+    sv.slot_count = (size_t)threads * SLOTS_PER_THREAD;
+    sv.slots = (struct output_slot *)xmalloc(sv.slot_count *
+                                             sizeof(struct output_slot));
+    for (size_t i = 0; i < sv.slot_count; i++) {
+      sv.slots[i].text = NULL;
+      sv.slots[i].capacity = 0;
+      sv.slots[i].segment = i;
+      sv.slots[i].ready = false;
+    }
+    printf("2\n");
+  }
+
+  pthread_t tids[MAX_THREADS];
+  for (int32_t i = 0; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, worker, &sv) != 0) {
+      fprintf(stderr, "Cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (print)
+    write_segments(&sv);
+  for (int32_t i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  if (print) {
+    for (size_t i = 0; i < sv.slot_count; i++)
+      free(sv.slots[i].text);
+    free(sv.slots);
+  }
+  pthread_cond_destroy(&sv.slot_done);
+  pthread_cond_destroy(&sv.slot_free);
+  pthread_mutex_destroy(&sv.lock);
+  free(sv.base_primes);
+  return sv.prime_count + 1; /* and 2 */
+}
+
+/*
+ * The loop from example 1.2, counting instead of printing.
+ * Like the original, it starts at 3, so 2 is added on.
+ */
+static uint64_t trial_division(int32_t limit) {
+  uint64_t count = limit > 2 ? 1 : 0;
+  for (int32_t this_number = 3; this_number < limit; this_number++) {
+    int32_t divisor = this_number / 2;
+    bool not_prime = false;
+    while (divisor > 1) {
+      if (this_number % divisor == 0) {
+        not_prime = true;
+        divisor = 0;
+      } else
+        divisor = divisor - 1;
+    }
+    if (not_prime == false)
+      count++;
+  }
+  return count;
+}
+
+static void benchmark(uint64_t limit, int32_t threads, size_t segment_kb) {
+  double start = now_seconds();
+  uint64_t count = run_sieve(limit, threads, segment_kb, false);
+  double sieve_time = now_seconds() - start;
+
+  int32_t trial_limit =
+      limit < TRIAL_DIVISION_LIMIT ? (int32_t)limit : TRIAL_DIVISION_LIMIT;
+  start = now_seconds();
+  uint64_t trial_count = trial_division(trial_limit);
+  double trial_time = now_seconds() - start;
+
+  double sieve_rate = count / sieve_time;
+  double trial_rate = trial_count / trial_time;
+  printf("sieve:          %" PRIu64 " primes below %" PRIu64
+         " in %.3f s, %.0f primes/sec (%d threads, %zu KB segments)\n",
+         count, limit, sieve_time, sieve_rate, threads, segment_kb);
+  printf("trial division: %" PRIu64 " primes below %d in %.3f s, "
+         "%.0f primes/sec\n",
+         trial_count, trial_limit, trial_time, trial_rate);
+  printf("speedup:        %.1fx\n", sieve_rate / trial_rate);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-b] [-c] [-t threads] [-s segment_kb] [limit]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  bool print = true;
+  int32_t threads = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  size_t segment_kb = DEFAULT_SEGMENT_KB;
+  uint64_t limit = DEFAULT_LIMIT;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bct:s:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 'c':
+      print = false;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 's':
+      segment_kb = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind < argc)
+    limit = strtoull(argv[optind], NULL, 10);
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  if (segment_kb < 1)
+    usage(argv[0]);
+
+  if (bench) {
+    benchmark(limit, threads, segment_kb);
+    exit(EXIT_SUCCESS);
+  }
+
+  setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+  uint64_t count = run_sieve(limit, threads, segment_kb, print);
+  if (!print)
+    printf("%" PRIu64 " primes below %" PRIu64 "\n", count, limit);
+  exit(EXIT_SUCCESS);
+}
@@ -2,6 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_char(char c);
+void out_int(int64_t value);
+void out_fixed(double value, int decimals);
+#endif
+
 #define BOILING 212 /* degrees Fahrenheit */
 
 int main(int argc, char *argv[]) {
@@ -12,7 +19,18 @@ int main(int argc, char *argv[]) {
     l_d_var = l_d_var / 9;
     const double d_var = l_d_var;
     const float f_var = l_d_var;
+#ifdef BULK_OUTPUT
+    out_int(i);
+    out_char(' ');
+    out_fixed(f_var, 6);
+    out_char(' ');
+    out_fixed(d_var, 6);
+    out_char(' ');
+    out_fixed((double)l_d_var, 6);
+    out_char('\n');
+#else
     printf("%d %f %f %Lf\n", i, f_var, d_var, l_d_var);
+#endif
     i = i + 1;
   }
   exit(EXIT_SUCCESS);
@@ -0,0 +1,379 @@
+/*
+ *
+ * Count bytes, fast.
+ *
+ * A general version of example 2.4: any set of bytes can be
+ * counted, not only '.' and ','.  Regular files are mapped into
+ * memory, anything else is read in large blocks.  Each block is
+ * split between threads, and each thread counts its share with
+ * an AVX2 or SSE2 kernel, chosen at run time from what the CPU
+ * supports, or with a plain C histogram.
+ *
+ * usage: example2.4-bytecount [-v] [-t threads] [-k kernel] [bytes [file]]
+ *
+ *   bytes   the bytes to count, default ".,"; C escapes such as
+ *           \n, \t, \\ and \xHH are understood
+ *   kernel  auto, scalar, sse2 or avx2
+ *   -v      report the throughput on stderr
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#define KILOBYTE 1024
+#define MEGABYTE (KILOBYTE * KILOBYTE)
+#define BLOCK_SIZE (16 * MEGABYTE)
+#define MIN_BYTES_PER_THREAD MEGABYTE
+#define MAX_THREADS 256
+#define MAX_SIMD_TARGETS 8 /* beyond this the histogram wins */
+
+typedef void (*count_kernel)(const uint8_t *buf, size_t len,
+                             const uint8_t *targets, size_t ntargets,
+                             uint64_t *counts);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Portable kernel: a full histogram of every byte value.
+ * Four tables are used in turn so that runs of the same
+ * byte don't all wait on one counter.
+ */
+static void count_scalar(const uint8_t *buf, size_t len,
+                         const uint8_t *targets, size_t ntargets,
+                         uint64_t *counts) {
+  uint64_t histogram[4][256];
+  memset(histogram, 0, sizeof(histogram));
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    histogram[0][buf[i]]++;
+    histogram[1][buf[i + 1]]++;
+    histogram[2][buf[i + 2]]++;
+    histogram[3][buf[i + 3]]++;
+  }
+  for (; i < len; i++)
+    histogram[0][buf[i]]++;
+  for (size_t t = 0; t < ntargets; t++)
+    counts[t] += histogram[0][targets[t]] + histogram[1][targets[t]] +
+                 histogram[2][targets[t]] + histogram[3][targets[t]];
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * The SIMD kernels compare a vector against the wanted byte,
+ * which gives 0xff (-1) in each matching lane, and subtract that
+ * from per-lane byte counters.  Those can only count to 255, so
+ * after at most 255 vectors they are added up with psadbw.
+ * The same few kilobytes are scanned once for each wanted byte
+ * while they are still in L1.
+ */
+__attribute__((target("sse2"))) static void
+count_sse2(const uint8_t *buf, size_t len, const uint8_t *targets,
+           size_t ntargets, uint64_t *counts) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  while (len - i >= 16) {
+    size_t vectors = (len - i) / 16;
+    if (vectors > 255)
+      vectors = 255;
+    for (size_t t = 0; t < ntargets; t++) {
+      const __m128i needle = _mm_set1_epi8((char)targets[t]);
+      __m128i acc = zero;
+      for (size_t v = 0; v < vectors; v++) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(buf + i + 16 * v));
+        acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(x, needle));
+      }
+      __m128i sums = _mm_sad_epu8(acc, zero);
+      counts[t] += _mm_cvtsi128_si64(sums) +
+                   _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+    }
+    i += vectors * 16;
+  }
+  count_scalar(buf + i, len - i, targets, ntargets, counts);
+}
+
+__attribute__((target("avx2"))) static void
+count_avx2(const uint8_t *buf, size_t len, const uint8_t *targets,
+           size_t ntargets, uint64_t *counts) {
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  while (len - i >= 32) {
+    size_t vectors = (len - i) / 32;
+    if (vectors > 255)
+      vectors = 255;
+    for (size_t t = 0; t < ntargets; t++) {
+      const __m256i needle = _mm256_set1_epi8((char)targets[t]);
+      __m256i acc = zero;
+      for (size_t v = 0; v < vectors; v++) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(buf + i + 32 * v));
+        acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(x, needle));
+      }
+      __m256i sums = _mm256_sad_epu8(acc, zero);
+      counts[t] += _mm256_extract_epi64(sums, 0) +
+                   _mm256_extract_epi64(sums, 1) +
+                   _mm256_extract_epi64(sums, 2) +
+                   _mm256_extract_epi64(sums, 3);
+    }
+    i += vectors * 32;
+  }
+  count_scalar(buf + i, len - i, targets, ntargets, counts);
+}
+#endif
+
+struct kernel_choice {
+  const char *name;
+  count_kernel kernel;
+};
+
+static struct kernel_choice choose_kernel(const char *wanted,
+                                          size_t ntargets) {
+  struct kernel_choice scalar = {"scalar", count_scalar};
+#ifdef HAVE_X86_KERNELS
+  struct kernel_choice sse2 = {"sse2", count_sse2};
+  struct kernel_choice avx2 = {"avx2", count_avx2};
+  __builtin_cpu_init();
+  bool have_avx2 = __builtin_cpu_supports("avx2");
+  bool have_sse2 = __builtin_cpu_supports("sse2");
+  if (strcmp(wanted, "auto") == 0) {
+    if (ntargets > MAX_SIMD_TARGETS)
+      return scalar;
+    return have_avx2 ? avx2 : have_sse2 ? sse2 : scalar;
+  }
+  if (strcmp(wanted, "avx2") == 0 && have_avx2)
+    return avx2;
+  if (strcmp(wanted, "sse2") == 0 && have_sse2)
+    return sse2;
+#else
+  (void)ntargets;
+  if (strcmp(wanted, "auto") == 0)
+    return scalar;
+#endif
+  if (strcmp(wanted, "scalar") != 0) {
+    fprintf(stderr, "Kernel %s is not available\n", wanted);
+    exit(EXIT_FAILURE);
+  }
+  return scalar;
+}
+
+struct count_job {
+  const uint8_t *buf;
+  size_t len;
+  const uint8_t *targets;
+  size_t ntargets;
+  count_kernel kernel;
+  uint64_t counts[256];
+};
+
+static void *count_worker(void *arg) {
+  struct count_job *job = (struct count_job *)arg;
+  job->kernel(job->buf, job->len, job->targets, job->ntargets, job->counts);
+  return NULL;
+}
+
+/* count one buffer, split across up to 'threads' threads */
+static void count_buffer(const uint8_t *buf, size_t len, int32_t threads,
+                         const uint8_t *targets, size_t ntargets,
+                         count_kernel kernel, uint64_t *counts) {
+  if (len / MIN_BYTES_PER_THREAD < (size_t)threads)
+    threads = (int32_t)(len / MIN_BYTES_PER_THREAD);
+  if (threads <= 1) {
+    kernel(buf, len, targets, ntargets, counts);
+    return;
+  }
+
+  struct count_job jobs[MAX_THREADS];
+  pthread_t tids[MAX_THREADS];
+  size_t share = len / threads;
+  for (int32_t i = 0; i < threads; i++) {
+    jobs[i].buf = buf + i * share;
+    jobs[i].len = i == threads - 1 ? len - i * share : share;
+    jobs[i].targets = targets;
+    jobs[i].ntargets = ntargets;
+    jobs[i].kernel = kernel;
+    memset(jobs[i].counts, 0, sizeof(jobs[i].counts));
+    /* the first share is counted by this thread */
+    if (i > 0 && pthread_create(&tids[i], NULL, count_worker, &jobs[i]) != 0) {
+      fprintf(stderr, "Cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  count_worker(&jobs[0]);
+  for (int32_t i = 0; i < threads; i++) {
+    if (i > 0)
+      pthread_join(tids[i], NULL);
+    for (size_t t = 0; t < ntargets; t++)
+      counts[t] += jobs[i].counts[t];
+  }
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* turn the bytes argument into a list of distinct bytes */
+static size_t parse_targets(const char *arg, uint8_t *targets) {
+  bool seen[256] = {false};
+  size_t n = 0;
+  while (*arg) {
+    uint8_t c = (uint8_t)*arg++;
+    if (c == '\\' && *arg) {
+      char e = *arg++;
+      switch (e) {
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case '0':
+        c = 0;
+        break;
+      case 'x':
+        if (hex_digit(arg[0]) >= 0 && hex_digit(arg[1]) >= 0) {
+          c = (uint8_t)(hex_digit(arg[0]) * 16 + hex_digit(arg[1]));
+          arg += 2;
+          break;
+        }
+        /* fall through */
+      default:
+        c = (uint8_t)e;
+      }
+    }
+    if (!seen[c]) {
+      seen[c] = true;
+      targets[n++] = c;
+    }
+  }
+  return n;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-v] [-t threads] [-k kernel] [bytes [file]]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool verbose = false;
+  int32_t threads = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  const char *kernel_name = "auto";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "vt:k:")) != -1) {
+    switch (opt) {
+    case 'v':
+      verbose = true;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'k':
+      kernel_name = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+
+  uint8_t targets[256];
+  size_t ntargets = parse_targets(optind < argc ? argv[optind] : ".,", targets);
+  if (ntargets == 0)
+    usage(argv[0]);
+  struct kernel_choice choice = choose_kernel(kernel_name, ntargets);
+
+  int fd = STDIN_FILENO;
+  if (optind + 1 < argc) {
+    fd = open(argv[optind + 1], O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "Cannot open %s\n", argv[optind + 1]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  uint64_t counts[256] = {0};
+  uint64_t total = 0;
+  double start = now_seconds();
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED) {
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    count_buffer((const uint8_t *)map, st.st_size, threads, targets,
+                 ntargets, choice.kernel, counts);
+    total = st.st_size;
+    munmap(map, st.st_size);
+  } else {
+    /* pipes and terminals: read large blocks */
+    uint8_t *block = (uint8_t *)malloc(BLOCK_SIZE);
+    if (block == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    for (;;) {
+      size_t filled = 0;
+      ssize_t got = 0;
+      while (filled < BLOCK_SIZE) {
+        got = read(fd, block + filled, BLOCK_SIZE - filled);
+        if (got < 0 && errno == EINTR)
+          continue;
+        if (got <= 0)
+          break;
+        filled += got;
+      }
+      if (got < 0) {
+        fprintf(stderr, "Read error\n");
+        exit(EXIT_FAILURE);
+      }
+      if (filled == 0)
+        break;
+      count_buffer(block, filled, threads, targets, ntargets, choice.kernel,
+                   counts);
+      total += filled;
+    }
+    free(block);
+  }
+  double elapsed = now_seconds() - start;
+
+  for (size_t t = 0; t < ntargets; t++) {
+    if (targets[t] > ' ' && targets[t] < 127)
+      printf("'%c' %" PRIu64 "\n", targets[t], counts[t]);
+    else
+      printf("'\\x%02x' %" PRIu64 "\n", targets[t], counts[t]);
+  }
+  if (verbose)
+    fprintf(stderr, "%" PRIu64 " bytes in %.3f s, %.2f GB/s (%s kernel)\n",
+            total, elapsed, total / elapsed / 1e9, choice.name);
+  exit(EXIT_SUCCESS);
+}
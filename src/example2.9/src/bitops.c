@@ -0,0 +1,501 @@
+/*
+ *
+ * Operations on long arrays of bits.
+ *
+ * Example 2.9 applies &, |, ^, << and >> to one int at a time.
+ * This applies them to bit vectors held in arrays of 64-bit
+ * words, bit i of the vector being bit i % 64 of word i / 64:
+ * counting the set bits, finding the next set bit, combining two
+ * vectors a word at a time, counting the set bits before a
+ * position (rank) and finding the position of the kth set bit
+ * (select), and transposing 64 x 64 matrices of bits.
+ *
+ * Each operation comes in several variants, collected in a table
+ * per set of processor features: plain C, then POPCNT, then BMI1
+ * and BMI2 as well, then AVX2 as well.  bitops_best picks the
+ * last table the processor supports, going by what CPUID says;
+ * all of them give the same results.
+ *
+ * Rank and select need an index, built once for a vector: the
+ * number of set bits before every block of 8 words, and which
+ * block every 4096th set bit is in.  Select looks up the blocks
+ * of the nearest samples either side, searches the index between
+ * them, and counts through the block it finds.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_X86_VARIANTS 1
+#else
+#define HAVE_X86_VARIANTS 0
+#endif
+
+#define WORD_BITS 64
+#define BLOCK_WORDS 8
+#define SELECT_SAMPLE 4096
+
+/* processor features a variant needs */
+#define BITOPS_POPCNT 1U
+#define BITOPS_BMI1 2U
+#define BITOPS_BMI2 4U
+#define BITOPS_AVX2 8U
+
+struct bitops {
+  const char *name;
+  unsigned needs;
+  unsigned (*popcount_word)(uint64_t w);
+  uint64_t (*popcount)(const uint64_t *w, size_t n);
+  void (*and_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    size_t n);
+  void (*or_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                   size_t n);
+  void (*xor_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    size_t n);
+  /* a & ~b */
+  void (*andnot_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                       size_t n);
+  /* the first set bit at or after 'from', or n * 64 if none */
+  size_t (*next_set)(const uint64_t *w, size_t n, size_t from);
+  /* the position of set bit k, counting from 0, of w */
+  unsigned (*select_in_word)(uint64_t w, unsigned k);
+  /* row i is m[i]; afterwards bit j of m[i] is bit i of the old m[j] */
+  void (*transpose64)(uint64_t m[64]);
+};
+
+struct bit_rank {
+  const struct bitops *ops;
+  const uint64_t *words;
+  size_t n;
+  uint64_t *before; /* set bits before each block, and in all of them */
+  size_t blocks;
+  size_t *sample; /* the block holding set bit i * SELECT_SAMPLE */
+  size_t samples;
+};
+
+/* -------- plain C -------- */
+
+static unsigned popcount_word_portable(uint64_t w) {
+  w = w - ((w >> 1) & 0x5555555555555555ULL);
+  w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+  w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (unsigned)((w * 0x0101010101010101ULL) >> 56);
+}
+
+static uint64_t popcount_portable(const uint64_t *w, size_t n) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < n; i++)
+    count += popcount_word_portable(w[i]);
+  return count;
+}
+
+#define WORDWISE(name, expr)                                                 \
+  static void name(uint64_t *dst, const uint64_t *a, const uint64_t *b,      \
+                   size_t n) {                                               \
+    for (size_t i = 0; i < n; i++)                                           \
+      dst[i] = (expr);                                                       \
+  }
+WORDWISE(and_portable, a[i] & b[i])
+WORDWISE(or_portable, a[i] | b[i])
+WORDWISE(xor_portable, a[i] ^ b[i])
+WORDWISE(andnot_portable, a[i] & ~b[i])
+#undef WORDWISE
+
+/* the number of trailing zeros of a nonzero word, by de Bruijn sequence */
+static unsigned ctz_portable(uint64_t w) {
+  static const unsigned char position[64] = {
+      0,  1,  48, 2,  57, 49, 28, 3,  61, 58, 50, 42, 38, 29, 17, 4,
+      62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+      63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+      46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9,  13, 8,  7,  6};
+  return position[((w & -w) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+static size_t next_set_portable(const uint64_t *w, size_t n, size_t from) {
+  size_t i = from / WORD_BITS;
+  if (i >= n)
+    return n * WORD_BITS;
+  uint64_t word = w[i] & (~(uint64_t)0 << (from % WORD_BITS));
+  while (word == 0) {
+    if (++i == n)
+      return n * WORD_BITS;
+    word = w[i];
+  }
+  return i * WORD_BITS + ctz_portable(word);
+}
+
+static unsigned select_in_word_portable(uint64_t w, unsigned k) {
+  unsigned pos = 0;
+  for (;;) {
+    unsigned in_byte = popcount_word_portable(w & 0xff);
+    if (k < in_byte)
+      break;
+    k -= in_byte;
+    w >>= 8;
+    pos += 8;
+  }
+  for (;; w >>= 1, pos++)
+    if ((w & 1) && k-- == 0)
+      return pos;
+}
+
+/*
+ * Swap the off-diagonal blocks of 32 x 32 bits, then within each
+ * of those the blocks of 16 x 16, and so on down to single bits.
+ */
+static void transpose64_portable(uint64_t m[64]) {
+  uint64_t mask = 0x00000000ffffffffULL;
+  for (unsigned j = 32; j != 0; j >>= 1, mask ^= mask << j)
+    for (unsigned k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      uint64_t t = ((m[k] >> j) ^ m[k | j]) & mask;
+      m[k] ^= t << j;
+      m[k | j] ^= t;
+    }
+}
+
+static const struct bitops portable_ops = {
+    .name = "portable",
+    .needs = 0,
+    .popcount_word = popcount_word_portable,
+    .popcount = popcount_portable,
+    .and_words = and_portable,
+    .or_words = or_portable,
+    .xor_words = xor_portable,
+    .andnot_words = andnot_portable,
+    .next_set = next_set_portable,
+    .select_in_word = select_in_word_portable,
+    .transpose64 = transpose64_portable,
+};
+
+#if HAVE_X86_VARIANTS
+
+/* -------- POPCNT -------- */
+
+__attribute__((target("popcnt"))) static unsigned
+popcount_word_popcnt(uint64_t w) {
+  return (unsigned)__builtin_popcountll(w);
+}
+
+__attribute__((target("popcnt"))) static uint64_t
+popcount_popcnt(const uint64_t *w, size_t n) {
+  /* four counts at once, as POPCNT has a false dependency on its output */
+  uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    c0 += __builtin_popcountll(w[i]);
+    c1 += __builtin_popcountll(w[i + 1]);
+    c2 += __builtin_popcountll(w[i + 2]);
+    c3 += __builtin_popcountll(w[i + 3]);
+  }
+  for (; i < n; i++)
+    c0 += __builtin_popcountll(w[i]);
+  return c0 + c1 + c2 + c3;
+}
+
+static const struct bitops popcnt_ops = {
+    .name = "popcnt",
+    .needs = BITOPS_POPCNT,
+    .popcount_word = popcount_word_popcnt,
+    .popcount = popcount_popcnt,
+    .and_words = and_portable,
+    .or_words = or_portable,
+    .xor_words = xor_portable,
+    .andnot_words = andnot_portable,
+    .next_set = next_set_portable,
+    .select_in_word = select_in_word_portable,
+    .transpose64 = transpose64_portable,
+};
+
+/* -------- BMI1 and BMI2 -------- */
+
+__attribute__((target("popcnt,bmi"))) static size_t
+next_set_bmi(const uint64_t *w, size_t n, size_t from) {
+  size_t i = from / WORD_BITS;
+  if (i >= n)
+    return n * WORD_BITS;
+  uint64_t word = w[i] & (~(uint64_t)0 << (from % WORD_BITS));
+  while (word == 0) {
+    if (++i == n)
+      return n * WORD_BITS;
+    word = w[i];
+  }
+  return i * WORD_BITS + _tzcnt_u64(word);
+}
+
+/* deposit a single bit at the kth set bit of w, and find it */
+__attribute__((target("bmi,bmi2"))) static unsigned
+select_in_word_bmi2(uint64_t w, unsigned k) {
+  return (unsigned)_tzcnt_u64(_pdep_u64((uint64_t)1 << k, w));
+}
+
+static const struct bitops bmi_ops = {
+    .name = "popcnt+bmi2",
+    .needs = BITOPS_POPCNT | BITOPS_BMI1 | BITOPS_BMI2,
+    .popcount_word = popcount_word_popcnt,
+    .popcount = popcount_popcnt,
+    .and_words = and_portable,
+    .or_words = or_portable,
+    .xor_words = xor_portable,
+    .andnot_words = andnot_portable,
+    .next_set = next_set_bmi,
+    .select_in_word = select_in_word_bmi2,
+    .transpose64 = transpose64_portable,
+};
+
+/* -------- AVX2 -------- */
+
+/*
+ * Each nibble counted by table lookup, 32 bytes at a time, and
+ * the byte counts summed into four 64-bit totals with vpsadbw.
+ */
+__attribute__((target("avx2,popcnt"))) static uint64_t
+popcount_avx2(const uint64_t *w, size_t n) {
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3,
+                                         2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(w + i));
+    __m256i counts = _mm256_add_epi8(
+        _mm256_shuffle_epi8(table, _mm256_and_si256(v, low)),
+        _mm256_shuffle_epi8(table,
+                            _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    total = _mm256_add_epi64(total,
+                             _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, total);
+  uint64_t count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < n; i++)
+    count += __builtin_popcountll(w[i]);
+  return count;
+}
+
+#define WORDWISE_AVX2(name, vexpr, expr)                                     \
+  __attribute__((target("avx2"))) static void name(                         \
+      uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t n) {       \
+    size_t i = 0;                                                            \
+    for (; i + 4 <= n; i += 4) {                                             \
+      __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));             \
+      __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));             \
+      _mm256_storeu_si256((__m256i *)(dst + i), (vexpr));                    \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+      dst[i] = (expr);                                                       \
+  }
+WORDWISE_AVX2(and_avx2, _mm256_and_si256(va, vb), a[i] & b[i])
+WORDWISE_AVX2(or_avx2, _mm256_or_si256(va, vb), a[i] | b[i])
+WORDWISE_AVX2(xor_avx2, _mm256_xor_si256(va, vb), a[i] ^ b[i])
+WORDWISE_AVX2(andnot_avx2, _mm256_andnot_si256(vb, va), a[i] & ~b[i])
+#undef WORDWISE_AVX2
+
+/* zero words are skipped four at a time */
+__attribute__((target("avx2,bmi"))) static size_t
+next_set_avx2(const uint64_t *w, size_t n, size_t from) {
+  size_t i = from / WORD_BITS;
+  if (i >= n)
+    return n * WORD_BITS;
+  uint64_t word = w[i] & (~(uint64_t)0 << (from % WORD_BITS));
+  if (word)
+    return i * WORD_BITS + _tzcnt_u64(word);
+  for (i++; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(w + i));
+    if (!_mm256_testz_si256(v, v))
+      break;
+  }
+  for (; i < n; i++)
+    if (w[i])
+      return i * WORD_BITS + _tzcnt_u64(w[i]);
+  return n * WORD_BITS;
+}
+
+/* the same swaps, four rows at a time while the blocks are 4 or more */
+__attribute__((target("avx2"))) static void transpose64_avx2(uint64_t m[64]) {
+  uint64_t mask = 0x00000000ffffffffULL;
+  unsigned j = 32;
+  for (; j >= 4; j >>= 1, mask ^= mask << j) {
+    __m256i vmask = _mm256_set1_epi64x((long long)mask);
+    __m128i shift = _mm_cvtsi32_si128((int)j);
+    for (unsigned base = 0; base < 64; base += 2 * j)
+      for (unsigned k = base; k < base + j; k += 4) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(m + k));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(m + k + j));
+        __m256i t = _mm256_and_si256(
+            _mm256_xor_si256(_mm256_srl_epi64(lo, shift), hi), vmask);
+        _mm256_storeu_si256((__m256i *)(m + k),
+                            _mm256_xor_si256(lo, _mm256_sll_epi64(t, shift)));
+        _mm256_storeu_si256((__m256i *)(m + k + j), _mm256_xor_si256(hi, t));
+      }
+  }
+  for (; j != 0; j >>= 1, mask ^= mask << j)
+    for (unsigned k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+      uint64_t t = ((m[k] >> j) ^ m[k | j]) & mask;
+      m[k] ^= t << j;
+      m[k | j] ^= t;
+    }
+}
+
+static const struct bitops avx2_ops = {
+    .name = "avx2",
+    .needs = BITOPS_POPCNT | BITOPS_BMI1 | BITOPS_BMI2 | BITOPS_AVX2,
+    .popcount_word = popcount_word_popcnt,
+    .popcount = popcount_avx2,
+    .and_words = and_avx2,
+    .or_words = or_avx2,
+    .xor_words = xor_avx2,
+    .andnot_words = andnot_avx2,
+    .next_set = next_set_avx2,
+    .select_in_word = select_in_word_bmi2,
+    .transpose64 = transpose64_avx2,
+};
+
+#endif
+
+static const struct bitops *const variants[] = {
+    &portable_ops,
+#if HAVE_X86_VARIANTS
+    &popcnt_ops,
+    &bmi_ops,
+    &avx2_ops,
+#endif
+};
+
+/* -------- choosing a variant -------- */
+
+/* the BITOPS_ features this processor and operating system support */
+unsigned bitops_cpu_features(void) {
+  unsigned features = 0;
+#if HAVE_X86_VARIANTS
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  if (ecx & bit_POPCNT)
+    features |= BITOPS_POPCNT;
+  bool avx_state = false;
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+    /* the operating system must save the YMM registers too */
+    unsigned lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    avx_state = (lo & 6) == 6;
+  }
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    if (ebx & bit_BMI)
+      features |= BITOPS_BMI1;
+    if (ebx & bit_BMI2)
+      features |= BITOPS_BMI2;
+    if ((ebx & bit_AVX2) && avx_state)
+      features |= BITOPS_AVX2;
+  }
+#endif
+  return features;
+}
+
+size_t bitops_variant_count(void) {
+  return sizeof(variants) / sizeof(variants[0]);
+}
+
+/* variant i, from plain C up, whether or not it can run here */
+const struct bitops *bitops_variant(size_t i) {
+  return i < bitops_variant_count() ? variants[i] : NULL;
+}
+
+bool bitops_supported(const struct bitops *ops) {
+  return (ops->needs & ~bitops_cpu_features()) == 0;
+}
+
+const struct bitops *bitops_best(void) {
+  const struct bitops *best = &portable_ops;
+  for (size_t i = 0; i < bitops_variant_count(); i++)
+    if (bitops_supported(variants[i]))
+      best = variants[i];
+  return best;
+}
+
+/* -------- rank and select -------- */
+
+/* index the n words at 'words'; false if out of memory */
+bool bit_rank_build(struct bit_rank *r, const struct bitops *ops,
+                    const uint64_t *words, size_t n) {
+  r->ops = ops;
+  r->words = words;
+  r->n = n;
+  r->blocks = (n + BLOCK_WORDS - 1) / BLOCK_WORDS;
+  r->before = (uint64_t *)malloc((r->blocks + 1) * sizeof(uint64_t));
+  if (r->before == NULL)
+    return false;
+  uint64_t count = 0;
+  for (size_t b = 0; b < r->blocks; b++) {
+    r->before[b] = count;
+    size_t first = b * BLOCK_WORDS;
+    size_t len = n - first < BLOCK_WORDS ? n - first : BLOCK_WORDS;
+    count += ops->popcount(words + first, len);
+  }
+  r->before[r->blocks] = count;
+
+  r->samples = (count + SELECT_SAMPLE - 1) / SELECT_SAMPLE;
+  r->sample = (size_t *)malloc((r->samples + 1) * sizeof(size_t));
+  if (r->sample == NULL) {
+    free(r->before);
+    return false;
+  }
+  size_t s = 0;
+  for (size_t b = 0; b < r->blocks; b++)
+    while (s < r->samples && (uint64_t)s * SELECT_SAMPLE < r->before[b + 1])
+      r->sample[s++] = b;
+  r->sample[r->samples] = r->blocks;
+  return true;
+}
+
+void bit_rank_free(struct bit_rank *r) {
+  free(r->before);
+  free(r->sample);
+  r->before = NULL;
+  r->sample = NULL;
+}
+
+/* the number of set bits before bit 'pos', which may be n * 64 */
+uint64_t bit_rank(const struct bit_rank *r, size_t pos) {
+  size_t word = pos / WORD_BITS;
+  if (word >= r->n)
+    return r->before[r->blocks];
+  size_t block = word / BLOCK_WORDS;
+  uint64_t count = r->before[block];
+  for (size_t i = block * BLOCK_WORDS; i < word; i++)
+    count += r->ops->popcount_word(r->words[i]);
+  uint64_t below = ((uint64_t)1 << (pos % WORD_BITS)) - 1;
+  return count + r->ops->popcount_word(r->words[word] & below);
+}
+
+/* the position of set bit k, counting from 0, or n * 64 if none */
+size_t bit_select(const struct bit_rank *r, uint64_t k) {
+  if (k >= r->before[r->blocks])
+    return r->n * WORD_BITS;
+  /* the last block with fewer than k + 1 set bits before it */
+  size_t s = k / SELECT_SAMPLE;
+  size_t lo = r->sample[s], hi = r->sample[s + 1] + 1;
+  if (hi > r->blocks)
+    hi = r->blocks;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (r->before[mid] <= k)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  k -= r->before[lo];
+  size_t i = lo * BLOCK_WORDS;
+  for (;; i++) {
+    unsigned in_word = r->ops->popcount_word(r->words[i]);
+    if (k < in_word)
+      break;
+    k -= in_word;
+  }
+  return i * WORD_BITS + r->ops->select_in_word(r->words[i], (unsigned)k);
+}
@@ -0,0 +1,406 @@
+/*
+ *
+ * Checking and timing the variants of bitops.c.
+ *
+ * With -c, every variant this processor can run is checked
+ * against plain bit-at-a-time code: on vectors of awkward lengths
+ * and of random, empty, full and sparse contents, and on random
+ * 64 x 64 matrices.  Otherwise, each variant is timed on bit
+ * vectors of 'size' megabytes, 1024 by default; three of them
+ * are needed.  The variants' results are compared as they go.
+ *
+ * usage: example2.9-bitops [-c] [-m size_mb]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SIZE_MB 1024
+#define MEGABYTE (1024 * 1024)
+#define QUERIES 10000000
+#define SPARSE_ONE_IN 4096
+
+struct bitops {
+  const char *name;
+  unsigned needs;
+  unsigned (*popcount_word)(uint64_t w);
+  uint64_t (*popcount)(const uint64_t *w, size_t n);
+  void (*and_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    size_t n);
+  void (*or_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                   size_t n);
+  void (*xor_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    size_t n);
+  void (*andnot_words)(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                       size_t n);
+  size_t (*next_set)(const uint64_t *w, size_t n, size_t from);
+  unsigned (*select_in_word)(uint64_t w, unsigned k);
+  void (*transpose64)(uint64_t m[64]);
+};
+
+struct bit_rank {
+  const struct bitops *ops;
+  const uint64_t *words;
+  size_t n;
+  uint64_t *before;
+  size_t blocks;
+  size_t *sample;
+  size_t samples;
+};
+
+unsigned bitops_cpu_features(void);
+size_t bitops_variant_count(void);
+const struct bitops *bitops_variant(size_t i);
+bool bitops_supported(const struct bitops *ops);
+const struct bitops *bitops_best(void);
+bool bit_rank_build(struct bit_rank *r, const struct bitops *ops,
+                    const uint64_t *words, size_t n);
+void bit_rank_free(struct bit_rank *r);
+uint64_t bit_rank(const struct bit_rank *r, size_t pos);
+size_t bit_select(const struct bit_rank *r, uint64_t k);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/* -------- a bit at a time -------- */
+
+static bool bit(const uint64_t *w, size_t i) {
+  return (w[i / 64] >> i % 64) & 1;
+}
+
+static uint64_t ref_popcount(const uint64_t *w, size_t n) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < n * 64; i++)
+    count += bit(w, i);
+  return count;
+}
+
+static size_t ref_next_set(const uint64_t *w, size_t n, size_t from) {
+  for (size_t i = from; i < n * 64; i++)
+    if (bit(w, i))
+      return i;
+  return n * 64;
+}
+
+static size_t ref_select(const uint64_t *w, size_t n, uint64_t k) {
+  for (size_t i = 0; i < n * 64; i++)
+    if (bit(w, i) && k-- == 0)
+      return i;
+  return n * 64;
+}
+
+static void ref_transpose(const uint64_t in[64], uint64_t out[64]) {
+  for (unsigned i = 0; i < 64; i++) {
+    out[i] = 0;
+    for (unsigned j = 0; j < 64; j++)
+      out[i] |= ((in[j] >> i) & 1) << j;
+  }
+}
+
+/* -------- checking -------- */
+
+static bool failed;
+
+static void expect(bool ok, const struct bitops *ops, const char *what,
+                   size_t n) {
+  if (!ok && !failed)
+    fprintf(stderr, "%s: %s wrong on %zu words\n", ops->name, what, n);
+  failed |= !ok;
+}
+
+static void fill(uint64_t *w, size_t n, int pattern) {
+  for (size_t i = 0; i < n; i++) {
+    switch (pattern) {
+    case 0:
+      w[i] = next_random();
+      break;
+    case 1:
+      w[i] = 0;
+      break;
+    case 2:
+      w[i] = ~(uint64_t)0;
+      break;
+    default:
+      w[i] = next_random() % 13 == 0 ? (uint64_t)1 << next_random() % 64 : 0;
+      break;
+    }
+  }
+}
+
+static void check_vector(const struct bitops *ops, const uint64_t *a,
+                         const uint64_t *b, size_t n) {
+  uint64_t *dst = (uint64_t *)xmalloc(n * sizeof(uint64_t) + 1);
+  expect(ops->popcount(a, n) == ref_popcount(a, n), ops, "popcount", n);
+
+#define WORDWISE(fn, expr)                                                   \
+  ops->fn(dst, a, b, n);                                                     \
+  for (size_t i = 0; i < n; i++)                                             \
+    expect(dst[i] == (expr), ops, #fn, n);
+  WORDWISE(and_words, a[i] & b[i])
+  WORDWISE(or_words, a[i] | b[i])
+  WORDWISE(xor_words, a[i] ^ b[i])
+  WORDWISE(andnot_words, a[i] & ~b[i])
+#undef WORDWISE
+
+  for (size_t from = 0; from <= n * 64 + 64; from++)
+    expect(ops->next_set(a, n, from) == ref_next_set(a, n, from), ops,
+           "next_set", n);
+
+  struct bit_rank r;
+  if (!bit_rank_build(&r, ops, a, n)) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  uint64_t count = 0;
+  for (size_t pos = 0; pos <= n * 64; pos++) {
+    expect(bit_rank(&r, pos) == count, ops, "rank", n);
+    if (pos < n * 64)
+      count += bit(a, pos);
+  }
+  for (uint64_t k = 0; k <= count + 1; k++)
+    expect(bit_select(&r, k) == ref_select(a, n, k), ops, "select", n);
+  bit_rank_free(&r);
+  free(dst);
+}
+
+static void check_words(const struct bitops *ops) {
+  for (int trial = 0; trial < 1000; trial++) {
+    uint64_t w = next_random();
+    if (trial % 4 == 1)
+      w &= next_random() & next_random();
+    if (trial == 0)
+      w = ~(uint64_t)0;
+    unsigned count = 0;
+    for (unsigned i = 0; i < 64; i++)
+      count += (w >> i) & 1;
+    expect(ops->popcount_word(w) == count, ops, "popcount_word", 1);
+    for (unsigned k = 0; k < count; k++)
+      expect(ops->select_in_word(w, k) == ref_select(&w, 1, k), ops,
+             "select_in_word", 1);
+  }
+  for (int trial = 0; trial < 100; trial++) {
+    uint64_t m[64], expected[64];
+    fill(m, 64, trial % 4);
+    ref_transpose(m, expected);
+    ops->transpose64(m);
+    expect(memcmp(m, expected, sizeof(m)) == 0, ops, "transpose64", 64);
+  }
+}
+
+static int check(void) {
+  static const size_t lengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31,
+                                   33, 63, 64, 65, 200};
+  for (size_t v = 0; v < bitops_variant_count(); v++) {
+    const struct bitops *ops = bitops_variant(v);
+    if (!bitops_supported(ops)) {
+      printf("%-12s not supported here\n", ops->name);
+      continue;
+    }
+    failed = false;
+    check_words(ops);
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+      for (int pattern = 0; pattern < 4; pattern++) {
+        size_t n = lengths[l];
+        uint64_t *a = (uint64_t *)xmalloc(n * sizeof(uint64_t) + 1);
+        uint64_t *b = (uint64_t *)xmalloc(n * sizeof(uint64_t) + 1);
+        fill(a, n, pattern);
+        fill(b, n, 3 - pattern);
+        check_vector(ops, a, b, n);
+        free(a);
+        free(b);
+      }
+    printf("%-12s %s\n", ops->name, failed ? "FAILED" : "ok");
+    if (failed)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* -------- timing -------- */
+
+static uint64_t checksum(const uint64_t *w, size_t n) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum = sum * 31 + w[i];
+  return sum;
+}
+
+/* the same answer from every variant, or stop */
+static void agree(uint64_t *expected, uint64_t got, bool first,
+                  const struct bitops *ops, const char *what) {
+  if (first)
+    *expected = got;
+  else if (got != *expected) {
+    fprintf(stderr, "%s: %s differs from the plain C result\n", ops->name,
+            what);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void bench(size_t size_mb) {
+  size_t bytes = size_mb * MEGABYTE;
+  size_t n = bytes / sizeof(uint64_t);
+  double gb = bytes / 1e9;
+  uint64_t *a = (uint64_t *)xmalloc(bytes);
+  uint64_t *b = (uint64_t *)xmalloc(bytes);
+  uint64_t *dst = (uint64_t *)xmalloc(bytes);
+  fill(a, n, 0);
+  fill(b, n, 0);
+  memset(dst, 0, bytes);
+
+  printf("%zu MB bit vectors; best variant here is %s\n", size_mb,
+         bitops_best()->name);
+  printf("%-12s %9s %9s %9s %9s %9s   GB/s of each operand\n", "",
+         "popcount", "and", "or", "xor", "andnot");
+  uint64_t expected[8] = {0};
+  bool first = true;
+  for (size_t v = 0; v < bitops_variant_count(); v++) {
+    const struct bitops *ops = bitops_variant(v);
+    if (!bitops_supported(ops))
+      continue;
+    double start = now_seconds();
+    agree(&expected[0], ops->popcount(a, n), first, ops, "popcount");
+    double t_popcount = now_seconds() - start;
+    double t[4];
+    void (*fns[4])(uint64_t *, const uint64_t *, const uint64_t *, size_t) = {
+        ops->and_words, ops->or_words, ops->xor_words, ops->andnot_words};
+    for (int f = 0; f < 4; f++) {
+      start = now_seconds();
+      fns[f](dst, a, b, n);
+      t[f] = now_seconds() - start;
+      agree(&expected[1 + f], checksum(dst, n), first, ops, "and/or/xor");
+    }
+    printf("%-12s %9.2f %9.2f %9.2f %9.2f %9.2f\n", ops->name,
+           gb / t_popcount, gb / t[0], gb / t[1], gb / t[2], gb / t[3]);
+    first = false;
+  }
+
+  /* one bit in SPARSE_ONE_IN set, for scanning */
+  memset(dst, 0, bytes);
+  for (size_t i = 0; i < n * 64 / SPARSE_ONE_IN; i++) {
+    size_t pos = next_random() % (n * 64);
+    dst[pos / 64] |= (uint64_t)1 << pos % 64;
+  }
+  uint64_t before = checksum(a, n);
+  size_t *positions = (size_t *)xmalloc(QUERIES * sizeof(size_t));
+  for (size_t q = 0; q < QUERIES; q++)
+    positions[q] = next_random() % (n * 64);
+
+  printf("\n%-12s %9s %9s %9s %9s\n", "", "scan", "rank", "select",
+         "transpose");
+  printf("%-12s %9s %9s %9s %9s\n", "", "GB/s", "M/s", "M/s", "GB/s");
+  first = true;
+  for (size_t v = 0; v < bitops_variant_count(); v++) {
+    const struct bitops *ops = bitops_variant(v);
+    if (!bitops_supported(ops))
+      continue;
+
+    /* every set bit of the sparse vector, in order */
+    double start = now_seconds();
+    uint64_t found = 0, sum = 0;
+    for (size_t pos = ops->next_set(dst, n, 0); pos < n * 64;
+         pos = ops->next_set(dst, n, pos + 1)) {
+      found++;
+      sum += pos;
+    }
+    double t_scan = now_seconds() - start;
+    agree(&expected[5], found ^ sum, first, ops, "next_set");
+
+    struct bit_rank r;
+    if (!bit_rank_build(&r, ops, a, n)) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    uint64_t total = r.before[r.blocks];
+    start = now_seconds();
+    sum = 0;
+    for (size_t q = 0; q < QUERIES; q++)
+      sum += bit_rank(&r, positions[q]);
+    double t_rank = now_seconds() - start;
+    agree(&expected[6], sum, first, ops, "rank");
+
+    start = now_seconds();
+    sum = 0;
+    for (size_t q = 0; q < QUERIES; q++)
+      sum += bit_select(&r, positions[q] % total);
+    double t_select = now_seconds() - start;
+    agree(&expected[7], sum, first, ops, "select");
+    bit_rank_free(&r);
+
+    /* twice, which puts every matrix back */
+    start = now_seconds();
+    for (int pass = 0; pass < 2; pass++)
+      for (size_t i = 0; i + 64 <= n; i += 64)
+        ops->transpose64(a + i);
+    double t_transpose = (now_seconds() - start) / 2;
+    if (checksum(a, n) != before) {
+      fprintf(stderr, "%s: transpose64 twice changed the matrices\n",
+              ops->name);
+      exit(EXIT_FAILURE);
+    }
+
+    printf("%-12s %9.2f %9.1f %9.1f %9.2f\n", ops->name, gb / t_scan,
+           QUERIES / t_rank / 1e6, QUERIES / t_select / 1e6,
+           gb / t_transpose);
+    first = false;
+  }
+
+  free(positions);
+  free(a);
+  free(b);
+  free(dst);
+}
+
+int main(int argc, char *argv[]) {
+  bool check_only = false;
+  size_t size_mb = DEFAULT_SIZE_MB;
+  int opt;
+  while ((opt = getopt(argc, argv, "cm:")) != -1) {
+    switch (opt) {
+    case 'c':
+      check_only = true;
+      break;
+    case 'm':
+      size_mb = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c] [-m size_mb]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (check_only)
+    exit(check());
+  if (size_mb < 1) {
+    fprintf(stderr, "Size out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  bench(size_mb);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,211 @@
+/*
+ *
+ * Bounded queues of 64-bit values shared between threads.
+ *
+ * spsc_ring is for exactly one producer thread and one consumer
+ * thread.  Each side owns one index and only reads the other's,
+ * so no read-modify-write is needed at all; the indexes sit on
+ * separate cache lines, and each side keeps a private copy of
+ * the other's index, only reloading it when the ring looks full
+ * or empty.
+ *
+ * mpmc_ring takes any number of each.  A producer reserves room
+ * by advancing prod_head with compare-and-swap, copies its values
+ * in, then waits for producers that reserved earlier to finish
+ * before publishing through prod_tail, so consumers only ever see
+ * whole batches, in order.  Consumers do the same with cons_head
+ * and cons_tail.  A thread that is descheduled in the middle holds
+ * up the others on its side, who yield the processor to it.
+ *
+ * Capacities are rounded up to a power of two.  The batch calls
+ * move as many values as they can, up to n, and return how many.
+ */
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE 64
+#define SPINS_BEFORE_YIELD 64
+
+struct spsc_ring {
+  _Alignas(CACHE_LINE) _Atomic size_t head; /* written by the consumer */
+  size_t cached_tail;
+  _Alignas(CACHE_LINE) _Atomic size_t tail; /* written by the producer */
+  size_t cached_head;
+  _Alignas(CACHE_LINE) size_t mask;
+  uint64_t *slots;
+};
+
+struct mpmc_ring {
+  _Alignas(CACHE_LINE) _Atomic size_t prod_head;
+  _Atomic size_t prod_tail;
+  _Alignas(CACHE_LINE) _Atomic size_t cons_head;
+  _Atomic size_t cons_tail;
+  _Alignas(CACHE_LINE) size_t mask;
+  uint64_t *slots;
+};
+
+static size_t round_up_power_of_two(size_t n) {
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+static void *alloc_ring(size_t size) {
+  size = (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  return aligned_alloc(CACHE_LINE, size);
+}
+
+/* -------- single producer, single consumer -------- */
+
+struct spsc_ring *spsc_create(size_t capacity) {
+  struct spsc_ring *r = (struct spsc_ring *)alloc_ring(sizeof(*r));
+  if (r == NULL)
+    return NULL;
+  capacity = round_up_power_of_two(capacity ? capacity : 1);
+  r->slots = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  if (r->slots == NULL) {
+    free(r);
+    return NULL;
+  }
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->cached_head = r->cached_tail = 0;
+  r->mask = capacity - 1;
+  return r;
+}
+
+void spsc_destroy(struct spsc_ring *r) {
+  free(r->slots);
+  free(r);
+}
+
+size_t spsc_enqueue_batch(struct spsc_ring *r, const uint64_t *v, size_t n) {
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  size_t room = r->mask + 1 - (tail - r->cached_head);
+  if (room < n) {
+    r->cached_head = atomic_load_explicit(&r->head, memory_order_acquire);
+    room = r->mask + 1 - (tail - r->cached_head);
+    if (room < n)
+      n = room;
+  }
+  for (size_t i = 0; i < n; i++)
+    r->slots[(tail + i) & r->mask] = v[i];
+  atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+  return n;
+}
+
+size_t spsc_dequeue_batch(struct spsc_ring *r, uint64_t *v, size_t n) {
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  size_t ready = r->cached_tail - head;
+  if (ready < n) {
+    r->cached_tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    ready = r->cached_tail - head;
+    if (ready < n)
+      n = ready;
+  }
+  for (size_t i = 0; i < n; i++)
+    v[i] = r->slots[(head + i) & r->mask];
+  atomic_store_explicit(&r->head, head + n, memory_order_release);
+  return n;
+}
+
+bool spsc_enqueue(struct spsc_ring *r, uint64_t v) {
+  return spsc_enqueue_batch(r, &v, 1) == 1;
+}
+
+bool spsc_dequeue(struct spsc_ring *r, uint64_t *v) {
+  return spsc_dequeue_batch(r, v, 1) == 1;
+}
+
+/* -------- multiple producers and consumers -------- */
+
+struct mpmc_ring *mpmc_create(size_t capacity) {
+  struct mpmc_ring *r = (struct mpmc_ring *)alloc_ring(sizeof(*r));
+  if (r == NULL)
+    return NULL;
+  capacity = round_up_power_of_two(capacity ? capacity : 1);
+  r->slots = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  if (r->slots == NULL) {
+    free(r);
+    return NULL;
+  }
+  atomic_init(&r->prod_head, 0);
+  atomic_init(&r->prod_tail, 0);
+  atomic_init(&r->cons_head, 0);
+  atomic_init(&r->cons_tail, 0);
+  r->mask = capacity - 1;
+  return r;
+}
+
+void mpmc_destroy(struct mpmc_ring *r) {
+  free(r->slots);
+  free(r);
+}
+
+/*
+ * Wait for the earlier reservations on one side to be published.
+ * Acquire, so that the release store that follows also publishes
+ * their slots: a plain store is not part of their release sequence.
+ */
+static void wait_turn(_Atomic size_t *tail, size_t mine) {
+  int spins = 0;
+  while (atomic_load_explicit(tail, memory_order_acquire) != mine)
+    if (++spins == SPINS_BEFORE_YIELD) {
+      spins = 0;
+      sched_yield();
+    }
+}
+
+size_t mpmc_enqueue_batch(struct mpmc_ring *r, const uint64_t *v, size_t n) {
+  size_t head = atomic_load_explicit(&r->prod_head, memory_order_relaxed);
+  size_t k;
+  do {
+    size_t cons_tail =
+        atomic_load_explicit(&r->cons_tail, memory_order_acquire);
+    size_t room = r->mask + 1 - (head - cons_tail);
+    k = n < room ? n : room;
+    if (k == 0)
+      return 0;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &r->prod_head, &head, head + k, memory_order_relaxed,
+      memory_order_relaxed));
+
+  for (size_t i = 0; i < k; i++)
+    r->slots[(head + i) & r->mask] = v[i];
+  wait_turn(&r->prod_tail, head);
+  atomic_store_explicit(&r->prod_tail, head + k, memory_order_release);
+  return k;
+}
+
+size_t mpmc_dequeue_batch(struct mpmc_ring *r, uint64_t *v, size_t n) {
+  size_t head = atomic_load_explicit(&r->cons_head, memory_order_relaxed);
+  size_t k;
+  do {
+    size_t prod_tail =
+        atomic_load_explicit(&r->prod_tail, memory_order_acquire);
+    size_t ready = prod_tail - head;
+    k = n < ready ? n : ready;
+    if (k == 0)
+      return 0;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &r->cons_head, &head, head + k, memory_order_relaxed,
+      memory_order_relaxed));
+
+  for (size_t i = 0; i < k; i++)
+    v[i] = r->slots[(head + i) & r->mask];
+  wait_turn(&r->cons_tail, head);
+  atomic_store_explicit(&r->cons_tail, head + k, memory_order_release);
+  return k;
+}
+
+bool mpmc_enqueue(struct mpmc_ring *r, uint64_t v) {
+  return mpmc_enqueue_batch(r, &v, 1) == 1;
+}
+
+bool mpmc_dequeue(struct mpmc_ring *r, uint64_t *v) {
+  return mpmc_dequeue_batch(r, v, 1) == 1;
+}
@@ -0,0 +1,331 @@
+/*
+ *
+ * Benchmark of the rings in ring.c.
+ *
+ * After checking that values come out whole and in order, values
+ * are passed from producer threads to consumer threads, one at a
+ * time and in batches: through the single producer ring with one
+ * of each, and through the multiple producer ring with 1 to N of
+ * each.  Each setting is run twice.  In the first run, values are
+ * a producer number and a count, so consumers can check that each
+ * producer's values arrive in order, and that run is timed.  In
+ * the second, values are the time they were enqueued, and a sample
+ * of how long they waited is reported as percentiles.
+ *
+ * usage: example4.10-ring [-t max_threads] [-n values]
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_VALUES 10000000
+#define RING_CAPACITY 4096
+#define BATCH 32
+#define SAMPLE_EVERY 16
+#define MAX_THREADS 64
+
+struct spsc_ring;
+struct spsc_ring *spsc_create(size_t capacity);
+void spsc_destroy(struct spsc_ring *r);
+bool spsc_enqueue(struct spsc_ring *r, uint64_t v);
+bool spsc_dequeue(struct spsc_ring *r, uint64_t *v);
+size_t spsc_enqueue_batch(struct spsc_ring *r, const uint64_t *v, size_t n);
+size_t spsc_dequeue_batch(struct spsc_ring *r, uint64_t *v, size_t n);
+
+struct mpmc_ring;
+struct mpmc_ring *mpmc_create(size_t capacity);
+void mpmc_destroy(struct mpmc_ring *r);
+bool mpmc_enqueue(struct mpmc_ring *r, uint64_t v);
+bool mpmc_dequeue(struct mpmc_ring *r, uint64_t *v);
+size_t mpmc_enqueue_batch(struct mpmc_ring *r, const uint64_t *v, size_t n);
+size_t mpmc_dequeue_batch(struct mpmc_ring *r, uint64_t *v, size_t n);
+
+struct run {
+  bool multi; /* which ring */
+  struct spsc_ring *spsc;
+  struct mpmc_ring *mpmc;
+  size_t batch;
+  uint64_t per_producer;
+  uint64_t total;
+  _Atomic uint64_t consumed;
+  bool stamp; /* values are times rather than producer and sequence */
+};
+
+struct consumer {
+  struct run *run;
+  int32_t producers;
+  uint64_t *samples;
+  size_t sample_count;
+  size_t sample_size;
+  bool failed; /* saw a value out of order */
+};
+
+struct producer {
+  struct run *run;
+  uint64_t id;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static size_t enqueue(struct run *r, const uint64_t *v, size_t n) {
+  if (r->multi)
+    return n == 1 ? mpmc_enqueue(r->mpmc, v[0])
+                  : mpmc_enqueue_batch(r->mpmc, v, n);
+  return n == 1 ? spsc_enqueue(r->spsc, v[0])
+                : spsc_enqueue_batch(r->spsc, v, n);
+}
+
+static size_t dequeue(struct run *r, uint64_t *v, size_t n) {
+  if (r->multi)
+    return n == 1 ? mpmc_dequeue(r->mpmc, v)
+                  : mpmc_dequeue_batch(r->mpmc, v, n);
+  return n == 1 ? spsc_dequeue(r->spsc, v)
+                : spsc_dequeue_batch(r->spsc, v, n);
+}
+
+/* values are the producer in the top bits and a count below */
+#define SEQUENCE_BITS 40
+
+static void *producer(void *arg) {
+  struct producer *p = (struct producer *)arg;
+  struct run *r = p->run;
+  uint64_t values[BATCH];
+  uint64_t sent = 0;
+  while (sent < r->per_producer) {
+    size_t n = r->batch;
+    if (r->per_producer - sent < n)
+      n = r->per_producer - sent;
+    uint64_t stamp = r->stamp ? now_ns() : 0;
+    for (size_t i = 0; i < n; i++)
+      values[i] = r->stamp ? stamp : p->id << SEQUENCE_BITS | (sent + i);
+    size_t done = 0;
+    while (done < n) {
+      size_t k = enqueue(r, values + done, n - done);
+      if (k == 0)
+        sched_yield();
+      done += k;
+    }
+    sent += n;
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  struct consumer *c = (struct consumer *)arg;
+  struct run *r = c->run;
+  uint64_t values[BATCH];
+  uint64_t next[MAX_THREADS] = {0}; /* lowest sequence still expected */
+  uint64_t seen = 0;
+  while (atomic_load_explicit(&r->consumed, memory_order_relaxed) <
+         r->total) {
+    size_t k = dequeue(r, values, r->batch);
+    if (k == 0) {
+      sched_yield();
+      continue;
+    }
+    uint64_t now = r->stamp ? now_ns() : 0;
+    for (size_t i = 0; i < k; i++, seen++) {
+      if (r->stamp) {
+        if (seen % SAMPLE_EVERY == 0 && c->sample_count < c->sample_size)
+          c->samples[c->sample_count++] = now - values[i];
+        continue;
+      }
+      uint64_t id = values[i] >> SEQUENCE_BITS;
+      uint64_t sequence = values[i] & (((uint64_t)1 << SEQUENCE_BITS) - 1);
+      if (id >= (uint64_t)c->producers || sequence < next[id])
+        c->failed = true;
+      else
+        next[id] = sequence + 1;
+    }
+    atomic_fetch_add_explicit(&r->consumed, k, memory_order_relaxed);
+  }
+  return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* runs 'threads' producers and as many consumers */
+static bool run_threads(bool multi, int32_t threads, size_t batch,
+                        uint64_t values, bool stamp, double *seconds,
+                        uint64_t percentiles[3]) {
+  struct run r;
+  memset(&r, 0, sizeof(r));
+  r.multi = multi;
+  if (multi)
+    r.mpmc = mpmc_create(RING_CAPACITY);
+  else
+    r.spsc = spsc_create(RING_CAPACITY);
+  if (r.mpmc == NULL && r.spsc == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  r.batch = batch;
+  r.per_producer = values / threads;
+  r.total = r.per_producer * threads;
+  atomic_init(&r.consumed, 0);
+  r.stamp = stamp;
+
+  struct producer producers[MAX_THREADS];
+  struct consumer consumers[MAX_THREADS];
+  pthread_t tids[2 * MAX_THREADS];
+  /* a consumer may get more than its share; extra samples are dropped */
+  size_t sample_size = r.total / SAMPLE_EVERY / threads * 2 + BATCH;
+  double start = now_seconds();
+  for (int32_t i = 0; i < threads; i++) {
+    consumers[i] = (struct consumer){&r, threads,
+                                     (uint64_t *)xmalloc(sample_size *
+                                                         sizeof(uint64_t)),
+                                     0, sample_size, false};
+    producers[i] = (struct producer){&r, (uint64_t)i};
+    if (pthread_create(&tids[2 * i], NULL, consumer, &consumers[i]) != 0 ||
+        pthread_create(&tids[2 * i + 1], NULL, producer, &producers[i]) !=
+            0) {
+      fprintf(stderr, "Cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int32_t i = 0; i < 2 * threads; i++)
+    pthread_join(tids[i], NULL);
+  *seconds = now_seconds() - start;
+
+  if (stamp) {
+    size_t count = 0;
+    for (int32_t i = 0; i < threads; i++)
+      count += consumers[i].sample_count;
+    uint64_t *all = (uint64_t *)xmalloc((count + 1) * sizeof(uint64_t));
+    count = 0;
+    for (int32_t i = 0; i < threads; i++) {
+      memcpy(all + count, consumers[i].samples,
+             consumers[i].sample_count * sizeof(uint64_t));
+      count += consumers[i].sample_count;
+    }
+    qsort(all, count, sizeof(uint64_t), compare_u64);
+    percentiles[0] = count ? all[count / 2] : 0;
+    percentiles[1] = count ? all[count * 99 / 100] : 0;
+    percentiles[2] = count ? all[count * 999 / 1000] : 0;
+    free(all);
+  }
+  bool failed = false;
+  for (int32_t i = 0; i < threads; i++) {
+    failed = failed || consumers[i].failed;
+    free(consumers[i].samples);
+  }
+  if (multi)
+    mpmc_destroy(r.mpmc);
+  else
+    spsc_destroy(r.spsc);
+  return !failed &&
+         atomic_load_explicit(&r.consumed, memory_order_relaxed) == r.total;
+}
+
+/* one thread: fill, overfill, drain and overdrain */
+static bool check_single_thread(bool multi) {
+  struct run r;
+  memset(&r, 0, sizeof(r));
+  r.multi = multi;
+  r.spsc = multi ? NULL : spsc_create(100);
+  r.mpmc = multi ? mpmc_create(100) : NULL;
+  uint64_t in[200], out[200];
+  for (uint64_t i = 0; i < 200; i++)
+    in[i] = i * 7919;
+  bool ok = enqueue(&r, in, 1) == 1 && enqueue(&r, in + 1, 200) == 127 &&
+            enqueue(&r, in, 1) == 0 && dequeue(&r, out, 1) == 1 &&
+            dequeue(&r, out + 1, 200) == 127 && dequeue(&r, out, 1) == 0 &&
+            memcmp(in, out, 128 * sizeof(uint64_t)) == 0;
+  /* and again, wrapping round */
+  ok = ok && enqueue(&r, in, 100) == 100 && dequeue(&r, out, 100) == 100 &&
+       memcmp(in, out, 100 * sizeof(uint64_t)) == 0;
+  if (multi)
+    mpmc_destroy(r.mpmc);
+  else
+    spsc_destroy(r.spsc);
+  return ok;
+}
+
+static void report(const char *label, int32_t threads, size_t batch,
+                   uint64_t values, bool multi) {
+  double check_time, time;
+  uint64_t percentiles[3];
+  bool ok = run_threads(multi, threads, batch, values, false, &check_time,
+                        percentiles);
+  ok = ok && run_threads(multi, threads, batch, values, true, &time,
+                         percentiles);
+  printf("%-6s %2d+%-2d batch %2zu: %11.0f values/sec, wait p50 %7" PRIu64
+         " ns p99 %8" PRIu64 " ns p99.9 %9" PRIu64 " ns%s\n",
+         label, threads, threads, batch, values / check_time, percentiles[0],
+         percentiles[1], percentiles[2], ok ? "" : " FAILED");
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  int32_t max_threads = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t values = DEFAULT_VALUES;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      values = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-t max_threads] [-n values]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (max_threads < 1)
+    max_threads = 1;
+  if (max_threads > MAX_THREADS)
+    max_threads = MAX_THREADS;
+  if (values < (uint64_t)max_threads * BATCH)
+    values = (uint64_t)max_threads * BATCH;
+
+  bool ok = check_single_thread(false) && check_single_thread(true);
+  printf("single thread check: %s\n", ok ? "ok" : "FAILED");
+  if (!ok)
+    exit(EXIT_FAILURE);
+
+  /* throughput is from runs carrying sequence numbers, checked in order */
+  report("spsc", 1, 1, values, false);
+  report("spsc", 1, BATCH, values, false);
+  for (int32_t threads = 1;; threads *= 2) {
+    if (threads > max_threads)
+      threads = max_threads;
+    report("mpmc", threads, 1, values, true);
+    report("mpmc", threads, BATCH, values, true);
+    if (threads == max_threads)
+      break;
+  }
+  exit(EXIT_SUCCESS);
+}
@@ -1,21 +1,38 @@
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+/* from ring.c */
+struct spsc_ring;
+struct spsc_ring *spsc_create(size_t capacity);
+bool spsc_dequeue(struct spsc_ring *r, uint64_t *v);
+size_t spsc_enqueue_batch(struct spsc_ring *r, const uint64_t *v, size_t n);
+
 /* example library module */
 /* only 'callable' is visible outside */
-static int32_t buf[100];
+static uint64_t buf[100];
 static size_t length;
+static struct spsc_ring *queue;
 static void fillup();
 
 int32_t callable() {
-  if (length == 0) {
+  uint64_t value;
+  if (queue == NULL && (queue = spsc_create(100)) == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!spsc_dequeue(queue, &value)) {
     fillup();
+    spsc_dequeue(queue, &value);
   }
-  return buf[length--];
+  return (int32_t)value;
 }
 
 static void fillup() {
+  length = 0;
   while (length < 100) {
     buf[length++] = 0;
   }
+  spsc_enqueue_batch(queue, buf, length);
 }
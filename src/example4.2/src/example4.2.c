@@ -2,6 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+#endif
+
 int main(int argc, char *argv[]) {
   void pmax(); /* declaration */
   for (int32_t i = -10; i <= 10; i++) {
@@ -25,5 +32,15 @@ void pmax(int32_t a1, int32_t a2) { /* definition */
     biggest = a2;
   }
 
+#ifdef BULK_OUTPUT
+  out_str("larger of ");
+  out_int(a1);
+  out_str(" and ");
+  out_int(a2);
+  out_str(" is ");
+  out_int(biggest);
+  out_char('\n');
+#else
   printf("larger of %d and %d is %d\n", a1, a2, biggest);
+#endif
 }
@@ -0,0 +1,237 @@
+/*
+ *
+ * Square roots of whole arrays.
+ *
+ * Like sq_root in example 4.4 this uses Newton's method, but it
+ * starts from an estimate good enough that a fixed, small number
+ * of steps always suffices, so several values can be worked on
+ * at once in SIMD registers.  The steps improve r ~ 1/sqrt(x),
+ * which needs no division:
+ *
+ *     r = r * (1.5 - 0.5 * x * r * r)
+ *
+ * and the root is then x * r, with one final correction step.
+ *
+ * For doubles the first estimate comes from halving the exponent
+ * with an integer trick, for floats from the rsqrtps instruction.
+ * Zero, negative, denormal, infinite and NaN inputs are handed to
+ * the library sqrt.
+ *
+ * The module keeps one set of kernels, chosen the first time it
+ * is used from what the CPU supports; sq_root_batch_kernel
+ * changes the choice.
+ */
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+#define DOUBLE_RSQRT_MAGIC 0x5fe6eb50c7b537a9ULL
+#define FLOAT_RSQRT_MAGIC 0x5f375a86U
+#define DOUBLE_NEWTON_STEPS 3
+#define FLOAT_NEWTON_STEPS 2
+
+typedef void (*double_kernel)(const double *x, double *root, size_t n);
+typedef void (*float_kernel)(const float *x, float *root, size_t n);
+
+static bool is_normal_double(double x) { return x >= DBL_MIN && x <= DBL_MAX; }
+static bool is_normal_float(float x) { return x >= FLT_MIN && x <= FLT_MAX; }
+
+static double scalar_root(double x) {
+  if (!is_normal_double(x))
+    return sqrt(x);
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = DOUBLE_RSQRT_MAGIC - (bits >> 1);
+  double r;
+  memcpy(&r, &bits, sizeof(r));
+  for (int32_t i = 0; i < DOUBLE_NEWTON_STEPS; i++)
+    r = r * (1.5 - 0.5 * x * r * r);
+  double s = x * r;
+  return s + 0.5 * r * (x - s * s);
+}
+
+static float scalar_root_f(float x) {
+  if (!is_normal_float(x))
+    return sqrtf(x);
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = FLOAT_RSQRT_MAGIC - (bits >> 1);
+  float r;
+  memcpy(&r, &bits, sizeof(r));
+  for (int32_t i = 0; i < FLOAT_NEWTON_STEPS; i++)
+    r = r * (1.5f - 0.5f * x * r * r);
+  float s = x * r;
+  return s + 0.5f * r * (x - s * s);
+}
+
+static void scalar_batch(const double *x, double *root, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    root[i] = scalar_root(x[i]);
+}
+
+static void scalar_batch_f(const float *x, float *root, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    root[i] = scalar_root_f(x[i]);
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2"))) static void
+sse2_batch(const double *x, double *root, size_t n) {
+  const __m128i magic = _mm_set1_epi64x((int64_t)DOUBLE_RSQRT_MAGIC);
+  const __m128d half = _mm_set1_pd(0.5), three_halves = _mm_set1_pd(1.5);
+  const __m128d lo = _mm_set1_pd(DBL_MIN), hi = _mm_set1_pd(DBL_MAX);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(x + i);
+    __m128d r = _mm_castsi128_pd(
+        _mm_sub_epi64(magic, _mm_srli_epi64(_mm_castpd_si128(v), 1)));
+    __m128d half_v = _mm_mul_pd(half, v);
+    for (int32_t k = 0; k < DOUBLE_NEWTON_STEPS; k++)
+      r = _mm_mul_pd(r, _mm_sub_pd(three_halves,
+                                   _mm_mul_pd(half_v, _mm_mul_pd(r, r))));
+    __m128d s = _mm_mul_pd(v, r);
+    s = _mm_add_pd(s, _mm_mul_pd(_mm_mul_pd(half, r),
+                                 _mm_sub_pd(v, _mm_mul_pd(s, s))));
+    _mm_storeu_pd(root + i, s);
+    __m128d ok = _mm_and_pd(_mm_cmpge_pd(v, lo), _mm_cmple_pd(v, hi));
+    if (_mm_movemask_pd(ok) != 0x3)
+      for (size_t k = i; k < i + 2; k++)
+        if (!is_normal_double(x[k]))
+          root[k] = sqrt(x[k]);
+  }
+  scalar_batch(x + i, root + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void
+sse2_batch_f(const float *x, float *root, size_t n) {
+  const __m128 half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+  const __m128 lo = _mm_set1_ps(FLT_MIN), hi = _mm_set1_ps(FLT_MAX);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_loadu_ps(x + i);
+    __m128 r = _mm_rsqrt_ps(v); /* about 12 bits */
+    r = _mm_mul_ps(r, _mm_sub_ps(three_halves,
+                                 _mm_mul_ps(_mm_mul_ps(half, v),
+                                            _mm_mul_ps(r, r))));
+    __m128 s = _mm_mul_ps(v, r);
+    s = _mm_add_ps(s, _mm_mul_ps(_mm_mul_ps(half, r),
+                                 _mm_sub_ps(v, _mm_mul_ps(s, s))));
+    _mm_storeu_ps(root + i, s);
+    __m128 ok = _mm_and_ps(_mm_cmpge_ps(v, lo), _mm_cmple_ps(v, hi));
+    if (_mm_movemask_ps(ok) != 0xf)
+      for (size_t k = i; k < i + 4; k++)
+        if (!is_normal_float(x[k]))
+          root[k] = sqrtf(x[k]);
+  }
+  scalar_batch_f(x + i, root + i, n - i);
+}
+
+/* with FMA, x - s * s is exact, which makes the last step exact */
+__attribute__((target("avx2,fma"))) static void
+avx2_batch(const double *x, double *root, size_t n) {
+  const __m256i magic = _mm256_set1_epi64x((int64_t)DOUBLE_RSQRT_MAGIC);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d three_halves = _mm256_set1_pd(1.5);
+  const __m256d lo = _mm256_set1_pd(DBL_MIN), hi = _mm256_set1_pd(DBL_MAX);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d v = _mm256_loadu_pd(x + i);
+    __m256d r = _mm256_castsi256_pd(
+        _mm256_sub_epi64(magic, _mm256_srli_epi64(_mm256_castpd_si256(v), 1)));
+    __m256d half_v = _mm256_mul_pd(half, v);
+    for (int32_t k = 0; k < DOUBLE_NEWTON_STEPS; k++)
+      r = _mm256_mul_pd(
+          r, _mm256_fnmadd_pd(half_v, _mm256_mul_pd(r, r), three_halves));
+    __m256d s = _mm256_mul_pd(v, r);
+    s = _mm256_fmadd_pd(_mm256_mul_pd(half, r), _mm256_fnmadd_pd(s, s, v), s);
+    _mm256_storeu_pd(root + i, s);
+    __m256d ok = _mm256_and_pd(_mm256_cmp_pd(v, lo, _CMP_GE_OQ),
+                               _mm256_cmp_pd(v, hi, _CMP_LE_OQ));
+    if (_mm256_movemask_pd(ok) != 0xf)
+      for (size_t k = i; k < i + 4; k++)
+        if (!is_normal_double(x[k]))
+          root[k] = sqrt(x[k]);
+  }
+  scalar_batch(x + i, root + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static void
+avx2_batch_f(const float *x, float *root, size_t n) {
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 three_halves = _mm256_set1_ps(1.5f);
+  const __m256 lo = _mm256_set1_ps(FLT_MIN), hi = _mm256_set1_ps(FLT_MAX);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    __m256 r = _mm256_rsqrt_ps(v);
+    r = _mm256_mul_ps(r, _mm256_fnmadd_ps(_mm256_mul_ps(half, v),
+                                          _mm256_mul_ps(r, r), three_halves));
+    __m256 s = _mm256_mul_ps(v, r);
+    s = _mm256_fmadd_ps(_mm256_mul_ps(half, r), _mm256_fnmadd_ps(s, s, v), s);
+    _mm256_storeu_ps(root + i, s);
+    __m256 ok = _mm256_and_ps(_mm256_cmp_ps(v, lo, _CMP_GE_OQ),
+                              _mm256_cmp_ps(v, hi, _CMP_LE_OQ));
+    if (_mm256_movemask_ps(ok) != 0xff)
+      for (size_t k = i; k < i + 8; k++)
+        if (!is_normal_float(x[k]))
+          root[k] = sqrtf(x[k]);
+  }
+  scalar_batch_f(x + i, root + i, n - i);
+}
+#endif
+
+static double_kernel chosen_double;
+static float_kernel chosen_float;
+static const char *chosen_name;
+
+/*
+ * Choose the kernels: "auto", "scalar", "sse2" or "avx2".
+ * Returns the name of the kernels now in use, or NULL if
+ * the CPU can't run the ones asked for.
+ */
+const char *sq_root_batch_kernel(const char *name) {
+  bool is_auto = strcmp(name, "auto") == 0;
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  bool have_avx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  bool have_sse2 = __builtin_cpu_supports("sse2");
+  if ((is_auto || strcmp(name, "avx2") == 0) && have_avx2) {
+    chosen_double = avx2_batch;
+    chosen_float = avx2_batch_f;
+    return chosen_name = "avx2";
+  }
+  if ((is_auto || strcmp(name, "sse2") == 0) && have_sse2) {
+    chosen_double = sse2_batch;
+    chosen_float = sse2_batch_f;
+    return chosen_name = "sse2";
+  }
+#endif
+  if (is_auto || strcmp(name, "scalar") == 0) {
+    chosen_double = scalar_batch;
+    chosen_float = scalar_batch_f;
+    return chosen_name = "scalar";
+  }
+  return NULL;
+}
+
+/* root[i] = square root of x[i], for i from 0 to n - 1 */
+void sq_root_batch(const double *x, double *root, size_t n) {
+  if (chosen_double == NULL)
+    sq_root_batch_kernel("auto");
+  chosen_double(x, root, n);
+}
+
+void sq_root_batch_f(const float *x, float *root, size_t n) {
+  if (chosen_float == NULL)
+    sq_root_batch_kernel("auto");
+  chosen_float(x, root, n);
+}
@@ -0,0 +1,218 @@
+/*
+ *
+ * Benchmark for sq_root_batch.
+ *
+ * Checks the error, in units in the last place, of the batch
+ * square roots against the library sqrt, then times them against
+ * calling the sq_root of example 4.4 once per value.
+ *
+ * usage: example4.4-batchsqrt [-k kernel] [-n count]
+ */
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DELTA 0.0001
+#define CHUNK (1 << 20)
+#define DEFAULT_COUNT 100000000
+#define MIN_VALUE 1e-3
+#define MAX_VALUE 1e6
+
+const char *sq_root_batch_kernel(const char *name);
+void sq_root_batch(const double *x, double *root, size_t n);
+void sq_root_batch_f(const float *x, float *root, size_t n);
+
+/* sq_root from example 4.4 */
+double sq_root(double x) {
+  double last_appx = x;
+  double diff = DELTA + 1;
+
+  double curr_appx;
+  while (diff > DELTA) {
+    curr_appx = 0.5 * (last_appx + x / last_appx);
+    diff = curr_appx - last_appx;
+    if (diff < 0)
+      diff = -diff;
+    last_appx = curr_appx;
+  }
+  return curr_appx;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* positive doubles are ordered like their bit patterns */
+static uint64_t ulp_distance(double a, double b) {
+  int64_t ia, ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+  return ia > ib ? ia - ib : ib - ia;
+}
+
+static uint32_t ulp_distance_f(float a, float b) {
+  int32_t ia, ib;
+  memcpy(&ia, &a, sizeof(ia));
+  memcpy(&ib, &b, sizeof(ib));
+  return ia > ib ? ia - ib : ib - ia;
+}
+
+static bool same_value(double a, double b) {
+  return (isnan(a) && isnan(b)) || a == b;
+}
+
+/* values spread evenly over the exponents */
+static void fill(double *x, float *xf, size_t n, double lo, double hi) {
+  double log_lo = log(lo), log_hi = log(hi);
+  for (size_t i = 0; i < n; i++) {
+    x[i] = exp(log_lo + (log_hi - log_lo) * rand() / RAND_MAX);
+    xf[i] = (float)x[i];
+  }
+}
+
+static bool check_accuracy(double *x, float *xf, double *root, float *rootf) {
+  static const double special[] = {0.0,     -0.0,    -1.0,    INFINITY,
+                                   NAN,     DBL_MIN, DBL_MAX, 4.9e-324,
+                                   1e-310,  1.0,     4.0,     2.0};
+  bool ok = true;
+  size_t nspecial = sizeof(special) / sizeof(special[0]);
+  for (size_t i = 0; i < nspecial; i++) {
+    x[i] = special[i];
+    xf[i] = (float)special[i];
+  }
+  sq_root_batch(x, root, nspecial);
+  sq_root_batch_f(xf, rootf, nspecial);
+  for (size_t i = 0; i < nspecial; i++) {
+    /* exact answers for the special cases, 1 ulp for the others */
+    bool normal = x[i] >= DBL_MIN && x[i] <= DBL_MAX;
+    bool normal_f = xf[i] >= FLT_MIN && xf[i] <= FLT_MAX;
+    if (!(same_value(root[i], sqrt(x[i])) ||
+          (normal && ulp_distance(root[i], sqrt(x[i])) <= 1)) ||
+        !(same_value(rootf[i], sqrtf(xf[i])) ||
+          (normal_f && ulp_distance_f(rootf[i], sqrtf(xf[i])) <= 1))) {
+      printf("error: wrong root of %g\n", x[i]);
+      ok = false;
+    }
+  }
+
+  fill(x, xf, CHUNK, DBL_MIN, DBL_MAX);
+  sq_root_batch(x, root, CHUNK);
+  uint64_t worst = 0;
+  for (size_t i = 0; i < CHUNK; i++) {
+    uint64_t d = ulp_distance(root[i], sqrt(x[i]));
+    if (d > worst)
+      worst = d;
+  }
+  fill(x, xf, CHUNK, FLT_MIN, FLT_MAX);
+  sq_root_batch_f(xf, rootf, CHUNK);
+  uint32_t worst_f = 0;
+  for (size_t i = 0; i < CHUNK; i++) {
+    uint32_t d = ulp_distance_f(rootf[i], sqrtf(xf[i]));
+    if (d > worst_f)
+      worst_f = d;
+  }
+  printf("max error: %" PRIu64 " ulp (double), %u ulp (float)\n", worst,
+         worst_f);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  const char *kernel = "auto";
+  size_t count = DEFAULT_COUNT;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "k:n:")) != -1) {
+    switch (opt) {
+    case 'k':
+      kernel = optarg;
+      break;
+    case 'n':
+      count = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-k kernel] [-n count]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  const char *name = sq_root_batch_kernel(kernel);
+  if (name == NULL) {
+    fprintf(stderr, "Kernel %s is not available\n", kernel);
+    exit(EXIT_FAILURE);
+  }
+  printf("%s kernel\n", name);
+
+  double *x = (double *)xmalloc(CHUNK * sizeof(double));
+  double *root = (double *)xmalloc(CHUNK * sizeof(double));
+  float *xf = (float *)xmalloc(CHUNK * sizeof(float));
+  float *rootf = (float *)xmalloc(CHUNK * sizeof(float));
+
+  srand(1);
+  bool ok = check_accuracy(x, xf, root, rootf);
+
+  /* the same chunk of values is used over and over */
+  fill(x, xf, CHUNK, MIN_VALUE, MAX_VALUE);
+  size_t rounds = (count + CHUNK - 1) / CHUNK;
+  double sink = 0;
+
+  double start = now_seconds();
+  for (size_t r = 0; r < rounds; r++)
+    for (size_t i = 0; i < CHUNK; i++)
+      root[i] = sq_root(x[i]);
+  double scalar_time = now_seconds() - start;
+  sink += root[0];
+
+  start = now_seconds();
+  for (size_t r = 0; r < rounds; r++)
+    for (size_t i = 0; i < CHUNK; i++)
+      root[i] = sqrt(x[i]);
+  double libm_time = now_seconds() - start;
+  sink += root[0];
+
+  start = now_seconds();
+  for (size_t r = 0; r < rounds; r++)
+    sq_root_batch(x, root, CHUNK);
+  double batch_time = now_seconds() - start;
+  sink += root[0];
+
+  start = now_seconds();
+  for (size_t r = 0; r < rounds; r++)
+    sq_root_batch_f(xf, rootf, CHUNK);
+  double batch_f_time = now_seconds() - start;
+  sink += rootf[0];
+
+  double values = (double)rounds * CHUNK;
+  printf("%.0f values\n", values);
+  printf("sq_root loop:          %.3f s, %.1f M/s\n", scalar_time,
+         values / scalar_time / 1e6);
+  printf("library sqrt loop:     %.3f s, %.1f M/s\n", libm_time,
+         values / libm_time / 1e6);
+  printf("sq_root_batch:         %.3f s, %.1f M/s, %.1fx\n", batch_time,
+         values / batch_time / 1e6, scalar_time / batch_time);
+  printf("sq_root_batch_f:       %.3f s, %.1f M/s, %.1fx\n", batch_f_time,
+         values / batch_f_time / 1e6, scalar_time / batch_f_time);
+  if (sink == 0)
+    printf("\n");
+
+  free(x);
+  free(root);
+  free(xf);
+  free(rootf);
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
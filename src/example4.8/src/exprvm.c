@@ -0,0 +1,806 @@
+/*
+ *
+ * Expression compiler and batch evaluator.
+ *
+ * Takes the grammar of the recursive descent parser in
+ * example 4.8, adds multi-digit numbers and named variables,
+ * and parses an expression only once.  The parse tree is
+ * constant folded and compiled to code for a small stack
+ * machine, which is then run for every row of variable values.
+ *
+ * Three evaluators are provided:
+ *   - walking the parse tree, which stands in for example 4.8:
+ *     that evaluates as it parses, reading the expression again
+ *     from its input for every value, which is more work still,
+ *   - running the bytecode one row at a time, with computed
+ *     goto dispatch and the top of stack kept in a register,
+ *   - running the bytecode over a block of rows at a time, so
+ *     that each instruction is dispatched once per block and
+ *     works on whole columns.
+ *
+ * usage: example4.8-exprvm [-b] [-d] [-f file | -n rows] expression
+ *
+ *   -f file  variable values: a header line naming the columns,
+ *            then one row of whitespace separated integers per line
+ *   -n rows  make up 'rows' rows of random values instead
+ *   -b       benchmark the three evaluators and check they agree;
+ *            the speedups are over this program's own tree walk
+ *   -d       print the bytecode on stderr
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_VARIABLES 64
+#define MAX_NAME 32
+#define BLOCK_ROWS 256
+#define RANDOM_RANGE 1000
+
+enum node_kind { N_CONST, N_VAR, N_ADD, N_SUB, N_MUL, N_DIV, N_MOD, N_NEG };
+
+struct node {
+  enum node_kind kind;
+  int32_t value; /* constant, or variable number */
+  struct node *left, *right;
+};
+
+enum opcode {
+  OP_PUSH,
+  OP_LOAD,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_NEG,
+  OP_HALT
+};
+
+static const char *opcode_names[] = {"push", "load", "add", "sub", "mul",
+                                     "div",  "mod",  "neg", "halt"};
+
+struct program {
+  int32_t *code; /* opcodes, each followed by its operand if any */
+  size_t length;
+  size_t capacity;
+  size_t depth;
+  size_t max_stack;
+};
+
+struct parser {
+  const char *p;
+  char names[MAX_VARIABLES][MAX_NAME];
+  size_t nvariables;
+};
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Arithmetic is done on int32_t, wrapping on overflow rather
+ * than being undefined.  Division by zero is an error.
+ */
+static int32_t wrap_add(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+static int32_t wrap_sub(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+static int32_t wrap_mul(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+static int32_t wrap_neg(int32_t a) { return (int32_t)(0 - (uint32_t)a); }
+static int32_t safe_div(int32_t a, int32_t b) {
+  return b == -1 ? wrap_neg(a) : a / b;
+}
+static int32_t safe_mod(int32_t a, int32_t b) { return b == -1 ? 0 : a % b; }
+
+/* -------- parsing -------- */
+
+static struct node *make_node(enum node_kind kind, int32_t value,
+                              struct node *left, struct node *right) {
+  struct node *n = (struct node *)xmalloc(sizeof(struct node));
+  n->kind = kind;
+  n->value = value;
+  n->left = left;
+  n->right = right;
+  return n;
+}
+
+static void free_tree(struct node *n) {
+  if (n == NULL)
+    return;
+  free_tree(n->left);
+  free_tree(n->right);
+  free(n);
+}
+
+static char peek(struct parser *ps) {
+  while (isspace((unsigned char)*ps->p))
+    ps->p++;
+  return *ps->p;
+}
+
+static void parse_error(struct parser *ps, const char *what) {
+  fprintf(stderr, "error: %s at \"%s\"\n", what, ps->p);
+  exit(EXIT_FAILURE);
+}
+
+static struct node *expr(struct parser *ps);
+
+static int32_t variable_number(struct parser *ps, const char *name) {
+  for (size_t i = 0; i < ps->nvariables; i++)
+    if (strcmp(ps->names[i], name) == 0)
+      return (int32_t)i;
+  if (ps->nvariables == MAX_VARIABLES)
+    parse_error(ps, "too many variables");
+  strcpy(ps->names[ps->nvariables], name);
+  return (int32_t)ps->nvariables++;
+}
+
+static struct node *primary(struct parser *ps) {
+  char ch = peek(ps);
+  if (isdigit((unsigned char)ch)) {
+    int64_t val = 0;
+    while (isdigit((unsigned char)*ps->p)) {
+      val = val * 10 + (*ps->p++ - '0');
+      if (val > INT32_MAX)
+        parse_error(ps, "number too large");
+    }
+    return make_node(N_CONST, (int32_t)val, NULL, NULL);
+  }
+  if (isalpha((unsigned char)ch) || ch == '_') {
+    char name[MAX_NAME];
+    size_t len = 0;
+    while (isalnum((unsigned char)*ps->p) || *ps->p == '_') {
+      if (len == MAX_NAME - 1)
+        parse_error(ps, "name too long");
+      name[len++] = *ps->p++;
+    }
+    name[len] = 0;
+    return make_node(N_VAR, variable_number(ps, name), NULL, NULL);
+  }
+  if (ch == '(') {
+    ps->p++;
+    struct node *n = expr(ps);
+    if (peek(ps) != ')')
+      parse_error(ps, "expected ')'");
+    ps->p++;
+    return n;
+  }
+  parse_error(ps, "expected a number, name or '('");
+  return NULL;
+}
+
+static struct node *unary_exp(struct parser *ps) {
+  char ch = peek(ps);
+  if (ch == '+') {
+    ps->p++;
+    return unary_exp(ps);
+  }
+  if (ch == '-') {
+    ps->p++;
+    return make_node(N_NEG, 0, unary_exp(ps), NULL);
+  }
+  return primary(ps);
+}
+
+static struct node *mul_exp(struct parser *ps) {
+  struct node *n = unary_exp(ps);
+  for (;;) {
+    switch (peek(ps)) {
+    default:
+      return n;
+    case '*':
+      ps->p++;
+      n = make_node(N_MUL, 0, n, unary_exp(ps));
+      break;
+    case '/':
+      ps->p++;
+      n = make_node(N_DIV, 0, n, unary_exp(ps));
+      break;
+    case '%':
+      ps->p++;
+      n = make_node(N_MOD, 0, n, unary_exp(ps));
+      break;
+    }
+  }
+}
+
+static struct node *expr(struct parser *ps) {
+  struct node *n = mul_exp(ps);
+  for (;;) {
+    switch (peek(ps)) {
+    default:
+      return n;
+    case '+':
+      ps->p++;
+      n = make_node(N_ADD, 0, n, mul_exp(ps));
+      break;
+    case '-':
+      ps->p++;
+      n = make_node(N_SUB, 0, n, mul_exp(ps));
+      break;
+    }
+  }
+}
+
+/*
+ * Replace operators on constants by their value.
+ * Division by a constant zero is left for run time
+ * to report.
+ */
+static struct node *fold(struct node *n) {
+  if (n->left)
+    n->left = fold(n->left);
+  if (n->right)
+    n->right = fold(n->right);
+  if (n->kind == N_NEG && n->left->kind == N_CONST) {
+    int32_t value = wrap_neg(n->left->value);
+    free_tree(n);
+    return make_node(N_CONST, value, NULL, NULL);
+  }
+  if (n->right == NULL || n->left->kind != N_CONST ||
+      n->right->kind != N_CONST)
+    return n;
+
+  int32_t a = n->left->value, b = n->right->value, value;
+  switch (n->kind) {
+  case N_ADD:
+    value = wrap_add(a, b);
+    break;
+  case N_SUB:
+    value = wrap_sub(a, b);
+    break;
+  case N_MUL:
+    value = wrap_mul(a, b);
+    break;
+  case N_DIV:
+    if (b == 0)
+      return n;
+    value = safe_div(a, b);
+    break;
+  case N_MOD:
+    if (b == 0)
+      return n;
+    value = safe_mod(a, b);
+    break;
+  default:
+    return n;
+  }
+  free_tree(n);
+  return make_node(N_CONST, value, NULL, NULL);
+}
+
+/* -------- code generation -------- */
+
+static void emit(struct program *prog, int32_t word) {
+  if (prog->length == prog->capacity) {
+    prog->capacity = prog->capacity ? 2 * prog->capacity : 64;
+    prog->code =
+        (int32_t *)realloc(prog->code, prog->capacity * sizeof(int32_t));
+    if (prog->code == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  prog->code[prog->length++] = word;
+}
+
+static void compile(struct program *prog, const struct node *n) {
+  static const enum opcode binary_ops[] = {
+      [N_ADD] = OP_ADD, [N_SUB] = OP_SUB, [N_MUL] = OP_MUL,
+      [N_DIV] = OP_DIV, [N_MOD] = OP_MOD};
+
+  switch (n->kind) {
+  case N_CONST:
+  case N_VAR:
+    emit(prog, n->kind == N_CONST ? OP_PUSH : OP_LOAD);
+    emit(prog, n->value);
+    if (++prog->depth > prog->max_stack)
+      prog->max_stack = prog->depth;
+    break;
+  case N_NEG:
+    compile(prog, n->left);
+    emit(prog, OP_NEG);
+    break;
+  default:
+    compile(prog, n->left);
+    compile(prog, n->right);
+    emit(prog, binary_ops[n->kind]);
+    prog->depth--;
+    break;
+  }
+}
+
+static void disassemble(const struct program *prog, const struct parser *ps) {
+  for (size_t pc = 0; pc < prog->length; pc++) {
+    int32_t op = prog->code[pc];
+    fprintf(stderr, "%4zu  %s", pc, opcode_names[op]);
+    if (op == OP_PUSH)
+      fprintf(stderr, " %d", prog->code[++pc]);
+    else if (op == OP_LOAD)
+      fprintf(stderr, " %s", ps->names[prog->code[++pc]]);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* -------- evaluators -------- */
+
+/* returns false on division by zero */
+static bool tree_eval(const struct node *n, int32_t *const *columns,
+                      size_t row, int32_t *result) {
+  int32_t a, b;
+  switch (n->kind) {
+  case N_CONST:
+    *result = n->value;
+    return true;
+  case N_VAR:
+    *result = columns[n->value][row];
+    return true;
+  case N_NEG:
+    if (!tree_eval(n->left, columns, row, &a))
+      return false;
+    *result = wrap_neg(a);
+    return true;
+  default:
+    break;
+  }
+  if (!tree_eval(n->left, columns, row, &a) ||
+      !tree_eval(n->right, columns, row, &b))
+    return false;
+  switch (n->kind) {
+  case N_ADD:
+    *result = wrap_add(a, b);
+    break;
+  case N_SUB:
+    *result = wrap_sub(a, b);
+    break;
+  case N_MUL:
+    *result = wrap_mul(a, b);
+    break;
+  case N_DIV:
+    if (b == 0)
+      return false;
+    *result = safe_div(a, b);
+    break;
+  default:
+    if (b == 0)
+      return false;
+    *result = safe_mod(a, b);
+    break;
+  }
+  return true;
+}
+
+/*
+ * One row at a time.  'stack' needs room for max_stack + 1
+ * values; the top of the stack lives in 'tos'.
+ */
+static bool vm_run_row(const struct program *prog, int32_t *const *columns,
+                       size_t row, int32_t *stack, int32_t *result) {
+  static void *dispatch[] = {&&do_push, &&do_load, &&do_add,
+                             &&do_sub,  &&do_mul,  &&do_div,
+                             &&do_mod,  &&do_neg,  &&do_halt};
+  const int32_t *pc = prog->code;
+  int32_t *sp = stack;
+  int32_t tos = 0;
+
+#define NEXT goto *dispatch[*pc++]
+  NEXT;
+do_push:
+  *sp++ = tos;
+  tos = *pc++;
+  NEXT;
+do_load:
+  *sp++ = tos;
+  tos = columns[*pc++][row];
+  NEXT;
+do_add:
+  tos = wrap_add(*--sp, tos);
+  NEXT;
+do_sub:
+  tos = wrap_sub(*--sp, tos);
+  NEXT;
+do_mul:
+  tos = wrap_mul(*--sp, tos);
+  NEXT;
+do_div:
+  if (tos == 0)
+    return false;
+  tos = safe_div(*--sp, tos);
+  NEXT;
+do_mod:
+  if (tos == 0)
+    return false;
+  tos = safe_mod(*--sp, tos);
+  NEXT;
+do_neg:
+  tos = wrap_neg(tos);
+  NEXT;
+do_halt:
+  *result = tos;
+  return true;
+#undef NEXT
+}
+
+/*
+ * A block of 'n' rows starting at 'row0' at a time.  Each stack
+ * slot holds BLOCK_ROWS values.  Rows that divide by zero get
+ * their 'error' flag set.
+ */
+static void vm_run_block(const struct program *prog, int32_t *const *columns,
+                         size_t row0, size_t n,
+                         int32_t (*stack)[BLOCK_ROWS], int32_t *results,
+                         bool *error) {
+  static void *dispatch[] = {&&do_push, &&do_load, &&do_add,
+                             &&do_sub,  &&do_mul,  &&do_div,
+                             &&do_mod,  &&do_neg,  &&do_halt};
+  const int32_t *pc = prog->code;
+  int32_t(*sp)[BLOCK_ROWS] = stack;
+  memset(error, 0, n * sizeof(bool));
+
+#define NEXT goto *dispatch[*pc++]
+#define BINARY(op)                                                             \
+  do {                                                                         \
+    int32_t *a = sp[-2], *b = sp[-1];                                          \
+    for (size_t i = 0; i < n; i++)                                             \
+      a[i] = op(a[i], b[i]);                                                   \
+    sp--;                                                                      \
+  } while (0)
+#define DIVIDE(op)                                                             \
+  do {                                                                         \
+    int32_t *a = sp[-2], *b = sp[-1];                                          \
+    for (size_t i = 0; i < n; i++) {                                           \
+      if (b[i] == 0) {                                                         \
+        error[i] = true;                                                       \
+        a[i] = 0;                                                              \
+      } else                                                                   \
+        a[i] = op(a[i], b[i]);                                                 \
+    }                                                                          \
+    sp--;                                                                      \
+  } while (0)
+
+  NEXT;
+do_push : {
+  int32_t value = *pc++;
+  for (size_t i = 0; i < n; i++)
+    (*sp)[i] = value;
+  sp++;
+  NEXT;
+}
+do_load:
+  memcpy(*sp++, columns[*pc++] + row0, n * sizeof(int32_t));
+  NEXT;
+do_add:
+  BINARY(wrap_add);
+  NEXT;
+do_sub:
+  BINARY(wrap_sub);
+  NEXT;
+do_mul:
+  BINARY(wrap_mul);
+  NEXT;
+do_div:
+  DIVIDE(safe_div);
+  NEXT;
+do_mod:
+  DIVIDE(safe_mod);
+  NEXT;
+do_neg:
+  for (size_t i = 0; i < n; i++)
+    sp[-1][i] = wrap_neg(sp[-1][i]);
+  NEXT;
+do_halt:
+  memcpy(results, sp[-1], n * sizeof(int32_t));
+#undef DIVIDE
+#undef BINARY
+#undef NEXT
+}
+
+/* -------- variable values -------- */
+
+struct table {
+  char names[MAX_VARIABLES][MAX_NAME];
+  size_t ncolumns;
+  int32_t *columns[MAX_VARIABLES];
+  size_t rows;
+};
+
+static char *read_file(const char *name) {
+  FILE *in = fopen(name, "rb");
+  if (in == NULL) {
+    fprintf(stderr, "Cannot open %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  size_t length = 0, capacity = 1 << 20;
+  char *text = (char *)xmalloc(capacity + 1);
+  size_t got;
+  while ((got = fread(text + length, 1, capacity - length, in)) > 0) {
+    length += got;
+    if (length == capacity) {
+      capacity *= 2;
+      text = (char *)realloc(text, capacity + 1);
+      if (text == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  fclose(in);
+  text[length] = 0;
+  return text;
+}
+
+/* the values are stored a column at a time */
+static void load_table(struct table *t, const char *name) {
+  char *text = read_file(name);
+  char *p = text;
+
+  t->ncolumns = 0;
+  while (*p && *p != '\n') {
+    if (isspace((unsigned char)*p)) {
+      p++;
+      continue;
+    }
+    if (t->ncolumns == MAX_VARIABLES) {
+      fprintf(stderr, "Too many columns in %s\n", name);
+      exit(EXIT_FAILURE);
+    }
+    size_t len = 0;
+    while (*p && !isspace((unsigned char)*p)) {
+      if (len < MAX_NAME - 1)
+        t->names[t->ncolumns][len++] = *p;
+      p++;
+    }
+    t->names[t->ncolumns++][len] = 0;
+  }
+
+  size_t capacity = 1024;
+  for (size_t c = 0; c < t->ncolumns; c++)
+    t->columns[c] = (int32_t *)xmalloc(capacity * sizeof(int32_t));
+  t->rows = 0;
+  for (;;) {
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == 0)
+      break;
+    if (t->rows == capacity) {
+      capacity *= 2;
+      for (size_t c = 0; c < t->ncolumns; c++) {
+        t->columns[c] =
+            (int32_t *)realloc(t->columns[c], capacity * sizeof(int32_t));
+        if (t->columns[c] == NULL) {
+          fprintf(stderr, "Out of memory\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+    }
+    /* a row is one line, with exactly one value for each column */
+    for (size_t c = 0; c < t->ncolumns; c++) {
+      while (*p != '\n' && isspace((unsigned char)*p))
+        p++;
+      char *end;
+      errno = 0;
+      long value = strtol(p, &end, 10);
+      if (end == p || *p == '\n') {
+        fprintf(stderr, "Too few values on row %zu of %s\n", t->rows + 1,
+                name);
+        exit(EXIT_FAILURE);
+      }
+      if (errno == ERANGE || value < INT32_MIN || value > INT32_MAX ||
+          (*end != 0 && !isspace((unsigned char)*end))) {
+        fprintf(stderr, "Bad value on row %zu of %s\n", t->rows + 1, name);
+        exit(EXIT_FAILURE);
+      }
+      t->columns[c][t->rows] = (int32_t)value;
+      p = end;
+    }
+    while (*p != '\n' && isspace((unsigned char)*p))
+      p++;
+    if (*p != 0 && *p != '\n') {
+      fprintf(stderr, "Too many values on row %zu of %s\n", t->rows + 1,
+              name);
+      exit(EXIT_FAILURE);
+    }
+    t->rows++;
+  }
+  free(text);
+}
+
+static void random_table(struct table *t, const struct parser *ps,
+                         size_t rows) {
+  t->ncolumns = ps->nvariables;
+  t->rows = rows;
+  srand(1);
+  for (size_t c = 0; c < t->ncolumns; c++) {
+    strcpy(t->names[c], ps->names[c]);
+    t->columns[c] = (int32_t *)xmalloc((rows + 1) * sizeof(int32_t));
+    for (size_t r = 0; r < rows; r++)
+      t->columns[c][r] = rand() % (2 * RANDOM_RANGE + 1) - RANDOM_RANGE;
+  }
+}
+
+/* -------- driver -------- */
+
+struct evaluation {
+  int32_t *results;
+  bool *error;
+  double seconds;
+};
+
+static void run_tree(const struct node *tree, int32_t *const *columns,
+                     size_t rows, struct evaluation *ev) {
+  double start = now_seconds();
+  for (size_t r = 0; r < rows; r++)
+    ev->error[r] = !tree_eval(tree, columns, r, &ev->results[r]);
+  ev->seconds = now_seconds() - start;
+}
+
+static void run_rows(const struct program *prog, int32_t *const *columns,
+                     size_t rows, struct evaluation *ev) {
+  int32_t *stack = (int32_t *)xmalloc((prog->max_stack + 1) * sizeof(int32_t));
+  double start = now_seconds();
+  for (size_t r = 0; r < rows; r++)
+    ev->error[r] = !vm_run_row(prog, columns, r, stack, &ev->results[r]);
+  ev->seconds = now_seconds() - start;
+  free(stack);
+}
+
+static void run_blocks(const struct program *prog, int32_t *const *columns,
+                       size_t rows, struct evaluation *ev) {
+  int32_t(*stack)[BLOCK_ROWS] = (int32_t(*)[BLOCK_ROWS])xmalloc(
+      (prog->max_stack + 1) * sizeof(int32_t[BLOCK_ROWS]));
+  double start = now_seconds();
+  for (size_t r = 0; r < rows; r += BLOCK_ROWS) {
+    size_t n = rows - r < BLOCK_ROWS ? rows - r : BLOCK_ROWS;
+    vm_run_block(prog, columns, r, n, stack, ev->results + r, ev->error + r);
+  }
+  ev->seconds = now_seconds() - start;
+  free(stack);
+}
+
+static bool same_results(const struct evaluation *a,
+                         const struct evaluation *b, size_t rows) {
+  for (size_t r = 0; r < rows; r++) {
+    if (a->error[r] != b->error[r])
+      return false;
+    if (!a->error[r] && a->results[r] != b->results[r])
+      return false;
+  }
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-b] [-d] [-f file | -n rows] expression\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  bool show_code = false;
+  const char *file = NULL;
+  size_t random_rows = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bdf:n:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 'd':
+      show_code = true;
+      break;
+    case 'f':
+      file = optarg;
+      break;
+    case 'n':
+      random_rows = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc)
+    usage(argv[0]);
+
+  struct parser ps;
+  ps.p = argv[optind];
+  ps.nvariables = 0;
+  struct node *tree = expr(&ps);
+  if (peek(&ps) != 0)
+    parse_error(&ps, "unexpected character");
+  tree = fold(tree);
+
+  struct program prog = {NULL, 0, 0, 0, 0};
+  compile(&prog, tree);
+  emit(&prog, OP_HALT);
+  if (show_code)
+    disassemble(&prog, &ps);
+
+  /* find the column for each variable in the expression */
+  struct table table;
+  if (file)
+    load_table(&table, file);
+  else if (random_rows)
+    random_table(&table, &ps, random_rows);
+  else {
+    table.ncolumns = 0;
+    table.rows = 1;
+  }
+  int32_t *columns[MAX_VARIABLES];
+  for (size_t v = 0; v < ps.nvariables; v++) {
+    size_t c = 0;
+    while (c < table.ncolumns && strcmp(table.names[c], ps.names[v]) != 0)
+      c++;
+    if (c == table.ncolumns) {
+      fprintf(stderr, "error: no value for %s\n", ps.names[v]);
+      exit(EXIT_FAILURE);
+    }
+    columns[v] = table.columns[c];
+  }
+
+  size_t rows = table.rows;
+  struct evaluation block_ev;
+  block_ev.results = (int32_t *)xmalloc((rows + 1) * sizeof(int32_t));
+  block_ev.error = (bool *)xmalloc((rows + 1) * sizeof(bool));
+  run_blocks(&prog, columns, rows, &block_ev);
+
+  if (bench) {
+    struct evaluation tree_ev, row_ev;
+    tree_ev.results = (int32_t *)xmalloc((rows + 1) * sizeof(int32_t));
+    tree_ev.error = (bool *)xmalloc((rows + 1) * sizeof(bool));
+    row_ev.results = (int32_t *)xmalloc((rows + 1) * sizeof(int32_t));
+    row_ev.error = (bool *)xmalloc((rows + 1) * sizeof(bool));
+    run_tree(tree, columns, rows, &tree_ev);
+    run_rows(&prog, columns, rows, &row_ev);
+
+    printf("%zu rows, %zu bytecode words, stack depth %zu\n", rows,
+           prog.length, prog.max_stack);
+    printf("speedups are over this program's tree walk, "
+           "not example 4.8's parser\n");
+    printf("tree walk:       %.3f s, %.0f expressions/sec\n",
+           tree_ev.seconds, rows / tree_ev.seconds);
+    printf("bytecode, rows:  %.3f s, %.0f expressions/sec, %.1fx\n",
+           row_ev.seconds, rows / row_ev.seconds,
+           tree_ev.seconds / row_ev.seconds);
+    printf("bytecode, block: %.3f s, %.0f expressions/sec, %.1fx\n",
+           block_ev.seconds, rows / block_ev.seconds,
+           tree_ev.seconds / block_ev.seconds);
+    if (!same_results(&tree_ev, &row_ev, rows) ||
+        !same_results(&tree_ev, &block_ev, rows)) {
+      printf("error: evaluators disagree\n");
+      exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+  }
+
+  static char out_buffer[1 << 20];
+  setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+  for (size_t r = 0; r < rows; r++) {
+    if (block_ev.error[r])
+      printf("error\n");
+    else
+      printf("%d\n", block_ev.results[r]);
+  }
+  exit(EXIT_SUCCESS);
+}
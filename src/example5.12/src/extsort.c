@@ -0,0 +1,732 @@
+/*
+ *
+ * External merge sort for lines of text.
+ *
+ * The big brother of examples 5.10 to 5.12: there is no limit
+ * on the number or length of lines.  Lines are read in large
+ * blocks into one arena, the arena is sorted with a multikey
+ * quicksort that works on 8 byte chunks of the lines, and when
+ * the memory budget is used up the sorted run is written to a
+ * temporary file.  At the end the runs are combined with a k-way
+ * heap merge.
+ *
+ * So that the runs open at once stay within the limit on open
+ * files, they are merged as they pile up while the input is read:
+ * each run has a level, and whenever 'merge_ways' runs of one level
+ * have been written they are merged into one run of the next, as a
+ * counter in base 'merge_ways' carries, so that each line is merged
+ * again only once for every 'merge_ways' times as many runs.
+ *
+ * Lines are compared byte by byte as unsigned chars, which is
+ * what strcmp does in the "C" locale.
+ *
+ * usage: example5.12-extsort [-c] [-v] [-m megabytes] [-T tmpdir] [file ...]
+ *
+ *   -c  check the sort against qsort, with a small budget
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KILOBYTE 1024
+#define MEGABYTE (KILOBYTE * KILOBYTE)
+#define DEFAULT_BUDGET_MB 256
+#define IO_BUFFER_SIZE MEGABYTE
+#define MIN_READER_BUFFER (64 * KILOBYTE)
+#define MAX_MERGE_WAYS 64
+/* files other than runs: standard ones, an input and a merge output */
+#define RESERVED_FILES 8
+#define INSERTION_THRESHOLD 16
+#define CHUNK_SIZE 8
+
+struct line {
+  uint64_t prefix; /* first CHUNK_SIZE bytes, big-endian, zero padded */
+  const unsigned char *text;
+  size_t length;
+};
+
+struct run {
+  FILE *file;
+  unsigned level; /* merged from merge_ways runs of the level below */
+};
+
+struct sorter {
+  /* the arena, holding complete lines then a partial one */
+  unsigned char *text;
+  size_t text_capacity;
+  size_t used;
+  size_t filled;
+
+  struct line *lines;
+  size_t line_count;
+  size_t line_capacity;
+
+  struct run *runs;
+  size_t run_count;
+  size_t run_capacity;
+  size_t spilled; /* runs written from the arena */
+  size_t merge_ways;
+  size_t max_runs; /* open at once */
+
+  size_t budget;
+  const char *tmpdir;
+  uint64_t total_lines;
+  uint64_t total_bytes;
+};
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void *xrealloc(void *old, size_t size) {
+  void *p = realloc(old, size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* -------- in-memory sort -------- */
+
+/*
+ * Chunk 'depth' of a line as a big-endian number, so that
+ * comparing chunks as integers compares the bytes in order.
+ */
+static uint64_t chunk_at(const struct line *l, size_t depth) {
+  if (depth == 0)
+    return l->prefix;
+  size_t offset = depth * CHUNK_SIZE;
+  if (offset >= l->length)
+    return 0;
+  size_t n = l->length - offset;
+  if (n > CHUNK_SIZE)
+    n = CHUNK_SIZE;
+  uint64_t chunk = 0;
+  for (size_t i = 0; i < n; i++)
+    chunk |= (uint64_t)l->text[offset + i] << (56 - 8 * i);
+  return chunk;
+}
+
+static int compare_bytes(const unsigned char *a, size_t a_length,
+                         const unsigned char *b, size_t b_length) {
+  int c = memcmp(a, b, a_length < b_length ? a_length : b_length);
+  if (c != 0)
+    return c;
+  return (a_length > b_length) - (a_length < b_length);
+}
+
+/* compare two lines known to be equal before byte 'offset' */
+static int compare_from(const struct line *a, const struct line *b,
+                        size_t offset) {
+  if (offset > a->length)
+    offset = a->length;
+  if (offset > b->length)
+    offset = b->length;
+  return compare_bytes(a->text + offset, a->length - offset,
+                       b->text + offset, b->length - offset);
+}
+
+static void swap_lines(struct line *a, struct line *b) {
+  struct line tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+static void insertion_sort(struct line *a, size_t n, size_t depth) {
+  for (size_t i = 1; i < n; i++)
+    for (size_t j = i;
+         j > 0 && compare_from(&a[j], &a[j - 1], depth * CHUNK_SIZE) < 0; j--)
+      swap_lines(&a[j], &a[j - 1]);
+}
+
+static uint64_t median_of_three(uint64_t a, uint64_t b, uint64_t c) {
+  if (a < b)
+    return b < c ? b : (a < c ? c : a);
+  return a < c ? a : (b < c ? c : b);
+}
+
+/*
+ * Multikey quicksort (Bentley and Sedgewick) over CHUNK_SIZE byte
+ * symbols.  All of a[0..n) agree on chunks before 'depth'.
+ */
+static void multikey_sort(struct line *a, size_t n, size_t depth) {
+  while (n > INSERTION_THRESHOLD) {
+    uint64_t pivot =
+        median_of_three(chunk_at(&a[0], depth), chunk_at(&a[n / 2], depth),
+                        chunk_at(&a[n - 1], depth));
+    /* three way partition: < pivot, == pivot, > pivot */
+    size_t lt = 0, i = 0, gt = n;
+    while (i < gt) {
+      uint64_t c = chunk_at(&a[i], depth);
+      if (c < pivot)
+        swap_lines(&a[lt++], &a[i++]);
+      else if (c > pivot)
+        swap_lines(&a[i], &a[--gt]);
+      else
+        i++;
+    }
+
+    /*
+     * In the equal part, lines that end within this chunk are
+     * prefixes of the others, so they go first, shortest first.
+     */
+    struct line *eq = a + lt;
+    size_t eq_n = gt - lt;
+    size_t end = (depth + 1) * CHUNK_SIZE;
+    size_t done = 0;
+    for (size_t length = depth * CHUNK_SIZE; length <= end; length++)
+      for (size_t k = done; k < eq_n; k++)
+        if (eq[k].length == length)
+          swap_lines(&eq[done++], &eq[k]);
+
+    /*
+     * Recurse on the two smaller parts and go round again for the
+     * largest, so the stack holds at most log2(n) frames however
+     * the input is made.
+     */
+    struct line *part[3] = {a, a + gt, eq + done};
+    size_t size[3] = {lt, n - gt, eq_n - done};
+    size_t part_depth[3] = {depth, depth, depth + 1};
+    size_t largest = 0;
+    for (size_t i = 1; i < 3; i++)
+      if (size[i] > size[largest])
+        largest = i;
+    for (size_t i = 0; i < 3; i++)
+      if (i != largest)
+        multikey_sort(part[i], size[i], part_depth[i]);
+    a = part[largest];
+    n = size[largest];
+    depth = part_depth[largest];
+  }
+  insertion_sort(a, n, depth);
+}
+
+/* -------- reading input into the arena -------- */
+
+static void add_line(struct sorter *s, const unsigned char *text,
+                     size_t length) {
+  struct line *l = &s->lines[s->line_count++];
+  l->text = text;
+  l->length = length;
+  l->prefix = 0;
+  for (size_t i = 0; i < length && i < CHUNK_SIZE; i++)
+    l->prefix |= (uint64_t)text[i] << (56 - 8 * i);
+  s->total_lines++;
+  s->total_bytes += length + 1;
+}
+
+static void write_lines(FILE *out, const struct line *lines, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    fwrite(lines[i].text, 1, lines[i].length, out);
+    putc('\n', out);
+  }
+}
+
+static FILE *temporary_file(const char *tmpdir) {
+  size_t length = strlen(tmpdir) + sizeof("/extsortXXXXXX");
+  char *name = (char *)xmalloc(length);
+  snprintf(name, length, "%s/extsortXXXXXX", tmpdir);
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot create temporary file in %s\n", tmpdir);
+    exit(EXIT_FAILURE);
+  }
+  /* the file disappears as soon as it is closed */
+  unlink(name);
+  free(name);
+  FILE *file = fdopen(fd, "w+");
+  if (file == NULL) {
+    fprintf(stderr, "Cannot open temporary file\n");
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(file, NULL, _IOFBF, IO_BUFFER_SIZE);
+  return file;
+}
+
+static void add_run(struct sorter *s, FILE *file, unsigned level) {
+  if (s->run_count == s->run_capacity) {
+    s->run_capacity = s->run_capacity ? 2 * s->run_capacity : 16;
+    s->runs =
+        (struct run *)xrealloc(s->runs, s->run_capacity * sizeof(struct run));
+  }
+  s->runs[s->run_count].file = file;
+  s->runs[s->run_count++].level = level;
+}
+
+static void merge_runs(struct run *runs, size_t n, FILE *out, size_t budget);
+
+/* merge the runs from 'first' on into one run at 'level' in their place */
+static void merge_tail(struct sorter *s, size_t first, unsigned level,
+                       size_t budget) {
+  FILE *file = temporary_file(s->tmpdir);
+  merge_runs(s->runs + first, s->run_count - first, file, budget);
+  if (fflush(file) != 0) {
+    fprintf(stderr, "Cannot write temporary file\n");
+    exit(EXIT_FAILURE);
+  }
+  rewind(file);
+  s->run_count = first;
+  add_run(s, file, level);
+}
+
+/*
+ * Merge the runs of the last level while there are merge_ways of
+ * them; levels only go down along the runs, so they are the last
+ * merge_ways.  If the runs still come to max_runs, which only a low
+ * limit on open files makes possible, they are all merged into one.
+ * The arena is still held, so the merge gets a quarter of the budget.
+ */
+static void cascade(struct sorter *s) {
+  for (;;) {
+    size_t n = s->run_count;
+    if (n >= s->merge_ways &&
+        s->runs[n - s->merge_ways].level == s->runs[n - 1].level)
+      merge_tail(s, n - s->merge_ways, s->runs[n - 1].level + 1,
+                 s->budget / 4);
+    else if (n >= s->max_runs)
+      merge_tail(s, 0, s->runs[0].level + 1, s->budget / 4);
+    else
+      return;
+  }
+}
+
+/*
+ * Sort what is in the arena and write it out as a run, then
+ * move the partial line at the end to the front of the arena.
+ */
+static void spill(struct sorter *s) {
+  multikey_sort(s->lines, s->line_count, 0);
+  FILE *file = temporary_file(s->tmpdir);
+  write_lines(file, s->lines, s->line_count);
+  if (fflush(file) != 0) {
+    fprintf(stderr, "Cannot write temporary file\n");
+    exit(EXIT_FAILURE);
+  }
+  rewind(file);
+  add_run(s, file, 0);
+  s->spilled++;
+  cascade(s);
+
+  memmove(s->text, s->text + s->used, s->filled - s->used);
+  s->filled -= s->used;
+  s->used = 0;
+  s->line_count = 0;
+}
+
+static void read_input(struct sorter *s, FILE *in) {
+  for (;;) {
+    while (s->line_count < s->line_capacity) {
+      unsigned char *nl = (unsigned char *)memchr(s->text + s->used, '\n',
+                                                  s->filled - s->used);
+      if (nl == NULL)
+        break;
+      add_line(s, s->text + s->used, nl - (s->text + s->used));
+      s->used = nl + 1 - s->text;
+    }
+    if (s->line_count == s->line_capacity) {
+      spill(s);
+      continue;
+    }
+    if (s->filled == s->text_capacity) {
+      if (s->used == 0) {
+        /* one line longer than the whole arena */
+        s->text_capacity *= 2;
+        s->text = (unsigned char *)xrealloc(s->text, s->text_capacity);
+      } else
+        spill(s);
+      continue;
+    }
+    size_t got = fread(s->text + s->filled, 1, s->text_capacity - s->filled,
+                       in);
+    if (got == 0) {
+      if (ferror(in)) {
+        fprintf(stderr, "Read error\n");
+        exit(EXIT_FAILURE);
+      }
+      return;
+    }
+    s->filled += got;
+  }
+}
+
+/* -------- merging the runs -------- */
+
+struct run_reader {
+  FILE *file;
+  char *buffer;
+  size_t capacity;
+  size_t start;
+  size_t end;
+  bool eof;
+  const char *line;
+  size_t length;
+};
+
+/* the line stays valid until the next call for this reader */
+static bool reader_next(struct run_reader *r) {
+  for (;;) {
+    char *nl = (char *)memchr(r->buffer + r->start, '\n', r->end - r->start);
+    if (nl) {
+      r->line = r->buffer + r->start;
+      r->length = nl - r->line;
+      r->start = nl + 1 - r->buffer;
+      return true;
+    }
+    if (r->eof) {
+      if (r->start == r->end)
+        return false;
+      r->line = r->buffer + r->start;
+      r->length = r->end - r->start;
+      r->start = r->end;
+      return true;
+    }
+    memmove(r->buffer, r->buffer + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+    if (r->end == r->capacity) {
+      r->capacity *= 2;
+      r->buffer = (char *)xrealloc(r->buffer, r->capacity);
+    }
+    size_t got = fread(r->buffer + r->end, 1, r->capacity - r->end, r->file);
+    if (got == 0) {
+      if (ferror(r->file)) {
+        fprintf(stderr, "Cannot read temporary file\n");
+        exit(EXIT_FAILURE);
+      }
+      r->eof = true;
+    }
+    r->end += got;
+  }
+}
+
+static bool reader_less(const struct run_reader *a,
+                        const struct run_reader *b) {
+  return compare_bytes((const unsigned char *)a->line, a->length,
+                       (const unsigned char *)b->line, b->length) < 0;
+}
+
+static void sift_down(struct run_reader **heap, size_t n, size_t i) {
+  for (;;) {
+    size_t smallest = i;
+    size_t left = 2 * i + 1, right = 2 * i + 2;
+    if (left < n && reader_less(heap[left], heap[smallest]))
+      smallest = left;
+    if (right < n && reader_less(heap[right], heap[smallest]))
+      smallest = right;
+    if (smallest == i)
+      return;
+    struct run_reader *tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+/* merge 'n' runs into 'out', closing the runs */
+static void merge_runs(struct run *runs, size_t n, FILE *out, size_t budget) {
+  size_t buffer_size = budget / (n + 1);
+  if (buffer_size < MIN_READER_BUFFER)
+    buffer_size = MIN_READER_BUFFER;
+
+  struct run_reader *readers =
+      (struct run_reader *)xmalloc(n * sizeof(struct run_reader));
+  struct run_reader **heap =
+      (struct run_reader **)xmalloc(n * sizeof(struct run_reader *));
+  size_t heap_size = 0;
+  for (size_t i = 0; i < n; i++) {
+    struct run_reader *r = &readers[i];
+    r->file = runs[i].file;
+    r->capacity = buffer_size;
+    r->buffer = (char *)xmalloc(buffer_size);
+    r->start = r->end = 0;
+    r->eof = false;
+    if (reader_next(r))
+      heap[heap_size++] = r;
+  }
+  for (size_t i = heap_size; i-- > 0;)
+    sift_down(heap, heap_size, i);
+
+  while (heap_size > 0) {
+    struct run_reader *r = heap[0];
+    fwrite(r->line, 1, r->length, out);
+    putc('\n', out);
+    if (!reader_next(r))
+      heap[0] = heap[--heap_size];
+    sift_down(heap, heap_size, 0);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    free(readers[i].buffer);
+    fclose(readers[i].file);
+  }
+  free(heap);
+  free(readers);
+}
+
+/* the last line of an input may have no newline: end it there */
+static void end_input(struct sorter *s) {
+  if (s->used < s->filled) {
+    if (s->line_count == s->line_capacity)
+      spill(s);
+    add_line(s, s->text + s->used, s->filled - s->used);
+    s->used = s->filled;
+  }
+}
+
+static void finish(struct sorter *s, FILE *out) {
+  end_input(s);
+  if (s->run_count == 0) {
+    multikey_sort(s->lines, s->line_count, 0);
+    write_lines(out, s->lines, s->line_count);
+    return;
+  }
+  if (s->line_count > 0)
+    spill(s);
+
+  /* the arena is no longer needed, give its memory to the merge */
+  free(s->text);
+  free(s->lines);
+  s->text = NULL;
+  s->lines = NULL;
+
+  /* too many runs to merge at once: merge the smallest first */
+  while (s->run_count > s->merge_ways)
+    merge_tail(s, s->run_count - s->merge_ways, 0, s->budget);
+  merge_runs(s->runs, s->run_count, out, s->budget);
+}
+
+static void sorter_init(struct sorter *s, size_t budget, const char *tmpdir) {
+  memset(s, 0, sizeof(*s));
+  s->budget = budget;
+  s->tmpdir = tmpdir;
+  /* as many runs open as the limit on open files leaves room for */
+  struct rlimit files;
+  s->max_runs = MAX_MERGE_WAYS * MAX_MERGE_WAYS;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY)
+    s->max_runs = files.rlim_cur > RESERVED_FILES + 2
+                      ? (size_t)files.rlim_cur - RESERVED_FILES
+                      : 2;
+  s->merge_ways = s->max_runs < MAX_MERGE_WAYS ? s->max_runs : MAX_MERGE_WAYS;
+  /* three quarters of the budget for text, the rest for line records */
+  s->text_capacity = s->budget / 4 * 3;
+  s->text = (unsigned char *)xmalloc(s->text_capacity);
+  s->line_capacity = s->budget / 4 / sizeof(struct line);
+  s->lines = (struct line *)xmalloc(s->line_capacity * sizeof(struct line));
+}
+
+static void sorter_free(struct sorter *s) {
+  free(s->text);
+  free(s->lines);
+  free(s->runs);
+}
+
+/* -------- checking -------- */
+
+struct check_line {
+  const char *text;
+  size_t length;
+};
+
+static int compare_check_lines(const void *a, const void *b) {
+  const struct check_line *x = (const struct check_line *)a;
+  const struct check_line *y = (const struct check_line *)b;
+  return compare_bytes((const unsigned char *)x->text, x->length,
+                       (const unsigned char *)y->text, y->length);
+}
+
+/*
+ * Sort the 'count' inputs, as separate files, with the sorter and
+ * with qsort, and compare.  A budget of 64 KB and merge_ways of 4
+ * make even a small input spill runs, merge them as it is read and
+ * hit max_runs.
+ */
+static void check_case(const char *what, const char *const *inputs,
+                       const size_t *lengths, size_t count, size_t budget,
+                       const char *tmpdir) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+    total += lengths[i] + 1;
+  struct check_line *lines =
+      (struct check_line *)xmalloc(total * sizeof(struct check_line));
+  size_t line_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    const char *p = inputs[i], *end = inputs[i] + lengths[i];
+    while (p < end) {
+      const char *nl = (const char *)memchr(p, '\n', end - p);
+      const char *line_end = nl ? nl : end;
+      lines[line_count].text = p;
+      lines[line_count++].length = line_end - p;
+      p = nl ? nl + 1 : end;
+    }
+  }
+  qsort(lines, line_count, sizeof(struct check_line), compare_check_lines);
+  char *expected = (char *)xmalloc(total + 1);
+  size_t expected_length = 0;
+  for (size_t i = 0; i < line_count; i++) {
+    memcpy(expected + expected_length, lines[i].text, lines[i].length);
+    expected_length += lines[i].length;
+    expected[expected_length++] = '\n';
+  }
+
+  struct sorter s;
+  sorter_init(&s, budget, tmpdir);
+  s.merge_ways = 4;
+  s.max_runs = 6;
+  char *got;
+  size_t got_length;
+  FILE *out = open_memstream(&got, &got_length);
+  if (out == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < count; i++) {
+    FILE *in = lengths[i] ? fmemopen((void *)inputs[i], lengths[i], "rb")
+                          : fopen("/dev/null", "rb");
+    if (in == NULL) {
+      fprintf(stderr, "Cannot open input\n");
+      exit(EXIT_FAILURE);
+    }
+    read_input(&s, in);
+    end_input(&s);
+    fclose(in);
+  }
+  finish(&s, out);
+  fclose(out);
+  sorter_free(&s);
+
+  if (got_length != expected_length ||
+      memcmp(got, expected, got_length) != 0) {
+    fprintf(stderr, "%s: results differ\n", what);
+    exit(EXIT_FAILURE);
+  }
+  free(got);
+  free(expected);
+  free(lines);
+}
+
+static void check(const char *tmpdir) {
+  /* a last line without a newline ends with its file */
+  const char *joined[] = {"b\nz", "a\n"};
+  check_case("unterminated file", joined, (size_t[]){3, 2}, 2, MEGABYTE,
+             tmpdir);
+  const char *empty[] = {"", "x", "\n", "y"};
+  check_case("empty files and lines", empty, (size_t[]){0, 1, 1, 1}, 4,
+             MEGABYTE, tmpdir);
+
+  /* lines sharing long prefixes, copies of one line, and a huge one */
+  size_t length = 4 * MEGABYTE;
+  char *text = (char *)xmalloc(length);
+  size_t used = 0;
+  uint64_t x = 88172645463325252ULL;
+  while (used + 256 * KILOBYTE < length) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    size_t n = x % 48;
+    if (x % 7 == 0)
+      n = 0;
+    for (size_t i = 0; i < n; i++)
+      text[used++] = i < 20 && x % 3 ? 'p' : (char)('a' + (x >> (i % 60)) % 3);
+    text[used++] = '\n';
+  }
+  for (int i = 0; i < 2000; i++)
+    used += (size_t)sprintf(text + used, "the same line\n");
+  memset(text + used, 'q', 200 * KILOBYTE);
+  used += 200 * KILOBYTE;
+  const char *parts[] = {text, text + used / 3, text + used / 3 * 2};
+  size_t lengths[] = {used / 3, used / 3 * 2 - used / 3, used - used / 3 * 2};
+  check_case("runs", parts, lengths, 3, 64 * KILOBYTE, tmpdir);
+  free(text);
+  printf("checked\n");
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-c] [-v] [-m megabytes] [-T tmpdir] [file ...]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool verbose = false, checking = false;
+  size_t budget_mb = DEFAULT_BUDGET_MB;
+  const char *tmpdir = getenv("TMPDIR");
+  if (tmpdir == NULL)
+    tmpdir = "/tmp";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "cvm:T:")) != -1) {
+    switch (opt) {
+    case 'c':
+      checking = true;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    case 'm':
+      budget_mb = strtoull(optarg, NULL, 10);
+      break;
+    case 'T':
+      tmpdir = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (budget_mb < 1)
+    usage(argv[0]);
+
+  if (checking) {
+    check(tmpdir);
+    exit(EXIT_SUCCESS);
+  }
+
+  struct sorter s;
+  sorter_init(&s, budget_mb * MEGABYTE, tmpdir);
+
+  setvbuf(stdout, NULL, _IOFBF, IO_BUFFER_SIZE);
+  double start = now_seconds();
+
+  if (optind == argc)
+    read_input(&s, stdin);
+  for (int i = optind; i < argc; i++) {
+    FILE *in = fopen(argv[i], "rb");
+    if (in == NULL) {
+      fprintf(stderr, "Cannot open %s\n", argv[i]);
+      exit(EXIT_FAILURE);
+    }
+    read_input(&s, in);
+    end_input(&s);
+    fclose(in);
+  }
+  finish(&s, stdout);
+  fflush(stdout);
+
+  if (verbose) {
+    double elapsed = now_seconds() - start;
+    fprintf(stderr,
+            "%" PRIu64 " lines, %.1f MB, %zu runs, %.3f s, %.1f MB/s\n",
+            s.total_lines, s.total_bytes / (double)MEGABYTE,
+            s.spilled, elapsed,
+            s.total_bytes / (double)MEGABYTE / elapsed);
+  }
+  sorter_free(&s);
+  exit(EXIT_SUCCESS);
+}
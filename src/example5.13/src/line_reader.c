@@ -0,0 +1,222 @@
+/*
+ *
+ * Reading lines without copying them.
+ *
+ * Example 5.13 reads a character at a time, growing its line by
+ * GROW_BY bytes, copying all of it each time, and freeing and
+ * allocating again for every line.  Here a regular file is mapped
+ * into memory whole, and each line handed out is just a pointer
+ * into the mapping and a length.  Anything else, a pipe or a
+ * terminal, is read into a buffer twice the size of WINDOW, and
+ * lines are handed out from the buffer.  Only a line left unfinished
+ * at the end of the data read so far is moved, to the front of the
+ * buffer, before reading more after it; and only when that line
+ * leaves less than WINDOW free is the buffer grown, by doubling.
+ *
+ * Newlines are found 64 bytes at a time: with SSE2, four 16-byte
+ * comparisons give a 64-bit mask of where the newlines are, and
+ * the lines within the block are then handed out one bit at a
+ * time, without looking at the bytes again.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define WINDOW (1024 * 1024)
+#define BLOCK 64
+
+/* line_reader_open flags */
+#define LINE_READER_NO_MAP 1U
+
+/* valid until the next call of line_reader_next */
+struct line {
+  const char *text; /* not terminated by a zero */
+  size_t length;    /* without the newline */
+  bool terminated;  /* false for a last line with no newline */
+};
+
+struct line_reader {
+  int fd;
+  bool mapped;
+  bool eof;
+  int error; /* errno of a failed read */
+  char *map;
+  size_t map_size;
+  char *buffer;
+  size_t capacity;
+  const char *next;    /* the start of the next line */
+  const char *end;     /* of the data mapped or read so far */
+  const char *scanned; /* where the next block to look at starts */
+  const char *block;   /* the block 'newlines' describes */
+  uint64_t newlines;   /* bit i set: block[i] is a newline not passed */
+};
+
+/* bit i set if p[i] is a newline, for the 64 bytes at p */
+static uint64_t newline_mask(const char *p) {
+#if defined(__SSE2__)
+  const __m128i nl = _mm_set1_epi8('\n');
+  uint64_t mask = 0;
+  for (int k = 0; k < 4; k++) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+    uint64_t bits = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nl));
+    mask |= bits << (16 * k);
+  }
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < BLOCK; i++)
+    mask |= (uint64_t)(p[i] == '\n') << i;
+  return mask;
+#endif
+}
+
+/* the same for fewer than 64 bytes at the end of the data */
+static uint64_t newline_mask_short(const char *p, size_t n) {
+  uint64_t mask = 0;
+  for (size_t i = 0; i < n; i++)
+    mask |= (uint64_t)(p[i] == '\n') << i;
+  return mask;
+}
+
+/* the next newline not yet passed, or NULL if none is in the data */
+static const char *find_newline(struct line_reader *r) {
+  while (r->newlines == 0) {
+    size_t left = (size_t)(r->end - r->scanned);
+    if (left == 0)
+      return NULL;
+    r->block = r->scanned;
+    if (left >= BLOCK) {
+      r->newlines = newline_mask(r->block);
+      r->scanned += BLOCK;
+    } else {
+      r->newlines = newline_mask_short(r->block, left);
+      r->scanned = r->end;
+    }
+  }
+  const char *nl = r->block + __builtin_ctzll(r->newlines);
+  r->newlines &= r->newlines - 1;
+  return nl;
+}
+
+/*
+ * A reader of fd, which is mapped if it is a regular file, unless
+ * flags has LINE_READER_NO_MAP.  NULL if out of memory.
+ */
+struct line_reader *line_reader_open(int fd, unsigned flags) {
+  struct line_reader *r = (struct line_reader *)calloc(1, sizeof(*r));
+  if (r == NULL)
+    return NULL;
+  r->fd = fd;
+  struct stat st;
+  if (!(flags & LINE_READER_NO_MAP) && fstat(fd, &st) == 0 &&
+      S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (uint64_t)st.st_size <= SIZE_MAX) {
+    void *map =
+        mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      r->mapped = true;
+      r->eof = true;
+      r->map = (char *)map;
+      r->map_size = (size_t)st.st_size;
+      r->next = r->scanned = r->map;
+      r->end = r->map + r->map_size;
+      return r;
+    }
+  }
+  /* not a file that can be mapped: read it a window at a time */
+  r->capacity = 2 * WINDOW;
+  r->buffer = (char *)malloc(r->capacity);
+  if (r->buffer == NULL) {
+    free(r);
+    return NULL;
+  }
+  r->next = r->end = r->scanned = r->buffer;
+  return r;
+}
+
+/* unmap or free what the reader holds; fd is left open */
+void line_reader_close(struct line_reader *r) {
+  if (r->mapped)
+    munmap(r->map, r->map_size);
+  free(r->buffer);
+  free(r);
+}
+
+/*
+ * Keep the unfinished line, moved to the front of the buffer, and
+ * read more after it.  False at the end of the input or on error.
+ */
+static bool refill(struct line_reader *r) {
+  size_t pending = (size_t)(r->end - r->next);
+  if (r->capacity - pending < WINDOW) {
+    size_t capacity = r->capacity * 2;
+    char *buffer = (char *)malloc(capacity);
+    if (buffer == NULL) {
+      r->eof = true;
+      r->error = ENOMEM;
+      return false;
+    }
+    memcpy(buffer, r->next, pending);
+    free(r->buffer);
+    r->buffer = buffer;
+    r->capacity = capacity;
+  } else if (r->next != r->buffer) {
+    memmove(r->buffer, r->next, pending);
+  }
+  r->next = r->buffer;
+  r->end = r->scanned = r->buffer + pending;
+
+  ssize_t n;
+  do
+    n = read(r->fd, r->buffer + pending, r->capacity - pending);
+  while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    r->eof = true;
+    if (n < 0)
+      r->error = errno;
+    return false;
+  }
+  r->end += n;
+  return true;
+}
+
+/*
+ * The next line, in *line.  False at the end of the input, or on
+ * error, when line_reader_error says which.
+ */
+bool line_reader_next(struct line_reader *r, struct line *line) {
+  for (;;) {
+    const char *nl = find_newline(r);
+    if (nl != NULL) {
+      line->text = r->next;
+      line->length = (size_t)(nl - r->next);
+      line->terminated = true;
+      r->next = nl + 1;
+      return true;
+    }
+    if (r->eof || !refill(r)) {
+      if (r->next == r->end)
+        return false;
+      line->text = r->next;
+      line->length = (size_t)(r->end - r->next);
+      line->terminated = false;
+      r->next = r->end;
+      return true;
+    }
+  }
+}
+
+/* the errno of a failed read, or 0 */
+int line_reader_error(const struct line_reader *r) { return r->error; }
+
+bool line_reader_mapped(const struct line_reader *r) { return r->mapped; }
@@ -0,0 +1,366 @@
+/*
+ *
+ * Example 5.13 on the line reader of line_reader.c.
+ *
+ * Copies the standard input to the standard output a line at a
+ * time, like example 5.13, complaining of an incomplete last line,
+ * but with no copying of the lines on the way and no limit on
+ * their length.
+ *
+ * With -b, lines are counted instead, in a log of 'size'
+ * megabytes, 1024 by default, written to a temporary file, or in
+ * 'file' if one is named: by example 5.13's loop, by getline, and
+ * by the line reader, mapping the file and reading it a window at
+ * a time as it would a pipe.  The reader is first checked against
+ * lines it was given, some of them longer than the window.
+ *
+ * usage: example5.13-lines [-b] [-m size_mb] [file]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SIZE_MB 1024
+#define MEGABYTE (1024 * 1024)
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define GROW_BY 10
+#define LONG_LINE_ONE_IN 10000
+#define LONG_LINE (16 * 1024)
+#define CHECK_LINES 20000
+#define HUGE_LINE (5 * MEGABYTE)
+
+#define LINE_READER_NO_MAP 1U
+
+struct line {
+  const char *text;
+  size_t length;
+  bool terminated;
+};
+
+struct line_reader;
+struct line_reader *line_reader_open(int fd, unsigned flags);
+void line_reader_close(struct line_reader *r);
+bool line_reader_next(struct line_reader *r, struct line *line);
+int line_reader_error(const struct line_reader *r);
+bool line_reader_mapped(const struct line_reader *r);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* xorshift64 */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static struct line_reader *open_reader(int fd, unsigned flags) {
+  struct line_reader *r = line_reader_open(fd, flags);
+  if (r == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return r;
+}
+
+/* -------- example 5.13 -------- */
+
+static void copy_lines(void) {
+  static char output[OUTPUT_BUFFER_SIZE];
+  setvbuf(stdout, output, _IOFBF, sizeof(output));
+  struct line_reader *r = open_reader(STDIN_FILENO, 0);
+  struct line line;
+  while (line_reader_next(r, &line)) {
+    if (!line.terminated)
+      fprintf(stderr, "Incomplete last line\n");
+    fwrite(line.text, 1, line.length, stdout);
+    putchar('\n');
+  }
+  if (line_reader_error(r) != 0) {
+    errno = line_reader_error(r);
+    fail("read");
+  }
+  line_reader_close(r);
+}
+
+/* -------- counting lines -------- */
+
+struct tally {
+  uint64_t lines, bytes, check;
+};
+
+static inline void count(struct tally *t, const char *text, size_t length) {
+  t->lines++;
+  t->bytes += length;
+  t->check = t->check * 31 + (length ? (unsigned char)text[length - 1] : 0);
+}
+
+/* example 5.13's loop, counting rather than printing */
+static struct tally count_grow_by(const char *path) {
+  struct tally t = {0, 0, 0};
+  FILE *in = fopen(path, "r");
+  if (in == NULL)
+    fail(path);
+  char *str_p = (char *)xmalloc(GROW_BY);
+  char *next_p = str_p;
+  int chars_read = 0;
+  int ch;
+  while ((ch = getc(in)) != EOF) {
+    if (ch == '\n') {
+      *next_p = 0;
+      count(&t, str_p, (size_t)(next_p - str_p));
+      free(str_p);
+      chars_read = 0;
+      str_p = (char *)xmalloc(GROW_BY);
+      next_p = str_p;
+      continue;
+    }
+    if (chars_read == GROW_BY - 1) {
+      *next_p = 0;
+      size_t need = next_p - str_p + 1;
+      char *tmp_p = (char *)xmalloc(need + GROW_BY);
+      strcpy(tmp_p, str_p);
+      free(str_p);
+      str_p = tmp_p;
+      next_p = str_p + need - 1;
+      chars_read = 0;
+    }
+    *next_p++ = (char)ch;
+    chars_read++;
+  }
+  if (next_p != str_p)
+    count(&t, str_p, (size_t)(next_p - str_p));
+  free(str_p);
+  fclose(in);
+  return t;
+}
+
+static struct tally count_getline(const char *path) {
+  struct tally t = {0, 0, 0};
+  FILE *in = fopen(path, "r");
+  if (in == NULL)
+    fail(path);
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t n;
+  while ((n = getline(&line, &size, in)) > 0) {
+    size_t length = (size_t)n;
+    if (line[length - 1] == '\n')
+      length--;
+    count(&t, line, length);
+  }
+  free(line);
+  fclose(in);
+  return t;
+}
+
+static struct tally count_reader(const char *path, unsigned flags) {
+  struct tally t = {0, 0, 0};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    fail(path);
+  struct line_reader *r = open_reader(fd, flags);
+  struct line line;
+  while (line_reader_next(r, &line))
+    count(&t, line.text, line.length);
+  if (line_reader_error(r) != 0) {
+    errno = line_reader_error(r);
+    fail(path);
+  }
+  line_reader_close(r);
+  close(fd);
+  return t;
+}
+
+/* -------- a log to read -------- */
+
+static const char *const levels[] = {"DEBUG", "INFO", "INFO", "INFO", "WARN",
+                                     "ERROR"};
+
+/* 'size_mb' megabytes of log lines, mostly short, now and then long */
+static void write_log(int fd, size_t size_mb) {
+  static char block[MEGABYTE + LONG_LINE + 256];
+  size_t total = size_mb * MEGABYTE;
+  uint64_t line = 0;
+  while (total > 0) {
+    size_t used = 0;
+    while (used < MEGABYTE) {
+      uint64_t r = next_random();
+      line++;
+      used += (size_t)sprintf(
+          block + used, "2024-05-%02u %02u:%02u:%02u.%03u %-5s worker-%u ",
+          (unsigned)(1 + line / 8640000 % 28), (unsigned)(line / 360000 % 24),
+          (unsigned)(line / 6000 % 60), (unsigned)(line / 100 % 60),
+          (unsigned)(r % 1000), levels[r % 6], (unsigned)(r >> 8 & 31));
+      size_t words = r >> 16 & 15;
+      if (line % LONG_LINE_ONE_IN == 0)
+        words = LONG_LINE / 8;
+      for (size_t w = 0; w < words; w++)
+        used += (size_t)sprintf(block + used, "k%u=%03u ",
+                                (unsigned)(next_random() % 10),
+                                (unsigned)(next_random() % 1000));
+      block[used++] = '\n';
+    }
+    size_t n = used < total ? used : total;
+    if (write(fd, block, n) != (ssize_t)n)
+      fail("write");
+    total -= n;
+  }
+}
+
+/* -------- checking -------- */
+
+/* lines of every length up to a few, and some longer than the window */
+static void check(void) {
+  char path[] = "/tmp/example5.13-check-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    fail("mkstemp");
+  unlink(path);
+  size_t *lengths = (size_t *)xmalloc(CHECK_LINES * sizeof(size_t));
+  char *text = (char *)xmalloc(HUGE_LINE + 256);
+  size_t size = 0;
+  for (size_t i = 0; i < CHECK_LINES; i++) {
+    uint64_t r = next_random();
+    lengths[i] = i % 5000 == 4999 ? HUGE_LINE - (r & 1023) : r % 200;
+    for (size_t k = 0; k < lengths[i]; k++)
+      text[k] = (char)('a' + (i + k) % 26);
+    text[lengths[i]] = '\n';
+    /* the last line has no newline */
+    size_t n = lengths[i] + (i + 1 < CHECK_LINES);
+    if (write(fd, text, n) != (ssize_t)n)
+      fail("write");
+    size += n;
+  }
+  free(text);
+
+  unsigned modes[] = {0, LINE_READER_NO_MAP};
+  for (int m = 0; m < 2; m++) {
+    if (lseek(fd, 0, SEEK_SET) != 0)
+      fail("lseek");
+    struct line_reader *r = open_reader(fd, modes[m]);
+    struct line line;
+    size_t i = 0;
+    bool ok = true;
+    while (ok && line_reader_next(r, &line)) {
+      ok = i < CHECK_LINES && line.length == lengths[i] &&
+           line.terminated == (i + 1 < CHECK_LINES);
+      for (size_t k = 0; ok && k < line.length; k++)
+        ok = line.text[k] == (char)('a' + (i + k) % 26);
+      i++;
+    }
+    if (!ok || i != CHECK_LINES || line_reader_error(r) != 0 ||
+        line_reader_mapped(r) != (modes[m] == 0)) {
+      fprintf(stderr, "%s: results differ at line %zu\n",
+              modes[m] ? "read window" : "mapped", i);
+      exit(EXIT_FAILURE);
+    }
+    line_reader_close(r);
+  }
+  close(fd);
+  free(lengths);
+  printf("checked on %zu lines, %.1f MB\n", (size_t)CHECK_LINES,
+         (double)size / MEGABYTE);
+}
+
+/* -------- timing -------- */
+
+static void report(const char *name, struct tally t, double seconds,
+                   const struct tally *expected) {
+  printf("%-20s %8.3f s %8.2f M lines/s %8.1f MB/s%s\n", name, seconds,
+         t.lines / seconds / 1e6, t.bytes / seconds / MEGABYTE,
+         t.lines == expected->lines && t.bytes == expected->bytes &&
+                 t.check == expected->check
+             ? ""
+             : "   results differ");
+}
+
+static void bench(size_t size_mb, const char *file) {
+  char path[] = "/tmp/example5.13-log-XXXXXX";
+  if (file == NULL) {
+    int fd = mkstemp(path);
+    if (fd < 0)
+      fail("mkstemp");
+    write_log(fd, size_mb);
+    close(fd);
+    file = path;
+  }
+  double start = now_seconds();
+  struct tally expected = count_reader(file, 0);
+  double t_mapped = now_seconds() - start;
+  printf("%s: %llu lines, %.1f MB\n", file,
+         (unsigned long long)expected.lines,
+         (double)expected.bytes / MEGABYTE);
+  report("line reader, mapped", expected, t_mapped, &expected);
+
+  start = now_seconds();
+  struct tally t = count_reader(file, LINE_READER_NO_MAP);
+  report("line reader, window", t, now_seconds() - start, &expected);
+
+  start = now_seconds();
+  t = count_getline(file);
+  report("getline", t, now_seconds() - start, &expected);
+
+  start = now_seconds();
+  t = count_grow_by(file);
+  report("example 5.13", t, now_seconds() - start, &expected);
+
+  if (file == path)
+    unlink(path);
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  size_t size_mb = DEFAULT_SIZE_MB;
+  int opt;
+  while ((opt = getopt(argc, argv, "bm:")) != -1) {
+    switch (opt) {
+    case 'b':
+      benchmark = true;
+      break;
+    case 'm':
+      size_mb = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-m size_mb] [file]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!benchmark) {
+    copy_lines();
+    exit(EXIT_SUCCESS);
+  }
+  if (size_mb == 0) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  check();
+  bench(size_mb, optind < argc ? argv[optind] : NULL);
+  exit(EXIT_SUCCESS);
+}
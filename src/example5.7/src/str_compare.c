@@ -0,0 +1,429 @@
+/*
+ *
+ * Comparing strings more than a byte at a time.
+ *
+ * Example 5.7's str_eq compares a character at a time.  Here each
+ * comparison finds the first place where the first string ends or
+ * the two differ, a block at a time: 8 bytes in a 64-bit word,
+ * using the usual trick to spot a zero byte without looking at the
+ * bytes one by one, or 16 or 32 bytes with SSE2 or AVX2, where one
+ * comparison of the two blocks and one against zero give a mask
+ * of the bytes that matter.  Equality, three-way comparison, a
+ * comparison of at most n bytes, and whether one string starts
+ * with another all follow from where that first place is.
+ *
+ * A string may end anywhere, and the bytes after its end may not
+ * be there to read.  A block is read only when none of it lies on
+ * a later page than the byte it starts with, which must be there;
+ * the few bytes before the nearer page boundary are compared one
+ * at a time.  Pages are at least 4096 bytes, aligned to their
+ * size, so this holds for every page size.
+ *
+ * The variants are collected in a table per set of processor
+ * features, and str_compare_best picks the last one the processor
+ * supports, as bitops.c does.  The str_ functions use it, and
+ * str_cmp_many compares many pairs, prefetching the strings of
+ * pairs a few ahead.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HAVE_X86_VARIANTS 1
+#else
+#define HAVE_X86_VARIANTS 0
+#endif
+
+#define MIN_PAGE_SIZE 4096
+#define PREFETCH_AHEAD 8
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* processor features a variant needs */
+#define STR_SSE2 1U
+#define STR_AVX2 2U
+
+struct str_compare {
+  const char *name;
+  unsigned needs;
+  /* 0 if s1 and s2 are equal, 1 if not, like example 5.7's str_eq */
+  int32_t (*eq)(const char *s1, const char *s2);
+  /* less than, equal to or greater than 0, like strcmp */
+  int (*cmp)(const char *s1, const char *s2);
+  /* the same, for at most n bytes, like strncmp */
+  int (*ncmp)(const char *s1, const char *s2, size_t n);
+  /* whether s starts with prefix */
+  bool (*prefix)(const char *s, const char *prefix);
+};
+
+/* whether the 'bytes' bytes from p are all on p's page */
+static inline bool on_one_page(const char *p, size_t bytes) {
+  return ((uintptr_t)p & (MIN_PAGE_SIZE - 1)) <= MIN_PAGE_SIZE - bytes;
+}
+
+/* bytes from p to the end of its page, 1 to MIN_PAGE_SIZE */
+static inline size_t to_page_end(const char *p) {
+  return MIN_PAGE_SIZE - ((uintptr_t)p & (MIN_PAGE_SIZE - 1));
+}
+
+/* how many of the next n bytes of a and b are before a page boundary */
+static inline size_t safe_bytes(const char *a, const char *b, size_t n) {
+  size_t room = to_page_end(a), room_b = to_page_end(b);
+  if (room_b < room)
+    room = room_b;
+  return n < room ? n : room;
+}
+
+/*
+ * The index of the first byte where a ends or differs from b,
+ * looking at no more than n bytes: n if there is none.  'stop_bits'
+ * gives a mask with a bit set for each byte of a 'block' that ends
+ * a or differs, byte i's among bits i << 'shift' to
+ * ((i + 1) << 'shift') - 1, and 'stop4' whether any of four blocks
+ * does.
+ *
+ * Most strings compared end or differ in the first block, so that
+ * is tried with as little as possible before it: every instruction
+ * spent while the strings are being fetched from memory is one
+ * less for the comparisons after it to overlap their fetches with.
+ * Past it, blocks are compared up to the nearer page boundary: the
+ * first four one at a time, the rest four at a time with one test
+ * and branch for the four, then one at a
+ * time to find the place in the four that stopped them or to come
+ * as near the boundary as whole blocks go.  The rest is compared
+ * as the block that ends at the boundary: the bytes of it already
+ * compared are equal and not zero, so set no bits, and it is all
+ * on pages already read from.  Only strings shorter than a block
+ * are left for a byte at a time.  All that is a function of its
+ * own, so that the first block stays small enough to inline.
+ */
+#define STOP_FUNCTION(variant, attributes, block, stop_bits, stop4, shift)   \
+  attributes static size_t stop_rest_##variant(const char *a, const char *b,  \
+                                               size_t i, size_t n) {         \
+    while (i < n) {                                                          \
+      size_t end = i + safe_bytes(a + i, b + i, n - i);                      \
+      size_t single = i < 4 * (block) ? 4 * (block) : i;                     \
+      for (; i + (block) <= end && i < single; i += (block)) {               \
+        uint64_t stop = stop_bits(a + i, b + i);                             \
+        if (stop != 0)                                                       \
+          return i + ((size_t)__builtin_ctzll(stop) >> (shift));             \
+      }                                                                      \
+      for (; i + 4 * (block) <= end; i += 4 * (block))                       \
+        if (stop4(a + i, b + i))                                             \
+          break;                                                             \
+      for (; i + (block) <= end; i += (block)) {                             \
+        uint64_t stop = stop_bits(a + i, b + i);                             \
+        if (stop != 0)                                                       \
+          return i + ((size_t)__builtin_ctzll(stop) >> (shift));             \
+      }                                                                      \
+      if (i < end && end >= (block)) {                                       \
+        uint64_t stop = stop_bits(a + end - (block), b + end - (block));     \
+        if (stop != 0)                                                       \
+          return end - (block) + ((size_t)__builtin_ctzll(stop) >> (shift)); \
+        i = end;                                                             \
+      }                                                                      \
+      for (; i < end; i++)                                                   \
+        if (a[i] == 0 || a[i] != b[i])                                       \
+          return i;                                                          \
+    }                                                                        \
+    return n;                                                                \
+  }                                                                          \
+                                                                             \
+  attributes static inline size_t stop_##variant(const char *a,              \
+                                                 const char *b, size_t n) {  \
+    if (n >= (block) && on_one_page(a, (block)) && on_one_page(b, (block))) { \
+      uint64_t stop = stop_bits(a, b);                                       \
+      if (stop != 0)                                                         \
+        return (size_t)__builtin_ctzll(stop) >> (shift);                     \
+      return stop_rest_##variant(a, b, (block), n);                          \
+    }                                                                        \
+    return stop_rest_##variant(a, b, 0, n);                                  \
+  }
+
+/* the comparisons, from the index of the first difference */
+#define COMPARISONS(variant, attributes)                                     \
+  attributes static int32_t eq_##variant(const char *s1, const char *s2) {   \
+    size_t i = stop_##variant(s1, s2, SIZE_MAX);                             \
+    return s1[i] != s2[i];                                                   \
+  }                                                                          \
+                                                                             \
+  attributes static int cmp_##variant(const char *s1, const char *s2) {      \
+    size_t i = stop_##variant(s1, s2, SIZE_MAX);                             \
+    return (unsigned char)s1[i] - (unsigned char)s2[i];                      \
+  }                                                                          \
+                                                                             \
+  attributes static int ncmp_##variant(const char *s1, const char *s2,       \
+                                       size_t n) {                           \
+    size_t i = stop_##variant(s1, s2, n);                                    \
+    return i == n ? 0 : (unsigned char)s1[i] - (unsigned char)s2[i];         \
+  }                                                                          \
+                                                                             \
+  attributes static bool prefix_##variant(const char *s,                     \
+                                          const char *prefix) {              \
+    return prefix[stop_##variant(prefix, s, SIZE_MAX)] == 0;                 \
+  }
+
+/* -------- a byte at a time -------- */
+
+/* example 5.7's loop, for the others to be checked against */
+static size_t stop_bytes(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  while (i < n && a[i] != 0 && a[i] == b[i])
+    i++;
+  return i;
+}
+
+COMPARISONS(bytes, )
+
+static const struct str_compare bytes_ops = {
+    .name = "bytes",
+    .needs = 0,
+    .eq = eq_bytes,
+    .cmp = cmp_bytes,
+    .ncmp = ncmp_bytes,
+    .prefix = prefix_bytes,
+};
+
+/* -------- a word at a time -------- */
+
+/* the 8 bytes at p, the first in the low-order byte */
+static inline uint64_t load_word(const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+/*
+ * The high bit of each byte of x that is zero.  Borrows can also
+ * set it in bytes above a zero byte, but never below the first.
+ */
+static inline uint64_t zero_bytes(uint64_t x) {
+  return (x - ONES) & ~x & HIGHS;
+}
+
+/* the high bit of each byte of x that is not zero, exactly */
+static inline uint64_t nonzero_bytes(uint64_t x) {
+  return (((x & ~HIGHS) + ~HIGHS) | x) & HIGHS;
+}
+
+/* bit 8i + 7 for each byte i that ends a or differs from b */
+static inline uint64_t stop_bits_word(const char *a, const char *b) {
+  uint64_t x = load_word(a), y = load_word(b);
+  return zero_bytes(x) | nonzero_bytes(x ^ y);
+}
+
+static inline bool stop4_word(const char *a, const char *b) {
+  return (stop_bits_word(a, b) | stop_bits_word(a + 8, b + 8) |
+          stop_bits_word(a + 16, b + 16) | stop_bits_word(a + 24, b + 24)) != 0;
+}
+
+STOP_FUNCTION(word, , 8, stop_bits_word, stop4_word, 3)
+COMPARISONS(word, )
+
+static const struct str_compare word_ops = {
+    .name = "word",
+    .needs = 0,
+    .eq = eq_word,
+    .cmp = cmp_word,
+    .ncmp = ncmp_word,
+    .prefix = prefix_word,
+};
+
+#if HAVE_X86_VARIANTS
+
+/* -------- SSE2 -------- */
+
+/*
+ * Where the bytes are equal the comparison mask is all ones, and
+ * the minimum of it and a byte of a is that byte; elsewhere it is
+ * zero.  So the minimum is zero where a ends or the two differ.
+ */
+__attribute__((target("sse2"))) static inline uint64_t
+stop_bits_sse2(const char *a, const char *b) {
+  __m128i x = _mm_loadu_si128((const __m128i *)a);
+  __m128i y = _mm_loadu_si128((const __m128i *)b);
+  __m128i same_or_end = _mm_min_epu8(_mm_cmpeq_epi8(x, y), x);
+  return (uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(same_or_end, _mm_setzero_si128()));
+}
+
+/* the same, with the minima of four blocks reduced to one first */
+__attribute__((target("sse2"))) static inline __m128i
+same_or_end_sse2(const char *a, const char *b) {
+  __m128i x = _mm_loadu_si128((const __m128i *)a);
+  __m128i y = _mm_loadu_si128((const __m128i *)b);
+  return _mm_min_epu8(_mm_cmpeq_epi8(x, y), x);
+}
+
+__attribute__((target("sse2"))) static inline bool
+stop4_sse2(const char *a, const char *b) {
+  __m128i m = _mm_min_epu8(
+      _mm_min_epu8(same_or_end_sse2(a, b), same_or_end_sse2(a + 16, b + 16)),
+      _mm_min_epu8(same_or_end_sse2(a + 32, b + 32),
+                   same_or_end_sse2(a + 48, b + 48)));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128())) != 0;
+}
+
+STOP_FUNCTION(sse2, __attribute__((target("sse2"))), 16, stop_bits_sse2,
+              stop4_sse2, 0)
+COMPARISONS(sse2, __attribute__((target("sse2"))))
+
+static const struct str_compare sse2_ops = {
+    .name = "sse2",
+    .needs = STR_SSE2,
+    .eq = eq_sse2,
+    .cmp = cmp_sse2,
+    .ncmp = ncmp_sse2,
+    .prefix = prefix_sse2,
+};
+
+/* -------- AVX2 -------- */
+
+__attribute__((target("avx2"))) static inline uint64_t
+stop_bits_avx2(const char *a, const char *b) {
+  __m256i x = _mm256_loadu_si256((const __m256i *)a);
+  __m256i y = _mm256_loadu_si256((const __m256i *)b);
+  __m256i same_or_end = _mm256_min_epu8(_mm256_cmpeq_epi8(x, y), x);
+  return (uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(same_or_end, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+same_or_end_avx2(const char *a, const char *b) {
+  __m256i x = _mm256_loadu_si256((const __m256i *)a);
+  __m256i y = _mm256_loadu_si256((const __m256i *)b);
+  return _mm256_min_epu8(_mm256_cmpeq_epi8(x, y), x);
+}
+
+__attribute__((target("avx2"))) static inline bool
+stop4_avx2(const char *a, const char *b) {
+  __m256i m = _mm256_min_epu8(
+      _mm256_min_epu8(same_or_end_avx2(a, b), same_or_end_avx2(a + 32, b + 32)),
+      _mm256_min_epu8(same_or_end_avx2(a + 64, b + 64),
+                      same_or_end_avx2(a + 96, b + 96)));
+  __m256i ends = _mm256_cmpeq_epi8(m, _mm256_setzero_si256());
+  return _mm256_movemask_epi8(ends) != 0;
+}
+
+STOP_FUNCTION(avx2, __attribute__((target("avx2"))), 32, stop_bits_avx2,
+              stop4_avx2, 0)
+COMPARISONS(avx2, __attribute__((target("avx2"))))
+
+static const struct str_compare avx2_ops = {
+    .name = "avx2",
+    .needs = STR_SSE2 | STR_AVX2,
+    .eq = eq_avx2,
+    .cmp = cmp_avx2,
+    .ncmp = ncmp_avx2,
+    .prefix = prefix_avx2,
+};
+
+#endif
+
+static const struct str_compare *const variants[] = {
+    &bytes_ops,
+    &word_ops,
+#if HAVE_X86_VARIANTS
+    &sse2_ops,
+    &avx2_ops,
+#endif
+};
+
+/* -------- choosing a variant -------- */
+
+/* the STR_ features this processor and operating system support */
+unsigned str_compare_cpu_features(void) {
+  unsigned features = 0;
+#if HAVE_X86_VARIANTS
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  if (edx & bit_SSE2)
+    features |= STR_SSE2;
+  bool avx_state = false;
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+    /* the operating system must save the YMM registers too */
+    unsigned lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    avx_state = (lo & 6) == 6;
+  }
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2) &&
+      avx_state)
+    features |= STR_AVX2;
+#endif
+  return features;
+}
+
+size_t str_compare_variant_count(void) {
+  return sizeof(variants) / sizeof(variants[0]);
+}
+
+/* variant i, from a byte at a time up, whether or not it can run here */
+const struct str_compare *str_compare_variant(size_t i) {
+  return i < str_compare_variant_count() ? variants[i] : NULL;
+}
+
+bool str_compare_supported(const struct str_compare *ops) {
+  return (ops->needs & ~str_compare_cpu_features()) == 0;
+}
+
+const struct str_compare *str_compare_best(void) {
+  const struct str_compare *best = &word_ops;
+  for (size_t i = 0; i < str_compare_variant_count(); i++)
+    if (str_compare_supported(variants[i]))
+      best = variants[i];
+  return best;
+}
+
+/* -------- the best variant -------- */
+
+static const struct str_compare *chosen;
+
+/* CPUID once: under a hypervisor each one may trap */
+static const struct str_compare *best_ops(void) {
+  const struct str_compare *ops = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+  if (ops == NULL) {
+    ops = str_compare_best();
+    __atomic_store_n(&chosen, ops, __ATOMIC_RELAXED);
+  }
+  return ops;
+}
+
+int32_t str_eq(const char *s1, const char *s2) {
+  return best_ops()->eq(s1, s2);
+}
+
+int str_cmp(const char *s1, const char *s2) { return best_ops()->cmp(s1, s2); }
+
+int str_ncmp(const char *s1, const char *s2, size_t n) {
+  return best_ops()->ncmp(s1, s2, n);
+}
+
+bool str_prefix(const char *s, const char *prefix) {
+  return best_ops()->prefix(s, prefix);
+}
+
+/*
+ * result[i] = str_cmp(s1[i], s2[i]) for each of n pairs.  The
+ * strings of the pairs a few ahead are prefetched, so that when
+ * they are scattered through memory their cache misses overlap
+ * with the comparisons before them.
+ */
+void str_cmp_many(const char *const *s1, const char *const *s2, int *result,
+                  size_t n) {
+  int (*cmp)(const char *, const char *) = best_ops()->cmp;
+  for (size_t i = 0; i < n; i++) {
+    if (i + PREFETCH_AHEAD < n) {
+      __builtin_prefetch(s1[i + PREFETCH_AHEAD]);
+      __builtin_prefetch(s2[i + PREFETCH_AHEAD]);
+    }
+    result[i] = cmp(s1[i], s2[i]);
+  }
+}
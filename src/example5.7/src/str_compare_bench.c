@@ -0,0 +1,442 @@
+/*
+ *
+ * Example 5.7 on the string comparisons of str_compare.c.
+ *
+ * Prints what example 5.7 prints, comparing with the best variant
+ * of str_eq this processor can run.
+ *
+ * With -b, every variant the processor can run is first checked
+ * against the comparison a byte at a time, for 'rounds' pairs of
+ * random strings, 200000 by default.  Strings are placed against a
+ * page that cannot be read, ending either at its edge or anywhere
+ * before it, and some are compared by length alone, with nothing to
+ * end them before the edge, so that a read past where a comparison
+ * may look faults.  Then each variant's str_eq, example 5.7's loop
+ * and the C library's strcmp are timed on equal strings, by length,
+ * for strings aligned to 64 bytes and for strings that are not, and
+ * the comparison of many pairs of strings scattered through memory
+ * is timed with and without str_cmp_many's prefetching.
+ *
+ * usage: example5.7-strcmp [-b] [-n rounds]
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ROUNDS 200000
+#define ARENA_PAGES 4
+#define MAX_LENGTH 6000
+#define BATCH 64
+#define BYTES_PER_TIMING (64 * 1024 * 1024)
+#define ALIGNMENT 64
+#define POOL_STRINGS (1024 * 1024)
+#define PAIRS (4 * 1024 * 1024)
+
+#define STR_SSE2 1U
+#define STR_AVX2 2U
+
+struct str_compare {
+  const char *name;
+  unsigned needs;
+  int32_t (*eq)(const char *s1, const char *s2);
+  int (*cmp)(const char *s1, const char *s2);
+  int (*ncmp)(const char *s1, const char *s2, size_t n);
+  bool (*prefix)(const char *s, const char *prefix);
+};
+
+size_t str_compare_variant_count(void);
+const struct str_compare *str_compare_variant(size_t i);
+bool str_compare_supported(const struct str_compare *ops);
+const struct str_compare *str_compare_best(void);
+int32_t str_eq(const char *s1, const char *s2);
+int str_cmp(const char *s1, const char *s2);
+void str_cmp_many(const char *const *s1, const char *const *s2, int *result,
+                  size_t n);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* xorshift64 */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static int sign(int x) { return (x > 0) - (x < 0); }
+
+/* -------- example 5.7 -------- */
+
+static void example(void) {
+  char *str1 = "str1";
+  char *str2 = "str2";
+  char *str3 = "str1";
+
+  printf("str1 compared to str2 is %d\n", str_eq(str1, str2));
+  printf("str1 compared to str3 is %d\n", str_eq(str1, str3));
+  printf("str2 compared to str3 is %d\n", str_eq(str2, str3));
+}
+
+/* example 5.7's str_eq, kept out of line to be timed */
+__attribute__((noinline)) static int32_t example_str_eq(const char *s1,
+                                                        const char *s2) {
+  while (*s1 == *s2) {
+    if (*s1 == 0)
+      return 0;
+    s1++;
+    s2++;
+  }
+  return 1;
+}
+
+static int32_t libc_str_eq(const char *s1, const char *s2) {
+  return strcmp(s1, s2) != 0;
+}
+
+/* -------- checking -------- */
+
+/*
+ * ARENA_PAGES pages that can be read and written, with one after
+ * them that cannot.
+ */
+static char *guarded_arena(void) {
+  long page = sysconf(_SC_PAGESIZE);
+  size_t size = ARENA_PAGES * (size_t)page;
+  char *arena = (char *)mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (arena == MAP_FAILED)
+    fail("mmap");
+  if (mprotect(arena + size, page, PROT_NONE) != 0)
+    fail("mprotect");
+  return arena;
+}
+
+/* a few byte values, so that strings often share long prefixes */
+static char random_byte(void) {
+  static const char bytes[] = {'a', 'b', 'z', '\x7f', '\x80', '\xff'};
+  return bytes[next_random() % sizeof(bytes)];
+}
+
+static size_t random_length(void) {
+  uint64_t r = next_random();
+  switch (r & 3) {
+  case 0:
+    return r >> 8 & 15;
+  case 1:
+    return r >> 8 & 127;
+  default:
+    return (r >> 8) % MAX_LENGTH;
+  }
+}
+
+/*
+ * Copy the 'length' bytes of text into the arena, ending at the
+ * unreadable page or a random distance before it.
+ */
+static char *place(char *arena, const char *text, size_t length) {
+  size_t size = ARENA_PAGES * (size_t)sysconf(_SC_PAGESIZE);
+  size_t gap = next_random() & 1 ? 0 : next_random() % (size - length);
+  char *p = arena + size - gap - length;
+  memcpy(p, text, length);
+  return p;
+}
+
+/* the second of a pair: the first, or the first changed */
+static size_t mutate(char *text, size_t length) {
+  uint64_t r = next_random();
+  size_t at = length ? (r >> 8) % length : 0;
+  switch (r % 5) {
+  case 0:
+    return length;
+  case 1:
+    if (length > 0)
+      text[at] = random_byte();
+    return length;
+  case 2:
+    /* shorter */
+    text[at] = 0;
+    return at + 1;
+  case 3: {
+    /* longer */
+    size_t more = next_random() % 100;
+    for (size_t k = 0; k < more; k++)
+      text[length - 1 + k] = random_byte();
+    text[length - 1 + more] = 0;
+    return length + more;
+  }
+  default:
+    /* the same but for the last byte before the end */
+    if (length > 1)
+      text[length - 2] ^= 1;
+    return length;
+  }
+}
+
+static void differ(const char *variant, const char *op, size_t length1,
+                   size_t length2) {
+  fprintf(stderr, "%s %s: results differ on strings of %zu and %zu bytes\n",
+          variant, op, length1, length2);
+  exit(EXIT_FAILURE);
+}
+
+static void check(size_t rounds) {
+  const struct str_compare *reference = str_compare_variant(0);
+  char *arena1 = guarded_arena(), *arena2 = guarded_arena();
+  char *arena3 = guarded_arena(), *arena4 = guarded_arena();
+  char *text1 = (char *)xmalloc(MAX_LENGTH + 100);
+  char *text2 = (char *)xmalloc(MAX_LENGTH + 100);
+  char *pairs1[BATCH], *pairs2[BATCH];
+  int expected[BATCH], results[BATCH];
+  size_t checked = 0;
+
+  for (size_t round = 0; round < rounds; round++) {
+    /* strings ending in a zero */
+    size_t length1 = random_length() + 1;
+    for (size_t k = 0; k + 1 < length1; k++)
+      text1[k] = random_byte();
+    text1[length1 - 1] = 0;
+    memcpy(text2, text1, length1);
+    size_t length2 = mutate(text2, length1);
+    const char *s1 = place(arena1, text1, length1);
+    const char *s2 = place(arena2, text2, length2);
+    size_t n = next_random() % (length1 + 8);
+
+    int cmp = sign(reference->cmp(s1, s2));
+    if (cmp != sign(strcmp(s1, s2)))
+      differ(reference->name, "cmp", length1, length2);
+    int32_t eq = reference->eq(s1, s2);
+    int ncmp = sign(reference->ncmp(s1, s2, n));
+    bool prefix12 = reference->prefix(s1, s2);
+    bool prefix21 = reference->prefix(s2, s1);
+
+    /* and the first n bytes alone, against the unreadable page */
+    size_t bounded = n < length1 && n < length2 ? n : 0;
+    const char *b1 = place(arena3, text1, bounded);
+    const char *b2 = place(arena4, text2, bounded);
+    int ncmp_bounded = sign(reference->ncmp(b1, b2, bounded));
+
+    for (size_t v = 1; v < str_compare_variant_count(); v++) {
+      const struct str_compare *ops = str_compare_variant(v);
+      if (!str_compare_supported(ops))
+        continue;
+      if (ops->eq(s1, s2) != eq)
+        differ(ops->name, "eq", length1, length2);
+      if (sign(ops->cmp(s1, s2)) != cmp)
+        differ(ops->name, "cmp", length1, length2);
+      if (sign(ops->ncmp(s1, s2, n)) != ncmp)
+        differ(ops->name, "ncmp", length1, length2);
+      if (ops->prefix(s1, s2) != prefix12 || ops->prefix(s2, s1) != prefix21)
+        differ(ops->name, "prefix", length1, length2);
+      if (sign(ops->ncmp(b1, b2, bounded)) != ncmp_bounded)
+        differ(ops->name, "ncmp", bounded, bounded);
+      checked++;
+    }
+
+    /* str_cmp_many on copies of the pairs of the last BATCH rounds */
+    size_t b = round % BATCH;
+    pairs1[b] = (char *)xmalloc(length1);
+    pairs2[b] = (char *)xmalloc(length2);
+    memcpy(pairs1[b], s1, length1);
+    memcpy(pairs2[b], s2, length2);
+    expected[b] = cmp;
+    if (b == BATCH - 1 || round + 1 == rounds) {
+      str_cmp_many((const char *const *)pairs1, (const char *const *)pairs2,
+                   results, b + 1);
+      for (size_t i = 0; i <= b; i++) {
+        if (sign(results[i]) != expected[i])
+          differ("str_cmp_many", "cmp", strlen(pairs1[i]) + 1,
+                 strlen(pairs2[i]) + 1);
+        free(pairs1[i]);
+        free(pairs2[i]);
+      }
+    }
+  }
+  free(text1);
+  free(text2);
+  printf("checked on %zu pairs of strings, %zu comparisons of each kind\n",
+         rounds, checked);
+}
+
+/* -------- timing -------- */
+
+typedef int32_t (*eq_function)(const char *s1, const char *s2);
+
+/* nanoseconds per comparison of equal strings of 'length' bytes */
+static double time_eq(eq_function eq, const char *s1, const char *s2,
+                      size_t length) {
+  size_t repeats = BYTES_PER_TIMING / (length + 16);
+  int32_t sum = 0;
+  double start = now_seconds();
+  for (size_t r = 0; r < repeats; r++)
+    sum += eq(s1, s2);
+  double seconds = now_seconds() - start;
+  if (sum != 0)
+    differ("timing", "eq", length, length);
+  return seconds * 1e9 / repeats;
+}
+
+static void bench_lengths(void) {
+  static const size_t lengths[] = {1, 4, 8, 15, 16, 31, 32, 64,
+                                   100, 256, 1000, 4096, 16384};
+  static const size_t offsets[][2] = {{0, 0}, {1, 7}, {13, 3}};
+  size_t max_length = lengths[sizeof(lengths) / sizeof(lengths[0]) - 1];
+  char *buffer1 = (char *)aligned_alloc(ALIGNMENT, max_length + ALIGNMENT);
+  char *buffer2 = (char *)aligned_alloc(ALIGNMENT, max_length + ALIGNMENT);
+  if (buffer1 == NULL || buffer2 == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  eq_function functions[8] = {example_str_eq, libc_str_eq};
+  const char *names[8] = {"example", "strcmp"};
+  size_t count = 2;
+  for (size_t v = 1; v < str_compare_variant_count(); v++)
+    if (str_compare_supported(str_compare_variant(v))) {
+      functions[count] = str_compare_variant(v)->eq;
+      names[count++] = str_compare_variant(v)->name;
+    }
+
+  for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+    printf("\nequal strings at offsets %zu and %zu from 64 bytes, "
+           "ns per str_eq\n%8s",
+           offsets[o][0], offsets[o][1], "length");
+    for (size_t f = 0; f < count; f++)
+      printf(" %9s", names[f]);
+    printf("\n");
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+      char *s1 = buffer1 + offsets[o][0], *s2 = buffer2 + offsets[o][1];
+      for (size_t k = 0; k < lengths[l]; k++)
+        s1[k] = s2[k] = (char)('a' + k % 26);
+      s1[lengths[l]] = s2[lengths[l]] = 0;
+      printf("%8zu", lengths[l]);
+      for (size_t f = 0; f < count; f++)
+        printf(" %9.2f", time_eq(functions[f], s1, s2, lengths[l]));
+      printf("\n");
+    }
+  }
+  free(buffer1);
+  free(buffer2);
+}
+
+/*
+ * Keys of 8 to 40 bytes, scattered through a pool too big for the
+ * caches, compared in random pairs, most sharing a prefix.
+ */
+static void bench_many(void) {
+  char **pool = (char **)xmalloc(POOL_STRINGS * sizeof(char *));
+  for (size_t i = 0; i < POOL_STRINGS; i++) {
+    size_t length = 8 + next_random() % 33;
+    pool[i] = (char *)xmalloc(length + 1);
+    int n = snprintf(pool[i], length + 1, "user:%llu:",
+                     (unsigned long long)(next_random() % 64));
+    for (size_t k = (size_t)n; k < length; k++)
+      pool[i][k] = (char)('a' + next_random() % 4);
+    pool[i][length] = 0;
+  }
+  /* in a random order, so that neighbours in the pool are not together */
+  for (size_t i = POOL_STRINGS - 1; i > 0; i--) {
+    size_t j = next_random() % (i + 1);
+    char *t = pool[i];
+    pool[i] = pool[j];
+    pool[j] = t;
+  }
+  const char **s1 = (const char **)xmalloc(PAIRS * sizeof(char *));
+  const char **s2 = (const char **)xmalloc(PAIRS * sizeof(char *));
+  int *expected = (int *)xmalloc(PAIRS * sizeof(int));
+  int *result = (int *)xmalloc(PAIRS * sizeof(int));
+  for (size_t i = 0; i < PAIRS; i++) {
+    s1[i] = pool[next_random() % POOL_STRINGS];
+    s2[i] = pool[next_random() % POOL_STRINGS];
+  }
+
+  printf("\n%d pairs of %d scattered strings\n", PAIRS, POOL_STRINGS);
+  double start = now_seconds();
+  for (size_t i = 0; i < PAIRS; i++)
+    expected[i] = sign(strcmp(s1[i], s2[i]));
+  double t = now_seconds() - start;
+  printf("%-22s %8.2f ns per pair\n", "strcmp", t * 1e9 / PAIRS);
+
+  start = now_seconds();
+  for (size_t i = 0; i < PAIRS; i++)
+    result[i] = str_cmp(s1[i], s2[i]);
+  t = now_seconds() - start;
+  bool same = true;
+  for (size_t i = 0; i < PAIRS; i++)
+    same = same && sign(result[i]) == expected[i];
+  printf("%-22s %8.2f ns per pair%s\n", "str_cmp", t * 1e9 / PAIRS,
+         same ? "" : "   results differ");
+
+  start = now_seconds();
+  str_cmp_many(s1, s2, result, PAIRS);
+  t = now_seconds() - start;
+  same = true;
+  for (size_t i = 0; i < PAIRS; i++)
+    same = same && sign(result[i]) == expected[i];
+  printf("%-22s %8.2f ns per pair%s\n", "str_cmp_many", t * 1e9 / PAIRS,
+         same ? "" : "   results differ");
+
+  for (size_t i = 0; i < POOL_STRINGS; i++)
+    free(pool[i]);
+  free(pool);
+  free(s1);
+  free(s2);
+  free(expected);
+  free(result);
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  size_t rounds = DEFAULT_ROUNDS;
+  int opt;
+  while ((opt = getopt(argc, argv, "bn:")) != -1) {
+    switch (opt) {
+    case 'b':
+      benchmark = true;
+      break;
+    case 'n':
+      rounds = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-n rounds]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!benchmark) {
+    example();
+    exit(EXIT_SUCCESS);
+  }
+  if (rounds == 0) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  check(rounds);
+  printf("best variant here: %s\n", str_compare_best()->name);
+  bench_lengths();
+  bench_many();
+  exit(EXIT_SUCCESS);
+}
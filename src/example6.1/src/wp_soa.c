@@ -0,0 +1,174 @@
+/*
+ *
+ * Styled characters stored as columns.
+ *
+ * Examples 6.1 and 6.2 keep an array of struct wp_char and sort
+ * it by swapping whole structures.  Here the characters, fonts
+ * and point sizes are kept in three separate arrays, so a pass
+ * over the characters alone touches only the bytes it needs.
+ *
+ * Sorting by character is a counting sort: one pass counts each
+ * character, and a second produces a permutation, the old index
+ * of each element in sorted order.  The sort is stable, unlike
+ * the exchange sort of the examples, so characters that compare
+ * equal keep their order.  The character column can be rebuilt
+ * straight from the counts; the other columns are each moved
+ * once, through the permutation.
+ */
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS (UCHAR_MAX + 1)
+#define READ_BLOCK (1024 * 1024)
+
+struct wp_text {
+  char *cval;
+  short *font;
+  short *psize;
+  size_t length;
+  size_t capacity;
+};
+
+/* the counting sort's bucket for a character, in char order */
+static inline size_t key_of(char c) { return (size_t)((int)c - CHAR_MIN); }
+
+void wp_text_init(struct wp_text *t) { memset(t, 0, sizeof(*t)); }
+
+void wp_text_free(struct wp_text *t) {
+  free(t->cval);
+  free(t->font);
+  free(t->psize);
+  wp_text_init(t);
+}
+
+/* make room for 'capacity' characters; false if out of memory */
+bool wp_text_reserve(struct wp_text *t, size_t capacity) {
+  if (capacity <= t->capacity)
+    return true;
+  char *cval = (char *)realloc(t->cval, capacity);
+  if (cval == NULL)
+    return false;
+  t->cval = cval;
+  short *font = (short *)realloc(t->font, capacity * sizeof(short));
+  if (font == NULL)
+    return false;
+  t->font = font;
+  short *psize = (short *)realloc(t->psize, capacity * sizeof(short));
+  if (psize == NULL)
+    return false;
+  t->psize = psize;
+  t->capacity = capacity;
+  return true;
+}
+
+/* append n characters, all in the same font and size */
+bool wp_text_append(struct wp_text *t, const char *chars, size_t n, short font,
+                    short psize) {
+  if (t->capacity - t->length < n) {
+    size_t capacity = t->capacity ? t->capacity : READ_BLOCK;
+    while (capacity - t->length < n)
+      capacity *= 2;
+    if (!wp_text_reserve(t, capacity))
+      return false;
+  }
+  memcpy(t->cval + t->length, chars, n);
+  for (size_t i = 0; i < n; i++) {
+    t->font[t->length + i] = font;
+    t->psize[t->length + i] = psize;
+  }
+  t->length += n;
+  return true;
+}
+
+/*
+ * Read characters from 'in' up to the first newline or the end of
+ * the input, as infun does in the examples one character at a time,
+ * but a buffer at a time with fgets, which stops at the newline and
+ * so neither waits for more than a line from a terminal or pipe nor
+ * takes anything after it from the stream.  The newline is not kept.
+ * Returns false if out of memory or on a read error.
+ */
+bool wp_text_read_line(struct wp_text *t, FILE *in, short font, short psize) {
+  char *block = (char *)malloc(READ_BLOCK);
+  if (block == NULL)
+    return false;
+  bool ok = true;
+  while (fgets(block, READ_BLOCK, in) != NULL) {
+    size_t got = strlen(block);
+    bool newline = got > 0 && block[got - 1] == '\n';
+    if (!wp_text_append(t, block, got - newline, font, psize)) {
+      ok = false;
+      break;
+    }
+    if (newline)
+      break;
+  }
+  free(block);
+  return ok && !ferror(in);
+}
+
+/* perm[i] is set to the index of the ith character in sorted order */
+void wp_sort_permutation(const char *cval, size_t n, uint32_t *perm) {
+  size_t start[KEYS] = {0};
+  for (size_t i = 0; i < n; i++)
+    start[key_of(cval[i])]++;
+  size_t total = 0;
+  for (size_t k = 0; k < KEYS; k++) {
+    size_t count = start[k];
+    start[k] = total;
+    total += count;
+  }
+  for (size_t i = 0; i < n; i++)
+    perm[start[key_of(cval[i])]++] = (uint32_t)i;
+}
+
+/* reorder the font and size columns through a permutation */
+bool wp_text_permute_styles(struct wp_text *t, const uint32_t *perm) {
+  short *font = (short *)malloc(t->capacity * sizeof(short));
+  short *psize = (short *)malloc(t->capacity * sizeof(short));
+  if (font == NULL || psize == NULL) {
+    free(font);
+    free(psize);
+    return false;
+  }
+  for (size_t i = 0; i < t->length; i++) {
+    font[i] = t->font[perm[i]];
+    psize[i] = t->psize[perm[i]];
+  }
+  free(t->font);
+  free(t->psize);
+  t->font = font;
+  t->psize = psize;
+  return true;
+}
+
+/* the character column in sorted order is just runs of each key */
+static void rebuild_chars(char *cval, size_t n) {
+  size_t count[KEYS] = {0};
+  for (size_t i = 0; i < n; i++)
+    count[key_of(cval[i])]++;
+  char *p = cval;
+  for (size_t k = 0; k < KEYS; k++) {
+    memset(p, (int)k + CHAR_MIN, count[k]);
+    p += count[k];
+  }
+}
+
+/* sort the text by character; false if out of memory or too long */
+bool wp_text_sort(struct wp_text *t) {
+  if (t->length > UINT32_MAX)
+    return false;
+  uint32_t *perm = (uint32_t *)malloc(t->length * sizeof(uint32_t) + 1);
+  if (perm == NULL)
+    return false;
+  wp_sort_permutation(t->cval, t->length, perm);
+  bool ok = wp_text_permute_styles(t, perm);
+  if (ok)
+    rebuild_chars(t->cval, t->length);
+  free(perm);
+  return ok;
+}
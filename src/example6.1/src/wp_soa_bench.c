@@ -0,0 +1,350 @@
+/*
+ *
+ * Sorting styled characters stored as columns.
+ *
+ * Reads a line of characters from the standard input like
+ * examples 6.1 and 6.2, but in blocks rather than a character at
+ * a time and with no limit on the length, sorts it with the
+ * counting sort of wp_soa.c and prints it in the same format.
+ *
+ * With -b, generated text with runs of different fonts and sizes
+ * is sorted instead, and timed against the exchange sort of the
+ * examples on an array of structures.  The exchange sort takes
+ * time proportional to the square of the length, so it is only
+ * run on the first few thousand characters; qsort on the array
+ * of structures is timed at every size instead.
+ *
+ * usage: example6.1-wpsort [-b] [-n max_chars]
+ */
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_CHARS 1000000
+#define DEFAULT_MAX_CHARS 10000000
+#define EXCHANGE_CHARS 20000
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define MAX_LINE 16
+
+struct wp_text {
+  char *cval;
+  short *font;
+  short *psize;
+  size_t length;
+  size_t capacity;
+};
+
+void wp_text_init(struct wp_text *t);
+void wp_text_free(struct wp_text *t);
+bool wp_text_reserve(struct wp_text *t, size_t capacity);
+bool wp_text_append(struct wp_text *t, const char *chars, size_t n, short font,
+                    short psize);
+bool wp_text_read_line(struct wp_text *t, FILE *in, short font, short psize);
+void wp_sort_permutation(const char *cval, size_t n, uint32_t *perm);
+bool wp_text_permute_styles(struct wp_text *t, const uint32_t *perm);
+bool wp_text_sort(struct wp_text *t);
+
+/* the structure of examples 6.1 and 6.2 */
+struct wp_char {
+  char wp_cval;
+  short wp_font;
+  short wp_psize;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static char *format_short(char *p, short n) {
+  char digits[8];
+  int len = 0;
+  unsigned int u = n < 0 ? 0U - (unsigned int)n : (unsigned int)n;
+  if (n < 0)
+    *p++ = '-';
+  do {
+    digits[len++] = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  while (len)
+    *p++ = digits[--len];
+  return p;
+}
+
+/* printf("%c %d %d\n") for every character, a buffer at a time */
+static void print_text(const struct wp_text *t) {
+  char *buffer = (char *)xmalloc(OUTPUT_BUFFER_SIZE);
+  char *p = buffer;
+  for (size_t i = 0; i < t->length; i++) {
+    if (p - buffer > OUTPUT_BUFFER_SIZE - MAX_LINE) {
+      fwrite(buffer, 1, p - buffer, stdout);
+      p = buffer;
+    }
+    *p++ = t->cval[i];
+    *p++ = ' ';
+    p = format_short(p, t->font[i]);
+    *p++ = ' ';
+    p = format_short(p, t->psize[i]);
+    *p++ = '\n';
+  }
+  fwrite(buffer, 1, p - buffer, stdout);
+  free(buffer);
+}
+
+/* -------- benchmark -------- */
+
+/* text in runs of one font and size, with English-ish letters */
+static void generate(struct wp_text *t, size_t n) {
+  static const char sample[] =
+      "the quick brown fox jumps over the lazy dog, THEN RESTS. "
+      "etaoin shrdlu etaoin shrdlu 0123456789";
+  static const short sizes[] = {8, 9, 10, 11, 12, 14, 18, 24};
+  char run[128];
+  t->length = 0;
+  while (t->length < n) {
+    size_t length = 1 + next_random() % sizeof(run);
+    if (length > n - t->length)
+      length = n - t->length;
+    for (size_t i = 0; i < length; i++)
+      run[i] = sample[next_random() % (sizeof(sample) - 1)];
+    short font = (short)(1 + next_random() % 8);
+    short psize = sizes[next_random() % 8];
+    if (!wp_text_append(t, run, length, font, psize)) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static struct wp_char *to_structs(const struct wp_text *t) {
+  struct wp_char *ar =
+      (struct wp_char *)xmalloc(t->length * sizeof(struct wp_char));
+  for (size_t i = 0; i < t->length; i++)
+    ar[i] = (struct wp_char){t->cval[i], t->font[i], t->psize[i]};
+  return ar;
+}
+
+/* the sort of example 6.1 */
+static void exchange_sort(struct wp_char *ar, size_t icount) {
+  if (icount < 2)
+    return;
+  for (size_t lo_indx = 0; lo_indx <= icount - 2; lo_indx++)
+    for (size_t hi_indx = lo_indx + 1; hi_indx <= icount - 1; hi_indx++) {
+      if (ar[lo_indx].wp_cval > ar[hi_indx].wp_cval) {
+        struct wp_char wp_tmp = ar[lo_indx];
+        ar[lo_indx] = ar[hi_indx];
+        ar[hi_indx] = wp_tmp;
+      }
+    }
+}
+
+static int compare_cval(const void *a, const void *b) {
+  return ((const struct wp_char *)a)->wp_cval -
+         ((const struct wp_char *)b)->wp_cval;
+}
+
+static int compare_all(const void *a, const void *b) {
+  const struct wp_char *x = (const struct wp_char *)a;
+  const struct wp_char *y = (const struct wp_char *)b;
+  if (x->wp_cval != y->wp_cval)
+    return x->wp_cval - y->wp_cval;
+  if (x->wp_font != y->wp_font)
+    return x->wp_font - y->wp_font;
+  return x->wp_psize - y->wp_psize;
+}
+
+/*
+ * The permutation must put the characters in order, and keep
+ * equal ones in their original order.
+ */
+static bool check_permutation(const struct wp_text *t) {
+  uint32_t *perm = (uint32_t *)xmalloc(t->length * sizeof(uint32_t) + 1);
+  wp_sort_permutation(t->cval, t->length, perm);
+  bool ok = true;
+  for (size_t i = 1; i < t->length && ok; i++) {
+    char a = t->cval[perm[i - 1]], b = t->cval[perm[i]];
+    ok = a < b || (a == b && perm[i - 1] < perm[i]);
+  }
+  free(perm);
+  return ok;
+}
+
+/* the sorted columns must hold the same records as the exchange sort */
+static bool same_records(const struct wp_text *t, struct wp_char *ar) {
+  struct wp_char *sorted = to_structs(t);
+  bool ok = true;
+  for (size_t i = 0; i < t->length && ok; i++)
+    ok = sorted[i].wp_cval == ar[i].wp_cval;
+  qsort(sorted, t->length, sizeof(struct wp_char), compare_all);
+  qsort(ar, t->length, sizeof(struct wp_char), compare_all);
+  for (size_t i = 0; i < t->length && ok; i++)
+    ok = compare_all(&sorted[i], &ar[i]) == 0;
+  free(sorted);
+  return ok;
+}
+
+static void bench_read(size_t n) {
+  FILE *f = tmpfile();
+  if (f == NULL) {
+    perror("tmpfile");
+    exit(EXIT_FAILURE);
+  }
+  struct wp_text t;
+  wp_text_init(&t);
+  generate(&t, n);
+  fwrite(t.cval, 1, t.length, f);
+  putc('\n', f);
+
+  rewind(f);
+  struct wp_char *ar = (struct wp_char *)xmalloc(n * sizeof(struct wp_char));
+  double start = now_seconds();
+  size_t count = 0;
+  for (; count < n; count++) {
+    /* infun from example 6.2 */
+    ar[count].wp_cval = getc(f);
+    ar[count].wp_font = 2;
+    ar[count].wp_psize = 10;
+    if (ar[count].wp_cval == '\n')
+      break;
+  }
+  double char_time = now_seconds() - start;
+
+  rewind(f);
+  struct wp_text in;
+  wp_text_init(&in);
+  start = now_seconds();
+  bool ok = wp_text_read_line(&in, f, 2, 10);
+  double block_time = now_seconds() - start;
+  ok = ok && in.length == n && count == n &&
+       memcmp(in.cval, t.cval, n) == 0;
+
+  printf("reading %zu characters%s\n", n, ok ? "" : ", INPUT DIFFERS");
+  printf("  a character at a time:   %8.4f s\n", char_time);
+  printf("  in blocks:               %8.4f s, %.1fx\n", block_time,
+         char_time / block_time);
+  wp_text_free(&in);
+  wp_text_free(&t);
+  free(ar);
+  fclose(f);
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+static void bench_exchange(size_t n) {
+  struct wp_text t;
+  wp_text_init(&t);
+  generate(&t, n);
+  struct wp_char *ar = to_structs(&t);
+
+  double start = now_seconds();
+  exchange_sort(ar, n);
+  double exchange_time = now_seconds() - start;
+
+  bool ok = check_permutation(&t);
+  start = now_seconds();
+  ok = wp_text_sort(&t) && ok;
+  double sort_time = now_seconds() - start;
+  ok = ok && same_records(&t, ar);
+
+  printf("%zu characters%s\n", n, ok ? "" : ", SORTS DIFFER");
+  printf("  exchange sort, structs:  %8.4f s\n", exchange_time);
+  printf("  counting sort, columns:  %8.4f s, %.0fx\n", sort_time,
+         exchange_time / sort_time);
+  wp_text_free(&t);
+  free(ar);
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+static void bench(size_t n) {
+  struct wp_text t;
+  wp_text_init(&t);
+  generate(&t, n);
+  struct wp_char *ar = to_structs(&t);
+
+  bool ok = check_permutation(&t);
+  double start = now_seconds();
+  ok = wp_text_sort(&t) && ok;
+  double sort_time = now_seconds() - start;
+
+  start = now_seconds();
+  qsort(ar, n, sizeof(struct wp_char), compare_cval);
+  double qsort_time = now_seconds() - start;
+  for (size_t i = 0; i < n && ok; i++)
+    ok = ar[i].wp_cval == t.cval[i];
+
+  printf("%zu characters%s\n", n, ok ? "" : ", SORTS DIFFER");
+  printf("  qsort, structs:          %8.4f s\n", qsort_time);
+  printf("  counting sort, columns:  %8.4f s, %.0fx, %.0f chars/sec\n",
+         sort_time, qsort_time / sort_time, n / sort_time);
+  wp_text_free(&t);
+  free(ar);
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  size_t max_chars = DEFAULT_MAX_CHARS;
+  int opt;
+  while ((opt = getopt(argc, argv, "bn:")) != -1) {
+    switch (opt) {
+    case 'b':
+      benchmark = true;
+      break;
+    case 'n':
+      max_chars = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-n max_chars]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (benchmark) {
+    if (max_chars < 1 || max_chars > UINT32_MAX) {
+      fprintf(stderr, "Number of characters out of range\n");
+      exit(EXIT_FAILURE);
+    }
+    bench_read(max_chars);
+    bench_exchange(max_chars < EXCHANGE_CHARS ? max_chars : EXCHANGE_CHARS);
+    size_t n = max_chars < MIN_CHARS ? max_chars : MIN_CHARS;
+    for (; n <= max_chars; n *= 10)
+      bench(n);
+    exit(EXIT_SUCCESS);
+  }
+
+  struct wp_text t;
+  wp_text_init(&t);
+  if (!wp_text_read_line(&t, stdin, 2, 10) || !wp_text_sort(&t)) {
+    fprintf(stderr, "Cannot read and sort the input\n");
+    exit(EXIT_FAILURE);
+  }
+  print_text(&t);
+  wp_text_free(&t);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,393 @@
+/*
+ *
+ * Many values of the union of example 6.12, stored by type.
+ *
+ * An array of struct var_type spends 8 bytes on every value,
+ * whatever its type, and every operation on it switches on the
+ * type of each value in turn.  A variant_vector keeps a one-byte
+ * tag per value, in order, and the values themselves in one
+ * column per type: all the floats together, all the chars, all
+ * the ints.
+ *
+ * The batch operations walk the tags a run at a time, finding
+ * where each run of one type ends by comparing 8 tags at once.
+ * A run is then handled by a loop that knows its type, reading
+ * the next values from that type's column, so the switch happens
+ * once per run instead of once per value.  Values of the same
+ * type that come together, as they often do, make long runs.
+ * Where the types are mixed up, a block of tags at a time is
+ * handled a value at a time instead, reading the next value of
+ * every column and picking one by the tag, which costs more work
+ * per value but no mispredicted branches.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* code for types in union, as in example 6.12 */
+#define FLOAT_TYPE 1
+#define CHAR_TYPE 2
+#define INT_TYPE 3
+
+#define INITIAL_CAPACITY 1024
+
+struct var_type {
+  int32_t type_in_union;
+  union {
+    float un_float;
+    char un_char;
+    int32_t un_int;
+  } vt_un;
+};
+
+struct variant_vector {
+  uint8_t *tags;
+  size_t length, tag_capacity;
+  float *floats;
+  size_t float_count, float_capacity;
+  char *chars;
+  size_t char_count, char_capacity;
+  int32_t *ints;
+  size_t int_count, int_capacity;
+};
+
+/* the next value of each column, while walking the tags */
+struct cursor {
+  size_t at_float, at_char, at_int;
+};
+
+void vv_init(struct variant_vector *v) { memset(v, 0, sizeof(*v)); }
+
+void vv_free(struct variant_vector *v) {
+  free(v->tags);
+  free(v->floats);
+  free(v->chars);
+  free(v->ints);
+  vv_init(v);
+}
+
+/* make room for 'more' elements of 'size' bytes after 'count' */
+static bool grow(void **p, size_t *capacity, size_t count, size_t more,
+                 size_t size) {
+  if (*capacity - count >= more)
+    return true;
+  size_t c = *capacity ? *capacity : INITIAL_CAPACITY;
+  while (c - count < more)
+    c *= 2;
+  void *q = realloc(*p, c * size);
+  if (q == NULL)
+    return false;
+  *p = q;
+  *capacity = c;
+  return true;
+}
+
+static bool reserve_tags(struct variant_vector *v, size_t more) {
+  return grow((void **)&v->tags, &v->tag_capacity, v->length, more, 1);
+}
+
+static bool reserve_floats(struct variant_vector *v, size_t more) {
+  return grow((void **)&v->floats, &v->float_capacity, v->float_count, more,
+              sizeof(float));
+}
+
+static bool reserve_chars(struct variant_vector *v, size_t more) {
+  return grow((void **)&v->chars, &v->char_capacity, v->char_count, more, 1);
+}
+
+static bool reserve_ints(struct variant_vector *v, size_t more) {
+  return grow((void **)&v->ints, &v->int_capacity, v->int_count, more,
+              sizeof(int32_t));
+}
+
+bool vv_append_float(struct variant_vector *v, float f) {
+  if (!reserve_tags(v, 1) || !reserve_floats(v, 1))
+    return false;
+  v->tags[v->length++] = FLOAT_TYPE;
+  v->floats[v->float_count++] = f;
+  return true;
+}
+
+bool vv_append_char(struct variant_vector *v, char c) {
+  if (!reserve_tags(v, 1) || !reserve_chars(v, 1))
+    return false;
+  v->tags[v->length++] = CHAR_TYPE;
+  v->chars[v->char_count++] = c;
+  return true;
+}
+
+bool vv_append_int(struct variant_vector *v, int32_t i) {
+  if (!reserve_tags(v, 1) || !reserve_ints(v, 1))
+    return false;
+  v->tags[v->length++] = INT_TYPE;
+  v->ints[v->int_count++] = i;
+  return true;
+}
+
+/* false if out of memory or a type is unknown */
+bool vv_append_structs(struct variant_vector *v, const struct var_type *vt,
+                       size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    bool ok;
+    switch (vt[i].type_in_union) {
+    default:
+      return false;
+    case FLOAT_TYPE:
+      ok = vv_append_float(v, vt[i].vt_un.un_float);
+      break;
+    case CHAR_TYPE:
+      ok = vv_append_char(v, vt[i].vt_un.un_char);
+      break;
+    case INT_TYPE:
+      ok = vv_append_int(v, vt[i].vt_un.un_int);
+      break;
+    }
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+/* the index after the run of tags equal to tags[i] */
+static size_t run_end(const uint8_t *tags, size_t i, size_t n) {
+  uint64_t same = tags[i] * 0x0101010101010101ULL;
+  while (n - i >= 8) {
+    uint64_t word;
+    memcpy(&word, tags + i, sizeof(word));
+    uint64_t differ = word ^ same;
+    if (differ)
+      /* tags are loaded little-endian: the first tag is the low byte */
+      return i + __builtin_ctzll(differ) / 8;
+    i += 8;
+  }
+  while (i < n && tags[i] == (uint8_t)same)
+    i++;
+  return i;
+}
+
+/*
+ * Print every value, one per line, as print_vt does.  Returns
+ * false on an unknown type, after printing the values before it.
+ */
+bool vv_print(const struct variant_vector *v, FILE *out) {
+  struct cursor c = {0, 0, 0};
+  for (size_t i = 0; i < v->length;) {
+    size_t end = run_end(v->tags, i, v->length);
+    size_t n = end - i;
+    switch (v->tags[i]) {
+    default:
+      fprintf(out, "Unknown type in union\n");
+      return false;
+    case FLOAT_TYPE:
+      for (const float *f = v->floats + c.at_float; n--; f++)
+        fprintf(out, "%f\n", *f);
+      c.at_float += end - i;
+      break;
+    case CHAR_TYPE:
+      for (const char *ch = v->chars + c.at_char; n--; ch++) {
+        putc(*ch, out);
+        putc('\n', out);
+      }
+      c.at_char += end - i;
+      break;
+    case INT_TYPE:
+      for (const int32_t *p = v->ints + c.at_int; n--; p++)
+        fprintf(out, "%" PRId32 "\n", *p);
+      c.at_int += end - i;
+      break;
+    }
+    i = end;
+  }
+  return true;
+}
+
+/*
+ * Where the tags change more often than this in a block, runs
+ * are too short to pay for finding them, and values are taken
+ * one at a time without branching on their type instead.
+ */
+#define BLOCK 64
+#define MAX_CHANGES 8
+
+static size_t changes_in(const uint8_t *tags, size_t i, size_t end) {
+  size_t changes = 0;
+  for (size_t k = i + 1; k < end; k++)
+    changes += tags[k] != tags[k - 1];
+  return changes;
+}
+
+/*
+ * The next value of every column as a double, indexed by tag.
+ * Every column is read, so a column that has run out is read at
+ * its start instead (or from a zero, if it is empty), and the
+ * value thrown away.
+ */
+static inline void next_values(const struct variant_vector *v,
+                               const struct cursor *c, double values[4]) {
+  static const float no_float;
+  static const char no_char;
+  static const int32_t no_int;
+  const float *f = v->float_count ? v->floats : &no_float;
+  const char *ch = v->char_count ? v->chars : &no_char;
+  const int32_t *p = v->int_count ? v->ints : &no_int;
+  values[0] = 0;
+  values[FLOAT_TYPE] = f[c->at_float < v->float_count ? c->at_float : 0];
+  values[CHAR_TYPE] = ch[c->at_char < v->char_count ? c->at_char : 0];
+  values[INT_TYPE] = p[c->at_int < v->int_count ? c->at_int : 0];
+}
+
+static inline void advance(struct cursor *c, uint8_t tag) {
+  c->at_float += tag == FLOAT_TYPE;
+  c->at_char += tag == CHAR_TYPE;
+  c->at_int += tag == INT_TYPE;
+}
+
+static void convert_run(const struct variant_vector *v, size_t i, size_t n,
+                        struct cursor *c, double *out) {
+  switch (v->tags[i]) {
+  case FLOAT_TYPE:
+    for (size_t k = 0; k < n; k++)
+      out[i + k] = v->floats[c->at_float + k];
+    c->at_float += n;
+    break;
+  case CHAR_TYPE:
+    for (size_t k = 0; k < n; k++)
+      out[i + k] = v->chars[c->at_char + k];
+    c->at_char += n;
+    break;
+  case INT_TYPE:
+    for (size_t k = 0; k < n; k++)
+      out[i + k] = v->ints[c->at_int + k];
+    c->at_int += n;
+    break;
+  }
+}
+
+/*
+ * Each value converted to double, in order, into out[0] to
+ * out[length - 1].  Chars are taken as their character codes.
+ */
+void vv_to_double(const struct variant_vector *v, double *out) {
+  struct cursor c = {0, 0, 0};
+  for (size_t block = 0; block < v->length; block += BLOCK) {
+    size_t block_end = v->length - block < BLOCK ? v->length : block + BLOCK;
+    if (changes_in(v->tags, block, block_end) > MAX_CHANGES) {
+      for (size_t i = block; i < block_end; i++) {
+        double values[4];
+        next_values(v, &c, values);
+        out[i] = values[v->tags[i] & 3];
+        advance(&c, v->tags[i]);
+      }
+      continue;
+    }
+    for (size_t i = block; i < block_end;) {
+      size_t end = run_end(v->tags, i, block_end);
+      convert_run(v, i, end - i, &c, out);
+      i = end;
+    }
+  }
+}
+
+/*
+ * The sum of every value, as a double.  Order doesn't matter
+ * here, so each column is added up straight through, without
+ * looking at the tags; the result may differ in the last bits
+ * from adding the values in order.
+ */
+double vv_sum(const struct variant_vector *v) {
+  double floats = 0, chars = 0, ints = 0;
+  for (size_t k = 0; k < v->float_count; k++)
+    floats += v->floats[k];
+  for (size_t k = 0; k < v->char_count; k++)
+    chars += v->chars[k];
+  for (size_t k = 0; k < v->int_count; k++)
+    ints += v->ints[k];
+  return floats + chars + ints;
+}
+
+/* out has room for n more values of every type */
+static void filter_run(const struct variant_vector *v, size_t i, size_t n,
+                       double threshold, struct cursor *c,
+                       struct variant_vector *out) {
+  size_t kept = 0;
+  switch (v->tags[i]) {
+  case FLOAT_TYPE:
+    for (size_t k = 0; k < n; k++) {
+      float f = v->floats[c->at_float + k];
+      out->floats[out->float_count + kept] = f;
+      kept += f > threshold;
+    }
+    out->float_count += kept;
+    c->at_float += n;
+    break;
+  case CHAR_TYPE:
+    for (size_t k = 0; k < n; k++) {
+      char ch = v->chars[c->at_char + k];
+      out->chars[out->char_count + kept] = ch;
+      kept += ch > threshold;
+    }
+    out->char_count += kept;
+    c->at_char += n;
+    break;
+  case INT_TYPE:
+    for (size_t k = 0; k < n; k++) {
+      int32_t p = v->ints[c->at_int + k];
+      out->ints[out->int_count + kept] = p;
+      kept += p > threshold;
+    }
+    out->int_count += kept;
+    c->at_int += n;
+    break;
+  }
+  memset(out->tags + out->length, v->tags[i], kept);
+  out->length += kept;
+}
+
+/* the same, a value at a time; every column is written each time */
+static void filter_each(const struct variant_vector *v, size_t i, size_t end,
+                        double threshold, struct cursor *c,
+                        struct variant_vector *out) {
+  for (; i < end; i++) {
+    uint8_t tag = v->tags[i];
+    double values[4];
+    next_values(v, c, values);
+    bool keep = values[tag & 3] > threshold;
+    out->floats[out->float_count] = (float)values[FLOAT_TYPE];
+    out->chars[out->char_count] = (char)values[CHAR_TYPE];
+    out->ints[out->int_count] = (int32_t)values[INT_TYPE];
+    out->float_count += keep && tag == FLOAT_TYPE;
+    out->char_count += keep && tag == CHAR_TYPE;
+    out->int_count += keep && tag == INT_TYPE;
+    out->tags[out->length] = tag;
+    out->length += keep;
+    advance(c, tag);
+  }
+}
+
+/*
+ * Append to 'out' the values of 'v' greater than 'threshold', in
+ * order and keeping their types.  False if out of memory.
+ */
+bool vv_filter_greater(const struct variant_vector *v, double threshold,
+                       struct variant_vector *out) {
+  struct cursor c = {0, 0, 0};
+  for (size_t block = 0; block < v->length; block += BLOCK) {
+    size_t block_end = v->length - block < BLOCK ? v->length : block + BLOCK;
+    if (!reserve_tags(out, BLOCK) || !reserve_floats(out, BLOCK) ||
+        !reserve_chars(out, BLOCK) || !reserve_ints(out, BLOCK))
+      return false;
+    if (changes_in(v->tags, block, block_end) > MAX_CHANGES) {
+      filter_each(v, block, block_end, threshold, &c, out);
+      continue;
+    }
+    for (size_t i = block; i < block_end;) {
+      size_t end = run_end(v->tags, i, block_end);
+      filter_run(v, i, end - i, threshold, &c, out);
+      i = end;
+    }
+  }
+  return true;
+}
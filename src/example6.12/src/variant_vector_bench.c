@@ -0,0 +1,315 @@
+/*
+ *
+ * An array of struct var_type against a variant_vector.
+ *
+ * The same values are printed, summed, converted to double and
+ * filtered both ways: switching on each value's type as print_vt
+ * does in example 6.12, and a run at a time with the columns of
+ * variant_vector.c.  This is done twice, once with the types in
+ * random order, and once with them in runs of up to a thousand
+ * values of one type.  The results of the two are compared.
+ *
+ * usage: example6.12-variants [-n values] [-p printed_values]
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_VALUES 10000000
+#define DEFAULT_PRINTED 1000000
+#define MAX_RUN 1000
+#define THRESHOLD 50.0
+
+/* code for types in union */
+#define FLOAT_TYPE 1
+#define CHAR_TYPE 2
+#define INT_TYPE 3
+
+struct var_type {
+  int32_t type_in_union;
+  union {
+    float un_float;
+    char un_char;
+    int32_t un_int;
+  } vt_un;
+};
+
+struct variant_vector {
+  uint8_t *tags;
+  size_t length, tag_capacity;
+  float *floats;
+  size_t float_count, float_capacity;
+  char *chars;
+  size_t char_count, char_capacity;
+  int32_t *ints;
+  size_t int_count, int_capacity;
+};
+
+void vv_init(struct variant_vector *v);
+void vv_free(struct variant_vector *v);
+bool vv_append_structs(struct variant_vector *v, const struct var_type *vt,
+                       size_t n);
+bool vv_print(const struct variant_vector *v, FILE *out);
+void vv_to_double(const struct variant_vector *v, double *out);
+double vv_sum(const struct variant_vector *v);
+bool vv_filter_greater(const struct variant_vector *v, double threshold,
+                       struct variant_vector *out);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "%s: results differ\n", what);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* -------- one switch per value, as in example 6.12 -------- */
+
+static void print_structs(const struct var_type *vt, size_t n, FILE *out) {
+  for (size_t i = 0; i < n; i++) {
+    switch (vt[i].type_in_union) {
+    default:
+      fprintf(out, "Unknown type in union\n");
+      break;
+    case FLOAT_TYPE:
+      fprintf(out, "%f\n", vt[i].vt_un.un_float);
+      break;
+    case CHAR_TYPE:
+      fprintf(out, "%c\n", vt[i].vt_un.un_char);
+      break;
+    case INT_TYPE:
+      fprintf(out, "%" PRId32 "\n", vt[i].vt_un.un_int);
+      break;
+    }
+  }
+}
+
+static double value_of(const struct var_type *vt) {
+  switch (vt->type_in_union) {
+  case FLOAT_TYPE:
+    return vt->vt_un.un_float;
+  case CHAR_TYPE:
+    return vt->vt_un.un_char;
+  case INT_TYPE:
+    return vt->vt_un.un_int;
+  }
+  return 0;
+}
+
+static double sum_structs(const struct var_type *vt, size_t n) {
+  double sum = 0;
+  for (size_t i = 0; i < n; i++)
+    sum += value_of(&vt[i]);
+  return sum;
+}
+
+static void structs_to_double(const struct var_type *vt, size_t n,
+                              double *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = value_of(&vt[i]);
+}
+
+static size_t filter_structs(const struct var_type *vt, size_t n,
+                             double threshold, struct var_type *out) {
+  size_t kept = 0;
+  for (size_t i = 0; i < n; i++)
+    if (value_of(&vt[i]) > threshold)
+      out[kept++] = vt[i];
+  return kept;
+}
+
+/* -------- benchmark -------- */
+
+static void generate(struct var_type *vt, size_t n, bool clustered) {
+  int32_t type = FLOAT_TYPE;
+  size_t left = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!clustered || left-- == 0) {
+      type = FLOAT_TYPE + next_random() % 3;
+      left = next_random() % MAX_RUN;
+    }
+    uint64_t r = next_random();
+    vt[i].type_in_union = type;
+    switch (type) {
+    case FLOAT_TYPE:
+      vt[i].vt_un.un_float = (float)((int64_t)(r % 200000) - 100000) / 100;
+      break;
+    case CHAR_TYPE:
+      vt[i].vt_un.un_char = (char)(' ' + r % 95);
+      break;
+    case INT_TYPE:
+      vt[i].vt_un.un_int = (int32_t)(r % 2000) - 1000;
+      break;
+    }
+  }
+}
+
+/* everything printed to 'out' so far, to compare */
+struct captured {
+  FILE *out;
+  char *text;
+  size_t size;
+};
+
+static void capture(struct captured *c) {
+  c->out = open_memstream(&c->text, &c->size);
+  if (c->out == NULL) {
+    perror("open_memstream");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void row(const char *what, double structs, double columns) {
+  printf("  %-12s %8.4f s %8.4f s %6.1fx\n", what, structs, columns,
+         structs / columns);
+}
+
+static void bench(const char *name, size_t n, size_t printed,
+                  bool clustered) {
+  struct var_type *vt = (struct var_type *)xmalloc(n * sizeof(*vt));
+  generate(vt, n, clustered);
+
+  struct variant_vector v;
+  vv_init(&v);
+  double start = now_seconds();
+  check(vv_append_structs(&v, vt, n), "append");
+  double build_time = now_seconds() - start;
+  size_t runs = 1;
+  for (size_t i = 1; i < n; i++)
+    runs += v.tags[i] != v.tags[i - 1];
+
+  printf("%s: %zu values, %.1f per run on average, columns built in %.4f "
+         "s\n",
+         name, n, (double)n / runs, build_time);
+  printf("  %-12s %10s %10s\n", "", "structs", "columns");
+
+  struct captured a, b;
+  size_t print_n = printed < n ? printed : n;
+  struct variant_vector first;
+  vv_init(&first);
+  check(vv_append_structs(&first, vt, print_n), "append");
+  capture(&a);
+  start = now_seconds();
+  print_structs(vt, print_n, a.out);
+  double t_structs = now_seconds() - start;
+  capture(&b);
+  start = now_seconds();
+  check(vv_print(&first, b.out), "print");
+  double t_columns = now_seconds() - start;
+  fclose(a.out);
+  fclose(b.out);
+  check(a.size == b.size && memcmp(a.text, b.text, a.size) == 0, "print");
+  row("print", t_structs, t_columns);
+  free(a.text);
+  free(b.text);
+  vv_free(&first);
+
+  start = now_seconds();
+  double sum_a = sum_structs(vt, n);
+  t_structs = now_seconds() - start;
+  start = now_seconds();
+  double sum_b = vv_sum(&v);
+  t_columns = now_seconds() - start;
+  check(fabs(sum_a - sum_b) <= 1e-9 * (fabs(sum_a) + n), "sum");
+  row("sum", t_structs, t_columns);
+
+  double *da = (double *)xmalloc(n * sizeof(double));
+  double *db = (double *)xmalloc(n * sizeof(double));
+  memset(da, 0, n * sizeof(double));
+  memset(db, 0, n * sizeof(double));
+  start = now_seconds();
+  structs_to_double(vt, n, da);
+  t_structs = now_seconds() - start;
+  start = now_seconds();
+  vv_to_double(&v, db);
+  t_columns = now_seconds() - start;
+  check(memcmp(da, db, n * sizeof(double)) == 0, "convert");
+  row("convert", t_structs, t_columns);
+
+  struct var_type *kept = (struct var_type *)xmalloc(n * sizeof(*kept));
+  memset(kept, 0, n * sizeof(*kept));
+  struct variant_vector filtered;
+  vv_init(&filtered);
+  start = now_seconds();
+  size_t kept_n = filter_structs(vt, n, THRESHOLD, kept);
+  t_structs = now_seconds() - start;
+  start = now_seconds();
+  check(vv_filter_greater(&v, THRESHOLD, &filtered), "filter");
+  t_columns = now_seconds() - start;
+  check(filtered.length == kept_n, "filter");
+  structs_to_double(kept, kept_n, da);
+  vv_to_double(&filtered, db);
+  check(memcmp(da, db, kept_n * sizeof(double)) == 0, "filter");
+  for (size_t i = 0; i < kept_n; i++)
+    check(filtered.tags[i] == kept[i].type_in_union, "filter");
+  row("filter", t_structs, t_columns);
+
+  printf("  bytes per value: %zu as structs, %.2f as columns\n",
+         sizeof(struct var_type),
+         (double)(v.length + v.float_count * sizeof(float) + v.char_count +
+                  v.int_count * sizeof(int32_t)) /
+             n);
+
+  vv_free(&filtered);
+  vv_free(&v);
+  free(kept);
+  free(da);
+  free(db);
+  free(vt);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = DEFAULT_VALUES;
+  size_t printed = DEFAULT_PRINTED;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+    switch (opt) {
+    case 'n':
+      n = strtoull(optarg, NULL, 10);
+      break;
+    case 'p':
+      printed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n values] [-p printed_values]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (n < 1) {
+    fprintf(stderr, "Number of values out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  bench("mixed", n, printed, false);
+  bench("clustered", n, printed, true);
+  exit(EXIT_SUCCESS);
+}
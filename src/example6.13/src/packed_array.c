@@ -0,0 +1,256 @@
+/*
+ *
+ * Arrays of small records packed back to back.
+ *
+ * A structure of bit-fields like the one in example 6.13 still
+ * takes at least a whole storage unit per record, and usually
+ * more: the fields there need 11 bits, but the structure takes 8
+ * bytes.  A packed_array stores 'length' values of 'bits' bits
+ * each in consecutive bits of an array of 64-bit words, lowest
+ * bit first, so a value may straddle two words.  One spare word
+ * is kept at the end so a read of two words never runs off it.
+ *
+ * The values are usually records of several fields.  A field is
+ * named by its shift and width within the value, and the bulk
+ * calls move one field of a run of records to or from an array
+ * of bytes, one byte per record.  On x86-64 processors with BMI2
+ * they work on as many records as fit in 64 bits at once: pext
+ * gathers the field's bits out of the records and pdep spreads
+ * them into bytes, or the other way round.  (pdep and pext are
+ * microcoded, and slow, on AMD processors before Zen 3.)
+ * Elsewhere each record is done on its own.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_BMI2_PATH 1
+#else
+#define HAVE_BMI2_PATH 0
+#endif
+
+#define WORD_BITS 64
+
+struct packed_array {
+  uint64_t *words;
+  size_t length;
+  unsigned bits;
+};
+
+static inline uint64_t low_mask(unsigned len) {
+  return len == WORD_BITS ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+}
+
+/* 'len' bits, 1 to 64, starting at bit 'pos' */
+static inline uint64_t read_bits(const uint64_t *words, size_t pos,
+                                 unsigned len) {
+  size_t word = pos / WORD_BITS;
+  unsigned off = pos % WORD_BITS;
+  uint64_t v = words[word] >> off;
+  if (off + len > WORD_BITS)
+    v |= words[word + 1] << (WORD_BITS - off);
+  return v & low_mask(len);
+}
+
+static inline void write_bits(uint64_t *words, size_t pos, unsigned len,
+                              uint64_t v) {
+  size_t word = pos / WORD_BITS;
+  unsigned off = pos % WORD_BITS;
+  uint64_t mask = low_mask(len);
+  v &= mask;
+  words[word] = (words[word] & ~(mask << off)) | (v << off);
+  if (off + len > WORD_BITS) {
+    unsigned done = WORD_BITS - off;
+    words[word + 1] = (words[word + 1] & ~(mask >> done)) | (v >> done);
+  }
+}
+
+/* an array of 'length' zeros of 'bits' bits each, or NULL */
+struct packed_array *packed_create(size_t length, unsigned bits) {
+  if (bits < 1 || bits > WORD_BITS || length > SIZE_MAX / WORD_BITS)
+    return NULL;
+  struct packed_array *a = (struct packed_array *)malloc(sizeof(*a));
+  if (a == NULL)
+    return NULL;
+  size_t words = (length * bits + WORD_BITS - 1) / WORD_BITS + 1;
+  a->words = (uint64_t *)calloc(words, sizeof(uint64_t));
+  if (a->words == NULL) {
+    free(a);
+    return NULL;
+  }
+  a->length = length;
+  a->bits = bits;
+  return a;
+}
+
+void packed_destroy(struct packed_array *a) {
+  free(a->words);
+  free(a);
+}
+
+/* the storage used, in bytes */
+size_t packed_bytes(const struct packed_array *a) {
+  return ((a->length * a->bits + WORD_BITS - 1) / WORD_BITS + 1) *
+         sizeof(uint64_t);
+}
+
+uint64_t packed_get(const struct packed_array *a, size_t i) {
+  return read_bits(a->words, i * a->bits, a->bits);
+}
+
+void packed_set(struct packed_array *a, size_t i, uint64_t v) {
+  write_bits(a->words, i * a->bits, a->bits, v);
+}
+
+/* -------- one field of many records -------- */
+
+static bool portable_only;
+
+static void unpack_portable(const struct packed_array *a, size_t first,
+                            size_t n, unsigned shift, unsigned width,
+                            uint8_t *out) {
+  size_t pos = first * a->bits + shift;
+  for (size_t i = 0; i < n; i++, pos += a->bits)
+    out[i] = (uint8_t)read_bits(a->words, pos, width);
+}
+
+static void pack_portable(struct packed_array *a, size_t first, size_t n,
+                          unsigned shift, unsigned width, const uint8_t *in) {
+  size_t pos = first * a->bits + shift;
+  for (size_t i = 0; i < n; i++, pos += a->bits)
+    write_bits(a->words, pos, width, in[i]);
+}
+
+#if HAVE_BMI2_PATH
+
+/*
+ * A group is as many records as can be loaded with one unaligned
+ * 64-bit read at any bit offset, up to 57 bits, but no more than
+ * 8, one per byte of the other side.  field_mask picks the field
+ * out of every record of a group, byte_mask the low 'width' bits
+ * of every byte.
+ */
+struct group {
+  unsigned records;
+  unsigned bits;
+  uint64_t field_mask;
+  uint64_t byte_mask;
+};
+
+static struct group group_of(unsigned bits, unsigned shift, unsigned width) {
+  struct group g = {(WORD_BITS - 7) / bits, 0, 0, 0};
+  if (g.records > 8)
+    g.records = 8;
+  g.bits = g.records * bits;
+  for (unsigned j = 0; j < g.records; j++) {
+    g.field_mask |= low_mask(width) << (j * bits + shift);
+    g.byte_mask |= low_mask(width) << (j * 8);
+  }
+  return g;
+}
+
+/* x86-64 is little-endian, so bit 'pos' is bit pos % 8 of byte pos / 8 */
+static inline uint64_t load_at(const uint64_t *words, size_t pos) {
+  uint64_t v;
+  memcpy(&v, (const uint8_t *)words + pos / 8, sizeof(v));
+  return v >> (pos % 8);
+}
+
+__attribute__((target("bmi2"))) static void
+unpack_bmi2(const struct packed_array *a, size_t first, size_t n,
+            unsigned shift, unsigned width, uint8_t *out) {
+  struct group g = group_of(a->bits, shift, width);
+  if (g.records == 0) {
+    unpack_portable(a, first, n, shift, width, out);
+    return;
+  }
+  size_t pos = first * a->bits;
+  size_t i = 0;
+  /* whole 8-byte stores; the next group overwrites the extra bytes */
+  for (; i + 8 <= n; i += g.records, pos += g.bits) {
+    uint64_t records = load_at(a->words, pos);
+    uint64_t bytes =
+        _pdep_u64(_pext_u64(records, g.field_mask), g.byte_mask);
+    memcpy(out + i, &bytes, sizeof(bytes));
+  }
+  unpack_portable(a, first + i, n - i, shift, width, out + i);
+}
+
+__attribute__((target("bmi2"))) static void
+pack_bmi2(struct packed_array *a, size_t first, size_t n, unsigned shift,
+          unsigned width, const uint8_t *in) {
+  struct group g = group_of(a->bits, shift, width);
+  if (g.records == 0) {
+    pack_portable(a, first, n, shift, width, in);
+    return;
+  }
+  size_t pos = first * a->bits;
+  size_t i = 0;
+  for (; i + 8 <= n; i += g.records, pos += g.bits) {
+    uint64_t bytes;
+    memcpy(&bytes, in + i, sizeof(bytes));
+    uint64_t field = _pdep_u64(_pext_u64(bytes, g.byte_mask), g.field_mask);
+    uint8_t *at = (uint8_t *)a->words + pos / 8;
+    uint64_t v;
+    memcpy(&v, at, sizeof(v));
+    v = (v & ~(g.field_mask << (pos % 8))) | (field << (pos % 8));
+    memcpy(at, &v, sizeof(v));
+  }
+  pack_portable(a, first + i, n - i, shift, width, in + i);
+}
+
+#endif
+
+bool packed_have_bmi2(void) {
+#if HAVE_BMI2_PATH
+  return __builtin_cpu_supports("bmi2");
+#else
+  return false;
+#endif
+}
+
+/* use the one-record-at-a-time code even where BMI2 is available */
+void packed_force_portable(bool portable) { portable_only = portable; }
+
+static bool field_ok(const struct packed_array *a, size_t first, size_t n,
+                     unsigned shift, unsigned width) {
+  return width >= 1 && width <= 8 && shift + width <= a->bits &&
+         first <= a->length && n <= a->length - first;
+}
+
+/*
+ * Copy the field at 'shift' and 'width' bits, at most 8, of
+ * records first to first + n - 1 into out[0] to out[n - 1].
+ * False if the field or the records are out of range.
+ */
+bool packed_unpack_field(const struct packed_array *a, size_t first, size_t n,
+                         unsigned shift, unsigned width, uint8_t *out) {
+  if (!field_ok(a, first, n, shift, width))
+    return false;
+#if HAVE_BMI2_PATH
+  if (!portable_only && packed_have_bmi2()) {
+    unpack_bmi2(a, first, n, shift, width, out);
+    return true;
+  }
+#endif
+  unpack_portable(a, first, n, shift, width, out);
+  return true;
+}
+
+/* the reverse; only the low 'width' bits of each byte are used */
+bool packed_pack_field(struct packed_array *a, size_t first, size_t n,
+                       unsigned shift, unsigned width, const uint8_t *in) {
+  if (!field_ok(a, first, n, shift, width))
+    return false;
+#if HAVE_BMI2_PATH
+  if (!portable_only && packed_have_bmi2()) {
+    pack_bmi2(a, first, n, shift, width, in);
+    return true;
+  }
+#endif
+  pack_portable(a, first, n, shift, width, in);
+  return true;
+}
@@ -0,0 +1,346 @@
+/*
+ *
+ * The fields of example 6.13, packed.
+ *
+ * The record is listed once, as field names and widths, and the
+ * compiler works out each field's bit offset and the record size
+ * from a layout structure of char arrays, one char per bit.  The
+ * get and set functions for each field are generated from the
+ * list, so every shift and mask in them is a constant.  The
+ * unnamed padding fields of example 6.13 are left out: packed,
+ * a record is 4 + 1 + 6 = 11 bits.  As in the example, field2
+ * is signed, and holds 0 or -1.
+ *
+ * The program fills an array of records from byte arrays, one
+ * per field, with the bulk calls of packed_array.c, reads them
+ * back, and checks the results against the generated accessors
+ * and against the structure of bit-fields, reporting the space
+ * each takes and how fast the fields are unpacked.
+ *
+ * usage: example6.13-packed [-n records]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_RECORDS 50000000
+
+struct packed_array {
+  uint64_t *words;
+  size_t length;
+  unsigned bits;
+};
+
+struct packed_array *packed_create(size_t length, unsigned bits);
+void packed_destroy(struct packed_array *a);
+size_t packed_bytes(const struct packed_array *a);
+uint64_t packed_get(const struct packed_array *a, size_t i);
+void packed_set(struct packed_array *a, size_t i, uint64_t v);
+bool packed_have_bmi2(void);
+void packed_force_portable(bool portable);
+bool packed_unpack_field(const struct packed_array *a, size_t first, size_t n,
+                         unsigned shift, unsigned width, uint8_t *out);
+bool packed_pack_field(struct packed_array *a, size_t first, size_t n,
+                       unsigned shift, unsigned width, const uint8_t *in);
+
+/* the structure of example 6.13 */
+struct {
+  unsigned field1 : 4;
+  unsigned : 3;
+  signed field2 : 1;
+  unsigned : 0;
+  unsigned field3 : 6;
+} full_of_fields;
+
+typedef __typeof__(full_of_fields) full_of_fields_t;
+
+/* the fields of a record, in order from the lowest bit */
+#define RECORD_FIELDS(FIELD)                                                 \
+  FIELD(field1, 4, UNSIGNED)                                                 \
+  FIELD(field2, 1, SIGNED)                                                   \
+  FIELD(field3, 6, UNSIGNED)
+
+/*
+ * Never created; one char per bit, so that offsetof gives each
+ * field's bit offset and sizeof the bits in a record.
+ */
+struct record_layout {
+#define FIELD(name, width, sign) char name[width];
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+};
+
+enum {
+#define FIELD(name, width, sign)                                             \
+  SHIFT_OF_##name = offsetof(struct record_layout, name),                    \
+  WIDTH_OF_##name = width,
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+  RECORD_BITS = sizeof(struct record_layout)
+};
+
+#define EXTEND_UNSIGNED(v, width) ((int)(v))
+#define EXTEND_SIGNED(v, width)                                              \
+  ((int)((int64_t)((v) << (64 - (width))) >> (64 - (width))))
+
+/* the same word arithmetic as packed_array.c, with constant widths */
+static inline uint64_t record_bits(const uint64_t *words, size_t pos,
+                                   unsigned len) {
+  size_t word = pos / 64;
+  unsigned off = pos % 64;
+  uint64_t v = words[word] >> off;
+  if (off + len > 64)
+    v |= words[word + 1] << (64 - off);
+  return v & (((uint64_t)1 << len) - 1);
+}
+
+static inline void set_record_bits(uint64_t *words, size_t pos, unsigned len,
+                                   uint64_t v) {
+  size_t word = pos / 64;
+  unsigned off = pos % 64;
+  uint64_t mask = ((uint64_t)1 << len) - 1;
+  v &= mask;
+  words[word] = (words[word] & ~(mask << off)) | (v << off);
+  if (off + len > 64) {
+    unsigned done = 64 - off;
+    words[word + 1] = (words[word + 1] & ~(mask >> done)) | (v >> done);
+  }
+}
+
+/* record_get_field1(a, i), record_set_field1(a, i, v), and so on */
+#define FIELD(name, width, sign)                                             \
+  static inline int record_get_##name(const struct packed_array *a,          \
+                                      size_t i) {                            \
+    uint64_t v =                                                             \
+        record_bits(a->words, i * RECORD_BITS + SHIFT_OF_##name, width);     \
+    return EXTEND_##sign(v, width);                                          \
+  }                                                                          \
+  static inline void record_set_##name(struct packed_array *a, size_t i,     \
+                                       int v) {                              \
+    set_record_bits(a->words, i * RECORD_BITS + SHIFT_OF_##name, width,      \
+                    (uint64_t)v);                                            \
+  }
+RECORD_FIELDS(FIELD)
+#undef FIELD
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "%s: results differ\n", what);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* one byte per record and field, as the bulk calls take them */
+struct columns {
+#define FIELD(name, width, sign) uint8_t *name;
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+};
+
+static struct columns columns_create(size_t n) {
+  struct columns c;
+#define FIELD(name, width, sign) c.name = (uint8_t *)xmalloc(n);
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+  return c;
+}
+
+static void columns_free(struct columns *c) {
+#define FIELD(name, width, sign) free(c->name);
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+}
+
+static bool columns_equal(const struct columns *a, const struct columns *b,
+                          size_t n) {
+  bool ok = true;
+#define FIELD(name, width, sign) ok = ok && memcmp(a->name, b->name, n) == 0;
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+  return ok;
+}
+
+static double pack_all(struct packed_array *a, const struct columns *c) {
+  double start = now_seconds();
+#define FIELD(name, width, sign)                                             \
+  check(packed_pack_field(a, 0, a->length, SHIFT_OF_##name, width, c->name), \
+        "pack " #name);
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+  return now_seconds() - start;
+}
+
+static double unpack_all(const struct packed_array *a, struct columns *c) {
+  double start = now_seconds();
+#define FIELD(name, width, sign)                                             \
+  check(packed_unpack_field(a, 0, a->length, SHIFT_OF_##name, width,         \
+                            c->name),                                        \
+        "unpack " #name);
+  RECORD_FIELDS(FIELD)
+#undef FIELD
+  return now_seconds() - start;
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = DEFAULT_RECORDS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      n = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n records]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (n < 1) {
+    fprintf(stderr, "Number of records out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct columns in = columns_create(n);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t r = next_random();
+#define FIELD(name, width, sign)                                             \
+  in.name[i] = (uint8_t)(r & ((1U << (width)) - 1));                         \
+  r >>= 8;
+    RECORD_FIELDS(FIELD)
+#undef FIELD
+  }
+
+  struct packed_array *a = packed_create(n, RECORD_BITS);
+  struct packed_array *b = packed_create(n, RECORD_BITS);
+  if (a == NULL || b == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  full_of_fields_t *structs =
+      (full_of_fields_t *)xmalloc(n * sizeof(full_of_fields_t));
+  /* touch every page now, so the first timed run doesn't fault them in */
+  memset(a->words, 0, packed_bytes(a));
+  memset(b->words, 0, packed_bytes(b));
+  memset(structs, 0, n * sizeof(full_of_fields_t));
+
+  printf("%zu records of %d bits\n", n, RECORD_BITS);
+  printf("  packed:            %6.3f bytes per record\n",
+         (double)packed_bytes(a) / n);
+  printf("  bit-field struct:  %6zu bytes per record\n",
+         sizeof(full_of_fields_t));
+
+  /* filling: bulk, field by field accessors, and the bit-fields */
+  bool bmi2 = packed_have_bmi2();
+  packed_force_portable(false);
+  double bulk_pack = pack_all(a, &in);
+
+  double start = now_seconds();
+  for (size_t i = 0; i < n; i++) {
+#define FIELD(name, width, sign) record_set_##name(b, i, in.name[i]);
+    RECORD_FIELDS(FIELD)
+#undef FIELD
+  }
+  double accessor_set = now_seconds() - start;
+  check(memcmp(a->words, b->words, packed_bytes(a)) == 0, "set");
+
+  start = now_seconds();
+  for (size_t i = 0; i < n; i++) {
+    structs[i].field1 = in.field1[i];
+    structs[i].field2 = -(int)in.field2[i];
+    structs[i].field3 = in.field3[i];
+  }
+  double struct_set = now_seconds() - start;
+
+  printf("filling\n");
+  printf("  %s  %8.4f s\n",
+         bmi2 ? "bulk, pdep/pext:  " : "bulk, portable:   ", bulk_pack);
+  printf("  accessors:         %8.4f s\n", accessor_set);
+  printf("  bit-field struct:  %8.4f s\n", struct_set);
+
+  /* reading every field back and summing */
+  int64_t packed_sum = 0, struct_sum = 0, generic_sum = 0;
+  start = now_seconds();
+  for (size_t i = 0; i < n; i++)
+    packed_sum += record_get_field1(a, i) + record_get_field2(a, i) +
+                  record_get_field3(a, i);
+  double accessor_get = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < n; i++) {
+    uint64_t r = packed_get(a, i);
+    generic_sum += (int)((r >> SHIFT_OF_field1) & 15) -
+                   (int)((r >> SHIFT_OF_field2) & 1) +
+                   (int)((r >> SHIFT_OF_field3) & 63);
+  }
+  double generic_get = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < n; i++)
+    struct_sum += structs[i].field1 + structs[i].field2 + structs[i].field3;
+  double struct_get = now_seconds() - start;
+  check(packed_sum == struct_sum && packed_sum == generic_sum, "get");
+
+  printf("reading every field\n");
+  printf("  accessors:         %8.4f s\n", accessor_get);
+  printf("  packed_get:        %8.4f s\n", generic_get);
+  printf("  bit-field struct:  %8.4f s\n", struct_get);
+
+  /* unpacking into bytes, both ways where there is a choice */
+  struct columns out = columns_create(n);
+  double packed_gb = packed_bytes(a) / 1e9;
+  printf("unpacking all fields to bytes\n");
+  for (int portable = bmi2 ? 0 : 1; portable <= 1; portable++) {
+    packed_force_portable(portable);
+    memset(out.field1, 0xff, n);
+    double t = unpack_all(a, &out);
+    check(columns_equal(&in, &out, n), "unpack");
+    printf("  %s  %8.4f s, %5.2f GB/s packed, %6.1f M records/s\n",
+           portable ? "portable:         " : "pdep/pext:        ", t,
+           packed_gb / t, n / t / 1e6);
+  }
+  printf("packing all fields from bytes\n");
+  for (int portable = bmi2 ? 0 : 1; portable <= 1; portable++) {
+    packed_force_portable(portable);
+    memset(b->words, 0, packed_bytes(b));
+    double t = pack_all(b, &in);
+    check(memcmp(a->words, b->words, packed_bytes(a)) == 0, "pack");
+    printf("  %s  %8.4f s, %5.2f GB/s packed, %6.1f M records/s\n",
+           portable ? "portable:         " : "pdep/pext:        ", t,
+           packed_gb / t, n / t / 1e6);
+  }
+
+  columns_free(&in);
+  columns_free(&out);
+  packed_destroy(a);
+  packed_destroy(b);
+  free(structs);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,195 @@
+/*
+ *
+ * Natural merge sort for linked lists, and a pool to allocate
+ * the list elements from.
+ *
+ * list_merge_sort puts a list in the same order as sortfun in
+ * example 6.7, largest data first, keeping equal elements in
+ * their original order.  Like sortfun it only relinks elements;
+ * the data is not copied and no extra memory is needed.
+ *
+ * The pool hands out elements from large slabs, so that a list
+ * built from it sits in a few contiguous blocks of memory rather
+ * than wherever malloc put each element.
+ */
+#include <inttypes.h>
+#include <stdlib.h>
+
+struct list_ele {
+  int32_t data;
+  struct list_ele *pointer;
+};
+
+/*
+ * Cut the run starting at 'list' off the rest of the list.
+ * A run is as long a stretch as possible that is already in
+ * order.  Returns the last element of the run, and sets
+ * 'rest' to what follows it.
+ */
+static struct list_ele *cut_run(struct list_ele *list,
+                                struct list_ele **rest) {
+  while (list->pointer && list->pointer->data <= list->data)
+    list = list->pointer;
+  *rest = list->pointer;
+  list->pointer = 0;
+  return list;
+}
+
+/* merge two runs; on equal data, 'a' goes first */
+static struct list_ele *merge(struct list_ele *a, struct list_ele *b) {
+  struct list_ele dummy;
+  struct list_ele *thisp = &dummy;
+  while (a && b) {
+    if (a->data >= b->data) {
+      thisp->pointer = a;
+      a = a->pointer;
+    } else {
+      thisp->pointer = b;
+      b = b->pointer;
+    }
+    thisp = thisp->pointer;
+  }
+  thisp->pointer = a ? a : b;
+  return dummy.pointer;
+}
+
+/*
+ * Algorithm is this:
+ * Cut the list into runs that are already in order.  Keep
+ * pending[k] holding a sorted list of about 2^k runs, and add
+ * each new run like a carry in binary addition: merge it with
+ * pending[0], then that with pending[1], and so on up to the
+ * first empty slot.  Merges happen while the lists are still
+ * in cache, and at most 64 lists are ever pending, however
+ * long the input.  Earlier runs are always the first argument
+ * of merge, which keeps the sort stable.
+ */
+#define MAX_PENDING 64
+
+struct list_ele *list_merge_sort(struct list_ele *list) {
+  struct list_ele *pending[MAX_PENDING];
+  size_t used = 0;
+
+  while (list) {
+    struct list_ele *run = list;
+    cut_run(run, &list);
+    size_t k = 0;
+    for (; k < used && pending[k]; k++) {
+      run = merge(pending[k], run);
+      pending[k] = 0;
+    }
+    if (k == MAX_PENDING) /* can't happen with 2^64 runs */
+      k--;
+    if (k == used)
+      used++;
+    pending[k] = run;
+  }
+  /* merge what is left, later runs in the lower slots */
+  struct list_ele *result = 0;
+  for (size_t k = 0; k < used; k++)
+    if (pending[k])
+      result = result ? merge(pending[k], result) : pending[k];
+  return result;
+}
+
+/* -------- element pool -------- */
+
+struct slab {
+  struct slab *next;
+  size_t used;
+  struct list_ele elements[];
+};
+
+struct list_pool {
+  struct slab *slabs;
+  size_t slab_elements;
+  struct list_ele *free_list; /* linked through 'pointer' */
+};
+
+struct list_pool *list_pool_create(size_t slab_elements) {
+  struct list_pool *pool =
+      (struct list_pool *)malloc(sizeof(struct list_pool));
+  if (pool == 0)
+    return 0;
+  pool->slabs = 0;
+  pool->slab_elements = slab_elements ? slab_elements : 1;
+  pool->free_list = 0;
+  return pool;
+}
+
+static void free_slabs(struct slab *s) {
+  while (s) {
+    struct slab *next = s->next;
+    free(s);
+    s = next;
+  }
+}
+
+/* frees every element that came from the pool */
+void list_pool_destroy(struct list_pool *pool) {
+  free_slabs(pool->slabs);
+  free(pool);
+}
+
+struct list_ele *list_pool_alloc(struct list_pool *pool) {
+  struct list_ele *ele = pool->free_list;
+  if (ele) {
+    pool->free_list = ele->pointer;
+    return ele;
+  }
+  struct slab *s = pool->slabs;
+  if (s == 0 || s->used == pool->slab_elements) {
+    s = (struct slab *)malloc(sizeof(struct slab) +
+                              pool->slab_elements * sizeof(struct list_ele));
+    if (s == 0)
+      return 0;
+    s->next = pool->slabs;
+    s->used = 0;
+    pool->slabs = s;
+  }
+  return &s->elements[s->used++];
+}
+
+void list_pool_free(struct list_pool *pool, struct list_ele *ele) {
+  ele->pointer = pool->free_list;
+  pool->free_list = ele;
+}
+
+/*
+ * After sorting, following the list jumps about in memory.
+ * This copies the list into fresh slabs in list order and
+ * returns the new head; the old elements, and any others
+ * from the pool, are gone afterwards.  Returns 0, leaving
+ * the pool as it was, if there is no memory.
+ */
+struct list_ele *list_pool_relayout(struct list_pool *pool,
+                                    struct list_ele *list) {
+  struct slab *first = 0, *s = 0;
+  struct list_ele dummy, *tail = &dummy;
+  for (; list; list = list->pointer) {
+    if (s == 0 || s->used == pool->slab_elements) {
+      struct slab *next = (struct slab *)malloc(
+          sizeof(struct slab) + pool->slab_elements * sizeof(struct list_ele));
+      if (next == 0) {
+        free_slabs(first);
+        return 0;
+      }
+      next->next = 0;
+      next->used = 0;
+      if (s)
+        s->next = next;
+      else
+        first = next;
+      s = next;
+    }
+    struct list_ele *ele = &s->elements[s->used++];
+    ele->data = list->data;
+    tail->pointer = ele;
+    tail = ele;
+  }
+  tail->pointer = 0;
+  free_slabs(pool->slabs);
+  pool->slabs = first;
+  pool->free_list = 0;
+  return dummy.pointer;
+}
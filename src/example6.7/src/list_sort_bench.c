@@ -0,0 +1,283 @@
+/*
+ *
+ * Benchmark of the linked list merge sort against the bubble
+ * sort of example 6.7.
+ *
+ * For each size, a list of random numbers is built from the
+ * element pool and from one malloc per element, sorted with
+ * list_merge_sort, checked, and walked before and after being
+ * laid out again in list order.  The bubble sort takes time
+ * proportional to the square of the length, so it is only run
+ * on the first few thousand elements, and merge sort with it.
+ *
+ * usage: example6.7-listsort [-n max_elements]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_ELEMENTS 1000000
+#define DEFAULT_MAX_ELEMENTS 10000000
+#define BUBBLE_ELEMENTS 20000
+#define SLAB_ELEMENTS 65536
+
+struct list_ele {
+  int32_t data;
+  struct list_ele *pointer;
+};
+
+struct list_pool;
+struct list_ele *list_merge_sort(struct list_ele *list);
+struct list_pool *list_pool_create(size_t slab_elements);
+void list_pool_destroy(struct list_pool *pool);
+struct list_ele *list_pool_alloc(struct list_pool *pool);
+void list_pool_free(struct list_pool *pool, struct list_ele *ele);
+struct list_ele *list_pool_relayout(struct list_pool *pool,
+                                    struct list_ele *list);
+
+/* sortfun from example 6.7 */
+struct list_ele *sortfun(struct list_ele *list) {
+  bool exchange;
+  struct list_ele *nextp, *thisp, dummy;
+
+  dummy.pointer = list;
+  do {
+    exchange = false;
+    thisp = &dummy;
+    while ((nextp = thisp->pointer) && nextp->pointer) {
+      if (nextp->data < nextp->pointer->data) {
+        /* exchange */
+        exchange = true;
+        thisp->pointer = nextp->pointer;
+        nextp->pointer = thisp->pointer->pointer;
+        thisp->pointer->pointer = nextp;
+      }
+      thisp = thisp->pointer;
+    }
+  } while (exchange);
+  return dummy.pointer;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void out_of_memory(void) {
+  fprintf(stderr, "Out of memory\n");
+  exit(EXIT_FAILURE);
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/* a range small enough for plenty of equal elements */
+static int32_t random_data(size_t n) {
+  return (int32_t)(next_random() % n) - (int32_t)(n / 2);
+}
+
+static struct list_ele *build_pooled(struct list_pool *pool, size_t n) {
+  struct list_ele dummy, *tail = &dummy;
+  for (size_t i = 0; i < n; i++) {
+    struct list_ele *ele = list_pool_alloc(pool);
+    if (ele == 0)
+      out_of_memory();
+    ele->data = random_data(n);
+    tail->pointer = ele;
+    tail = ele;
+  }
+  tail->pointer = 0;
+  return dummy.pointer;
+}
+
+static struct list_ele *build_malloced(size_t n) {
+  struct list_ele dummy, *tail = &dummy;
+  for (size_t i = 0; i < n; i++) {
+    struct list_ele *ele = (struct list_ele *)malloc(sizeof(struct list_ele));
+    if (ele == 0)
+      out_of_memory();
+    ele->data = random_data(n);
+    tail->pointer = ele;
+    tail = ele;
+  }
+  tail->pointer = 0;
+  return dummy.pointer;
+}
+
+static void free_malloced(struct list_ele *list) {
+  while (list) {
+    struct list_ele *next = list->pointer;
+    free(list);
+    list = next;
+  }
+}
+
+static bool in_order(const struct list_ele *list, size_t n) {
+  size_t count = 0;
+  for (; list; list = list->pointer) {
+    count++;
+    if (list->pointer && list->data < list->pointer->data)
+      return false;
+  }
+  return count == n;
+}
+
+/* sum the list, so the walk can't be left out */
+static int64_t walk(const struct list_ele *list) {
+  int64_t sum = 0;
+  for (; list; list = list->pointer)
+    sum += list->data;
+  return sum;
+}
+
+/*
+ * Equal data can't show whether a sort was stable, but once
+ * the list is laid out in order, the addresses of the elements
+ * can: equal elements must still be in address order.  All of
+ * them go in one slab, so address order is list order.
+ */
+static bool check_stable(size_t n) {
+  struct list_pool *pool = list_pool_create(n);
+  if (pool == 0)
+    out_of_memory();
+  struct list_ele *list = build_pooled(pool, n);
+  for (struct list_ele *p = list; p; p = p->pointer)
+    p->data %= 100;
+  if ((list = list_pool_relayout(pool, list)) == 0)
+    out_of_memory();
+  list = list_merge_sort(list);
+  bool ok = in_order(list, n);
+  for (struct list_ele *p = list; ok && p && p->pointer; p = p->pointer)
+    if (p->data == p->pointer->data && p > p->pointer)
+      ok = false;
+  list_pool_destroy(pool);
+  return ok;
+}
+
+static void bench_bubble(size_t n) {
+  struct list_pool *pool = list_pool_create(SLAB_ELEMENTS);
+  if (pool == 0)
+    out_of_memory();
+  uint64_t saved_state = random_state;
+  struct list_ele *list = build_pooled(pool, n);
+  double start = now_seconds();
+  list = sortfun(list);
+  double bubble_time = now_seconds() - start;
+  bool ok = in_order(list, n);
+
+  random_state = saved_state;
+  list = build_pooled(pool, n);
+  start = now_seconds();
+  list = list_merge_sort(list);
+  double merge_time = now_seconds() - start;
+  ok = ok && in_order(list, n);
+  list_pool_destroy(pool);
+
+  printf("%zu elements\n", n);
+  printf("  example 6.7 bubble sort: %10.4f s\n", bubble_time);
+  printf("  merge sort:              %10.4f s, %.0fx%s\n", merge_time,
+         bubble_time / merge_time, ok ? "" : ", NOT SORTED");
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+static void bench(size_t n) {
+  struct list_pool *pool = list_pool_create(SLAB_ELEMENTS);
+  if (pool == 0)
+    out_of_memory();
+  double start = now_seconds();
+  struct list_ele *list = build_pooled(pool, n);
+  double pool_time = now_seconds() - start;
+
+  start = now_seconds();
+  int64_t sum = walk(list);
+  double walk_before = now_seconds() - start;
+
+  start = now_seconds();
+  list = list_merge_sort(list);
+  double sort_time = now_seconds() - start;
+  bool ok = in_order(list, n);
+
+  start = now_seconds();
+  bool same = walk(list) == sum;
+  double walk_sorted = now_seconds() - start;
+
+  start = now_seconds();
+  list = list_pool_relayout(pool, list);
+  double relayout_time = now_seconds() - start;
+  if (list == 0)
+    out_of_memory();
+
+  start = now_seconds();
+  same = same && walk(list) == sum;
+  double walk_after = now_seconds() - start;
+  ok = ok && same && in_order(list, n);
+  list_pool_destroy(pool);
+
+  /*
+   * After, not before: freeing millions of small blocks leaves
+   * malloc with a lot of tidying up to do on the next large
+   * allocation, which would be charged to the pool.
+   */
+  start = now_seconds();
+  struct list_ele *malloced = build_malloced(n);
+  double malloc_time = now_seconds() - start;
+  start = now_seconds();
+  malloced = list_merge_sort(malloced);
+  double malloc_sort_time = now_seconds() - start;
+  ok = ok && in_order(malloced, n);
+  free_malloced(malloced);
+
+  printf("%zu elements%s\n", n, ok ? "" : ", NOT SORTED");
+  printf("  build, malloc per element: %8.4f s\n", malloc_time);
+  printf("  build, from pool:          %8.4f s\n", pool_time);
+  printf("  merge sort, malloced:      %8.4f s\n", malloc_sort_time);
+  printf("  merge sort, pooled:        %8.4f s\n", sort_time);
+  printf("  walk before sort:          %8.4f s\n", walk_before);
+  printf("  walk after sort:           %8.4f s\n", walk_sorted);
+  printf("  lay out in list order:     %8.4f s\n", relayout_time);
+  printf("  walk after laying out:     %8.4f s\n", walk_after);
+  if (!ok)
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_elements = DEFAULT_MAX_ELEMENTS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      max_elements = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n max_elements]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (max_elements < 1 || max_elements > INT32_MAX) {
+    fprintf(stderr, "Number of elements out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  bool stable = check_stable(max_elements < 1000000 ? max_elements : 1000000);
+  printf("merge sort stability check: %s\n", stable ? "ok" : "FAILED");
+  if (!stable)
+    exit(EXIT_FAILURE);
+
+  bench_bubble(max_elements < BUBBLE_ELEMENTS ? max_elements
+                                              : BUBBLE_ELEMENTS);
+  size_t n = max_elements < MIN_ELEMENTS ? max_elements : MIN_ELEMENTS;
+  for (; n <= max_elements; n *= 10)
+    bench(n);
+  exit(EXIT_SUCCESS);
+}
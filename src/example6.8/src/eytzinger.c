@@ -0,0 +1,123 @@
+/*
+ *
+ * Frozen search trees in Eytzinger order.
+ *
+ * Example 6.8 lays a tree out in an array but still links the
+ * nodes with pointers.  For a table that is built once and then
+ * only searched, the pointers aren't needed: if the keys are
+ * stored in breadth first order, starting at index 1, the
+ * children of slot k are slots 2k and 2k+1.  The top levels of
+ * the tree share a few cache lines, and the 16 great-great-
+ * grandchildren of a slot share one, so it can be prefetched
+ * four levels ahead.
+ *
+ * eyt_freeze builds the array from keys in ascending order.
+ * The searches return the slot holding the key, or 0 if the
+ * key is not there.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CACHE_LINE 64
+#define KEYS_PER_LINE (CACHE_LINE / sizeof(int32_t))
+#define BATCH 16 /* lookups in flight at once */
+
+struct eytzinger {
+  int32_t *keys; /* keys[1..n]; keys[0] is unused */
+  size_t n;
+  size_t levels; /* longest path from the root */
+};
+
+/* fill slots in order of an in-order walk; returns next sorted index */
+static size_t fill(struct eytzinger *t, const int32_t *sorted, size_t i,
+                   size_t k) {
+  if (k <= t->n) {
+    i = fill(t, sorted, i, 2 * k);
+    t->keys[k] = sorted[i++];
+    i = fill(t, sorted, i, 2 * k + 1);
+  }
+  return i;
+}
+
+struct eytzinger *eyt_freeze(const int32_t *sorted, size_t n) {
+  struct eytzinger *t = (struct eytzinger *)malloc(sizeof(struct eytzinger));
+  if (t == NULL)
+    return NULL;
+  /* slot 0 starts a cache line, so slots 16k to 16k+15 share one */
+  size_t bytes = (n + KEYS_PER_LINE) * sizeof(int32_t);
+  bytes = (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  int32_t *mem = (int32_t *)aligned_alloc(CACHE_LINE, bytes);
+  if (mem == NULL) {
+    free(t);
+    return NULL;
+  }
+  t->keys = mem;
+  t->keys[0] = INT32_MIN; /* only read by finished batch lookups */
+  t->n = n;
+  t->levels = 0;
+  for (size_t k = n; k > 0; k >>= 1)
+    t->levels++;
+  fill(t, sorted, 0, 1);
+  return t;
+}
+
+void eyt_free(struct eytzinger *t) {
+  free(t->keys);
+  free(t);
+}
+
+int32_t eyt_key(const struct eytzinger *t, size_t slot) {
+  return t->keys[slot];
+}
+
+/*
+ * After the walk has fallen off the bottom of the tree, the
+ * last time it went left was at the smallest key >= v.  Each
+ * step appends a bit to k, 0 for left, so strip the trailing
+ * ones and then that zero.
+ */
+static size_t found_slot(const struct eytzinger *t, size_t k, int32_t v) {
+  k >>= __builtin_ffsll(~(long long)k);
+  return k != 0 && t->keys[k] == v ? k : 0;
+}
+
+size_t eyt_search(const struct eytzinger *t, int32_t v) {
+  const int32_t *keys = t->keys;
+  size_t k = 1;
+  while (k <= t->n) {
+    __builtin_prefetch(keys + KEYS_PER_LINE * k);
+    k = 2 * k + (keys[k] < v);
+  }
+  return found_slot(t, k, v);
+}
+
+/*
+ * Search for m keys at once.  The lookups of a batch all go down
+ * one level together, so their cache misses overlap instead of
+ * happening one after another.
+ */
+void eyt_search_batch(const struct eytzinger *t, const int32_t *v, size_t m,
+                      size_t *slots) {
+  const int32_t *keys = t->keys;
+  const size_t n = t->n;
+  size_t start = 0;
+  for (; start + BATCH <= m; start += BATCH) {
+    size_t k[BATCH];
+    for (size_t j = 0; j < BATCH; j++)
+      k[j] = 1;
+    for (size_t level = 0; level < t->levels; level++) {
+      for (size_t j = 0; j < BATCH; j++) {
+        /* once off the bottom, a lookup stays where it is */
+        size_t here = k[j] <= n ? k[j] : 0;
+        size_t next = 2 * k[j] + (keys[here] < v[start + j]);
+        k[j] = k[j] <= n ? next : k[j];
+        __builtin_prefetch(keys + KEYS_PER_LINE * (k[j] <= n ? k[j] : 0));
+      }
+    }
+    for (size_t j = 0; j < BATCH; j++)
+      slots[start + j] = found_slot(t, k[j], v[start + j]);
+  }
+  for (; start < m; start++)
+    slots[start] = eyt_search(t, v[start]);
+}
@@ -0,0 +1,212 @@
+/*
+ *
+ * Benchmark of frozen Eytzinger trees against pointer chasing.
+ *
+ * For each size, a balanced tree of the kind searched in example
+ * 6.8 is built with its nodes scattered through memory, as they
+ * would be after a run of mallocs, and the same keys are frozen
+ * into an Eytzinger array.  Random lookups, half of them for keys
+ * that are not there, are timed with t_search, with a binary
+ * search of the sorted keys, and with the single and batched
+ * Eytzinger searches.
+ *
+ * usage: example6.8-eytzinger [-n max_keys]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_KEYS 1000000
+#define DEFAULT_MAX_KEYS 10000000
+#define LOOKUPS 4000000
+
+struct eytzinger;
+struct eytzinger *eyt_freeze(const int32_t *sorted, size_t n);
+void eyt_free(struct eytzinger *t);
+int32_t eyt_key(const struct eytzinger *t, size_t slot);
+size_t eyt_search(const struct eytzinger *t, int32_t v);
+void eyt_search_batch(const struct eytzinger *t, const int32_t *v, size_t m,
+                      size_t *slots);
+
+struct tree_node {
+  int32_t data;
+  struct tree_node *left_p, *right_p;
+};
+
+/* t_search from example 6.8 */
+struct tree_node *t_search(struct tree_node *root, int32_t v) {
+
+  while (root) {
+    if (root->data == v)
+      return root;
+    if (root->data > v)
+      root = root->left_p;
+    else
+      root = root->right_p;
+  }
+  /* value not found, no tree left */
+  return 0;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/*
+ * Balanced tree over sorted[lo..hi), using the nodes in the
+ * order given by 'slot' so that neighbours in the tree are
+ * not neighbours in memory.
+ */
+static struct tree_node *build(struct tree_node *nodes, const size_t *slot,
+                               const int32_t *sorted, size_t lo, size_t hi) {
+  if (lo == hi)
+    return 0;
+  size_t mid = lo + (hi - lo) / 2;
+  struct tree_node *n = &nodes[slot[mid]];
+  n->data = sorted[mid];
+  n->left_p = build(nodes, slot, sorted, lo, mid);
+  n->right_p = build(nodes, slot, sorted, mid + 1, hi);
+  return n;
+}
+
+static bool binary_search(const int32_t *sorted, size_t n, int32_t v) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (sorted[mid] < v)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < n && sorted[lo] == v;
+}
+
+static void bench(size_t n) {
+  /* even keys 0, 2, 4 ... so odd lookups miss */
+  int32_t *sorted = (int32_t *)xmalloc(n * sizeof(int32_t));
+  for (size_t i = 0; i < n; i++)
+    sorted[i] = (int32_t)(2 * i);
+  int32_t *lookups = (int32_t *)xmalloc(LOOKUPS * sizeof(int32_t));
+  for (size_t i = 0; i < LOOKUPS; i++)
+    lookups[i] = (int32_t)(next_random() % (2 * n));
+
+  size_t *slot = (size_t *)xmalloc(n * sizeof(size_t));
+  for (size_t i = 0; i < n; i++)
+    slot[i] = i;
+  for (size_t i = n; i > 1; i--) {
+    size_t j = next_random() % i;
+    size_t tmp = slot[i - 1];
+    slot[i - 1] = slot[j];
+    slot[j] = tmp;
+  }
+  struct tree_node *nodes =
+      (struct tree_node *)xmalloc(n * sizeof(struct tree_node));
+  struct tree_node *root = build(nodes, slot, sorted, 0, n);
+  free(slot);
+
+  double start = now_seconds();
+  struct eytzinger *t = eyt_freeze(sorted, n);
+  if (t == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  double freeze_time = now_seconds() - start;
+
+  size_t found_tree = 0, found_binary = 0, found_eyt = 0, found_batch = 0;
+  bool agree = true;
+
+  start = now_seconds();
+  for (size_t i = 0; i < LOOKUPS; i++)
+    found_tree += t_search(root, lookups[i]) != 0;
+  double tree_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < LOOKUPS; i++)
+    found_binary += binary_search(sorted, n, lookups[i]);
+  double binary_time = now_seconds() - start;
+
+  start = now_seconds();
+  for (size_t i = 0; i < LOOKUPS; i++)
+    found_eyt += eyt_search(t, lookups[i]) != 0;
+  double eyt_time = now_seconds() - start;
+
+  size_t *slots = (size_t *)xmalloc(LOOKUPS * sizeof(size_t));
+  start = now_seconds();
+  eyt_search_batch(t, lookups, LOOKUPS, slots);
+  double batch_time = now_seconds() - start;
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    if (slots[i] == 0)
+      continue;
+    found_batch++;
+    if (eyt_key(t, slots[i]) != lookups[i])
+      agree = false;
+  }
+  agree = agree && found_tree == found_binary && found_tree == found_eyt &&
+          found_tree == found_batch;
+
+  printf("%zu keys, %d lookups, %zu found, frozen in %.3f s%s\n", n, LOOKUPS,
+         found_tree, freeze_time, agree ? "" : ", RESULTS DIFFER");
+  printf("  t_search:          %6.1f ns/lookup\n", tree_time / LOOKUPS * 1e9);
+  printf("  binary search:     %6.1f ns/lookup, %.1fx\n",
+         binary_time / LOOKUPS * 1e9, tree_time / binary_time);
+  printf("  eytzinger:         %6.1f ns/lookup, %.1fx\n",
+         eyt_time / LOOKUPS * 1e9, tree_time / eyt_time);
+  printf("  eytzinger batched: %6.1f ns/lookup, %.1fx\n",
+         batch_time / LOOKUPS * 1e9, tree_time / batch_time);
+
+  eyt_free(t);
+  free(slots);
+  free(nodes);
+  free(lookups);
+  free(sorted);
+  if (!agree)
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  size_t max_keys = DEFAULT_MAX_KEYS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      max_keys = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n max_keys]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (max_keys < 1 || max_keys > INT32_MAX / 2) {
+    fprintf(stderr, "Number of keys out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t n = max_keys < MIN_KEYS ? max_keys : MIN_KEYS;
+  for (; n <= max_keys; n *= 10)
+    bench(n);
+  exit(EXIT_SUCCESS);
+}
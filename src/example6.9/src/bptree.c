@@ -0,0 +1,509 @@
+/*
+ *
+ * B+-tree of int32_t keys.
+ *
+ * An ordered set that replaces the tree of example 6.9 when
+ * there are many keys.  Every node is four cache lines long
+ * and holds up to 60 keys (leaves) or 20 keys and 21 children
+ * (interior nodes), so a search touches only a handful of
+ * nodes, and the tree stays balanced whatever order the keys
+ * arrive in.  Leaves are chained together for range scans.
+ *
+ * Nodes are carved from 64 KB slabs, and freed nodes are kept
+ * on a free list for reuse, so there is no malloc per key.
+ */
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_SIZE 256
+#define CACHE_LINE 64
+#define SLAB_SIZE (64 * 1024)
+#define LEAF_KEYS 60
+#define INNER_KEYS 20
+#define LEAF_MIN (LEAF_KEYS / 2)
+#define INNER_MIN (INNER_KEYS / 2)
+#define BULK_LEAF_FILL 54 /* leave room for a few inserts per leaf */
+
+struct bpt_node {
+  uint16_t count; /* number of keys */
+  bool leaf;
+  union {
+    struct {
+      int32_t keys[LEAF_KEYS];
+      struct bpt_node *next;
+    } l;
+    struct {
+      int32_t keys[INNER_KEYS];
+      struct bpt_node *children[INNER_KEYS + 1];
+    } in;
+  } u;
+};
+
+_Static_assert(sizeof(struct bpt_node) == NODE_SIZE,
+               "a node should be exactly four cache lines");
+
+struct slab {
+  struct slab *next;
+};
+
+struct bptree {
+  struct bpt_node *root;
+  size_t keys;
+  size_t nodes;
+
+  /* node pool */
+  struct slab *slabs;
+  size_t slab_count;
+  char *carve;     /* next unused node in the newest slab */
+  char *carve_end;
+  struct bpt_node *free_nodes; /* linked through u.l.next */
+};
+
+/* -------- node pool -------- */
+
+static struct bpt_node *node_alloc(struct bptree *t, bool leaf) {
+  struct bpt_node *n = t->free_nodes;
+  if (n)
+    t->free_nodes = n->u.l.next;
+  else {
+    if (t->carve == t->carve_end) {
+      char *mem = (char *)aligned_alloc(CACHE_LINE, SLAB_SIZE);
+      if (mem == NULL)
+        return NULL;
+      struct slab *s = (struct slab *)mem;
+      s->next = t->slabs;
+      t->slabs = s;
+      t->slab_count++;
+      /* the first node's worth of the slab holds the slab header */
+      t->carve = mem + NODE_SIZE;
+      t->carve_end = mem + SLAB_SIZE;
+    }
+    n = (struct bpt_node *)t->carve;
+    t->carve += NODE_SIZE;
+  }
+  n->count = 0;
+  n->leaf = leaf;
+  if (leaf)
+    n->u.l.next = NULL;
+  t->nodes++;
+  return n;
+}
+
+static void node_free(struct bptree *t, struct bpt_node *n) {
+  n->u.l.next = t->free_nodes;
+  t->free_nodes = n;
+  t->nodes--;
+}
+
+struct bptree *bpt_create(void) {
+  struct bptree *t = (struct bptree *)calloc(1, sizeof(struct bptree));
+  if (t == NULL)
+    return NULL;
+  t->root = node_alloc(t, true);
+  if (t->root == NULL) {
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+void bpt_destroy(struct bptree *t) {
+  while (t->slabs) {
+    struct slab *s = t->slabs;
+    t->slabs = s->next;
+    free(s);
+  }
+  free(t);
+}
+
+size_t bpt_size(const struct bptree *t) { return t->keys; }
+
+/* bytes of memory taken by the tree */
+size_t bpt_bytes(const struct bptree *t) {
+  return t->slab_count * SLAB_SIZE + sizeof(struct bptree);
+}
+
+/* -------- searching -------- */
+
+/* number of keys less than v; written to compile without branches */
+static size_t count_less(const int32_t *keys, size_t n, int32_t v) {
+  size_t i = 0;
+  for (size_t j = 0; j < n; j++)
+    i += keys[j] < v;
+  return i;
+}
+
+/* number of keys less than or equal to v, i.e. the child to follow */
+static size_t count_not_greater(const int32_t *keys, size_t n, int32_t v) {
+  size_t i = 0;
+  for (size_t j = 0; j < n; j++)
+    i += keys[j] <= v;
+  return i;
+}
+
+static const struct bpt_node *find_leaf(const struct bptree *t, int32_t v) {
+  const struct bpt_node *n = t->root;
+  while (!n->leaf)
+    n = n->u.in.children[count_not_greater(n->u.in.keys, n->count, v)];
+  return n;
+}
+
+bool bpt_search(const struct bptree *t, int32_t v) {
+  const struct bpt_node *leaf = find_leaf(t, v);
+  size_t i = count_less(leaf->u.l.keys, leaf->count, v);
+  return i < leaf->count && leaf->u.l.keys[i] == v;
+}
+
+/*
+ * Copy the keys from lo to hi inclusive, in order, to 'out'.
+ * Stops after 'max' keys; returns how many were copied.
+ */
+size_t bpt_range(const struct bptree *t, int32_t lo, int32_t hi, int32_t *out,
+                 size_t max) {
+  const struct bpt_node *leaf = find_leaf(t, lo);
+  size_t i = count_less(leaf->u.l.keys, leaf->count, lo);
+  size_t found = 0;
+  while (leaf && found < max) {
+    for (; i < leaf->count && found < max; i++) {
+      if (leaf->u.l.keys[i] > hi)
+        return found;
+      out[found++] = leaf->u.l.keys[i];
+    }
+    leaf = leaf->u.l.next;
+    i = 0;
+  }
+  return found;
+}
+
+/* -------- insertion -------- */
+
+enum insert_result { INSERTED, PRESENT, NO_MEMORY, SPLIT };
+
+static enum insert_result insert_leaf(struct bptree *t, struct bpt_node *n,
+                                      int32_t v, int32_t *up_key,
+                                      struct bpt_node **up_node) {
+  size_t pos = count_less(n->u.l.keys, n->count, v);
+  if (pos < n->count && n->u.l.keys[pos] == v)
+    return PRESENT;
+  if (n->count < LEAF_KEYS) {
+    memmove(&n->u.l.keys[pos + 1], &n->u.l.keys[pos],
+            (n->count - pos) * sizeof(int32_t));
+    n->u.l.keys[pos] = v;
+    n->count++;
+    return INSERTED;
+  }
+
+  struct bpt_node *right = node_alloc(t, true);
+  if (right == NULL)
+    return NO_MEMORY;
+  size_t keep = (LEAF_KEYS + 1) / 2;
+  int32_t all[LEAF_KEYS + 1];
+  memcpy(all, n->u.l.keys, pos * sizeof(int32_t));
+  all[pos] = v;
+  memcpy(all + pos + 1, n->u.l.keys + pos, (LEAF_KEYS - pos) * sizeof(int32_t));
+  memcpy(n->u.l.keys, all, keep * sizeof(int32_t));
+  memcpy(right->u.l.keys, all + keep,
+         (LEAF_KEYS + 1 - keep) * sizeof(int32_t));
+  n->count = keep;
+  right->count = LEAF_KEYS + 1 - keep;
+  right->u.l.next = n->u.l.next;
+  n->u.l.next = right;
+  *up_key = right->u.l.keys[0];
+  *up_node = right;
+  return SPLIT;
+}
+
+static enum insert_result insert_node(struct bptree *t, struct bpt_node *n,
+                                      int32_t v, int32_t *up_key,
+                                      struct bpt_node **up_node) {
+  if (n->leaf)
+    return insert_leaf(t, n, v, up_key, up_node);
+
+  size_t i = count_not_greater(n->u.in.keys, n->count, v);
+  int32_t key;
+  struct bpt_node *child;
+  enum insert_result r = insert_node(t, n->u.in.children[i], v, &key, &child);
+  if (r != SPLIT)
+    return r;
+
+  if (n->count < INNER_KEYS) {
+    memmove(&n->u.in.keys[i + 1], &n->u.in.keys[i],
+            (n->count - i) * sizeof(int32_t));
+    memmove(&n->u.in.children[i + 2], &n->u.in.children[i + 1],
+            (n->count - i) * sizeof(struct bpt_node *));
+    n->u.in.keys[i] = key;
+    n->u.in.children[i + 1] = child;
+    n->count++;
+    return INSERTED;
+  }
+
+  /* split: the middle key moves up to the parent */
+  struct bpt_node *right = node_alloc(t, false);
+  if (right == NULL)
+    return NO_MEMORY;
+  int32_t keys[INNER_KEYS + 1];
+  struct bpt_node *children[INNER_KEYS + 2];
+  memcpy(keys, n->u.in.keys, i * sizeof(int32_t));
+  keys[i] = key;
+  memcpy(keys + i + 1, n->u.in.keys + i, (INNER_KEYS - i) * sizeof(int32_t));
+  memcpy(children, n->u.in.children, (i + 1) * sizeof(struct bpt_node *));
+  children[i + 1] = child;
+  memcpy(children + i + 2, n->u.in.children + i + 1,
+         (INNER_KEYS - i) * sizeof(struct bpt_node *));
+
+  size_t mid = (INNER_KEYS + 1) / 2;
+  n->count = mid;
+  memcpy(n->u.in.keys, keys, mid * sizeof(int32_t));
+  memcpy(n->u.in.children, children, (mid + 1) * sizeof(struct bpt_node *));
+  right->count = INNER_KEYS - mid;
+  memcpy(right->u.in.keys, keys + mid + 1, right->count * sizeof(int32_t));
+  memcpy(right->u.in.children, children + mid + 1,
+         (right->count + 1) * sizeof(struct bpt_node *));
+  *up_key = keys[mid];
+  *up_node = right;
+  return SPLIT;
+}
+
+/*
+ * Insert v.  As t_insert in example 6.9, returns 0 for success,
+ * 1 for value already in tree, 2 for malloc error.
+ */
+int32_t bpt_insert(struct bptree *t, int32_t v) {
+  int32_t key;
+  struct bpt_node *right;
+  enum insert_result r = insert_node(t, t->root, v, &key, &right);
+  if (r == SPLIT) {
+    struct bpt_node *root = node_alloc(t, false);
+    if (root == NULL)
+      return 2;
+    root->count = 1;
+    root->u.in.keys[0] = key;
+    root->u.in.children[0] = t->root;
+    root->u.in.children[1] = right;
+    t->root = root;
+  }
+  if (r == PRESENT)
+    return 1;
+  if (r == NO_MEMORY)
+    return 2;
+  t->keys++;
+  return 0;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Build the levels above 'nodes' until one node is left.
+ * 'low' holds the smallest key under each node.
+ */
+static int32_t build_levels(struct bptree *t, struct bpt_node **nodes,
+                            int32_t *low, size_t count) {
+  while (count > 1) {
+    size_t parents = (count + INNER_KEYS) / (INNER_KEYS + 1);
+    size_t next = 0;
+    for (size_t p = 0; p < parents; p++) {
+      /* share the children out evenly so no node is underfull */
+      size_t take = count / parents + (p < count % parents);
+      struct bpt_node *parent = node_alloc(t, false);
+      if (parent == NULL)
+        return 2;
+      parent->count = take - 1;
+      for (size_t c = 0; c < take; c++) {
+        parent->u.in.children[c] = nodes[next + c];
+        if (c > 0)
+          parent->u.in.keys[c - 1] = low[next + c];
+      }
+      nodes[p] = parent;
+      low[p] = low[next];
+      next += take;
+    }
+    count = parents;
+  }
+  t->root = nodes[0];
+  return 0;
+}
+
+/*
+ * Insert n keys in any order.  An empty tree is built bottom up
+ * from the sorted keys; otherwise they are inserted in sorted
+ * order, which keeps the path being changed in cache.
+ * Returns 0 for success, 2 for malloc error.
+ */
+int32_t bpt_bulk_insert(struct bptree *t, const int32_t *keys, size_t n) {
+  if (n == 0)
+    return 0;
+  int32_t *sorted = (int32_t *)malloc(n * sizeof(int32_t));
+  if (sorted == NULL)
+    return 2;
+  memcpy(sorted, keys, n * sizeof(int32_t));
+  qsort(sorted, n, sizeof(int32_t), compare_keys);
+  size_t unique = 1;
+  for (size_t i = 1; i < n; i++)
+    if (sorted[i] != sorted[unique - 1])
+      sorted[unique++] = sorted[i];
+
+  int32_t result = 0;
+  if (t->keys > 0) {
+    for (size_t i = 0; i < unique && result != 2; i++)
+      result = bpt_insert(t, sorted[i]) == 2 ? 2 : 0;
+    free(sorted);
+    return result;
+  }
+
+  /*
+   * BULK_LEAF_FILL keys a leaf, but no fewer than LEAF_MIN unless
+   * there is only one: 55 keys make one leaf, not 27 and 28.
+   */
+  size_t leaves = (unique + BULK_LEAF_FILL - 1) / BULK_LEAF_FILL;
+  if (leaves > 1 && unique / leaves < LEAF_MIN)
+    leaves = unique / LEAF_MIN > 1 ? unique / LEAF_MIN : 1;
+  struct bpt_node **nodes =
+      (struct bpt_node **)malloc(leaves * sizeof(struct bpt_node *));
+  int32_t *low = (int32_t *)malloc(leaves * sizeof(int32_t));
+  if (nodes == NULL || low == NULL) {
+    free(nodes);
+    free(low);
+    free(sorted);
+    return 2;
+  }
+  node_free(t, t->root);
+  struct bpt_node *prev = NULL;
+  size_t next = 0;
+  for (size_t l = 0; l < leaves && result == 0; l++) {
+    size_t take = unique / leaves + (l < unique % leaves);
+    assert(take <= LEAF_KEYS && (leaves == 1 || take >= LEAF_MIN));
+    struct bpt_node *leaf = node_alloc(t, true);
+    if (leaf == NULL) {
+      result = 2;
+      break;
+    }
+    memcpy(leaf->u.l.keys, sorted + next, take * sizeof(int32_t));
+    leaf->count = take;
+    if (prev)
+      prev->u.l.next = leaf;
+    prev = leaf;
+    nodes[l] = leaf;
+    low[l] = sorted[next];
+    next += take;
+  }
+  if (result == 0)
+    result = build_levels(t, nodes, low, leaves);
+  if (result == 0)
+    t->keys = unique;
+  free(nodes);
+  free(low);
+  free(sorted);
+  return result;
+}
+
+/* -------- deletion -------- */
+
+static void remove_inner_entry(struct bpt_node *n, size_t key_index) {
+  memmove(&n->u.in.keys[key_index], &n->u.in.keys[key_index + 1],
+          (n->count - key_index - 1) * sizeof(int32_t));
+  memmove(&n->u.in.children[key_index + 1], &n->u.in.children[key_index + 2],
+          (n->count - key_index - 1) * sizeof(struct bpt_node *));
+  n->count--;
+}
+
+/*
+ * Child i of 'parent' has too few keys: borrow one from a
+ * neighbour, or merge with it if it has none to spare.
+ */
+static void fix_child(struct bptree *t, struct bpt_node *parent, size_t i) {
+  /* always work on a pair: left = child sep, right = child sep + 1 */
+  size_t sep = i > 0 ? i - 1 : 0;
+  struct bpt_node *left = parent->u.in.children[sep];
+  struct bpt_node *right = parent->u.in.children[sep + 1];
+  bool fix_left = i == 0;
+  size_t min = left->leaf ? LEAF_MIN : INNER_MIN;
+
+  if (left->leaf) {
+    if (fix_left && right->count > min) {
+      left->u.l.keys[left->count++] = right->u.l.keys[0];
+      memmove(right->u.l.keys, right->u.l.keys + 1,
+              --right->count * sizeof(int32_t));
+      parent->u.in.keys[sep] = right->u.l.keys[0];
+    } else if (!fix_left && left->count > min) {
+      memmove(right->u.l.keys + 1, right->u.l.keys,
+              right->count++ * sizeof(int32_t));
+      right->u.l.keys[0] = left->u.l.keys[--left->count];
+      parent->u.in.keys[sep] = right->u.l.keys[0];
+    } else {
+      memcpy(left->u.l.keys + left->count, right->u.l.keys,
+             right->count * sizeof(int32_t));
+      left->count += right->count;
+      left->u.l.next = right->u.l.next;
+      remove_inner_entry(parent, sep);
+      node_free(t, right);
+    }
+    return;
+  }
+
+  if (fix_left && right->count > min) {
+    left->u.in.keys[left->count] = parent->u.in.keys[sep];
+    left->u.in.children[++left->count] = right->u.in.children[0];
+    parent->u.in.keys[sep] = right->u.in.keys[0];
+    memmove(right->u.in.keys, right->u.in.keys + 1,
+            (right->count - 1) * sizeof(int32_t));
+    memmove(right->u.in.children, right->u.in.children + 1,
+            right->count * sizeof(struct bpt_node *));
+    right->count--;
+  } else if (!fix_left && left->count > min) {
+    memmove(right->u.in.keys + 1, right->u.in.keys,
+            right->count * sizeof(int32_t));
+    memmove(right->u.in.children + 1, right->u.in.children,
+            (right->count + 1) * sizeof(struct bpt_node *));
+    right->u.in.keys[0] = parent->u.in.keys[sep];
+    right->u.in.children[0] = left->u.in.children[left->count];
+    right->count++;
+    parent->u.in.keys[sep] = left->u.in.keys[--left->count];
+  } else {
+    left->u.in.keys[left->count] = parent->u.in.keys[sep];
+    memcpy(left->u.in.keys + left->count + 1, right->u.in.keys,
+           right->count * sizeof(int32_t));
+    memcpy(left->u.in.children + left->count + 1, right->u.in.children,
+           (right->count + 1) * sizeof(struct bpt_node *));
+    left->count += right->count + 1;
+    remove_inner_entry(parent, sep);
+    node_free(t, right);
+  }
+}
+
+static bool delete_node(struct bptree *t, struct bpt_node *n, int32_t v) {
+  if (n->leaf) {
+    size_t pos = count_less(n->u.l.keys, n->count, v);
+    if (pos == n->count || n->u.l.keys[pos] != v)
+      return false;
+    memmove(&n->u.l.keys[pos], &n->u.l.keys[pos + 1],
+            (n->count - pos - 1) * sizeof(int32_t));
+    n->count--;
+    return true;
+  }
+  size_t i = count_not_greater(n->u.in.keys, n->count, v);
+  struct bpt_node *child = n->u.in.children[i];
+  if (!delete_node(t, child, v))
+    return false;
+  if (child->count < (child->leaf ? LEAF_MIN : INNER_MIN))
+    fix_child(t, n, i);
+  return true;
+}
+
+/* remove v; returns false if it wasn't there */
+bool bpt_delete(struct bptree *t, int32_t v) {
+  if (!delete_node(t, t->root, v))
+    return false;
+  t->keys--;
+  if (!t->root->leaf && t->root->count == 0) {
+    struct bpt_node *old = t->root;
+    t->root = old->u.in.children[0];
+    node_free(t, old);
+  }
+  return true;
+}
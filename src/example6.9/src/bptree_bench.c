@@ -0,0 +1,290 @@
+/*
+ *
+ * Benchmark of the B+-tree against the tree of example 6.9.
+ *
+ * Random and sorted keys are inserted one at a time and in
+ * bulk, then looked up in random order.  The tree of example
+ * 6.9 never rebalances, so sorted keys turn it into a linked
+ * list; it is only given the first few thousand of those.
+ * The B+-tree is checked against a sorted copy of the keys
+ * with range scans and deletes as it goes.
+ *
+ * usage: example6.9-bptree [-n keys]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_KEYS 10000000
+#define LINKED_LIST_KEYS 20000
+#define RANGE_CHECKS 1000
+#define RANGE_WIDTH 1000
+
+struct bptree;
+struct bptree *bpt_create(void);
+void bpt_destroy(struct bptree *t);
+size_t bpt_size(const struct bptree *t);
+size_t bpt_bytes(const struct bptree *t);
+bool bpt_search(const struct bptree *t, int32_t v);
+size_t bpt_range(const struct bptree *t, int32_t lo, int32_t hi, int32_t *out,
+                 size_t max);
+int32_t bpt_insert(struct bptree *t, int32_t v);
+int32_t bpt_bulk_insert(struct bptree *t, const int32_t *keys, size_t n);
+bool bpt_delete(struct bptree *t, int32_t v);
+
+/* the tree of example 6.9, without the printing */
+struct tree_node {
+  int32_t data;
+  struct tree_node *left_p, *right_p;
+};
+
+struct tree_node *t_search(struct tree_node *root, int32_t v) {
+  while (root) {
+    if (root->data == v)
+      return root;
+    if (root->data > v)
+      root = root->left_p;
+    else
+      root = root->right_p;
+  }
+  return 0;
+}
+
+int32_t t_insert(struct tree_node **root, int32_t v) {
+  while (*root) {
+    if ((*root)->data == v)
+      return 1;
+    if ((*root)->data > v)
+      root = &((*root)->left_p);
+    else
+      root = &((*root)->right_p);
+  }
+  if ((*root = (struct tree_node *)malloc(sizeof(struct tree_node))) == 0)
+    return 2;
+  (*root)->data = v;
+  (*root)->left_p = 0;
+  (*root)->right_p = 0;
+  return 0;
+}
+
+static void t_free(struct tree_node *root) {
+  /* iteratively, since the tree may be a very long list */
+  while (root) {
+    if (root->left_p) {
+      struct tree_node *left = root->left_p;
+      root->left_p = left->right_p;
+      left->right_p = root;
+      root = left;
+    } else {
+      struct tree_node *right = root->right_p;
+      free(root);
+      root = right;
+    }
+  }
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static void shuffle(int32_t *a, size_t n) {
+  for (size_t i = n; i > 1; i--) {
+    size_t j = next_random() % i;
+    int32_t tmp = a[i - 1];
+    a[i - 1] = a[j];
+    a[j] = tmp;
+  }
+}
+
+static int compare_keys(const void *a, const void *b) {
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool check_tree(struct bptree *t, const int32_t *sorted, size_t n) {
+  if (bpt_size(t) != n)
+    return false;
+  int32_t *found = (int32_t *)xmalloc(RANGE_WIDTH * sizeof(int32_t));
+  bool ok = true;
+  for (size_t c = 0; c < RANGE_CHECKS && n > 0 && ok; c++) {
+    size_t first = next_random() % n;
+    size_t last = first + RANGE_WIDTH - 1;
+    if (last >= n)
+      last = n - 1;
+    size_t got = bpt_range(t, sorted[first], sorted[last], found, RANGE_WIDTH);
+    ok = got == last - first + 1 &&
+         memcmp(found, sorted + first, got * sizeof(int32_t)) == 0;
+  }
+  free(found);
+  return ok;
+}
+
+/* delete every other key and check, then delete the rest */
+static bool check_delete(struct bptree *t, int32_t *sorted, size_t n) {
+  for (size_t i = 0; i < n; i += 2)
+    if (!bpt_delete(t, sorted[i]))
+      return false;
+  for (size_t i = 0; i < n; i += 2)
+    if (bpt_search(t, sorted[i]) || bpt_delete(t, sorted[i]))
+      return false;
+  size_t kept = 0;
+  for (size_t i = 1; i < n; i += 2)
+    sorted[kept++] = sorted[i];
+  if (!check_tree(t, sorted, kept))
+    return false;
+  for (size_t i = 0; i < kept; i++)
+    if (!bpt_delete(t, sorted[i]))
+      return false;
+  return bpt_size(t) == 0 && !bpt_search(t, sorted[0]);
+}
+
+static void bench_bptree(const char *label, const int32_t *keys,
+                         const int32_t *probes, size_t n, bool bulk) {
+  struct bptree *t = bpt_create();
+  if (t == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  double start = now_seconds();
+  if (bulk) {
+    if (bpt_bulk_insert(t, keys, n) != 0) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    for (size_t i = 0; i < n; i++)
+      if (bpt_insert(t, keys[i]) == 2) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+      }
+  }
+  double insert_time = now_seconds() - start;
+
+  start = now_seconds();
+  size_t hits = 0;
+  for (size_t i = 0; i < n; i++)
+    hits += bpt_search(t, probes[i]);
+  double search_time = now_seconds() - start;
+
+  printf("%-28s %8.0f inserts/sec %10.0f lookups/sec %6.1f bytes/key%s\n",
+         label, n / insert_time, n / search_time,
+         (double)bpt_bytes(t) / bpt_size(t),
+         hits == n ? "" : " MISSING KEYS");
+  bpt_destroy(t);
+}
+
+static void bench_example(const char *label, const int32_t *keys,
+                          const int32_t *probes, size_t n) {
+  struct tree_node *root = 0;
+  double start = now_seconds();
+  for (size_t i = 0; i < n; i++)
+    if (t_insert(&root, keys[i]) == 2) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  double insert_time = now_seconds() - start;
+
+  start = now_seconds();
+  size_t hits = 0;
+  for (size_t i = 0; i < n; i++)
+    hits += t_search(root, probes[i]) != 0;
+  double search_time = now_seconds() - start;
+
+  /* malloc's own overhead is not counted */
+  printf("%-28s %8.0f inserts/sec %10.0f lookups/sec %6.1f bytes/key%s\n",
+         label, n / insert_time, n / search_time,
+         (double)sizeof(struct tree_node), hits == n ? "" : " MISSING KEYS");
+  t_free(root);
+}
+
+int main(int argc, char *argv[]) {
+  size_t n = DEFAULT_KEYS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      n = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n keys]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (n < 2 || n > INT32_MAX) {
+    fprintf(stderr, "Number of keys out of range\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /*
+   * Distinct keys in random order: multiplying by an odd number
+   * shuffles the numbers below 2^31 among themselves.
+   */
+  int32_t *sorted = (int32_t *)xmalloc(n * sizeof(int32_t));
+  int32_t *random_keys = (int32_t *)xmalloc(n * sizeof(int32_t));
+  int32_t *probes = (int32_t *)xmalloc(n * sizeof(int32_t));
+  for (size_t i = 0; i < n; i++)
+    random_keys[i] =
+        (int32_t)((((uint32_t)i * 2654435761U) & 0x7fffffffU) << 1) ^
+        INT32_MIN;
+  memcpy(sorted, random_keys, n * sizeof(int32_t));
+  qsort(sorted, n, sizeof(int32_t), compare_keys);
+  memcpy(probes, random_keys, n * sizeof(int32_t));
+  shuffle(probes, n);
+
+  /* correctness, on the random keys */
+  struct bptree *t = bpt_create();
+  if (t == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < n; i++)
+    bpt_insert(t, random_keys[i]);
+  bool ok = bpt_insert(t, random_keys[0]) == 1 && check_tree(t, sorted, n);
+  ok = ok && check_delete(t, sorted, n);
+  bpt_destroy(t);
+  printf("B+-tree insert/range/delete check: %s\n", ok ? "ok" : "FAILED");
+  memcpy(sorted, random_keys, n * sizeof(int32_t));
+  qsort(sorted, n, sizeof(int32_t), compare_keys);
+
+  printf("%zu keys\n", n);
+  bench_bptree("B+-tree, random keys", random_keys, probes, n, false);
+  bench_bptree("B+-tree, sorted keys", sorted, probes, n, false);
+  bench_bptree("B+-tree, bulk insert", random_keys, probes, n, true);
+  bench_example("example 6.9, random keys", random_keys, probes, n);
+
+  size_t small = n < LINKED_LIST_KEYS ? n : LINKED_LIST_KEYS;
+  memcpy(probes, sorted, small * sizeof(int32_t));
+  shuffle(probes, small);
+  printf("%zu sorted keys\n", small);
+  bench_bptree("B+-tree, sorted keys", sorted, probes, small, false);
+  bench_example("example 6.9, sorted keys", sorted, probes, small);
+
+  free(sorted);
+  free(random_keys);
+  free(probes);
+  exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -2,6 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef BULK_OUTPUT
+#include <stdint.h>
+
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+#endif
+
 int i_var;
 void func();
 
@@ -13,4 +22,12 @@ int main(int argc, char *argv[]) {
   exit(EXIT_SUCCESS);
 }
 
-void func() { printf("in func, i_var is %d\n", i_var); }
+void func() {
+#ifdef BULK_OUTPUT
+  out_str("in func, i_var is ");
+  out_int(i_var);
+  out_char('\n');
+#else
+  printf("in func, i_var is %d\n", i_var);
+#endif
+}
@@ -0,0 +1,380 @@
+/*
+ *
+ * Coroutines, each with a stack of its own.
+ *
+ * Example 9.3 uses setjmp and longjmp to jump back up its own
+ * stack.  A coroutine needs more than that: a stack to run on,
+ * and a way to jump between stacks and back again.  Here the
+ * jump is coro_switch, a dozen instructions of x86-64 assembly
+ * that push the registers a called function must preserve, save
+ * the stack pointer, load another, and pop that stack's saved
+ * registers.  Everything else a function call may clobber anyway,
+ * so nothing else needs saving; swapcontext also saves the signal
+ * mask, which takes a system call.
+ *
+ * Stacks come from a pool.  They are mmap'd in slabs, each stack
+ * with an inaccessible guard page below it, and go back on a free
+ * list when their coroutine finishes.  A guard page splits the
+ * mapping, and the number of mappings a process may have is
+ * limited (vm.max_map_count, 65530 by default), so only so many
+ * stacks get one.  Each time a coroutine switches back to the
+ * scheduler its stack pointer is checked to be still inside its
+ * stack, which catches an overflow of a stack without a guard page
+ * that is still in progress, and the top word of the stack, next
+ * to the first frame, to hold a known value.  Nothing is written
+ * at the bottom of a stack, so a coroutine only ever touches the
+ * pages its calls reach down to.
+ *
+ * The scheduler runs coroutines from a queue in turn, each until
+ * it yields, waits for another to finish, or finishes itself.
+ * Everything runs on the thread that calls sched_run.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__)
+#error "coroutine.c switches stacks with x86-64 assembly"
+#endif
+
+#define STACKS_PER_SLAB 64
+#define DEFAULT_MAX_MAP_COUNT 65530
+#define MAPS_KEPT_SPARE 4096
+#define CANARY 0x5afe57ac6c0ffee5ULL
+
+/* the registers pushed by coro_switch, lowest address first */
+struct switch_frame {
+  uint32_t mxcsr;
+  uint16_t x87_control;
+  uint16_t padding;
+  uint64_t r15, r14, r13, r12, rbx, rbp;
+  void *return_address;
+};
+
+/*
+ * Save the callee-saved registers on the current stack and its
+ * stack pointer in *save, then switch to the stack at 'to' and
+ * return into whatever saved its registers there.
+ */
+void coro_switch(void **save, void *to) __asm__("coro_switch_impl")
+    __attribute__((visibility("hidden")));
+/* the first return into a new coroutine: coro_main(r12) */
+void coro_start(void) __asm__("coro_start_impl")
+    __attribute__((visibility("hidden")));
+
+__asm__(".pushsection .text\n"
+        ".globl coro_switch_impl\n"
+        ".type coro_switch_impl, @function\n"
+        ".p2align 4\n"
+        "coro_switch_impl:\n"
+        "  pushq %rbp\n"
+        "  pushq %rbx\n"
+        "  pushq %r12\n"
+        "  pushq %r13\n"
+        "  pushq %r14\n"
+        "  pushq %r15\n"
+        "  subq $8, %rsp\n"
+        "  stmxcsr (%rsp)\n"
+        "  fnstcw 4(%rsp)\n"
+        "  movq %rsp, (%rdi)\n"
+        "  movq %rsi, %rsp\n"
+        "  ldmxcsr (%rsp)\n"
+        "  fldcw 4(%rsp)\n"
+        "  addq $8, %rsp\n"
+        "  popq %r15\n"
+        "  popq %r14\n"
+        "  popq %r13\n"
+        "  popq %r12\n"
+        "  popq %rbx\n"
+        "  popq %rbp\n"
+        "  ret\n"
+        ".size coro_switch_impl, .-coro_switch_impl\n"
+        ".globl coro_start_impl\n"
+        ".type coro_start_impl, @function\n"
+        ".p2align 4\n"
+        "coro_start_impl:\n"
+        "  movq %r12, %rdi\n"
+        "  callq *%r13\n"
+        "  ud2\n"
+        ".size coro_start_impl, .-coro_start_impl\n"
+        ".popsection\n");
+
+struct stack_pool {
+  size_t stack_size; /* usable bytes, a whole number of pages */
+  size_t page;
+  void **free;
+  size_t free_count, free_capacity;
+  void **slabs;
+  size_t slab_count, slab_capacity;
+  size_t guards_left;
+  size_t mapped, guarded;
+};
+
+enum coro_state { CORO_READY, CORO_WAITING, CORO_DONE };
+
+struct coro {
+  void *sp;
+  struct sched *sched;
+  struct coro *next; /* in the run queue */
+  void *stack;       /* lowest usable address */
+  void (*fn)(void *);
+  void *arg;
+  enum coro_state state;
+  bool detached;
+  struct coro *waiter; /* waiting in coro_await for this to finish */
+};
+
+struct sched {
+  void *sp; /* of sched_run, while a coroutine runs */
+  struct coro *current;
+  struct coro *head, *tail;
+  struct stack_pool pool;
+  size_t live;
+  uint64_t switches;
+};
+
+/* -------- stacks -------- */
+
+static size_t max_map_count(void) {
+  size_t count = DEFAULT_MAX_MAP_COUNT;
+  FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%zu", &count) != 1)
+      count = DEFAULT_MAX_MAP_COUNT;
+    fclose(f);
+  }
+  return count;
+}
+
+/* room in *array for at least 'needed' pointers */
+static bool reserve_pointers(void ***array, size_t *capacity, size_t needed) {
+  if (needed <= *capacity)
+    return true;
+  size_t c = *capacity ? *capacity : 64;
+  while (c < needed)
+    c *= 2;
+  void **a = (void **)realloc(*array, c * sizeof(void *));
+  if (a == NULL)
+    return false;
+  *array = a;
+  *capacity = c;
+  return true;
+}
+
+static void pool_init(struct stack_pool *pool, size_t stack_size) {
+  memset(pool, 0, sizeof(*pool));
+  pool->page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t pages = (stack_size + pool->page - 1) / pool->page;
+  pool->stack_size = (pages ? pages : 1) * pool->page;
+  size_t maps = max_map_count();
+  /* each guard page costs two mappings: itself, and the stack above */
+  if (maps > MAPS_KEPT_SPARE)
+    pool->guards_left = (maps - MAPS_KEPT_SPARE) / 2;
+}
+
+static bool pool_add_slab(struct stack_pool *pool) {
+  size_t span = pool->page + pool->stack_size;
+  char *slab =
+      (char *)mmap(NULL, STACKS_PER_SLAB * span, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (slab == MAP_FAILED)
+    return false;
+  /* the free list must hold every stack mapped, given out or not */
+  if (!reserve_pointers(&pool->slabs, &pool->slab_capacity,
+                        pool->slab_count + 1) ||
+      !reserve_pointers(&pool->free, &pool->free_capacity,
+                        pool->mapped + STACKS_PER_SLAB)) {
+    munmap(slab, STACKS_PER_SLAB * span);
+    return false;
+  }
+  pool->slabs[pool->slab_count++] = slab;
+  /* pushed highest first, so the lowest stacks are handed out first */
+  for (size_t i = STACKS_PER_SLAB; i-- > 0;) {
+    char *guard = slab + i * span;
+    if (pool->guards_left > 0 &&
+        mprotect(guard, pool->page, PROT_NONE) == 0) {
+      pool->guards_left--;
+      pool->guarded++;
+    }
+    pool->free[pool->free_count++] = guard + pool->page;
+    pool->mapped++;
+  }
+  return true;
+}
+
+static void *pool_get(struct stack_pool *pool) {
+  if (pool->free_count == 0 && !pool_add_slab(pool))
+    return NULL;
+  return pool->free[--pool->free_count];
+}
+
+/* never fails: the free list has room for every stack mapped */
+static void pool_put(struct stack_pool *pool, void *stack) {
+  pool->free[pool->free_count++] = stack;
+}
+
+static void pool_destroy(struct stack_pool *pool) {
+  size_t span = pool->page + pool->stack_size;
+  for (size_t i = 0; i < pool->slab_count; i++)
+    munmap(pool->slabs[i], STACKS_PER_SLAB * span);
+  free(pool->slabs);
+  free(pool->free);
+}
+
+/* -------- scheduling -------- */
+
+static void enqueue(struct sched *s, struct coro *c) {
+  c->next = NULL;
+  if (s->tail)
+    s->tail->next = c;
+  else
+    s->head = c;
+  s->tail = c;
+}
+
+static struct coro *dequeue(struct sched *s) {
+  struct coro *c = s->head;
+  if (c) {
+    s->head = c->next;
+    if (s->head == NULL)
+      s->tail = NULL;
+  }
+  return c;
+}
+
+/* back to sched_run, from the current coroutine */
+static void to_scheduler(struct sched *s) {
+  struct coro *c = s->current;
+  s->switches += 2;
+  coro_switch(&c->sp, s->sp);
+}
+
+/* where every coroutine starts, on its own stack */
+static void coro_main(struct coro *c) {
+  c->fn(c->arg);
+  c->state = CORO_DONE;
+  to_scheduler(c->sched);
+}
+
+/* a scheduler whose coroutines get stacks of 'stack_size' bytes */
+struct sched *sched_create(size_t stack_size) {
+  struct sched *s = (struct sched *)calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+  pool_init(&s->pool, stack_size);
+  return s;
+}
+
+void sched_destroy(struct sched *s) {
+  pool_destroy(&s->pool);
+  free(s);
+}
+
+/*
+ * A coroutine that will run fn(arg), or NULL if out of memory.
+ * The result must be passed to coro_await, once.
+ */
+struct coro *coro_spawn(struct sched *s, void (*fn)(void *), void *arg) {
+  struct coro *c = (struct coro *)malloc(sizeof(*c));
+  if (c == NULL)
+    return NULL;
+  c->stack = pool_get(&s->pool);
+  if (c->stack == NULL) {
+    free(c);
+    return NULL;
+  }
+  c->sched = s;
+  c->fn = fn;
+  c->arg = arg;
+  c->state = CORO_READY;
+  c->detached = false;
+  c->waiter = NULL;
+
+  /* a frame for coro_switch to pop, returning into coro_start */
+  char *top = (char *)c->stack + s->pool.stack_size;
+  *(uint64_t *)(top - sizeof(uint64_t)) = CANARY;
+  struct switch_frame *f = (struct switch_frame *)(top - 64) - 1;
+  memset(f, 0, sizeof(*f));
+  f->mxcsr = 0x1f80;       /* all exceptions masked, round to nearest */
+  f->x87_control = 0x037f; /* the same, extended precision */
+  f->r12 = (uint64_t)(uintptr_t)c;
+  f->r13 = (uint64_t)(uintptr_t)coro_main;
+  f->return_address = (void *)coro_start;
+  c->sp = f;
+
+  s->live++;
+  enqueue(s, c);
+  return c;
+}
+
+/* a coroutine nobody will wait for; false if out of memory */
+bool coro_go(struct sched *s, void (*fn)(void *), void *arg) {
+  struct coro *c = coro_spawn(s, fn, arg);
+  if (c == NULL)
+    return false;
+  c->detached = true;
+  return true;
+}
+
+/* let the others run, from inside a coroutine */
+void coro_yield(struct sched *s) {
+  enqueue(s, s->current);
+  to_scheduler(s);
+}
+
+/* wait, from inside a coroutine, for c to finish, and free it */
+void coro_await(struct sched *s, struct coro *c) {
+  if (c->state != CORO_DONE) {
+    c->waiter = s->current;
+    s->current->state = CORO_WAITING;
+    to_scheduler(s);
+  }
+  free(c);
+}
+
+/* the coroutine running now, or NULL outside sched_run */
+struct coro *coro_self(struct sched *s) { return s->current; }
+
+/*
+ * Run coroutines until none are left to run.  Returns the number
+ * still alive, waiting for coroutines that will never finish.
+ */
+size_t sched_run(struct sched *s) {
+  struct coro *c;
+  while ((c = dequeue(s)) != NULL) {
+    s->current = c;
+    coro_switch(&s->sp, c->sp);
+    s->current = NULL;
+    char *bottom = (char *)c->stack;
+    char *top = bottom + s->pool.stack_size;
+    if ((char *)c->sp < bottom ||
+        *(uint64_t *)(top - sizeof(uint64_t)) != CANARY) {
+      fprintf(stderr, "Coroutine stack overflow\n");
+      abort();
+    }
+    if (c->state != CORO_DONE)
+      continue;
+    pool_put(&s->pool, c->stack);
+    s->live--;
+    if (c->waiter) {
+      c->waiter->state = CORO_READY;
+      enqueue(s, c->waiter);
+    }
+    if (c->detached)
+      free(c);
+  }
+  return s->live;
+}
+
+/* stacks mapped so far, and how many of them have guard pages */
+void sched_stack_counts(const struct sched *s, size_t *mapped,
+                        size_t *guarded) {
+  *mapped = s->pool.mapped;
+  *guarded = s->pool.guarded;
+}
+
+uint64_t sched_switches(const struct sched *s) { return s->switches; }
@@ -0,0 +1,281 @@
+/*
+ *
+ * Timing the coroutines of coroutine.c.
+ *
+ * A switch is timed three ways: a coroutine yielding to the
+ * scheduler and being resumed, over and over; the same with
+ * swapcontext; and two threads handing a turn back and forth
+ * with a mutex and a condition variable.  Then 'coroutines'
+ * coroutines, 100000 by default, are started at once: a thousand
+ * parents, each starting its share of children and waiting for
+ * every one of them, the children each yielding 'yields' times
+ * before adding to a total, which is checked.
+ *
+ * usage: example9.3-coroutines [-n coroutines] [-y yields]
+ *                              [-s stack_kb] [-r rounds]
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#define DEFAULT_COROUTINES 100000
+#define DEFAULT_YIELDS 10
+#define DEFAULT_STACK_KB 64
+#define DEFAULT_ROUNDS 10000000
+#define THREAD_ROUNDS_DIVISOR 50
+#define PARENTS 1000
+#define KILOBYTE 1024
+
+struct sched;
+struct coro;
+struct sched *sched_create(size_t stack_size);
+void sched_destroy(struct sched *s);
+struct coro *coro_spawn(struct sched *s, void (*fn)(void *), void *arg);
+bool coro_go(struct sched *s, void (*fn)(void *), void *arg);
+void coro_yield(struct sched *s);
+void coro_await(struct sched *s, struct coro *c);
+size_t sched_run(struct sched *s);
+void sched_stack_counts(const struct sched *s, size_t *mapped,
+                        size_t *guarded);
+uint64_t sched_switches(const struct sched *s);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* -------- one coroutine yielding -------- */
+
+struct yielder {
+  struct sched *s;
+  uint64_t rounds;
+};
+
+static void yield_often(void *arg) {
+  struct yielder *y = (struct yielder *)arg;
+  for (uint64_t i = 0; i < y->rounds; i++)
+    coro_yield(y->s);
+}
+
+static double time_coroutines(size_t stack_size, uint64_t rounds) {
+  struct sched *s = sched_create(stack_size);
+  struct yielder y = {s, rounds};
+  if (s == NULL || !coro_go(s, yield_often, &y)) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  double start = now_seconds();
+  sched_run(s);
+  double t = now_seconds() - start;
+  uint64_t switches = sched_switches(s);
+  sched_destroy(s);
+  return t / switches * 1e9;
+}
+
+/* -------- swapcontext -------- */
+
+static ucontext_t main_context, other_context;
+static uint64_t context_rounds;
+
+static void swap_often(void) {
+  for (uint64_t i = 0; i < context_rounds; i++)
+    swapcontext(&other_context, &main_context);
+}
+
+static double time_swapcontext(size_t stack_size, uint64_t rounds) {
+  char *stack = (char *)xmalloc(stack_size);
+  getcontext(&other_context);
+  other_context.uc_stack.ss_sp = stack;
+  other_context.uc_stack.ss_size = stack_size;
+  other_context.uc_link = &main_context;
+  makecontext(&other_context, swap_often, 0);
+  context_rounds = rounds;
+  double start = now_seconds();
+  /* rounds there and back, and one more to let swap_often finish */
+  for (uint64_t i = 0; i <= rounds; i++)
+    swapcontext(&main_context, &other_context);
+  double t = now_seconds() - start;
+  free(stack);
+  return t / (2 * rounds + 2) * 1e9;
+}
+
+/* -------- two threads -------- */
+
+struct handoff {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  int turn;
+  uint64_t rounds;
+};
+
+static void take_turns(struct handoff *h, int me) {
+  pthread_mutex_lock(&h->lock);
+  for (uint64_t i = 0; i < h->rounds; i++) {
+    while (h->turn != me)
+      pthread_cond_wait(&h->changed, &h->lock);
+    h->turn = !me;
+    pthread_cond_signal(&h->changed);
+  }
+  pthread_mutex_unlock(&h->lock);
+}
+
+static void *other_thread(void *arg) {
+  take_turns((struct handoff *)arg, 1);
+  return NULL;
+}
+
+static double time_threads(uint64_t rounds) {
+  struct handoff h = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0,
+                      rounds};
+  pthread_t thread;
+  double start = now_seconds();
+  if (pthread_create(&thread, NULL, other_thread, &h) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+  take_turns(&h, 0);
+  pthread_join(thread, NULL);
+  double t = now_seconds() - start;
+  return t / (2 * rounds) * 1e9;
+}
+
+/* -------- many coroutines -------- */
+
+struct family {
+  struct sched *s;
+  size_t children;
+  uint64_t yields;
+  uint64_t *total;
+};
+
+struct child {
+  struct family *family;
+  uint64_t value;
+};
+
+static void child(void *arg) {
+  struct child *c = (struct child *)arg;
+  for (uint64_t i = 0; i < c->family->yields; i++)
+    coro_yield(c->family->s);
+  *c->family->total += c->value;
+}
+
+static void parent(void *arg) {
+  struct family *f = (struct family *)arg;
+  struct child *kids = (struct child *)xmalloc(f->children * sizeof(*kids));
+  struct coro **handles =
+      (struct coro **)xmalloc(f->children * sizeof(*handles));
+  for (size_t i = 0; i < f->children; i++) {
+    kids[i].family = f;
+    kids[i].value = i + 1;
+    handles[i] = coro_spawn(f->s, child, &kids[i]);
+    if (handles[i] == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t i = 0; i < f->children; i++)
+    coro_await(f->s, handles[i]);
+  free(handles);
+  free(kids);
+}
+
+static void many(size_t stack_size, size_t coroutines, uint64_t yields) {
+  size_t parents = coroutines < PARENTS ? 1 : PARENTS;
+  size_t children = (coroutines - parents) / parents;
+  uint64_t total = 0;
+  struct sched *s = sched_create(stack_size);
+  if (s == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  struct family f = {s, children, yields, &total};
+  for (size_t p = 0; p < parents; p++)
+    if (!coro_go(s, parent, &f)) {
+      fprintf(stderr, "Out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  double start = now_seconds();
+  size_t stuck = sched_run(s);
+  double t = now_seconds() - start;
+
+  uint64_t expected = parents * (uint64_t)children * (children + 1) / 2;
+  size_t mapped, guarded;
+  sched_stack_counts(s, &mapped, &guarded);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%zu coroutines at once (%zu parents of %zu), %" PRIu64
+         " yields each\n",
+         parents * (children + 1), parents, children, yields);
+  printf("  %.3f s, %.1f ns per switch, %" PRIu64 " switches\n", t,
+         t / sched_switches(s) * 1e9, sched_switches(s));
+  printf("  %zu stacks of %zu KB mapped, %zu with guard pages; "
+         "max RSS %ld MB\n",
+         mapped, stack_size / KILOBYTE, guarded, usage.ru_maxrss / KILOBYTE);
+  sched_destroy(s);
+  if (stuck != 0 || total != expected) {
+    fprintf(stderr, "Wrong total %" PRIu64 ", expected %" PRIu64 "\n", total,
+            expected);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  size_t coroutines = DEFAULT_COROUTINES;
+  uint64_t yields = DEFAULT_YIELDS;
+  size_t stack_kb = DEFAULT_STACK_KB;
+  uint64_t rounds = DEFAULT_ROUNDS;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:y:s:r:")) != -1) {
+    switch (opt) {
+    case 'n':
+      coroutines = strtoull(optarg, NULL, 10);
+      break;
+    case 'y':
+      yields = strtoull(optarg, NULL, 10);
+      break;
+    case 's':
+      stack_kb = strtoull(optarg, NULL, 10);
+      break;
+    case 'r':
+      rounds = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-n coroutines] [-y yields] [-s stack_kb] "
+              "[-r rounds]\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (coroutines < 2 || stack_kb < 8 || rounds < THREAD_ROUNDS_DIVISOR) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t stack_size = stack_kb * KILOBYTE;
+
+  printf("switch latency\n");
+  printf("  coroutine yield:  %6.1f ns\n", time_coroutines(stack_size, rounds));
+  printf("  swapcontext:      %6.1f ns\n", time_swapcontext(stack_size, rounds));
+  printf("  pthread handoff:  %6.1f ns\n",
+         time_threads(rounds / THREAD_ROUNDS_DIVISOR));
+  many(stack_size, coroutines, yields);
+  exit(EXIT_SUCCESS);
+}
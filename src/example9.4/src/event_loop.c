@@ -0,0 +1,340 @@
+/*
+ *
+ * An event loop: file descriptors, timers and signals, one thread.
+ *
+ * Example 9.4 closes its file from inside a signal handler, which
+ * may interrupt fprintf or anything else half way through.  Here
+ * a watched signal is blocked instead, so it stays pending, and is
+ * read from a signalfd like any other input.  Timers are timerfds.
+ * All of them, and any other file descriptor, are watched with one
+ * epoll instance, and each callback runs on the thread that called
+ * event_loop_run, between calls of the others, where it may do
+ * whatever an ordinary function may.
+ *
+ * A signal blocked in one thread may still be delivered to another
+ * that has not blocked it, so watch signals before starting any
+ * threads; they inherit the mask.
+ *
+ * Watches are kept in a table indexed by file descriptor.  The
+ * epoll data of each holds its descriptor and a generation number,
+ * so an event for a descriptor unwatched, or closed and watched
+ * again, by an earlier callback in the same batch is recognised
+ * and dropped.
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define SIGNALS_PER_READ 16
+#define NANOSECONDS 1000000000ULL
+
+struct event_loop;
+
+/* 'events' are the EPOLLIN, EPOLLOUT, EPOLLHUP... bits that are set */
+typedef void (*event_fd_fn)(struct event_loop *loop, int fd, uint32_t events,
+                            void *arg);
+/* 'expirations' is how many times the timer has expired since last time */
+typedef void (*event_timer_fn)(struct event_loop *loop, int timer,
+                               uint64_t expirations, void *arg);
+typedef void (*event_signal_fn)(struct event_loop *loop,
+                                const struct signalfd_siginfo *info,
+                                void *arg);
+
+enum watch_kind { WATCH_NONE, WATCH_FD, WATCH_TIMER, WATCH_SIGNALS };
+
+struct watch {
+  enum watch_kind kind;
+  uint32_t generation;
+  bool once; /* a timer to close once it has expired */
+  union {
+    event_fd_fn fd;
+    event_timer_fn timer;
+  } fn;
+  void *arg;
+};
+
+struct signal_watch {
+  event_signal_fn fn;
+  void *arg;
+};
+
+struct event_loop {
+  int epoll_fd;
+  int signal_fd; /* -1 until a signal is watched */
+  sigset_t signals;
+  sigset_t blocked; /* by event_watch_signal, to unblock at the end */
+  struct signal_watch handlers[NSIG];
+  struct watch *watches; /* indexed by file descriptor */
+  size_t watch_capacity;
+  size_t watching;
+  uint32_t generation;
+  bool stopping;
+};
+
+/* -------- the table of watches -------- */
+
+static struct watch *add_watch(struct event_loop *loop, int fd,
+                               uint32_t events, enum watch_kind kind) {
+  if ((size_t)fd >= loop->watch_capacity) {
+    size_t capacity = loop->watch_capacity ? loop->watch_capacity : 64;
+    while (capacity <= (size_t)fd)
+      capacity *= 2;
+    struct watch *w = (struct watch *)realloc(loop->watches,
+                                              capacity * sizeof(*w));
+    if (w == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    memset(w + loop->watch_capacity, 0,
+           (capacity - loop->watch_capacity) * sizeof(*w));
+    loop->watches = w;
+    loop->watch_capacity = capacity;
+  }
+  struct watch *w = &loop->watches[fd];
+  if (w->kind != WATCH_NONE) {
+    errno = EEXIST;
+    return NULL;
+  }
+  uint32_t generation = ++loop->generation;
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.u64 = (uint64_t)generation << 32 | (uint32_t)fd;
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    return NULL;
+  memset(w, 0, sizeof(*w));
+  w->kind = kind;
+  w->generation = generation;
+  loop->watching++;
+  return w;
+}
+
+static bool remove_watch(struct event_loop *loop, int fd,
+                         enum watch_kind kind) {
+  if (fd < 0 || (size_t)fd >= loop->watch_capacity ||
+      loop->watches[fd].kind != kind) {
+    errno = ENOENT;
+    return false;
+  }
+  loop->watches[fd].kind = WATCH_NONE;
+  loop->watching--;
+  /* fails harmlessly if the caller has closed fd already */
+  epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  return true;
+}
+
+/* -------- setting up -------- */
+
+/* a loop with nothing to watch, or NULL with errno set */
+struct event_loop *event_loop_create(void) {
+  struct event_loop *loop = (struct event_loop *)calloc(1, sizeof(*loop));
+  if (loop == NULL)
+    return NULL;
+  loop->signal_fd = -1;
+  sigemptyset(&loop->signals);
+  sigemptyset(&loop->blocked);
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0) {
+    free(loop);
+    return NULL;
+  }
+  return loop;
+}
+
+/*
+ * Close the loop's timers and its signalfd and unblock the signals
+ * it blocked.  Watched file descriptors are left open.
+ */
+void event_loop_destroy(struct event_loop *loop) {
+  for (size_t fd = 0; fd < loop->watch_capacity; fd++)
+    if (loop->watches[fd].kind == WATCH_TIMER)
+      close((int)fd);
+  if (loop->signal_fd >= 0) {
+    close(loop->signal_fd);
+    pthread_sigmask(SIG_UNBLOCK, &loop->blocked, NULL);
+  }
+  close(loop->epoll_fd);
+  free(loop->watches);
+  free(loop);
+}
+
+/*
+ * Call fn(loop, fd, events, arg) whenever fd is ready for any of
+ * 'events' (EPOLLIN, EPOLLOUT...), until event_unwatch_fd.  False,
+ * with errno set, on failure: EPERM, for one, for a regular file,
+ * which epoll will not watch because it is always ready.
+ */
+bool event_watch_fd(struct event_loop *loop, int fd, uint32_t events,
+                    event_fd_fn fn, void *arg) {
+  struct watch *w = add_watch(loop, fd, events, WATCH_FD);
+  if (w == NULL)
+    return false;
+  w->fn.fd = fn;
+  w->arg = arg;
+  return true;
+}
+
+/* stop watching fd, which may be closed already; false if not watched */
+bool event_unwatch_fd(struct event_loop *loop, int fd) {
+  return remove_watch(loop, fd, WATCH_FD);
+}
+
+/*
+ * A timer calling fn(loop, timer, expirations, arg) 'first_ns'
+ * nanoseconds from now, and every 'interval_ns' after that.  With
+ * an interval of 0 it expires once, and is then cancelled.  Returns
+ * the timer, or -1 with errno set.
+ */
+int event_add_timer(struct event_loop *loop, uint64_t first_ns,
+                    uint64_t interval_ns, event_timer_fn fn, void *arg) {
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer < 0)
+    return -1;
+  if (first_ns == 0)
+    first_ns = 1; /* an it_value of zero would disarm the timer */
+  struct itimerspec when;
+  when.it_value.tv_sec = (time_t)(first_ns / NANOSECONDS);
+  when.it_value.tv_nsec = (long)(first_ns % NANOSECONDS);
+  when.it_interval.tv_sec = (time_t)(interval_ns / NANOSECONDS);
+  when.it_interval.tv_nsec = (long)(interval_ns % NANOSECONDS);
+  struct watch *w;
+  if (timerfd_settime(timer, 0, &when, NULL) != 0 ||
+      (w = add_watch(loop, timer, EPOLLIN, WATCH_TIMER)) == NULL) {
+    int saved = errno;
+    close(timer);
+    errno = saved;
+    return -1;
+  }
+  w->fn.timer = fn;
+  w->arg = arg;
+  w->once = interval_ns == 0;
+  return timer;
+}
+
+/* cancel and close a timer; false if it is not one of the loop's */
+bool event_cancel_timer(struct event_loop *loop, int timer) {
+  if (!remove_watch(loop, timer, WATCH_TIMER))
+    return false;
+  close(timer);
+  return true;
+}
+
+/*
+ * Block 'sig' and call fn(loop, info, arg) each time it arrives.
+ * False, with errno set, on failure.
+ */
+bool event_watch_signal(struct event_loop *loop, int sig, event_signal_fn fn,
+                        void *arg) {
+  if (sig <= 0 || sig >= NSIG) {
+    errno = EINVAL;
+    return false;
+  }
+  sigset_t add, old;
+  sigemptyset(&add);
+  sigaddset(&add, sig);
+  if (pthread_sigmask(SIG_BLOCK, &add, &old) != 0)
+    return false;
+  if (!sigismember(&old, sig))
+    sigaddset(&loop->blocked, sig);
+  sigaddset(&loop->signals, sig);
+
+  /* one signalfd for every signal watched, its set updated in place */
+  int sfd = signalfd(loop->signal_fd, &loop->signals,
+                     SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sfd < 0)
+    return false;
+  if (loop->signal_fd < 0) {
+    if (add_watch(loop, sfd, EPOLLIN, WATCH_SIGNALS) == NULL) {
+      int saved = errno;
+      close(sfd);
+      errno = saved;
+      return false;
+    }
+    loop->signal_fd = sfd;
+  }
+  loop->handlers[sig].fn = fn;
+  loop->handlers[sig].arg = arg;
+  return true;
+}
+
+/* -------- running -------- */
+
+static void read_timer(struct event_loop *loop, int fd, struct watch w) {
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return; /* nothing yet: reset since epoll_wait */
+  w.fn.timer(loop, fd, expirations, w.arg);
+  struct watch *now = &loop->watches[fd];
+  if (w.once && now->kind == WATCH_TIMER && now->generation == w.generation)
+    event_cancel_timer(loop, fd);
+}
+
+static void read_signals(struct event_loop *loop) {
+  struct signalfd_siginfo info[SIGNALS_PER_READ];
+  ssize_t n;
+  while (loop->signal_fd >= 0 &&
+         (n = read(loop->signal_fd, info, sizeof(info))) > 0) {
+    for (size_t i = 0; i < (size_t)n / sizeof(info[0]); i++) {
+      struct signal_watch *h = &loop->handlers[info[i].ssi_signo];
+      if (h->fn != NULL)
+        h->fn(loop, &info[i], h->arg);
+    }
+    if ((size_t)n < sizeof(info))
+      break;
+  }
+}
+
+static void dispatch(struct event_loop *loop, const struct epoll_event *ev) {
+  int fd = (int)(uint32_t)ev->data.u64;
+  uint32_t generation = (uint32_t)(ev->data.u64 >> 32);
+  /* a copy: a callback may grow the table, moving it */
+  struct watch w = loop->watches[fd];
+  if (w.kind == WATCH_NONE || w.generation != generation)
+    return;
+  switch (w.kind) {
+  case WATCH_FD:
+    w.fn.fd(loop, fd, ev->events, w.arg);
+    break;
+  case WATCH_TIMER:
+    read_timer(loop, fd, w);
+    break;
+  case WATCH_SIGNALS:
+    read_signals(loop);
+    break;
+  case WATCH_NONE:
+    break;
+  }
+}
+
+/*
+ * Wait for events and call their callbacks until event_loop_stop
+ * is called or nothing is left to watch.  Returns 0, or -1 with
+ * errno set if epoll_wait fails.
+ */
+int event_loop_run(struct event_loop *loop) {
+  struct epoll_event events[MAX_EVENTS];
+  loop->stopping = false;
+  while (!loop->stopping && loop->watching > 0) {
+    int n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    /* events left when stopping are still pending for the next run */
+    for (int i = 0; i < n && !loop->stopping; i++)
+      dispatch(loop, &events[i]);
+  }
+  return 0;
+}
+
+/* from a callback: return from event_loop_run after this callback */
+void event_loop_stop(struct event_loop *loop) { loop->stopping = true; }
@@ -0,0 +1,335 @@
+/*
+ *
+ * Example 9.4 on the event loop of event_loop.c.
+ *
+ * Prints "Ready..." for each line read from the standard input,
+ * like example 9.4, and on SIGINT writes "Interrupted.." to the
+ * file tmp and closes it.  The signal arrives through the event
+ * loop, so that happens in an ordinary callback rather than in a
+ * signal handler, and stdio is safe to use.
+ *
+ * With -b, two things are timed instead.  A second thread sends
+ * the loop SIGUSR1 'rounds' times, each with the time it was sent,
+ * and waits for the callback to answer; the delay from sending to
+ * the callback is reported.  Then 'pipes' pipes each hold a byte,
+ * and each callback reads its byte and writes it back, for 'ms'
+ * milliseconds, ended by a timer; the number of callbacks a second
+ * is reported.
+ *
+ * usage: example9.4-events [-b] [-r rounds] [-f pipes] [-t ms]
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ROUNDS 100000
+#define DEFAULT_PIPES 1000
+#define DEFAULT_MS 1000
+#define SPARE_FDS 64
+#define INPUT_BUFFER_SIZE 4096
+#define NANOSECONDS 1000000000ULL
+
+struct event_loop;
+typedef void (*event_fd_fn)(struct event_loop *loop, int fd, uint32_t events,
+                            void *arg);
+typedef void (*event_timer_fn)(struct event_loop *loop, int timer,
+                               uint64_t expirations, void *arg);
+typedef void (*event_signal_fn)(struct event_loop *loop,
+                                const struct signalfd_siginfo *info,
+                                void *arg);
+struct event_loop *event_loop_create(void);
+void event_loop_destroy(struct event_loop *loop);
+bool event_watch_fd(struct event_loop *loop, int fd, uint32_t events,
+                    event_fd_fn fn, void *arg);
+bool event_unwatch_fd(struct event_loop *loop, int fd);
+int event_add_timer(struct event_loop *loop, uint64_t first_ns,
+                    uint64_t interval_ns, event_timer_fn fn, void *arg);
+bool event_cancel_timer(struct event_loop *loop, int timer);
+bool event_watch_signal(struct event_loop *loop, int sig, event_signal_fn fn,
+                        void *arg);
+int event_loop_run(struct event_loop *loop);
+void event_loop_stop(struct event_loop *loop);
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NANOSECONDS + (uint64_t)ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+static struct event_loop *new_loop(void) {
+  struct event_loop *loop = event_loop_create();
+  if (loop == NULL)
+    fail("event_loop_create");
+  return loop;
+}
+
+/* -------- example 9.4 -------- */
+
+struct session {
+  FILE *temp_file;
+  int status;
+  bool done;
+};
+
+static void ready(struct event_loop *loop, int fd, uint32_t events,
+                  void *arg) {
+  (void)events;
+  struct session *s = (struct session *)arg;
+  char buffer[INPUT_BUFFER_SIZE];
+  ssize_t n = read(fd, buffer, sizeof(buffer));
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return;
+  if (n <= 0) {
+    s->done = true;
+    event_loop_stop(loop);
+    return;
+  }
+  for (ssize_t i = 0; i < n; i++)
+    if (buffer[i] == '\n')
+      printf("Ready...\n");
+  fflush(stdout);
+}
+
+static void interrupted(struct event_loop *loop,
+                        const struct signalfd_siginfo *info, void *arg) {
+  struct session *s = (struct session *)arg;
+  fprintf(s->temp_file, "\nInterrupted..\n");
+  s->status = (int)info->ssi_signo;
+  event_loop_stop(loop);
+}
+
+static void example(void) {
+  struct event_loop *loop = new_loop();
+  struct session s = {fopen("tmp", "w"), EXIT_SUCCESS, false};
+  if (s.temp_file == NULL)
+    fail("tmp");
+  if (!event_watch_signal(loop, SIGINT, interrupted, &s))
+    fail("event_watch_signal");
+  printf("Ready...\n");
+  fflush(stdout);
+  if (event_watch_fd(loop, STDIN_FILENO, EPOLLIN, ready, &s)) {
+    if (event_loop_run(loop) != 0)
+      fail("event_loop_run");
+  } else if (errno == EPERM) {
+    /* a regular file, which epoll will not watch: it is always ready */
+    while (!s.done)
+      ready(loop, STDIN_FILENO, EPOLLIN, &s);
+  } else {
+    fail("event_watch_fd");
+  }
+  fclose(s.temp_file);
+  event_loop_destroy(loop);
+  exit(s.status);
+}
+
+/* -------- signal to callback -------- */
+
+struct latency {
+  int answer; /* an eventfd the sender waits on */
+  uint64_t *delays;
+  size_t count, rounds;
+};
+
+/* the time each signal was sent travels with it, as its value */
+static void *send_signals(void *arg) {
+  struct latency *l = (struct latency *)arg;
+  for (size_t i = 0; i < l->rounds; i++) {
+    union sigval value;
+    value.sival_ptr = (void *)(uintptr_t)now_ns();
+    if (sigqueue(getpid(), SIGUSR1, value) != 0)
+      fail("sigqueue");
+    uint64_t answered;
+    if (read(l->answer, &answered, sizeof(answered)) != sizeof(answered))
+      fail("read");
+  }
+  return NULL;
+}
+
+static void received(struct event_loop *loop,
+                     const struct signalfd_siginfo *info, void *arg) {
+  uint64_t now = now_ns();
+  struct latency *l = (struct latency *)arg;
+  l->delays[l->count++] = now - info->ssi_ptr;
+  if (l->count == l->rounds)
+    event_loop_stop(loop);
+  uint64_t one = 1;
+  if (write(l->answer, &one, sizeof(one)) != sizeof(one))
+    fail("write");
+}
+
+static int compare_delays(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void time_signals(size_t rounds) {
+  struct event_loop *loop = new_loop();
+  struct latency l = {eventfd(0, EFD_CLOEXEC), NULL, 0, rounds};
+  if (l.answer < 0)
+    fail("eventfd");
+  l.delays = (uint64_t *)xmalloc(rounds * sizeof(*l.delays));
+  /* blocked before the thread starts, so it inherits the mask */
+  if (!event_watch_signal(loop, SIGUSR1, received, &l))
+    fail("event_watch_signal");
+  pthread_t sender;
+  if (pthread_create(&sender, NULL, send_signals, &l) != 0)
+    fail("pthread_create");
+  if (event_loop_run(loop) != 0)
+    fail("event_loop_run");
+  pthread_join(sender, NULL);
+
+  uint64_t sum = 0;
+  for (size_t i = 0; i < rounds; i++)
+    sum += l.delays[i];
+  qsort(l.delays, rounds, sizeof(*l.delays), compare_delays);
+  printf("signal to callback, %zu signals\n", rounds);
+  printf("  mean %.0f ns, median %" PRIu64 " ns, 99th percentile %" PRIu64
+         " ns, max %" PRIu64 " ns\n",
+         (double)sum / rounds, l.delays[rounds / 2],
+         l.delays[rounds - rounds / 100 - 1], l.delays[rounds - 1]);
+  free(l.delays);
+  close(l.answer);
+  event_loop_destroy(loop);
+}
+
+/* -------- many descriptors -------- */
+
+struct pipe_ends {
+  int read_fd, write_fd;
+  uint64_t *callbacks;
+};
+
+static void pass_back(struct event_loop *loop, int fd, uint32_t events,
+                      void *arg) {
+  (void)loop;
+  (void)events;
+  struct pipe_ends *p = (struct pipe_ends *)arg;
+  char byte;
+  if (read(fd, &byte, 1) != 1 || write(p->write_fd, &byte, 1) != 1)
+    fail("pipe");
+  ++*p->callbacks;
+}
+
+static void time_up(struct event_loop *loop, int timer, uint64_t expirations,
+                    void *arg) {
+  (void)timer;
+  (void)expirations;
+  (void)arg;
+  event_loop_stop(loop);
+}
+
+/* room for 'needed' descriptors, raising the soft limit if need be */
+static void reserve_fds(size_t needed) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+    fail("getrlimit");
+  if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed) {
+      fprintf(stderr, "Only %llu file descriptors allowed\n",
+              (unsigned long long)limit.rlim_max);
+      exit(EXIT_FAILURE);
+    }
+    limit.rlim_cur = needed;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+      fail("setrlimit");
+  }
+}
+
+static void time_pipes(size_t pipes, uint64_t ms) {
+  reserve_fds(2 * pipes + SPARE_FDS);
+  struct event_loop *loop = new_loop();
+  struct pipe_ends *p = (struct pipe_ends *)xmalloc(pipes * sizeof(*p));
+  uint64_t callbacks = 0;
+  for (size_t i = 0; i < pipes; i++) {
+    int fds[2];
+    if (pipe(fds) != 0)
+      fail("pipe");
+    p[i].read_fd = fds[0];
+    p[i].write_fd = fds[1];
+    p[i].callbacks = &callbacks;
+    if (!event_watch_fd(loop, fds[0], EPOLLIN, pass_back, &p[i]))
+      fail("event_watch_fd");
+    if (write(fds[1], "x", 1) != 1)
+      fail("write");
+  }
+  if (event_add_timer(loop, ms * (NANOSECONDS / 1000), 0, time_up, NULL) < 0)
+    fail("event_add_timer");
+  uint64_t start = now_ns();
+  if (event_loop_run(loop) != 0)
+    fail("event_loop_run");
+  double t = (double)(now_ns() - start) / NANOSECONDS;
+
+  printf("%zu pipes, each always ready\n", pipes);
+  printf("  %" PRIu64 " callbacks in %.3f s, %.0f a second, %.0f ns each\n",
+         callbacks, t, callbacks / t, t / callbacks * NANOSECONDS);
+  for (size_t i = 0; i < pipes; i++) {
+    event_unwatch_fd(loop, p[i].read_fd);
+    close(p[i].read_fd);
+    close(p[i].write_fd);
+  }
+  free(p);
+  event_loop_destroy(loop);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  size_t rounds = DEFAULT_ROUNDS;
+  size_t pipes = DEFAULT_PIPES;
+  uint64_t ms = DEFAULT_MS;
+  int opt;
+  while ((opt = getopt(argc, argv, "br:f:t:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 'r':
+      rounds = strtoull(optarg, NULL, 10);
+      break;
+    case 'f':
+      pipes = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      ms = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-r rounds] [-f pipes] [-t ms]\n",
+              argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!bench)
+    example();
+  if (rounds == 0 || pipes == 0 || ms == 0) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  time_signals(rounds);
+  time_pipes(pipes, ms);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,753 @@
+/*
+ *
+ * Reductions over arrays: the maximum, the minimum, where the
+ * maximum is, the sum, and the minimum and maximum together.
+ *
+ * Example 9.6's maxof finds the largest of its arguments one
+ * va_arg at a time.  These take an array instead, of 8, 16, 32 or
+ * 64-bit integers, floats or doubles, and go through it a vector
+ * at a time, keeping several vectors of partial results so that
+ * each step need not wait for the one before.  maxof is kept, as
+ * a wrapper that gathers its arguments into an array.
+ *
+ * Each reduction comes in three variants, collected in a table
+ * per set of processor features: plain C, unrolled four ways;
+ * SSE2, 16 bytes at a time; and AVX2, 32 bytes at a time.  The
+ * vector code is written once, with GCC's vector extensions, and
+ * compiled for each width.  reduce_best picks the last table the
+ * processor supports, going by what CPUID says.
+ *
+ * Max, min and argmax pass over NaNs.  Argmax finds the maximum
+ * of each block of ARGMAX_BLOCK elements, remembering the first
+ * block with the largest, then looks through that block again,
+ * while it is still in the cache, for the first element equal to
+ * it.  Integer sums are exact, in 64 bits, except that sums of
+ * int64 wrap.  Float and double sums are compensated (Kahan
+ * summation), each lane of each vector carrying the error of its
+ * own partial sum.
+ *
+ * The reduce_ functions use the best variant, and split arrays of
+ * PARALLEL_BYTES or more between as many threads as
+ * reduce_set_threads has asked for, one by default.
+ */
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#define HAVE_X86_VARIANTS 1
+#else
+#define HAVE_X86_VARIANTS 0
+#endif
+
+#define ARGMAX_BLOCK 4096
+#define PARALLEL_BYTES (16 * 1024 * 1024)
+#define MAX_THREADS 64
+#define MAXOF_CHUNK 64
+
+/* processor features a variant needs */
+#define REDUCE_AVX2 1U
+
+/* name, element, sum, integer of the same size, lowest, highest */
+#define REDUCE_TYPES(X)                                                      \
+  X(int8, int8_t, int64_t, int8_t, INT8_MIN, INT8_MAX)                       \
+  X(int16, int16_t, int64_t, int16_t, INT16_MIN, INT16_MAX)                  \
+  X(int32, int32_t, int64_t, int32_t, INT32_MIN, INT32_MAX)                  \
+  X(int64, int64_t, int64_t, int64_t, INT64_MIN, INT64_MAX)                  \
+  X(float, float, double, int32_t, -INFINITY, INFINITY)                      \
+  X(double, double, double, int64_t, -INFINITY, INFINITY)
+
+/*
+ * Integer sums add each vector, widened, into lanes of 'wide',
+ * which are added into the 64-bit total every 'steps' vectors,
+ * before they can overflow.
+ */
+#define INTEGER_SUMS(X)                                                      \
+  X(int8, int8_t, int16_t, 255)                                              \
+  X(int16, int16_t, int32_t, 65535)                                          \
+  X(int32, int32_t, int64_t, 1 << 24)                                        \
+  X(int64, int64_t, uint64_t, 1 << 24)
+
+#define FLOAT_SUMS(X)                                                        \
+  X(float, float)                                                            \
+  X(double, double)
+
+struct reductions {
+  const char *name;
+  unsigned needs;
+#define FIELDS(name, type, sum_type, ...)                                    \
+  type (*max_##name)(const type *a, size_t n);                               \
+  type (*min_##name)(const type *a, size_t n);                               \
+  size_t (*argmax_##name)(const type *a, size_t n);                          \
+  sum_type (*sum_##name)(const type *a, size_t n);                           \
+  void (*minmax_##name)(const type *a, size_t n, type *min, type *max);
+  REDUCE_TYPES(FIELDS)
+#undef FIELDS
+};
+
+/* NaNs are never greater or lesser, so y is kept */
+#define GREATER(x, y) ((x) > (y) ? (x) : (y))
+#define LESSER(x, y) ((x) < (y) ? (x) : (y))
+
+/* add x to the sum s, whose lost low-order part is -c */
+#define KAHAN_ADD(type, s, c, x)                                             \
+  do {                                                                       \
+    type y_ = (x) - (c);                                                     \
+    type t_ = (s) + y_;                                                      \
+    (c) = (t_ - (s)) - y_;                                                   \
+    (s) = t_;                                                                \
+  } while (0)
+
+/* the sum of s[i] - c[i] over n partial sums, itself compensated */
+static double combine_sums(const double *s, const double *c, size_t n) {
+  double sum = 0, compensation = 0;
+  for (size_t i = 0; i < n; i++) {
+    KAHAN_ADD(double, sum, compensation, s[i]);
+    KAHAN_ADD(double, sum, compensation, -c[i]);
+  }
+  return sum - compensation;
+}
+
+/*
+ * An infinity makes the compensation NaN, so a compensated sum
+ * that comes out NaN is done again plainly, to give the infinity,
+ * or the NaN there really is.
+ */
+#define PLAIN_SUM(name, type)                                                \
+  static double plain_sum_##name(const type *a, size_t n) {                  \
+    double s = 0;                                                            \
+    for (size_t i = 0; i < n; i++)                                           \
+      s += a[i];                                                             \
+    return s;                                                                \
+  }
+FLOAT_SUMS(PLAIN_SUM)
+#undef PLAIN_SUM
+
+/* -------- plain C -------- */
+
+#define PORTABLE(name, type, sum_type, bits, lowest, highest)                \
+  static type max_##name##_portable(const type *a, size_t n) {               \
+    type m0 = lowest, m1 = lowest, m2 = lowest, m3 = lowest;                 \
+    size_t i = 0;                                                            \
+    for (; i + 4 <= n; i += 4) {                                             \
+      m0 = GREATER(a[i], m0);                                                \
+      m1 = GREATER(a[i + 1], m1);                                            \
+      m2 = GREATER(a[i + 2], m2);                                            \
+      m3 = GREATER(a[i + 3], m3);                                            \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+      m0 = GREATER(a[i], m0);                                                \
+    m0 = GREATER(m1, m0);                                                    \
+    m2 = GREATER(m3, m2);                                                    \
+    return GREATER(m2, m0);                                                  \
+  }                                                                          \
+                                                                             \
+  static type min_##name##_portable(const type *a, size_t n) {               \
+    type m0 = highest, m1 = highest, m2 = highest, m3 = highest;             \
+    size_t i = 0;                                                            \
+    for (; i + 4 <= n; i += 4) {                                             \
+      m0 = LESSER(a[i], m0);                                                 \
+      m1 = LESSER(a[i + 1], m1);                                             \
+      m2 = LESSER(a[i + 2], m2);                                             \
+      m3 = LESSER(a[i + 3], m3);                                             \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+      m0 = LESSER(a[i], m0);                                                 \
+    m0 = LESSER(m1, m0);                                                     \
+    m2 = LESSER(m3, m2);                                                     \
+    return LESSER(m2, m0);                                                   \
+  }                                                                          \
+                                                                             \
+  static void minmax_##name##_portable(const type *a, size_t n, type *min,   \
+                                       type *max) {                          \
+    type lo0 = highest, lo1 = highest, hi0 = lowest, hi1 = lowest;           \
+    size_t i = 0;                                                            \
+    for (; i + 2 <= n; i += 2) {                                             \
+      lo0 = LESSER(a[i], lo0);                                               \
+      hi0 = GREATER(a[i], hi0);                                              \
+      lo1 = LESSER(a[i + 1], lo1);                                           \
+      hi1 = GREATER(a[i + 1], hi1);                                          \
+    }                                                                        \
+    for (; i < n; i++) {                                                     \
+      lo0 = LESSER(a[i], lo0);                                               \
+      hi0 = GREATER(a[i], hi0);                                              \
+    }                                                                        \
+    *min = LESSER(lo1, lo0);                                                 \
+    *max = GREATER(hi1, hi0);                                                \
+  }
+REDUCE_TYPES(PORTABLE)
+#undef PORTABLE
+
+/* wrapping, in unsigned arithmetic, for int64 */
+#define PORTABLE_INTEGER_SUM(name, type, wide, steps)                        \
+  static int64_t sum_##name##_portable(const type *a, size_t n) {            \
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;                                 \
+    size_t i = 0;                                                            \
+    for (; i + 4 <= n; i += 4) {                                             \
+      s0 += (uint64_t)a[i];                                                  \
+      s1 += (uint64_t)a[i + 1];                                              \
+      s2 += (uint64_t)a[i + 2];                                              \
+      s3 += (uint64_t)a[i + 3];                                              \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+      s0 += (uint64_t)a[i];                                                  \
+    return (int64_t)(s0 + s1 + s2 + s3);                                     \
+  }
+INTEGER_SUMS(PORTABLE_INTEGER_SUM)
+#undef PORTABLE_INTEGER_SUM
+
+#define PORTABLE_FLOAT_SUM(name, type)                                       \
+  static double sum_##name##_portable(const type *a, size_t n) {             \
+    type s[4] = {0, 0, 0, 0}, c[4] = {0, 0, 0, 0};                           \
+    size_t i = 0;                                                            \
+    for (; i + 4 <= n; i += 4)                                               \
+      for (int k = 0; k < 4; k++)                                            \
+        KAHAN_ADD(type, s[k], c[k], a[i + k]);                               \
+    for (; i < n; i++)                                                       \
+      KAHAN_ADD(type, s[0], c[0], a[i]);                                     \
+    double ds[4], dc[4];                                                     \
+    for (int k = 0; k < 4; k++) {                                            \
+      ds[k] = s[k];                                                          \
+      dc[k] = c[k];                                                          \
+    }                                                                        \
+    double sum = combine_sums(ds, dc, 4);                                    \
+    return sum == sum ? sum : plain_sum_##name(a, n);                        \
+  }
+FLOAT_SUMS(PORTABLE_FLOAT_SUM)
+#undef PORTABLE_FLOAT_SUM
+
+#define ARGMAX(variant, name, type, sum_type, bits, lowest, highest)         \
+  static size_t argmax_##name##_##variant(const type *a, size_t n) {         \
+    type best = lowest;                                                      \
+    size_t block = 0;                                                        \
+    for (size_t start = 0; start < n; start += ARGMAX_BLOCK) {               \
+      size_t length = n - start < ARGMAX_BLOCK ? n - start : ARGMAX_BLOCK;   \
+      type m = max_##name##_##variant(a + start, length);                    \
+      if (m > best) {                                                        \
+        best = m;                                                            \
+        block = start;                                                       \
+      }                                                                      \
+    }                                                                        \
+    for (size_t i = block; i < n; i++)                                       \
+      if (a[i] == best)                                                      \
+        return i;                                                            \
+    return 0; /* nothing but NaNs */                                         \
+  }
+
+#define ENTRIES(variant, name)                                               \
+  .max_##name = max_##name##_##variant, .min_##name = min_##name##_##variant, \
+  .argmax_##name = argmax_##name##_##variant,                                \
+  .sum_##name = sum_##name##_##variant,                                      \
+  .minmax_##name = minmax_##name##_##variant,
+
+#define PORTABLE_ARGMAX(...) ARGMAX(portable, __VA_ARGS__)
+REDUCE_TYPES(PORTABLE_ARGMAX)
+#undef PORTABLE_ARGMAX
+
+#define PORTABLE_ENTRIES(name, ...) ENTRIES(portable, name)
+static const struct reductions portable_ops = {
+    .name = "portable",
+    .needs = 0,
+    REDUCE_TYPES(PORTABLE_ENTRIES)};
+#undef PORTABLE_ENTRIES
+
+#if HAVE_X86_VARIANTS
+
+/* -------- vectors -------- */
+
+/* an unaligned vector load, as _mm_loadu_si128 and the like do it */
+#define UNALIGNED(type, bytes)                                               \
+  type __attribute__((vector_size(bytes), aligned(1), may_alias))
+#define LOAD(uvec, p) (*(const uvec *)(p))
+
+/* x where mask is set, y elsewhere */
+#define SELECT(vec, mask, m, x, y)                                           \
+  ((vec)(((mask)(x) & (m)) | ((mask)(y) & ~(m))))
+
+/* the reductions of one element type, 'bytes' at a time */
+#define VECTOR(variant, isa, bytes, name, type, sum_type, bits, lowest,      \
+               highest)                                                      \
+  __attribute__((target(isa))) static type max_##name##_##variant(           \
+      const type *a, size_t n) {                                             \
+    typedef type vec __attribute__((vector_size(bytes)));                    \
+    typedef UNALIGNED(type, bytes) uvec;                                     \
+    typedef bits mask __attribute__((vector_size(bytes)));                   \
+    enum { LANES = (bytes) / sizeof(type) };                                 \
+    vec m0 = (vec){0} + (type)(lowest), m1 = m0, m2 = m0, m3 = m0;           \
+    size_t i = 0;                                                            \
+    for (; i + 4 * LANES <= n; i += 4 * LANES) {                             \
+      vec x[4] = {LOAD(uvec, a + i), LOAD(uvec, a + i + LANES),              \
+                  LOAD(uvec, a + i + 2 * LANES),                             \
+                  LOAD(uvec, a + i + 3 * LANES)};                            \
+      mask g0 = x[0] > m0, g1 = x[1] > m1, g2 = x[2] > m2, g3 = x[3] > m3;   \
+      m0 = SELECT(vec, mask, g0, x[0], m0);                                  \
+      m1 = SELECT(vec, mask, g1, x[1], m1);                                  \
+      m2 = SELECT(vec, mask, g2, x[2], m2);                                  \
+      m3 = SELECT(vec, mask, g3, x[3], m3);                                  \
+    }                                                                        \
+    mask g = m1 > m0;                                                        \
+    m0 = SELECT(vec, mask, g, m1, m0);                                       \
+    g = m3 > m2;                                                             \
+    m2 = SELECT(vec, mask, g, m3, m2);                                       \
+    g = m2 > m0;                                                             \
+    m0 = SELECT(vec, mask, g, m2, m0);                                       \
+    type lanes[LANES];                                                       \
+    memcpy(lanes, &m0, sizeof(lanes));                                       \
+    type m = lowest;                                                         \
+    for (size_t k = 0; k < LANES; k++)                                       \
+      m = GREATER(lanes[k], m);                                              \
+    for (; i < n; i++)                                                       \
+      m = GREATER(a[i], m);                                                  \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  __attribute__((target(isa))) static type min_##name##_##variant(           \
+      const type *a, size_t n) {                                             \
+    typedef type vec __attribute__((vector_size(bytes)));                    \
+    typedef UNALIGNED(type, bytes) uvec;                                     \
+    typedef bits mask __attribute__((vector_size(bytes)));                   \
+    enum { LANES = (bytes) / sizeof(type) };                                 \
+    vec m0 = (vec){0} + (type)(highest), m1 = m0, m2 = m0, m3 = m0;          \
+    size_t i = 0;                                                            \
+    for (; i + 4 * LANES <= n; i += 4 * LANES) {                             \
+      vec x[4] = {LOAD(uvec, a + i), LOAD(uvec, a + i + LANES),              \
+                  LOAD(uvec, a + i + 2 * LANES),                             \
+                  LOAD(uvec, a + i + 3 * LANES)};                            \
+      mask l0 = x[0] < m0, l1 = x[1] < m1, l2 = x[2] < m2, l3 = x[3] < m3;   \
+      m0 = SELECT(vec, mask, l0, x[0], m0);                                  \
+      m1 = SELECT(vec, mask, l1, x[1], m1);                                  \
+      m2 = SELECT(vec, mask, l2, x[2], m2);                                  \
+      m3 = SELECT(vec, mask, l3, x[3], m3);                                  \
+    }                                                                        \
+    mask l = m1 < m0;                                                        \
+    m0 = SELECT(vec, mask, l, m1, m0);                                       \
+    l = m3 < m2;                                                             \
+    m2 = SELECT(vec, mask, l, m3, m2);                                       \
+    l = m2 < m0;                                                             \
+    m0 = SELECT(vec, mask, l, m2, m0);                                       \
+    type lanes[LANES];                                                       \
+    memcpy(lanes, &m0, sizeof(lanes));                                       \
+    type m = highest;                                                        \
+    for (size_t k = 0; k < LANES; k++)                                       \
+      m = LESSER(lanes[k], m);                                               \
+    for (; i < n; i++)                                                       \
+      m = LESSER(a[i], m);                                                   \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  __attribute__((target(isa))) static void minmax_##name##_##variant(        \
+      const type *a, size_t n, type *min, type *max) {                       \
+    typedef type vec __attribute__((vector_size(bytes)));                    \
+    typedef UNALIGNED(type, bytes) uvec;                                     \
+    typedef bits mask __attribute__((vector_size(bytes)));                   \
+    enum { LANES = (bytes) / sizeof(type) };                                 \
+    vec lo0 = (vec){0} + (type)(highest), lo1 = lo0;                         \
+    vec hi0 = (vec){0} + (type)(lowest), hi1 = hi0;                          \
+    size_t i = 0;                                                            \
+    for (; i + 2 * LANES <= n; i += 2 * LANES) {                             \
+      vec x[2] = {LOAD(uvec, a + i), LOAD(uvec, a + i + LANES)};             \
+      mask l0 = x[0] < lo0, l1 = x[1] < lo1;                                 \
+      mask g0 = x[0] > hi0, g1 = x[1] > hi1;                                 \
+      lo0 = SELECT(vec, mask, l0, x[0], lo0);                                \
+      lo1 = SELECT(vec, mask, l1, x[1], lo1);                                \
+      hi0 = SELECT(vec, mask, g0, x[0], hi0);                                \
+      hi1 = SELECT(vec, mask, g1, x[1], hi1);                                \
+    }                                                                        \
+    type lows[2 * LANES], highs[2 * LANES];                                  \
+    memcpy(lows, &lo0, sizeof(lo0));                                         \
+    memcpy(lows + LANES, &lo1, sizeof(lo1));                                 \
+    memcpy(highs, &hi0, sizeof(hi0));                                        \
+    memcpy(highs + LANES, &hi1, sizeof(hi1));                                \
+    type lo = highest, hi = lowest;                                          \
+    for (size_t k = 0; k < 2 * LANES; k++) {                                 \
+      lo = LESSER(lows[k], lo);                                              \
+      hi = GREATER(highs[k], hi);                                            \
+    }                                                                        \
+    for (; i < n; i++) {                                                     \
+      lo = LESSER(a[i], lo);                                                 \
+      hi = GREATER(a[i], hi);                                                \
+    }                                                                        \
+    *min = lo;                                                               \
+    *max = hi;                                                               \
+  }                                                                          \
+                                                                             \
+  ARGMAX(variant, name, type, sum_type, bits, lowest, highest)
+
+/* loads of narrow lanes, each widened to fill a vector of 'wide' */
+#define VECTOR_INTEGER_SUM(variant, isa, bytes, name, type, wide, steps)     \
+  __attribute__((target(isa))) static int64_t sum_##name##_##variant(        \
+      const type *a, size_t n) {                                             \
+    enum { LANES = (bytes) / sizeof(wide) };                                 \
+    typedef UNALIGNED(type, LANES * sizeof(type)) narrow;                    \
+    typedef wide wvec __attribute__((vector_size(bytes)));                   \
+    uint64_t total = 0;                                                      \
+    size_t i = 0;                                                            \
+    while (i + 2 * LANES <= n) {                                             \
+      wvec w0 = {0}, w1 = {0};                                               \
+      for (size_t k = 0; k < (steps) && i + 2 * LANES <= n;                  \
+           k++, i += 2 * LANES) {                                            \
+        w0 += __builtin_convertvector(LOAD(narrow, a + i), wvec);            \
+        w1 += __builtin_convertvector(LOAD(narrow, a + i + LANES), wvec);    \
+      }                                                                      \
+      wide lanes[2 * LANES];                                                 \
+      memcpy(lanes, &w0, sizeof(w0));                                        \
+      memcpy(lanes + LANES, &w1, sizeof(w1));                                \
+      for (size_t k = 0; k < 2 * LANES; k++)                                 \
+        total += (uint64_t)lanes[k];                                         \
+    }                                                                        \
+    for (; i < n; i++)                                                       \
+      total += (uint64_t)a[i];                                               \
+    return (int64_t)total;                                                   \
+  }
+
+#define VECTOR_FLOAT_SUM(variant, isa, bytes, name, type)                    \
+  __attribute__((target(isa))) static double sum_##name##_##variant(         \
+      const type *a, size_t n) {                                             \
+    enum { LANES = (bytes) / sizeof(type) };                                 \
+    typedef type vec __attribute__((vector_size(bytes)));                    \
+    typedef UNALIGNED(type, bytes) uvec;                                     \
+    vec s[4] = {{0}}, c[4] = {{0}};                                          \
+    size_t i = 0;                                                            \
+    for (; i + 4 * LANES <= n; i += 4 * LANES) {                             \
+      vec x[4] = {LOAD(uvec, a + i), LOAD(uvec, a + i + LANES),              \
+                  LOAD(uvec, a + i + 2 * LANES),                             \
+                  LOAD(uvec, a + i + 3 * LANES)};                            \
+      KAHAN_ADD(vec, s[0], c[0], x[0]);                                      \
+      KAHAN_ADD(vec, s[1], c[1], x[1]);                                      \
+      KAHAN_ADD(vec, s[2], c[2], x[2]);                                      \
+      KAHAN_ADD(vec, s[3], c[3], x[3]);                                      \
+    }                                                                        \
+    type ls[4 * LANES + 1], lc[4 * LANES + 1];                               \
+    memcpy(ls, s, sizeof(s));                                                \
+    memcpy(lc, c, sizeof(c));                                                \
+    type tail = 0, tail_c = 0;                                               \
+    for (; i < n; i++)                                                       \
+      KAHAN_ADD(type, tail, tail_c, a[i]);                                   \
+    ls[4 * LANES] = tail;                                                    \
+    lc[4 * LANES] = tail_c;                                                  \
+    double ds[4 * LANES + 1], dc[4 * LANES + 1];                             \
+    for (size_t k = 0; k <= 4 * LANES; k++) {                                \
+      ds[k] = ls[k];                                                         \
+      dc[k] = lc[k];                                                         \
+    }                                                                        \
+    double sum = combine_sums(ds, dc, 4 * LANES + 1);                        \
+    return sum == sum ? sum : plain_sum_##name(a, n);                        \
+  }
+
+/* -------- SSE2 -------- */
+
+#define SSE2(...) VECTOR(sse2, "sse2", 16, __VA_ARGS__)
+#define SSE2_INTEGER_SUM(...) VECTOR_INTEGER_SUM(sse2, "sse2", 16, __VA_ARGS__)
+#define SSE2_FLOAT_SUM(...) VECTOR_FLOAT_SUM(sse2, "sse2", 16, __VA_ARGS__)
+REDUCE_TYPES(SSE2)
+INTEGER_SUMS(SSE2_INTEGER_SUM)
+FLOAT_SUMS(SSE2_FLOAT_SUM)
+#undef SSE2
+#undef SSE2_INTEGER_SUM
+#undef SSE2_FLOAT_SUM
+
+/* SSE2 is part of x86-64, so always there */
+#define SSE2_ENTRIES(name, ...) ENTRIES(sse2, name)
+static const struct reductions sse2_ops = {
+    .name = "sse2",
+    .needs = 0,
+    REDUCE_TYPES(SSE2_ENTRIES)};
+#undef SSE2_ENTRIES
+
+/* -------- AVX2 -------- */
+
+#define AVX2(...) VECTOR(avx2, "avx2", 32, __VA_ARGS__)
+#define AVX2_INTEGER_SUM(...) VECTOR_INTEGER_SUM(avx2, "avx2", 32, __VA_ARGS__)
+#define AVX2_FLOAT_SUM(...) VECTOR_FLOAT_SUM(avx2, "avx2", 32, __VA_ARGS__)
+REDUCE_TYPES(AVX2)
+INTEGER_SUMS(AVX2_INTEGER_SUM)
+FLOAT_SUMS(AVX2_FLOAT_SUM)
+#undef AVX2
+#undef AVX2_INTEGER_SUM
+#undef AVX2_FLOAT_SUM
+
+#define AVX2_ENTRIES(name, ...) ENTRIES(avx2, name)
+static const struct reductions avx2_ops = {
+    .name = "avx2",
+    .needs = REDUCE_AVX2,
+    REDUCE_TYPES(AVX2_ENTRIES)};
+#undef AVX2_ENTRIES
+
+#endif
+
+static const struct reductions *const variants[] = {
+    &portable_ops,
+#if HAVE_X86_VARIANTS
+    &sse2_ops,
+    &avx2_ops,
+#endif
+};
+
+/* -------- choosing a variant -------- */
+
+/* the REDUCE_ features this processor and operating system support */
+unsigned reduce_cpu_features(void) {
+  unsigned features = 0;
+#if HAVE_X86_VARIANTS
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  bool avx_state = false;
+  if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+    /* the operating system must save the YMM registers too */
+    unsigned lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    avx_state = (lo & 6) == 6;
+  }
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2) &&
+      avx_state)
+    features |= REDUCE_AVX2;
+#endif
+  return features;
+}
+
+size_t reduce_variant_count(void) {
+  return sizeof(variants) / sizeof(variants[0]);
+}
+
+/* variant i, from plain C up, whether or not it can run here */
+const struct reductions *reduce_variant(size_t i) {
+  return i < reduce_variant_count() ? variants[i] : NULL;
+}
+
+bool reduce_supported(const struct reductions *ops) {
+  return (ops->needs & ~reduce_cpu_features()) == 0;
+}
+
+const struct reductions *reduce_best(void) {
+  const struct reductions *best = &portable_ops;
+  for (size_t i = 0; i < reduce_variant_count(); i++)
+    if (reduce_supported(variants[i]))
+      best = variants[i];
+  return best;
+}
+
+/* -------- the best variant, on one thread or several -------- */
+
+static const struct reductions *chosen;
+static unsigned thread_count = 1;
+
+/* CPUID once: under a hypervisor each one may trap */
+static const struct reductions *best_ops(void) {
+  const struct reductions *ops = __atomic_load_n(&chosen, __ATOMIC_RELAXED);
+  if (ops == NULL) {
+    ops = reduce_best();
+    __atomic_store_n(&chosen, ops, __ATOMIC_RELAXED);
+  }
+  return ops;
+}
+
+/* split arrays of PARALLEL_BYTES or more between 'threads' threads */
+void reduce_set_threads(unsigned threads) {
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  __atomic_store_n(&thread_count, threads, __ATOMIC_RELAXED);
+}
+
+static size_t parts_for(size_t bytes) {
+  return bytes < PARALLEL_BYTES ? 1
+                                : __atomic_load_n(&thread_count,
+                                                  __ATOMIC_RELAXED);
+}
+
+static int64_t add_parts_int64(const int64_t *sums, size_t n) {
+  uint64_t total = 0;
+  for (size_t i = 0; i < n; i++)
+    total += (uint64_t)sums[i];
+  return (int64_t)total;
+}
+
+static double add_parts_double(const double *sums, size_t n) {
+  double zeros[MAX_THREADS] = {0};
+  double sum = combine_sums(sums, zeros, n);
+  return sum == sum ? sum : plain_sum_double(sums, n);
+}
+
+#define ADD_PARTS(sums, n)                                                   \
+  _Generic((sums)[0], int64_t: add_parts_int64, double: add_parts_double)(   \
+      (sums), (n))
+
+enum reduce_op { OP_MAX, OP_MIN, OP_ARGMAX, OP_MINMAX };
+
+#define PARALLEL(name, type, sum_type, bits, lowest, highest)                \
+  struct part_##name {                                                       \
+    const struct reductions *ops;                                            \
+    enum reduce_op op;                                                       \
+    const type *a;                                                           \
+    size_t n;                                                                \
+    type min, max;                                                           \
+    size_t arg;                                                              \
+  };                                                                         \
+                                                                             \
+  static void *run_part_##name(void *arg) {                                  \
+    struct part_##name *p = (struct part_##name *)arg;                       \
+    switch (p->op) {                                                         \
+    case OP_MAX:                                                             \
+      p->max = p->ops->max_##name(p->a, p->n);                               \
+      break;                                                                 \
+    case OP_MIN:                                                             \
+      p->min = p->ops->min_##name(p->a, p->n);                               \
+      break;                                                                 \
+    case OP_ARGMAX:                                                          \
+      p->arg = p->ops->argmax_##name(p->a, p->n);                            \
+      break;                                                                 \
+    case OP_MINMAX:                                                          \
+      p->ops->minmax_##name(p->a, p->n, &p->min, &p->max);                   \
+      break;                                                                 \
+    }                                                                        \
+    return NULL;                                                             \
+  }                                                                          \
+                                                                             \
+  /* run op on 'count' pieces of a, each on a thread of its own */           \
+  static void run_parts_##name(enum reduce_op op, const type *a, size_t n,   \
+                               struct part_##name *parts, size_t count) {    \
+    pthread_t threads[MAX_THREADS];                                          \
+    bool started[MAX_THREADS];                                               \
+    for (size_t k = 0; k < count; k++) {                                     \
+      size_t from = n / count * k, to = k + 1 < count ? from + n / count : n; \
+      parts[k].ops = best_ops();                                             \
+      parts[k].op = op;                                                      \
+      parts[k].a = a + from;                                                 \
+      parts[k].n = to - from;                                                \
+    }                                                                        \
+    for (size_t k = 1; k < count; k++)                                       \
+      started[k] = pthread_create(&threads[k], NULL, run_part_##name,        \
+                                  &parts[k]) == 0;                           \
+    run_part_##name(&parts[0]);                                              \
+    for (size_t k = 1; k < count; k++)                                       \
+      if (started[k])                                                        \
+        pthread_join(threads[k], NULL);                                      \
+      else                                                                   \
+        run_part_##name(&parts[k]);                                          \
+  }                                                                          \
+                                                                             \
+  type reduce_max_##name(const type *a, size_t n) {                          \
+    size_t count = parts_for(n * sizeof(type));                              \
+    if (count <= 1)                                                          \
+      return best_ops()->max_##name(a, n);                                   \
+    struct part_##name parts[MAX_THREADS];                                   \
+    run_parts_##name(OP_MAX, a, n, parts, count);                            \
+    type m = lowest;                                                         \
+    for (size_t k = 0; k < count; k++)                                       \
+      m = GREATER(parts[k].max, m);                                          \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  type reduce_min_##name(const type *a, size_t n) {                          \
+    size_t count = parts_for(n * sizeof(type));                              \
+    if (count <= 1)                                                          \
+      return best_ops()->min_##name(a, n);                                   \
+    struct part_##name parts[MAX_THREADS];                                   \
+    run_parts_##name(OP_MIN, a, n, parts, count);                            \
+    type m = highest;                                                        \
+    for (size_t k = 0; k < count; k++)                                       \
+      m = LESSER(parts[k].min, m);                                           \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  /* the first element equal to the maximum; 0 if all are NaNs */            \
+  size_t reduce_argmax_##name(const type *a, size_t n) {                     \
+    size_t count = parts_for(n * sizeof(type));                              \
+    if (count <= 1)                                                          \
+      return best_ops()->argmax_##name(a, n);                                \
+    struct part_##name parts[MAX_THREADS];                                   \
+    run_parts_##name(OP_ARGMAX, a, n, parts, count);                         \
+    const type *best = NULL;                                                 \
+    for (size_t k = 0; k < count; k++) {                                     \
+      const type *p = parts[k].a + parts[k].arg;                             \
+      /* a part of nothing but NaNs gives its first */                       \
+      if (*p == *p && (best == NULL || *p > *best))                          \
+        best = p;                                                            \
+    }                                                                        \
+    return best == NULL ? 0 : (size_t)(best - a);                            \
+  }                                                                          \
+                                                                             \
+  void reduce_minmax_##name(const type *a, size_t n, type *min, type *max) { \
+    size_t count = parts_for(n * sizeof(type));                              \
+    if (count <= 1) {                                                        \
+      best_ops()->minmax_##name(a, n, min, max);                             \
+      return;                                                                \
+    }                                                                        \
+    struct part_##name parts[MAX_THREADS];                                   \
+    run_parts_##name(OP_MINMAX, a, n, parts, count);                         \
+    *min = highest;                                                          \
+    *max = lowest;                                                           \
+    for (size_t k = 0; k < count; k++) {                                     \
+      *min = LESSER(parts[k].min, *min);                                     \
+      *max = GREATER(parts[k].max, *max);                                    \
+    }                                                                        \
+  }                                                                          \
+                                                                             \
+  struct sum_part_##name {                                                   \
+    const type *a;                                                           \
+    size_t n;                                                                \
+    sum_type sum;                                                            \
+  };                                                                         \
+                                                                             \
+  static void *run_sum_part_##name(void *arg) {                              \
+    struct sum_part_##name *p = (struct sum_part_##name *)arg;               \
+    p->sum = best_ops()->sum_##name(p->a, p->n);                             \
+    return NULL;                                                             \
+  }                                                                          \
+                                                                             \
+  sum_type reduce_sum_##name(const type *a, size_t n) {                      \
+    size_t count = parts_for(n * sizeof(type));                              \
+    if (count <= 1)                                                          \
+      return best_ops()->sum_##name(a, n);                                   \
+    struct sum_part_##name parts[MAX_THREADS];                               \
+    pthread_t threads[MAX_THREADS];                                          \
+    bool started[MAX_THREADS];                                               \
+    for (size_t k = 0; k < count; k++) {                                     \
+      size_t from = n / count * k, to = k + 1 < count ? from + n / count : n; \
+      parts[k].a = a + from;                                                 \
+      parts[k].n = to - from;                                                \
+    }                                                                        \
+    for (size_t k = 1; k < count; k++)                                       \
+      started[k] = pthread_create(&threads[k], NULL, run_sum_part_##name,    \
+                                  &parts[k]) == 0;                           \
+    run_sum_part_##name(&parts[0]);                                          \
+    sum_type sums[MAX_THREADS];                                              \
+    sums[0] = parts[0].sum;                                                  \
+    for (size_t k = 1; k < count; k++) {                                     \
+      if (started[k])                                                        \
+        pthread_join(threads[k], NULL);                                      \
+      else                                                                   \
+        run_sum_part_##name(&parts[k]);                                      \
+      sums[k] = parts[k].sum;                                                \
+    }                                                                        \
+    return ADD_PARTS(sums, count);                                           \
+  }
+REDUCE_TYPES(PARALLEL)
+#undef PARALLEL
+
+/* -------- example 9.6 -------- */
+
+/* the largest of n_args ints, or INT_MIN if there are none */
+int maxof(int n_args, ...) {
+  int32_t chunk[MAXOF_CHUNK];
+  int32_t max = INT32_MIN;
+  va_list ap;
+
+  va_start(ap, n_args);
+  for (int done = 0; done < n_args;) {
+    size_t k = 0;
+    for (; k < MAXOF_CHUNK && done < n_args; k++, done++)
+      chunk[k] = va_arg(ap, int);
+    max = GREATER(reduce_max_int32(chunk, k), max);
+  }
+  va_end(ap);
+  return max;
+}
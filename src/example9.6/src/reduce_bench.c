@@ -0,0 +1,426 @@
+/*
+ *
+ * Checking and timing the reductions of reduce.c.
+ *
+ * First every variant this processor can run, and the reduce_
+ * functions split between threads, are checked against plain
+ * loops like maxof's: on arrays of awkward lengths, of random
+ * values with NaNs, infinities and the extremes of each type
+ * thrown in, and of nothing but the extremes.  Then, unless -c is
+ * given, each is timed on arrays of 'size' megabytes, 512 by
+ * default, of every type, along with the plain loops; the last
+ * row of each table is the reduce_ functions on 'threads' threads,
+ * by default one for each processor online.
+ *
+ * usage: example9.6-reduce [-c] [-m size_mb] [-t threads]
+ */
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SIZE_MB 512
+#define MEGABYTE (1024 * 1024)
+#define MAX_CHECK_LENGTH 100003
+#define THREAD_CHECK_LENGTH (17 * MEGABYTE)
+#define CHECK_THREADS 3
+#define FLOAT_TOLERANCE 1e-6
+#define DOUBLE_TOLERANCE 1e-12
+
+#define REDUCE_TYPES(X)                                                      \
+  X(int8, int8_t, int64_t, int8_t, INT8_MIN, INT8_MAX)                       \
+  X(int16, int16_t, int64_t, int16_t, INT16_MIN, INT16_MAX)                  \
+  X(int32, int32_t, int64_t, int32_t, INT32_MIN, INT32_MAX)                  \
+  X(int64, int64_t, int64_t, int64_t, INT64_MIN, INT64_MAX)                  \
+  X(float, float, double, int32_t, -INFINITY, INFINITY)                      \
+  X(double, double, double, int64_t, -INFINITY, INFINITY)
+
+struct reductions {
+  const char *name;
+  unsigned needs;
+#define FIELDS(name, type, sum_type, ...)                                    \
+  type (*max_##name)(const type *a, size_t n);                               \
+  type (*min_##name)(const type *a, size_t n);                               \
+  size_t (*argmax_##name)(const type *a, size_t n);                          \
+  sum_type (*sum_##name)(const type *a, size_t n);                           \
+  void (*minmax_##name)(const type *a, size_t n, type *min, type *max);
+  REDUCE_TYPES(FIELDS)
+#undef FIELDS
+};
+
+size_t reduce_variant_count(void);
+const struct reductions *reduce_variant(size_t i);
+bool reduce_supported(const struct reductions *ops);
+const struct reductions *reduce_best(void);
+void reduce_set_threads(unsigned threads);
+#define PROTOTYPES(name, type, sum_type, ...)                                \
+  type reduce_max_##name(const type *a, size_t n);                           \
+  type reduce_min_##name(const type *a, size_t n);                           \
+  size_t reduce_argmax_##name(const type *a, size_t n);                      \
+  sum_type reduce_sum_##name(const type *a, size_t n);                       \
+  void reduce_minmax_##name(const type *a, size_t n, type *min, type *max);
+REDUCE_TYPES(PROTOTYPES)
+#undef PROTOTYPES
+int maxof(int n_args, ...);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* xorshift64 */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/* a uniform value in [-1, 1) */
+static double random_fraction(void) {
+  return (double)((int64_t)next_random() >> 11) * 0x1p-52;
+}
+
+static bool failed;
+
+static void expect(bool ok, const char *who, const char *name,
+                   const char *what, size_t n) {
+  if (!ok) {
+    fprintf(stderr, "%s: %s %s wrong for %zu elements\n", who, name, what,
+            n);
+    failed = true;
+  }
+}
+
+/* sums of int64 wrap; others are exact in 64 bits or approximate */
+static int64_t wrapping_add(int64_t s, int64_t x) {
+  return (int64_t)((uint64_t)s + (uint64_t)x);
+}
+
+static double plain_add(double s, double x) { return s + x; }
+
+#define ADD(s, x) _Generic((s), int64_t: wrapping_add, double: plain_add)(s, x)
+
+/* a sum within 'tolerance' of the magnitudes summed, or both not finite */
+static bool close_enough(double got, long double exact, long double scale,
+                         double tolerance) {
+  if (isnan(exact) || isinf(exact) || isinf(scale))
+    return isnan(got) == isnan(exact) && (isnan(got) || got == exact);
+  return fabsl(got - exact) <= tolerance * scale;
+}
+
+/* -------- plain loops -------- */
+
+#define LOOPS(name, type, sum_type, bits, lowest, highest)                   \
+  static type loop_max_##name(const type *a, size_t n) {                     \
+    type m = lowest;                                                         \
+    for (size_t i = 0; i < n; i++)                                           \
+      if (a[i] > m)                                                          \
+        m = a[i];                                                            \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  static type loop_min_##name(const type *a, size_t n) {                     \
+    type m = highest;                                                        \
+    for (size_t i = 0; i < n; i++)                                           \
+      if (a[i] < m)                                                          \
+        m = a[i];                                                            \
+    return m;                                                                \
+  }                                                                          \
+                                                                             \
+  static size_t loop_argmax_##name(const type *a, size_t n) {                \
+    type m = lowest;                                                         \
+    size_t arg = 0;                                                          \
+    bool found = false;                                                      \
+    for (size_t i = 0; i < n; i++)                                           \
+      if (a[i] > m || (!found && a[i] == m)) {                               \
+        m = a[i];                                                            \
+        arg = i;                                                             \
+        found = true;                                                        \
+      }                                                                      \
+    return arg;                                                              \
+  }                                                                          \
+                                                                             \
+  static sum_type loop_sum_##name(const type *a, size_t n) {                 \
+    sum_type s = 0;                                                          \
+    for (size_t i = 0; i < n; i++)                                           \
+      s = ADD(s, a[i]);                                                      \
+    return s;                                                                \
+  }                                                                          \
+                                                                             \
+  static void loop_minmax_##name(const type *a, size_t n, type *min,         \
+                                 type *max) {                                \
+    *min = loop_min_##name(a, n);                                            \
+    *max = loop_max_##name(a, n);                                            \
+  }                                                                          \
+                                                                             \
+  /* the sum and the sum of magnitudes, more precisely */                    \
+  static long double exact_sum_##name(const type *a, size_t n,               \
+                                      long double *scale) {                  \
+    long double s = 0, magnitude = 0;                                        \
+    for (size_t i = 0; i < n; i++) {                                         \
+      s += a[i];                                                             \
+      magnitude += a[i] < 0 ? -(long double)a[i] : (long double)a[i];        \
+    }                                                                        \
+    *scale = magnitude;                                                      \
+    return s;                                                                \
+  }
+REDUCE_TYPES(LOOPS)
+#undef LOOPS
+
+static const struct reductions loop_ops = {
+    .name = "scalar loop",
+#define LOOP_ENTRIES(name, ...)                                              \
+  .max_##name = loop_max_##name, .min_##name = loop_min_##name,              \
+  .argmax_##name = loop_argmax_##name, .sum_##name = loop_sum_##name,        \
+  .minmax_##name = loop_minmax_##name,
+    REDUCE_TYPES(LOOP_ENTRIES)
+#undef LOOP_ENTRIES
+};
+
+/* the reduce_ functions, on however many threads are set */
+static const struct reductions threaded_ops = {
+    .name = "threads",
+#define THREADED_ENTRIES(name, ...)                                          \
+  .max_##name = reduce_max_##name, .min_##name = reduce_min_##name,          \
+  .argmax_##name = reduce_argmax_##name, .sum_##name = reduce_sum_##name,    \
+  .minmax_##name = reduce_minmax_##name,
+    REDUCE_TYPES(THREADED_ENTRIES)
+#undef THREADED_ENTRIES
+};
+
+/* -------- filling arrays -------- */
+
+/* not a constant, so that converting it in integer code draws no warning */
+static double not_a_number = NAN;
+
+enum pattern { RANDOM, SPECIALS, ALL_LOWEST, ALL_HIGHEST, PATTERNS };
+
+#define FILL(name, type, sum_type, bits, lowest, highest)                    \
+  static void fill_##name(type *a, size_t n, enum pattern pattern) {         \
+    bool integer = (type)0.5 == 0;                                           \
+    for (size_t i = 0; i < n; i++) {                                         \
+      if (pattern == ALL_LOWEST)                                             \
+        a[i] = lowest;                                                       \
+      else if (pattern == ALL_HIGHEST)                                       \
+        a[i] = highest;                                                      \
+      else if (integer)                                                      \
+        a[i] = (type)next_random();                                          \
+      else                                                                   \
+        a[i] = (type)random_fraction();                                      \
+    }                                                                        \
+    if (pattern == SPECIALS && n > 0) {                                      \
+      for (size_t k = 0; k < 1 + n / 1000; k++) {                            \
+        a[next_random() % n] = lowest;                                       \
+        a[next_random() % n] = highest;                                      \
+        a[next_random() % n] = 0;                                            \
+      }                                                                      \
+      if (!integer)                                                          \
+        for (size_t k = 0; k < 1 + n / 100; k++)                             \
+          a[next_random() % n] = (type)not_a_number;                         \
+    }                                                                        \
+  }
+REDUCE_TYPES(FILL)
+#undef FILL
+
+/* -------- checking -------- */
+
+#define CHECK(type_name, type, sum_type, bits, lowest, highest)              \
+  static void check_##type_name(const struct reductions *ops, const type *a, \
+                           size_t n) {                                       \
+    const char *who = ops->name;                                             \
+    type max = loop_max_##type_name(a, n), min = loop_min_##type_name(a, n); \
+    expect(ops->max_##type_name(a, n) == max, who, #type_name, "max", n);    \
+    expect(ops->min_##type_name(a, n) == min, who, #type_name, "min", n);    \
+    size_t arg = loop_argmax_##type_name(a, n);                              \
+    expect(ops->argmax_##type_name(a, n) == arg, who, #type_name, "argmax",  \
+           n);                                                               \
+    type lo, hi;                                                             \
+    ops->minmax_##type_name(a, n, &lo, &hi);                                 \
+    expect(lo == min && hi == max, who, #type_name, "minmax", n);            \
+    sum_type sum = ops->sum_##type_name(a, n);                               \
+    bool ok;                                                                 \
+    if ((type)0.5 == 0) {                                                    \
+      ok = sum == loop_sum_##type_name(a, n);                                \
+    } else {                                                                 \
+      long double scale, exact = exact_sum_##type_name(a, n, &scale);        \
+      ok = close_enough(sum, exact, scale,                                   \
+                        sizeof(type) < sizeof(double) ? FLOAT_TOLERANCE      \
+                                                      : DOUBLE_TOLERANCE);   \
+    }                                                                        \
+    expect(ok, who, #type_name, "sum", n);                                   \
+  }                                                                          \
+                                                                             \
+  static void check_all_##type_name(void *buffer,                            \
+                                    const struct reductions *ops) {          \
+    type *a = (type *)buffer;                                                \
+    for (int pattern = 0; pattern < PATTERNS; pattern++) {                   \
+      for (size_t n = 0; n < 300; n++) {                                     \
+        fill_##type_name(a, n, (enum pattern)pattern);                       \
+        check_##type_name(ops, a, n);                                        \
+      }                                                                      \
+      for (size_t n = 4095; n < MAX_CHECK_LENGTH; n = n * 5 + 3) {           \
+        fill_##type_name(a, n, (enum pattern)pattern);                       \
+        check_##type_name(ops, a, n);                                        \
+      }                                                                      \
+    }                                                                        \
+  }                                                                          \
+                                                                             \
+  /* long enough to be split between threads */                              \
+  static void check_threads_##type_name(void *buffer) {                      \
+    type *a = (type *)buffer;                                                \
+    size_t n = THREAD_CHECK_LENGTH / sizeof(type) - 7;                       \
+    for (int pattern = 0; pattern < PATTERNS; pattern++) {                   \
+      fill_##type_name(a, n, (enum pattern)pattern);                         \
+      check_##type_name(&threaded_ops, a, n);                                \
+    }                                                                        \
+  }
+REDUCE_TYPES(CHECK)
+#undef CHECK
+
+static void check(void) {
+  void *buffer = xmalloc(THREAD_CHECK_LENGTH);
+  for (size_t v = 0; v < reduce_variant_count(); v++) {
+    const struct reductions *ops = reduce_variant(v);
+    if (!reduce_supported(ops)) {
+      printf("%s not supported here\n", ops->name);
+      continue;
+    }
+#define CHECK_ALL(name, ...) check_all_##name(buffer, ops);
+    REDUCE_TYPES(CHECK_ALL)
+#undef CHECK_ALL
+    printf("%s checked\n", ops->name);
+  }
+  reduce_set_threads(CHECK_THREADS);
+#define CHECK_THREADS_OF(name, ...) check_threads_##name(buffer);
+  REDUCE_TYPES(CHECK_THREADS_OF)
+#undef CHECK_THREADS_OF
+  printf("%d threads checked\n", CHECK_THREADS);
+  free(buffer);
+
+  expect(maxof(3, 5, 24, 0) == 24, "maxof", "int", "max", 3);
+  expect(maxof(1, -7) == -7, "maxof", "int", "max", 1);
+  expect(maxof(0) == INT_MIN, "maxof", "int", "max", 0);
+  if (failed)
+    exit(EXIT_FAILURE);
+}
+
+/* -------- timing -------- */
+
+#define BENCH(type_name, type, sum_type, bits, lowest, highest)              \
+  static void bench_##type_name(void *buffer, size_t bytes,                  \
+                                unsigned threads) {                          \
+    type *a = (type *)buffer;                                                \
+    size_t n = bytes / sizeof(type);                                         \
+    double gb = n * sizeof(type) / 1e9;                                      \
+    fill_##type_name(a, n, RANDOM);                                          \
+    long double scale, exact = exact_sum_##type_name(a, n, &scale);          \
+    type max = loop_max_##type_name(a, n), min = loop_min_##type_name(a, n); \
+    size_t arg = loop_argmax_##type_name(a, n);                              \
+    sum_type sum = loop_sum_##type_name(a, n);                               \
+                                                                             \
+    printf("\n%-12s %9s %9s %9s %9s %9s   GB/s\n", #type_name, "max", "min", \
+           "argmax", "sum", "minmax");                                       \
+    for (size_t v = 0; v <= reduce_variant_count() + 1; v++) {               \
+      const struct reductions *ops =                                         \
+          v == 0 ? &loop_ops                                                 \
+                 : v <= reduce_variant_count() ? reduce_variant(v - 1)       \
+                                               : &threaded_ops;              \
+      if (!reduce_supported(ops))                                            \
+        continue;                                                            \
+      double t[5];                                                           \
+      bool ok = true;                                                        \
+      double start = now_seconds();                                          \
+      ok &= ops->max_##type_name(a, n) == max;                               \
+      t[0] = now_seconds() - start;                                          \
+      start = now_seconds();                                                 \
+      ok &= ops->min_##type_name(a, n) == min;                               \
+      t[1] = now_seconds() - start;                                          \
+      start = now_seconds();                                                 \
+      ok &= ops->argmax_##type_name(a, n) == arg;                            \
+      t[2] = now_seconds() - start;                                          \
+      start = now_seconds();                                                 \
+      sum_type s = ops->sum_##type_name(a, n);                               \
+      t[3] = now_seconds() - start;                                          \
+      ok &= (type)0.5 == 0 ? s == sum                                        \
+                           : close_enough(s, exact, scale, FLOAT_TOLERANCE); \
+      type lo, hi;                                                           \
+      start = now_seconds();                                                 \
+      ops->minmax_##type_name(a, n, &lo, &hi);                               \
+      t[4] = now_seconds() - start;                                          \
+      ok &= lo == min && hi == max;                                          \
+      char label[32];                                                        \
+      if (ops == &threaded_ops)                                              \
+        snprintf(label, sizeof(label), "%u threads", threads);               \
+      else                                                                   \
+        snprintf(label, sizeof(label), "%s", ops->name);                     \
+      printf("%-12s %9.2f %9.2f %9.2f %9.2f %9.2f%s\n", label, gb / t[0],    \
+             gb / t[1], gb / t[2], gb / t[3], gb / t[4],                     \
+             ok ? "" : "   results differ");                                 \
+      failed |= !ok;                                                         \
+    }                                                                        \
+  }
+REDUCE_TYPES(BENCH)
+#undef BENCH
+
+static void bench(size_t size_mb, unsigned threads) {
+  size_t bytes = size_mb * MEGABYTE;
+  void *buffer = xmalloc(bytes);
+  reduce_set_threads(threads);
+  printf("%zu MB arrays; best variant here is %s\n", size_mb,
+         reduce_best()->name);
+#define BENCH_OF(name, ...) bench_##name(buffer, bytes, threads);
+  REDUCE_TYPES(BENCH_OF)
+#undef BENCH_OF
+  free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+  bool check_only = false;
+  size_t size_mb = DEFAULT_SIZE_MB;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned threads = online > 0 ? (unsigned)online : 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "cm:t:")) != -1) {
+    switch (opt) {
+    case 'c':
+      check_only = true;
+      break;
+    case 'm':
+      size_mb = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c] [-m size_mb] [-t threads]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (size_mb == 0 || threads == 0) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  check();
+  if (!check_only)
+    bench(size_mb, threads);
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,278 @@
+/*
+ *
+ * An interpreter for recursive programs with the call stack
+ * held in an array of frames, after hanoi-subroutine-linkage.
+ *
+ * The programs are written once, as steps in frame_programs.def,
+ * and compiled three ways, to compare how the machine gets from
+ * one step to the next:
+ *
+ *   FRAME_SWITCH     a loop around a switch on the step number
+ *   FRAME_GOTO       a jump through a table of label addresses,
+ *                    like the return addresses of the original
+ *   FRAME_TAIL_CALL  a function per step, each ending in a tail
+ *                    call of the next, so nothing piles up on the
+ *                    C stack
+ *
+ * The frames are allocated in one block before the program
+ * starts, sized for the deepest the recursion can go.  A call
+ * that would go past the end stops the program instead.
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+enum frame_backend { FRAME_SWITCH, FRAME_GOTO, FRAME_TAIL_CALL };
+
+struct frame_tree_node {
+  int64_t value;
+  int32_t left, right; /* -1 for none */
+};
+
+struct frame_result {
+  int64_t value;     /* what the program returned */
+  uint64_t calls;    /* frames entered, counting tail calls */
+  uint64_t moves;    /* Hanoi moves made */
+  uint64_t checksum; /* of the moves, in order */
+};
+
+enum step {
+  STEP_HALT,
+#define STEP(name, ...) name,
+#include "frame_programs.def"
+#undef STEP
+  STEP_COUNT
+};
+
+struct frame {
+  int64_t a, b, c, d;
+  uint32_t resume; /* step to carry on at when the callee returns */
+};
+
+struct machine {
+  struct frame *limit; /* one past the last frame */
+  const struct frame_tree_node *tree;
+  int64_t ret;
+  uint64_t calls;
+  uint64_t moves;
+  uint64_t checksum;
+  bool overflow;
+};
+
+/* the parts of the step macros that don't depend on the backend */
+#define MOVE(from, to)                                                       \
+  {                                                                          \
+    m->moves++;                                                              \
+    m->checksum = m->checksum * 31 + (uint64_t)((from)*4 + (to));            \
+  }
+
+#define CALL(resume_step, entry_step, a_, b_, c_, d_)                        \
+  {                                                                          \
+    f->resume = (resume_step);                                               \
+    if (f + 1 == m->limit) {                                                 \
+      m->overflow = true;                                                    \
+      DISPATCH(STEP_HALT);                                                   \
+    }                                                                        \
+    f[1].a = (a_);                                                           \
+    f[1].b = (b_);                                                           \
+    f[1].c = (c_);                                                           \
+    f[1].d = (d_);                                                           \
+    f++;                                                                     \
+    m->calls++;                                                              \
+    DISPATCH(entry_step);                                                    \
+  }
+
+#define TAIL(entry_step, a_, b_, c_, d_)                                     \
+  {                                                                          \
+    int64_t new_a = (a_), new_b = (b_), new_c = (c_), new_d = (d_);          \
+    f->a = new_a;                                                            \
+    f->b = new_b;                                                            \
+    f->c = new_c;                                                            \
+    f->d = new_d;                                                            \
+    m->calls++;                                                              \
+    DISPATCH(entry_step);                                                    \
+  }
+
+#define RETURN(value)                                                        \
+  {                                                                          \
+    m->ret = (value);                                                        \
+    f--;                                                                     \
+    DISPATCH(f->resume);                                                     \
+  }
+
+/* -------- switch -------- */
+
+#define DISPATCH(s)                                                          \
+  {                                                                          \
+    step = (s);                                                              \
+    continue;                                                                \
+  }
+
+static void run_switch(struct machine *m, struct frame *f, uint32_t step) {
+  for (;;) {
+    switch (step) {
+    case STEP_HALT:
+      return;
+#define STEP(name, ...)                                                      \
+  case name: {                                                               \
+    __VA_ARGS__                                                              \
+  }
+#include "frame_programs.def"
+#undef STEP
+    }
+  }
+}
+
+#undef DISPATCH
+
+/* -------- computed goto -------- */
+
+#define DISPATCH(s) goto *labels[(s)]
+
+static void run_goto(struct machine *m, struct frame *f, uint32_t step) {
+  static void *const labels[STEP_COUNT] = {
+      [STEP_HALT] = &&label_STEP_HALT,
+#define STEP(name, ...) [name] = &&label_##name,
+#include "frame_programs.def"
+#undef STEP
+  };
+
+  DISPATCH(step);
+label_STEP_HALT:
+  return;
+#define STEP(name, ...)                                                      \
+  label_##name : {                                                           \
+    __VA_ARGS__                                                              \
+  }
+#include "frame_programs.def"
+#undef STEP
+}
+
+#undef DISPATCH
+
+/* -------- tail calls -------- */
+
+/*
+ * Without the musttail attribute, rely on the optimizer turning
+ * the calls into jumps, and make sure it runs on these functions
+ * even in an unoptimized build.
+ */
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifdef MUSTTAIL
+#define TAIL_STEP static void
+#else
+#define MUSTTAIL
+#define TAIL_STEP static __attribute__((optimize("O2"))) void
+#endif
+
+typedef void step_function(struct machine *m, struct frame *f);
+
+TAIL_STEP step_STEP_HALT(struct machine *m, struct frame *f) {
+  (void)m;
+  (void)f;
+}
+
+#define STEP(name, ...)                                                      \
+  TAIL_STEP step_##name(struct machine *m, struct frame *f);
+#include "frame_programs.def"
+#undef STEP
+
+static step_function *const step_functions[STEP_COUNT] = {
+    [STEP_HALT] = step_STEP_HALT,
+#define STEP(name, ...) [name] = step_##name,
+#include "frame_programs.def"
+#undef STEP
+};
+
+#define DISPATCH(s)                                                          \
+  {                                                                          \
+    MUSTTAIL return step_functions[(s)](m, f);                               \
+  }
+
+#define STEP(name, ...)                                                      \
+  TAIL_STEP step_##name(struct machine *m, struct frame *f) { __VA_ARGS__ }
+#include "frame_programs.def"
+#undef STEP
+
+#undef DISPATCH
+
+/* -------- running a program -------- */
+
+/*
+ * Run 'entry' with arguments a to d and room for 'depth' frames
+ * of recursion.  Returns false if there wasn't room, or memory.
+ */
+static bool run(enum frame_backend backend, uint32_t entry, int64_t a,
+                int64_t b, int64_t c, int64_t d, size_t depth,
+                const struct frame_tree_node *tree,
+                struct frame_result *result) {
+  /* frames[0] belongs to whoever called the program */
+  struct frame *frames =
+      (struct frame *)malloc((depth + 1) * sizeof(struct frame));
+  if (frames == NULL)
+    return false;
+  frames[0].resume = STEP_HALT;
+  frames[1].a = a;
+  frames[1].b = b;
+  frames[1].c = c;
+  frames[1].d = d;
+
+  struct machine m = {frames + depth + 1, tree, 0, 1, 0, 0, false};
+  switch (backend) {
+  case FRAME_SWITCH:
+    run_switch(&m, frames + 1, entry);
+    break;
+  case FRAME_GOTO:
+    run_goto(&m, frames + 1, entry);
+    break;
+  case FRAME_TAIL_CALL:
+    step_functions[entry](&m, frames + 1);
+    break;
+  }
+  free(frames);
+
+  result->value = m.ret;
+  result->calls = m.calls;
+  result->moves = m.moves;
+  result->checksum = m.checksum;
+  return !m.overflow;
+}
+
+/* moves are checksummed with pegs 1 to 3 */
+bool frame_hanoi(enum frame_backend backend, int32_t disks,
+                 struct frame_result *result) {
+  if (disks < 1 || disks > 62)
+    return false;
+  return run(backend, HANOI, disks, 1, 2, 3, (size_t)disks, NULL, result);
+}
+
+/*
+ * The recursion is never deeper than the answer, which for
+ * m up to 3 has a closed form.
+ */
+bool frame_ackermann(enum frame_backend backend, int64_t m, int64_t n,
+                     struct frame_result *result) {
+  if (m < 0 || m > 3 || n < 0 || n > 24)
+    return false;
+  int64_t answer[4] = {n + 1, n + 2, 2 * n + 3, ((int64_t)1 << (n + 3)) - 3};
+  return run(backend, ACKERMANN, m, n, 0, 0, (size_t)answer[m] + 1, NULL,
+             result);
+}
+
+bool frame_fib(enum frame_backend backend, int64_t n,
+               struct frame_result *result) {
+  if (n < 0 || n > 90)
+    return false;
+  return run(backend, FIB, n, 0, 0, 0, (size_t)n + 1, NULL, result);
+}
+
+/* 'height' counts nodes on the longest path from the root */
+bool frame_tree_sum(enum frame_backend backend,
+                    const struct frame_tree_node *tree, int32_t root,
+                    size_t height, struct frame_result *result) {
+  return run(backend, TREE_SUM, root, 0, 0, 0, height + 1, tree, result);
+}
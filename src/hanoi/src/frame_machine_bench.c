@@ -0,0 +1,258 @@
+/*
+ *
+ * Benchmark of the frame machine's three ways of dispatching.
+ *
+ * Hanoi, Ackermann, Fibonacci and the sum of a random binary
+ * tree are run with each backend and as ordinary recursive C
+ * functions.  The results must all agree; the time per frame
+ * entered is the cost of a call, return and dispatch.
+ *
+ * usage: hanoi-frames [-d disks]
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_DISKS 24
+#define ACKERMANN_M 3
+#define ACKERMANN_N 9
+#define FIB_N 32
+#define TREE_NODES (1 << 21)
+
+enum frame_backend { FRAME_SWITCH, FRAME_GOTO, FRAME_TAIL_CALL };
+
+struct frame_tree_node {
+  int64_t value;
+  int32_t left, right;
+};
+
+struct frame_result {
+  int64_t value;
+  uint64_t calls;
+  uint64_t moves;
+  uint64_t checksum;
+};
+
+bool frame_hanoi(enum frame_backend backend, int32_t disks,
+                 struct frame_result *result);
+bool frame_ackermann(enum frame_backend backend, int64_t m, int64_t n,
+                     struct frame_result *result);
+bool frame_fib(enum frame_backend backend, int64_t n,
+               struct frame_result *result);
+bool frame_tree_sum(enum frame_backend backend,
+                    const struct frame_tree_node *tree, int32_t root,
+                    size_t height, struct frame_result *result);
+
+static const char *const backend_names[] = {"switch", "computed goto",
+                                            "tail calls"};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/* -------- the same programs as plain recursion -------- */
+
+static void hanoi(struct frame_result *r, int32_t numberOfDisks,
+                  int32_t source, int32_t temp, int32_t target) {
+  r->calls++;
+  if (numberOfDisks == 1) {
+    r->moves++;
+    r->checksum = r->checksum * 31 + (uint64_t)(source * 4 + target);
+  } else {
+    hanoi(r, numberOfDisks - 1, source, target, temp);
+    r->moves++;
+    r->checksum = r->checksum * 31 + (uint64_t)(source * 4 + target);
+    hanoi(r, numberOfDisks - 1, temp, source, target);
+  }
+}
+
+static int64_t ackermann(struct frame_result *r, int64_t m, int64_t n) {
+  r->calls++;
+  if (m == 0)
+    return n + 1;
+  if (n == 0)
+    return ackermann(r, m - 1, 1);
+  return ackermann(r, m - 1, ackermann(r, m, n - 1));
+}
+
+static int64_t fib(struct frame_result *r, int64_t n) {
+  r->calls++;
+  if (n < 2)
+    return n;
+  return fib(r, n - 1) + fib(r, n - 2);
+}
+
+static int64_t tree_sum(struct frame_result *r,
+                        const struct frame_tree_node *tree, int32_t node) {
+  r->calls++;
+  if (node < 0)
+    return 0;
+  return tree_sum(r, tree, tree[node].left) +
+         tree_sum(r, tree, tree[node].right) + tree[node].value;
+}
+
+/* -------- benchmark -------- */
+
+enum program { HANOI, ACKERMANN, FIB, TREE_SUM };
+
+struct workload {
+  enum program program;
+  int64_t x, y;
+  const struct frame_tree_node *tree;
+  size_t height;
+};
+
+static bool run_native(const struct workload *w, struct frame_result *r) {
+  *r = (struct frame_result){0, 0, 0, 0};
+  switch (w->program) {
+  case HANOI:
+    hanoi(r, (int32_t)w->x, 1, 2, 3);
+    break;
+  case ACKERMANN:
+    r->value = ackermann(r, w->x, w->y);
+    break;
+  case FIB:
+    r->value = fib(r, w->x);
+    break;
+  case TREE_SUM:
+    r->value = tree_sum(r, w->tree, 0);
+    break;
+  }
+  return true;
+}
+
+static bool run_frames(const struct workload *w, enum frame_backend backend,
+                       struct frame_result *r) {
+  switch (w->program) {
+  case HANOI:
+    return frame_hanoi(backend, (int32_t)w->x, r);
+  case ACKERMANN:
+    return frame_ackermann(backend, w->x, w->y, r);
+  case FIB:
+    return frame_fib(backend, w->x, r);
+  case TREE_SUM:
+    return frame_tree_sum(backend, w->tree, 0, w->height, r);
+  }
+  return false;
+}
+
+/*
+ * Hanoi makes its second recursive call a tail call in the
+ * frame machine, so it enters fewer frames; compare the moves.
+ */
+static bool same_result(const struct workload *w, const struct frame_result *a,
+                        const struct frame_result *b) {
+  if (w->program == HANOI)
+    return a->moves == b->moves && a->checksum == b->checksum;
+  return a->value == b->value;
+}
+
+static void bench(const char *label, const struct workload *w) {
+  struct frame_result native;
+  double start = now_seconds();
+  run_native(w, &native);
+  double native_time = now_seconds() - start;
+  printf("%s\n", label);
+  printf("  %-14s %12" PRIu64 " frames %7.2f ns/frame\n", "C recursion",
+         native.calls, native_time / native.calls * 1e9);
+
+  for (int32_t backend = FRAME_SWITCH; backend <= FRAME_TAIL_CALL;
+       backend++) {
+    struct frame_result r;
+    start = now_seconds();
+    bool ok = run_frames(w, (enum frame_backend)backend, &r);
+    double time = now_seconds() - start;
+    if (!ok) {
+      printf("  %-14s ran out of frames\n", backend_names[backend]);
+      exit(EXIT_FAILURE);
+    }
+    printf("  %-14s %12" PRIu64 " frames %7.2f ns/frame%s\n",
+           backend_names[backend], r.calls, time / r.calls * 1e9,
+           same_result(w, &native, &r) ? "" : ", WRONG RESULT");
+    if (!same_result(w, &native, &r))
+      exit(EXIT_FAILURE);
+  }
+}
+
+/* a binary search tree of random keys; returns its height */
+static size_t random_tree(struct frame_tree_node *tree, int32_t n) {
+  size_t height = 0;
+  for (int32_t i = 0; i < n; i++) {
+    tree[i].value = (int64_t)(next_random() >> 32);
+    tree[i].left = tree[i].right = -1;
+    size_t depth = 1;
+    if (i > 0) {
+      int32_t *link = NULL;
+      for (int32_t node = 0; node >= 0; depth++) {
+        link = tree[i].value < tree[node].value ? &tree[node].left
+                                                : &tree[node].right;
+        node = *link;
+      }
+      *link = i;
+    }
+    if (depth > height)
+      height = depth;
+  }
+  return height;
+}
+
+int main(int argc, char *argv[]) {
+  int32_t disks = DEFAULT_DISKS;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:")) != -1) {
+    switch (opt) {
+    case 'd':
+      disks = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-d disks]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (disks < 1 || disks > 40) {
+    fprintf(stderr, "Number of disks must be from 1 to 40\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char label[64];
+  struct workload w = {HANOI, disks, 0, NULL, 0};
+  snprintf(label, sizeof(label), "hanoi(%d)", disks);
+  bench(label, &w);
+
+  w = (struct workload){ACKERMANN, ACKERMANN_M, ACKERMANN_N, NULL, 0};
+  snprintf(label, sizeof(label), "ackermann(%d, %d)", ACKERMANN_M,
+           ACKERMANN_N);
+  bench(label, &w);
+
+  w = (struct workload){FIB, FIB_N, 0, NULL, 0};
+  snprintf(label, sizeof(label), "fib(%d)", FIB_N);
+  bench(label, &w);
+
+  struct frame_tree_node *tree = (struct frame_tree_node *)malloc(
+      TREE_NODES * sizeof(struct frame_tree_node));
+  if (tree == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  size_t height = random_tree(tree, TREE_NODES);
+  w = (struct workload){TREE_SUM, 0, 0, tree, height};
+  snprintf(label, sizeof(label), "sum of a random tree, %d nodes, height %zu",
+           TREE_NODES, height);
+  bench(label, &w);
+  free(tree);
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,398 @@
+/*
+ *
+ * Towers of Hanoi without recursion.
+ *
+ * Number the moves from 1 and the disks from 0, smallest first.
+ * Move k moves disk d, where d is the number of trailing zeros
+ * in k, and that disk has already moved k >> (d + 1) times.
+ * A disk always steps the same way round the pegs: source, temp,
+ * target, source... when the number of disks from it down to the
+ * bottom of the tower is even, and the other way when it is odd.
+ * So every move can be worked out on its own, in constant time,
+ * with no stack at all.
+ *
+ * That lets the moves be cut into ranges and shared out between
+ * a pool of worker threads, each formatting its range into a
+ * buffer of its own; the main thread writes the buffers out in
+ * order, so the output is the same as hanoi-recursive's.
+ *
+ * usage: hanoi-iterative [-b] [-t threads] [-r first-last] [disks]
+ *
+ *   -b  benchmark against the recursive version
+ *   -r  only print moves first to last, counting from 1, and
+ *       "completed hanoi" only if last is the last move
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_bytes(const char *text, size_t length);
+bool out_flush(void);
+#endif
+
+#define MAX_DISKS 63
+#define MAX_THREADS 256
+#define SLOTS_PER_THREAD 2
+#define CHUNK_MOVES 65536
+#define LINE_LENGTH 17 /* "Move from 1 to 3\n" */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define BENCH_DISKS 25
+#define CHECK_DISKS 20
+
+/* the text of every possible move, indexed by from * 3 + to */
+static char lines[9][LINE_LENGTH + 1];
+
+/*
+ * Text for one chunk of moves, waiting to be written out.
+ * A slot may only be filled by the worker that owns 'chunk',
+ * and only written by the main thread once 'ready' is set.
+ */
+struct output_slot {
+  char *text;
+  size_t length;
+  uint64_t chunk;
+  bool ready;
+};
+
+struct hanoi {
+  int32_t disks;
+  uint64_t first; /* moves first to last inclusive */
+  uint64_t last;
+  uint64_t chunk_count;
+  FILE *out; /* 0 to throw the moves away */
+
+  pthread_mutex_t lock;
+  pthread_cond_t slot_free;
+  pthread_cond_t slot_done;
+  uint64_t next_chunk;
+  struct output_slot *slots;
+  size_t slot_count;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* pegs are 0 for source, 1 for temp and 2 for target */
+static void make_lines(void) {
+  for (int32_t from = 0; from < 3; from++)
+    for (int32_t to = 0; to < 3; to++)
+      snprintf(lines[from * 3 + to], sizeof(lines[0]), "Move from %d to %d\n",
+               from + 1, to + 1);
+}
+
+/* move k of a tower of 'disks' disks, as an index into lines */
+static inline uint32_t nth_move(int32_t disks, uint64_t k) {
+  int32_t disk = __builtin_ctzll(k);
+  uint64_t previous_moves = k >> (disk + 1);
+  uint32_t step = (disks - disk) & 1 ? 2 : 1;
+  uint32_t from = (uint32_t)(previous_moves % 3) * step % 3;
+  uint32_t to = (from + step) % 3;
+  return from * 3 + to;
+}
+
+static size_t format_moves(char *out, int32_t disks, uint64_t first,
+                           uint64_t last) {
+  char *p = out;
+  for (uint64_t k = first; k <= last; k++) {
+    memcpy(p, lines[nth_move(disks, k)], LINE_LENGTH);
+    p += LINE_LENGTH;
+  }
+  return p - out;
+}
+
+static void *worker(void *arg) {
+  struct hanoi *h = (struct hanoi *)arg;
+
+  for (;;) {
+    pthread_mutex_lock(&h->lock);
+    if (h->next_chunk == h->chunk_count) {
+      pthread_mutex_unlock(&h->lock);
+      break;
+    }
+    uint64_t chunk = h->next_chunk++;
+    /* wait for the main thread to write out the previous owner */
+    struct output_slot *slot = &h->slots[chunk % h->slot_count];
+    while (slot->chunk != chunk)
+      pthread_cond_wait(&h->slot_free, &h->lock);
+    pthread_mutex_unlock(&h->lock);
+
+    uint64_t first = h->first + chunk * CHUNK_MOVES;
+    uint64_t last = h->last - first < CHUNK_MOVES ? h->last
+                                                  : first + CHUNK_MOVES - 1;
+    size_t length = format_moves(slot->text, h->disks, first, last);
+
+    pthread_mutex_lock(&h->lock);
+    slot->length = length;
+    slot->ready = true;
+    pthread_cond_broadcast(&h->slot_done);
+    pthread_mutex_unlock(&h->lock);
+  }
+  return NULL;
+}
+
+/* to 'out', through src/output when that is standard output */
+static void write_text(FILE *out, const char *text, size_t length) {
+#ifdef BULK_OUTPUT
+  if (out == stdout) {
+    out_bytes(text, length);
+    return;
+  }
+#endif
+  fwrite(text, 1, length, out);
+}
+
+/* write the slots out in chunk order as they become ready */
+static void write_chunks(struct hanoi *h) {
+  for (uint64_t chunk = 0; chunk < h->chunk_count; chunk++) {
+    struct output_slot *slot = &h->slots[chunk % h->slot_count];
+    pthread_mutex_lock(&h->lock);
+    while (!slot->ready)
+      pthread_cond_wait(&h->slot_done, &h->lock);
+    pthread_mutex_unlock(&h->lock);
+
+    if (h->out)
+      write_text(h->out, slot->text, slot->length);
+
+    pthread_mutex_lock(&h->lock);
+    slot->ready = false;
+    slot->chunk = chunk + h->slot_count;
+    pthread_cond_broadcast(&h->slot_free);
+    pthread_mutex_unlock(&h->lock);
+  }
+}
+
+static void run_hanoi(int32_t disks, uint64_t first, uint64_t last,
+                      int32_t threads, FILE *out) {
+  struct hanoi h;
+  memset(&h, 0, sizeof(h));
+  h.disks = disks;
+  h.first = first;
+  h.last = last;
+  h.chunk_count = (last - first) / CHUNK_MOVES + 1;
+  h.out = out;
+  pthread_mutex_init(&h.lock, NULL);
+  pthread_cond_init(&h.slot_free, NULL);
+  pthread_cond_init(&h.slot_done, NULL);
+
+  h.slot_count = (size_t)threads * SLOTS_PER_THREAD;
+  h.slots = (struct output_slot *)xmalloc(h.slot_count *
+                                          sizeof(struct output_slot));
+  for (size_t i = 0; i < h.slot_count; i++) {
+    h.slots[i].text = (char *)xmalloc(CHUNK_MOVES * LINE_LENGTH);
+    h.slots[i].chunk = i;
+    h.slots[i].ready = false;
+  }
+
+  pthread_t tids[MAX_THREADS];
+  for (int32_t i = 0; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, worker, &h) != 0) {
+      fprintf(stderr, "Cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  write_chunks(&h);
+  for (int32_t i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  for (size_t i = 0; i < h.slot_count; i++)
+    free(h.slots[i].text);
+  free(h.slots);
+  pthread_cond_destroy(&h.slot_done);
+  pthread_cond_destroy(&h.slot_free);
+  pthread_mutex_destroy(&h.lock);
+}
+
+/* hanoi from hanoi-recursive.c, printing to 'out' */
+static void hanoi(FILE *out, int32_t numberOfDisks, int32_t source,
+                  int32_t temp, int32_t target) {
+  if (numberOfDisks == 1) {
+    fprintf(out, "Move from %d to %d\n", source, target);
+  } else {
+    hanoi(out, numberOfDisks - 1, source, target, temp);
+    hanoi(out, 1, source, temp, target);
+    hanoi(out, numberOfDisks - 1, temp, source, target);
+  }
+}
+
+/*
+ * The same recursion with the text copied from 'lines', so
+ * that the recursion itself can be timed apart from printf.
+ * Once the buffer is nearly full it is started again.
+ */
+struct text_buffer {
+  char *text;
+  size_t length;
+  size_t size;
+};
+
+static void hanoi_buffered(struct text_buffer *b, int32_t numberOfDisks,
+                           int32_t source, int32_t temp, int32_t target) {
+  if (numberOfDisks == 1) {
+    if (b->size - b->length < LINE_LENGTH)
+      b->length = 0;
+    memcpy(b->text + b->length, lines[source * 3 + target], LINE_LENGTH);
+    b->length += LINE_LENGTH;
+  } else {
+    hanoi_buffered(b, numberOfDisks - 1, source, target, temp);
+    hanoi_buffered(b, 1, source, temp, target);
+    hanoi_buffered(b, numberOfDisks - 1, temp, source, target);
+  }
+}
+
+/* the iterative moves must match the recursive ones exactly */
+static bool check_moves(int32_t disks) {
+  uint64_t moves = ((uint64_t)1 << disks) - 1;
+  struct text_buffer b = {(char *)xmalloc(moves * LINE_LENGTH), 0,
+                          moves * LINE_LENGTH};
+  char *text = (char *)xmalloc(moves * LINE_LENGTH);
+  hanoi_buffered(&b, disks, 0, 1, 2);
+  size_t length = format_moves(text, disks, 1, moves);
+  bool ok = length == b.length && memcmp(text, b.text, length) == 0;
+  /* and a range from the middle */
+  if (ok && moves > 2)
+    ok = format_moves(text, disks, moves / 3, moves / 2) ==
+             (moves / 2 - moves / 3 + 1) * LINE_LENGTH &&
+         memcmp(text, b.text + (moves / 3 - 1) * LINE_LENGTH,
+                (moves / 2 - moves / 3 + 1) * LINE_LENGTH) == 0;
+  free(text);
+  free(b.text);
+  return ok;
+}
+
+static void benchmark(int32_t disks, int32_t threads) {
+  for (int32_t d = 1; d <= CHECK_DISKS && d <= disks; d++)
+    if (!check_moves(d)) {
+      printf("moves for %d disks differ from the recursive version\n", d);
+      exit(EXIT_FAILURE);
+    }
+
+  uint64_t moves = ((uint64_t)1 << disks) - 1;
+  FILE *null_file = fopen("/dev/null", "w");
+  if (null_file == NULL) {
+    perror("/dev/null");
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(null_file, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+  double start = now_seconds();
+  hanoi(null_file, disks, 1, 2, 3);
+  fflush(null_file);
+  double printf_time = now_seconds() - start;
+
+  struct text_buffer b = {(char *)xmalloc(OUTPUT_BUFFER_SIZE), 0,
+                          OUTPUT_BUFFER_SIZE};
+  start = now_seconds();
+  hanoi_buffered(&b, disks, 0, 1, 2);
+  double recursive_time = now_seconds() - start;
+  free(b.text);
+
+  start = now_seconds();
+  run_hanoi(disks, 1, moves, 1, null_file);
+  fflush(null_file);
+  double one_time = now_seconds() - start;
+
+  start = now_seconds();
+  run_hanoi(disks, 1, moves, threads, null_file);
+  fflush(null_file);
+  double threaded_time = now_seconds() - start;
+  fclose(null_file);
+
+  printf("%d disks, %" PRIu64 " moves, written to /dev/null\n", disks, moves);
+  printf("  recursive, fprintf:      %12.0f moves/sec\n", moves / printf_time);
+  printf("  recursive, buffered:     %12.0f moves/sec, %.1fx\n",
+         moves / recursive_time, printf_time / recursive_time);
+  printf("  iterative, 1 thread:     %12.0f moves/sec, %.1fx\n",
+         moves / one_time, printf_time / one_time);
+  printf("  iterative, %3d threads:  %12.0f moves/sec, %.1fx\n", threads,
+         moves / threaded_time, printf_time / threaded_time);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-b] [-t threads] [-r first-last] [disks]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  int32_t threads = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t first = 1, last = 0;
+  int32_t number_of_disks = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bt:r:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'r':
+      if (sscanf(optarg, "%" SCNu64 "-%" SCNu64, &first, &last) != 2)
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  make_lines();
+
+  if (optind < argc)
+    number_of_disks = atoi(argv[optind]);
+  else if (bench)
+    number_of_disks = BENCH_DISKS;
+  else {
+    printf("Enter the number of disks\n");
+    if (scanf("%d", &number_of_disks) != 1)
+      usage(argv[0]);
+  }
+  if (number_of_disks < 1 || number_of_disks > MAX_DISKS) {
+    fprintf(stderr, "Number of disks must be from 1 to %d\n", MAX_DISKS);
+    exit(EXIT_FAILURE);
+  }
+
+  if (bench) {
+    benchmark(number_of_disks, threads);
+    exit(EXIT_SUCCESS);
+  }
+
+  uint64_t moves = ((uint64_t)1 << number_of_disks) - 1;
+  if (last == 0)
+    last = moves;
+  if (first < 1 || first > last || last > moves) {
+    fprintf(stderr, "Moves must be in the range 1-%" PRIu64 "\n", moves);
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+  run_hanoi(number_of_disks, first, last, threads, stdout);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
+  if (last == moves)
+    printf("completed hanoi\n");
+  exit(EXIT_SUCCESS);
+}
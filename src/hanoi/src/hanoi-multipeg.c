@@ -0,0 +1,332 @@
+/*
+ *
+ * Towers of Hanoi with more than three pegs.
+ *
+ * The Frame-Stewart algorithm moves the top t disks out of the
+ * way to a spare peg using all k pegs, moves the other n - t to
+ * the target using the k - 1 pegs left, and then moves the t
+ * disks on top of them, again using all k.  The best t for every
+ * number of disks and pegs is worked out once, bottom up, from
+ *
+ *   moves(n, 3) = 2^n - 1
+ *   moves(n, k) = min over t of 2 moves(t, k) + moves(n - t, k - 1)
+ *
+ * and kept in a table, so the solver never has to search.  Moves
+ * are formatted into a large buffer and written out whenever it
+ * fills, so the whole sequence is never held in memory.
+ *
+ * usage: hanoi-multipeg [-b] [-p pegs] [disks]
+ *
+ *   -b  benchmark table building and move output for 4 to 8 pegs
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_bytes(const char *text, size_t length);
+#endif
+
+#define MAX_PEGS 64
+#define DEFAULT_PEGS 4
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define MAX_LINE 32
+#define BENCH_TABLE_DISKS 1000
+#define BENCH_MIN_PEGS 4
+#define BENCH_MAX_PEGS 8
+#define BENCH_MOVES 50000000
+#define CHECK_DISKS 40
+
+/*
+ * moves[n][k] is the number of moves for n disks and k pegs,
+ * or UINT64_MAX if that doesn't fit; split[n][k] is the t that
+ * achieves it.  Rows hold MAX_PEGS + 1 entries.
+ */
+struct split_table {
+  int32_t max_disks;
+  int32_t max_pegs;
+  uint64_t *moves;
+  int32_t *split;
+};
+
+struct writer {
+  int fd;
+  char *buffer;
+  size_t length;
+  uint64_t moves;
+};
+
+/* the disks on each peg, for checking a solution as it is made */
+struct checker {
+  int32_t *disks[MAX_PEGS];
+  int32_t height[MAX_PEGS];
+  bool ok;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static uint64_t saturating_add(uint64_t a, uint64_t b) {
+  return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+#define ENTRY(n, k) ((size_t)(n) * (MAX_PEGS + 1) + (k))
+
+static void build_table(struct split_table *table, int32_t max_disks,
+                        int32_t max_pegs) {
+  size_t entries = ENTRY(max_disks + 1, 0);
+  table->max_disks = max_disks;
+  table->max_pegs = max_pegs;
+  table->moves = (uint64_t *)xmalloc(entries * sizeof(uint64_t));
+  table->split = (int32_t *)xmalloc(entries * sizeof(int32_t));
+
+  for (int32_t n = 0; n <= max_disks; n++) {
+    table->moves[ENTRY(n, 3)] = n < 64 ? ((uint64_t)1 << n) - 1 : UINT64_MAX;
+    table->split[ENTRY(n, 3)] = n > 0 ? n - 1 : 0;
+  }
+  for (int32_t k = 4; k <= max_pegs; k++) {
+    table->moves[ENTRY(0, k)] = 0;
+    table->split[ENTRY(0, k)] = 0;
+    for (int32_t n = 1; n <= max_disks; n++) {
+      uint64_t best = UINT64_MAX;
+      int32_t best_t = 0;
+      for (int32_t t = 0; t < n; t++) {
+        uint64_t top = table->moves[ENTRY(t, k)];
+        uint64_t m = saturating_add(saturating_add(top, top),
+                                    table->moves[ENTRY(n - t, k - 1)]);
+        if (m < best || t == 0) {
+          best = m;
+          best_t = t;
+        }
+      }
+      table->moves[ENTRY(n, k)] = best;
+      table->split[ENTRY(n, k)] = best_t;
+    }
+  }
+}
+
+static void free_table(struct split_table *table) {
+  free(table->moves);
+  free(table->split);
+}
+
+static void flush_writer(struct writer *w) {
+#ifdef BULK_OUTPUT
+  if (w->fd == STDOUT_FILENO) {
+    out_bytes(w->buffer, w->length);
+    w->length = 0;
+    return;
+  }
+#endif
+  size_t done = 0;
+  while (w->fd >= 0 && done < w->length) {
+    ssize_t n = write(w->fd, w->buffer + done, w->length - done);
+    if (n < 0) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    done += (size_t)n;
+  }
+  w->length = 0;
+}
+
+static char *format_peg(char *p, int32_t peg) {
+  if (peg >= 10)
+    *p++ = '0' + peg / 10;
+  *p++ = '0' + peg % 10;
+  return p;
+}
+
+/* pegs are numbered from 0 here and from 1 in the output */
+static void emit(struct writer *w, struct checker *c, int32_t from,
+                 int32_t to) {
+  if (c) {
+    int32_t disk = c->height[from] ? c->disks[from][c->height[from] - 1] : -1;
+    if (disk < 0 || (c->height[to] && c->disks[to][c->height[to] - 1] < disk))
+      c->ok = false;
+    else {
+      c->height[from]--;
+      c->disks[to][c->height[to]++] = disk;
+    }
+  }
+  if (OUTPUT_BUFFER_SIZE - w->length < MAX_LINE)
+    flush_writer(w);
+  char *p = w->buffer + w->length;
+  memcpy(p, "Move from ", 10);
+  p = format_peg(p + 10, from + 1);
+  memcpy(p, " to ", 4);
+  p = format_peg(p + 4, to + 1);
+  *p++ = '\n';
+  w->length = p - w->buffer;
+  w->moves++;
+}
+
+static void hanoi3(struct writer *w, struct checker *c, int32_t n,
+                   int32_t source, int32_t temp, int32_t target) {
+  if (n == 0)
+    return;
+  hanoi3(w, c, n - 1, source, target, temp);
+  emit(w, c, source, target);
+  hanoi3(w, c, n - 1, temp, source, target);
+}
+
+/* move n disks from 'from' to 'to' using the pegs in 'pegs' */
+static void solve(const struct split_table *table, struct writer *w,
+                  struct checker *c, int32_t n, int32_t from, int32_t to,
+                  uint64_t pegs) {
+  if (n == 0)
+    return;
+  if (n == 1) {
+    emit(w, c, from, to);
+    return;
+  }
+  uint64_t spares = pegs & ~((uint64_t)1 << from) & ~((uint64_t)1 << to);
+  int32_t spare = __builtin_ctzll(spares);
+  int32_t k = __builtin_popcountll(pegs);
+  if (k == 3) {
+    hanoi3(w, c, n, from, spare, to);
+    return;
+  }
+  int32_t t = table->split[ENTRY(n, k)];
+  solve(table, w, c, t, from, spare, pegs);
+  solve(table, w, c, n - t, from, to, pegs & ~((uint64_t)1 << spare));
+  solve(table, w, c, t, spare, to, pegs);
+}
+
+/* solve for 'disks' disks on pegs 1 to 'pegs', from 1 to the last */
+static uint64_t run(const struct split_table *table, int32_t disks,
+                    int32_t pegs, int fd, bool check) {
+  struct writer w = {fd, (char *)xmalloc(OUTPUT_BUFFER_SIZE), 0, 0};
+  struct checker c;
+  if (check) {
+    for (int32_t p = 0; p < pegs; p++) {
+      c.disks[p] = (int32_t *)xmalloc(disks * sizeof(int32_t));
+      c.height[p] = 0;
+    }
+    for (int32_t d = disks - 1; d >= 0; d--)
+      c.disks[0][c.height[0]++] = d;
+    c.ok = true;
+  }
+  uint64_t all = pegs == 64 ? UINT64_MAX : ((uint64_t)1 << pegs) - 1;
+  solve(table, &w, check ? &c : NULL, disks, 0, pegs - 1, all);
+  flush_writer(&w);
+  free(w.buffer);
+  if (check) {
+    if (c.height[pegs - 1] != disks)
+      c.ok = false;
+    for (int32_t p = 0; p < pegs; p++)
+      free(c.disks[p]);
+    if (!c.ok) {
+      fprintf(stderr, "illegal solution for %d disks and %d pegs\n", disks,
+              pegs);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return w.moves;
+}
+
+static void benchmark(void) {
+  struct split_table table;
+  double start = now_seconds();
+  build_table(&table, BENCH_TABLE_DISKS, BENCH_MAX_PEGS);
+  double table_time = now_seconds() - start;
+  printf("table for up to %d disks and %d pegs built in %.3f s\n",
+         BENCH_TABLE_DISKS, BENCH_MAX_PEGS, table_time);
+
+  int null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0) {
+    perror("/dev/null");
+    exit(EXIT_FAILURE);
+  }
+  for (int32_t k = BENCH_MIN_PEGS; k <= BENCH_MAX_PEGS; k++) {
+    /* check every solution small enough, then time the largest */
+    int32_t disks = 1;
+    for (int32_t n = 1; n <= BENCH_TABLE_DISKS; n++) {
+      uint64_t expected = table.moves[ENTRY(n, k)];
+      if (expected > BENCH_MOVES)
+        break;
+      disks = n;
+      if (n <= CHECK_DISKS && run(&table, n, k, -1, true) != expected) {
+        fprintf(stderr, "wrong number of moves for %d disks and %d pegs\n",
+                n, k);
+        exit(EXIT_FAILURE);
+      }
+    }
+    start = now_seconds();
+    uint64_t moves = run(&table, disks, k, null_fd, false);
+    double time = now_seconds() - start;
+    printf("%d pegs, %4d disks: %10" PRIu64 " moves, %.0f moves/sec\n", k,
+           disks, moves, moves / time);
+  }
+  close(null_fd);
+  free_table(&table);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-b] [-p pegs] [disks]\n", name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false;
+  int32_t pegs = DEFAULT_PEGS;
+  int opt;
+  while ((opt = getopt(argc, argv, "bp:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 'p':
+      pegs = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (bench) {
+    benchmark();
+    exit(EXIT_SUCCESS);
+  }
+  if (pegs < 3 || pegs > MAX_PEGS) {
+    fprintf(stderr, "Number of pegs must be from 3 to %d\n", MAX_PEGS);
+    exit(EXIT_FAILURE);
+  }
+
+  int32_t number_of_disks;
+  if (optind < argc)
+    number_of_disks = atoi(argv[optind]);
+  else {
+    printf("Enter the number of disks\n");
+    fflush(stdout);
+    if (scanf("%d", &number_of_disks) != 1)
+      usage(argv[0]);
+  }
+  if (number_of_disks < 1) {
+    fprintf(stderr, "Number of disks must be at least 1\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct split_table table;
+  build_table(&table, number_of_disks, pegs);
+  run(&table, number_of_disks, pegs, STDOUT_FILENO, false);
+  free_table(&table);
+  exit(EXIT_SUCCESS);
+}
@@ -3,6 +3,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+#endif
+
 #define x86_64_linux
 //#define x86_64_linux
 //#define x86_64_linux
@@ -122,7 +129,15 @@ applyHanoiProcedure : {
            frame_pointer + OFFSET_TO_TARGET, /*src*/
            SIZE_OF_INT32_T                   /*numberOfBytes*/
     );
+#ifdef BULK_OUTPUT
+    out_str("Move from ");
+    out_int(source);
+    out_str(" to ");
+    out_int(target);
+    out_char('\n');
+#else
     printf("Move from %d to %d\n", source, target);
+#endif
   }
   goto endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked;
 notOne:
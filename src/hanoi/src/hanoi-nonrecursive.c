@@ -1,6 +1,16 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+#ifdef BULK_OUTPUT
+#include <stdbool.h>
+
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+bool out_flush(void);
+#endif
+
 void hanoi1(int32_t source, int32_t temp, int32_t target);
 
 void hanoi2(int32_t source, int32_t temp, int32_t target);
@@ -19,12 +29,24 @@ int main(int argc, char *argv[]) {
   int32_t dest = 3;
 
   hanoi1(source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi1\n");
   hanoi2(source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi2\n");
   hanoi3(source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi3\n");
   hanoi4(source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi4\n");
 
   printf("Enter the number of disks\n");
@@ -32,13 +54,24 @@ int main(int argc, char *argv[]) {
   scanf("%d", &number_of_disks);
 
   hanoiBad(number_of_disks, source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi\n");
 
   return 0;
 }
 
 void hanoi1(int32_t source, int32_t temp, int32_t target) {
+#ifdef BULK_OUTPUT
+  out_str("Move from ");
+  out_int(source);
+  out_str(" to ");
+  out_int(target);
+  out_char('\n');
+#else
   printf("Move from %d to %d\n", source, target);
+#endif
 }
 
 void hanoi2(int32_t source, int32_t temp, int32_t target) {
@@ -63,6 +96,14 @@ void hanoi4(int32_t source, int32_t temp, int32_t target) {
 void hanoiBad(int32_t number_of_disks, int32_t source, int32_t temp,
               int32_t target) {
   hanoiBad(number_of_disks, source, target, temp);
+#ifdef BULK_OUTPUT
+  out_str("Move from ");
+  out_int(source);
+  out_str(" to ");
+  out_int(target);
+  out_char('\n');
+#else
   printf("Move from %d to %d\n", source, target);
+#endif
   hanoiBad(number_of_disks, temp, source, target);
 }
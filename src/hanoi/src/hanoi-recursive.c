@@ -1,6 +1,16 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+#ifdef BULK_OUTPUT
+#include <stdbool.h>
+
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+bool out_flush(void);
+#endif
+
 void hanoi(int32_t numberOfDisks, int32_t source, int32_t temp, int32_t target);
 
 int main(int argc, char *argv[]) {
@@ -14,6 +24,9 @@ int main(int argc, char *argv[]) {
   scanf("%d", &number_of_disks);
 
   hanoi(number_of_disks, source, temp, dest);
+#ifdef BULK_OUTPUT
+  out_flush();
+#endif
   printf("completed hanoi\n");
 
   return 0;
@@ -22,7 +35,15 @@ int main(int argc, char *argv[]) {
 void hanoi(int32_t numberOfDisks, int32_t source, int32_t temp,
            int32_t target) {
   if (numberOfDisks == 1) {
+#ifdef BULK_OUTPUT
+    out_str("Move from ");
+    out_int(source);
+    out_str(" to ");
+    out_int(target);
+    out_char('\n');
+#else
     printf("Move from %d to %d\n", source, target);
+#endif
   } else {
     hanoi(numberOfDisks - 1, source, target, temp);
     hanoi(1, source, temp, target);
@@ -0,0 +1,482 @@
+/*
+ *
+ * hanoi-no-structs, with a stack that grows.
+ *
+ * The original keeps its frames in a fixed 10 MB array and never
+ * checks that a new frame fits.  Here the simulated memory is a
+ * list of chunks, each mmap'd with an inaccessible guard page
+ * below it, for as long as vm.max_map_count leaves room for them:
+ * a guard page splits its mapping in two, and past the limit mmap
+ * fails.  The chunks beyond go without; every call checks that its
+ * frame fits anyway, so the guards only catch this program's own
+ * mistakes.  A call that would run off the bottom of a chunk
+ * moves on to the next one, mapping it if needed, and a return
+ * to a frame in an older chunk moves back.  One emptied chunk is
+ * kept, so a run that calls and returns across a boundary doesn't
+ * map and unmap over and over.  The total size is capped, and a
+ * run that needs more stops with an error rather than crashing.
+ *
+ * The frame layout is no longer a chain of hand-written offsets:
+ * the fields are listed once, and the compiler works out their
+ * offsets, alignment and the frame size.  Frames are aligned, so
+ * fields are read and written directly instead of with memcpy.
+ *
+ * usage: hanoi-segmented-stack [-b] [-q] [-c chunk_kb] [-m max_mb]
+ *                              [-d depth] [disks]
+ *
+ *   -b  benchmark against the recursive version, with a run of
+ *       'depth' nested calls to show the stack growing
+ *   -q  count the moves instead of printing them
+ */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+#endif
+
+#define BYTE uint8_t
+#define BYTE_ADDRESS BYTE *
+
+#define KILOBYTE 1024
+#define MEGABYTE (KILOBYTE * KILOBYTE)
+
+#define DEFAULT_MAX_MAP_COUNT 65530
+#define MAPS_KEPT_SPARE 4096
+
+#define DEFAULT_CHUNK_KB 1024
+#define DEFAULT_MAX_MB 4096
+#define BENCH_DISKS 25
+#define BENCH_DEPTH 10000000
+
+/* the fields of a frame, in order */
+#define HANOI_FRAME_FIELDS(FIELD)                                            \
+  FIELD(int32_t, NUMBER_OF_DISKS)                                            \
+  FIELD(int32_t, SOURCE)                                                     \
+  FIELD(int32_t, TEMP)                                                       \
+  FIELD(int32_t, TARGET)                                                     \
+  FIELD(void *, INSTRUCTION_OF_CALLER)                                       \
+  FIELD(BYTE_ADDRESS, FRAME_POINTER_OF_CALLER)
+
+/*
+ * Never created; it is only here so that offsetof and sizeof
+ * can lay the frame out the way the compiler would.
+ */
+struct hanoi_frame_layout {
+#define FIELD(type, name) type name;
+  HANOI_FRAME_FIELDS(FIELD)
+#undef FIELD
+};
+
+enum {
+#define FIELD(type, name)                                                    \
+  OFFSET_TO_##name = offsetof(struct hanoi_frame_layout, name),
+  HANOI_FRAME_FIELDS(FIELD)
+#undef FIELD
+  SIZE_REQUIRED_FOR_INSTANCE_OF_HANOI_INVOCATION =
+      sizeof(struct hanoi_frame_layout)
+};
+
+/* a field of the frame at 'frame', as an lvalue */
+#define FIELD_OF(frame, type, name) (*(type *)((frame) + OFFSET_TO_##name))
+
+struct chunk {
+  BYTE_ADDRESS mapping; /* guard page first */
+  size_t mapping_size;
+  BYTE_ADDRESS low; /* frames lie in [low, high) */
+  BYTE_ADDRESS high;
+  bool guarded;
+  struct chunk *older;
+  struct chunk *newer; /* kept after it empties */
+};
+
+struct segmented_stack {
+  struct chunk *current;
+  size_t chunk_size;
+  size_t max_chunks;
+  size_t chunks; /* mapped now */
+  size_t peak_chunks;
+  size_t guards_left;
+  size_t unguarded; /* chunks ever mapped without a guard page */
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t max_map_count(void) {
+  size_t count = DEFAULT_MAX_MAP_COUNT;
+  FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%zu", &count) != 1)
+      count = DEFAULT_MAX_MAP_COUNT;
+    fclose(f);
+  }
+  return count;
+}
+
+static struct chunk *map_chunk(struct segmented_stack *s) {
+  if (s->chunks == s->max_chunks)
+    return NULL;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  struct chunk *c = (struct chunk *)malloc(sizeof(struct chunk));
+  if (c == NULL)
+    return NULL;
+  c->mapping_size = s->chunk_size + page;
+  c->mapping = (BYTE_ADDRESS)mmap(NULL, c->mapping_size,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (c->mapping == (BYTE_ADDRESS)MAP_FAILED) {
+    free(c);
+    return NULL;
+  }
+  c->guarded = s->guards_left > 0 &&
+               mprotect(c->mapping, page, PROT_NONE) == 0;
+  if (c->guarded)
+    s->guards_left--;
+  else
+    s->unguarded++;
+  c->low = c->mapping + page;
+  c->high = c->low + s->chunk_size;
+  c->older = c->newer = NULL;
+  if (++s->chunks > s->peak_chunks)
+    s->peak_chunks = s->chunks;
+  return c;
+}
+
+static void unmap_chunk(struct segmented_stack *s, struct chunk *c) {
+  munmap(c->mapping, c->mapping_size);
+  if (c->guarded)
+    s->guards_left++;
+  free(c);
+  s->chunks--;
+}
+
+static bool stack_init(struct segmented_stack *s, size_t chunk_size,
+                       size_t max_size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  s->chunk_size = (chunk_size + page - 1) / page * page;
+  s->max_chunks = max_size / s->chunk_size;
+  s->chunks = s->peak_chunks = 0;
+  s->unguarded = 0;
+  /* each guard page costs two mappings: itself, and the chunk above */
+  size_t maps = max_map_count();
+  s->guards_left = maps > MAPS_KEPT_SPARE ? (maps - MAPS_KEPT_SPARE) / 2 : 0;
+  if (s->max_chunks == 0)
+    s->max_chunks = 1;
+  s->current = map_chunk(s);
+  return s->current != NULL;
+}
+
+static void stack_destroy(struct segmented_stack *s) {
+  struct chunk *c = s->current;
+  while (c->newer)
+    c = c->newer;
+  while (c) {
+    struct chunk *older = c->older;
+    unmap_chunk(s, c);
+    c = older;
+  }
+}
+
+/* move on to a newer chunk; returns its top, or NULL if full */
+static BYTE_ADDRESS stack_grow(struct segmented_stack *s) {
+  struct chunk *c = s->current->newer;
+  if (c == NULL) {
+    if ((c = map_chunk(s)) == NULL)
+      return NULL;
+    c->older = s->current;
+    s->current->newer = c;
+  }
+  s->current = c;
+  return c->high;
+}
+
+/* back to the older chunk, dropping all but one spare */
+static void stack_shrink(struct segmented_stack *s) {
+  struct chunk *spare = s->current;
+  if (spare->newer) {
+    unmap_chunk(s, spare->newer);
+    spare->newer = NULL;
+  }
+  s->current = spare->older;
+}
+
+struct run_stats {
+  uint64_t frames;
+  uint64_t moves;
+  bool overflow;
+};
+
+/*
+ * The machine of hanoi-no-structs.  With 'depth' non-zero it
+ * instead makes that many nested calls, to test the stack.
+ */
+static void run_machine(struct segmented_stack *stack, int32_t number_of_disks,
+                        int32_t depth, bool print, struct run_stats *stats) {
+  const size_t frame_size = SIZE_REQUIRED_FOR_INSTANCE_OF_HANOI_INVOCATION;
+  BYTE_ADDRESS frame_pointer = stack->current->high;
+  BYTE_ADDRESS stack_low = stack->current->low;
+  BYTE_ADDRESS stack_high = stack->current->high;
+  uint64_t frames = 1, moves = 0;
+  bool overflow = false;
+
+/*
+ * Make room for a callee frame, moving to a new chunk if this
+ * one is full, and fill in the fields every call has.
+ */
+#define NEW_FRAME(callee, return_label)                                      \
+  BYTE_ADDRESS callee = frame_pointer - frame_size;                          \
+  if (callee < stack_low) {                                                  \
+    BYTE_ADDRESS top = stack_grow(stack);                                    \
+    if (top == NULL) {                                                       \
+      overflow = true;                                                       \
+      goto endMain;                                                          \
+    }                                                                        \
+    callee = top - frame_size;                                               \
+    stack_low = stack->current->low;                                         \
+    stack_high = stack->current->high;                                       \
+  }                                                                          \
+  FIELD_OF(callee, void *, INSTRUCTION_OF_CALLER) = &&return_label;          \
+  FIELD_OF(callee, BYTE_ADDRESS, FRAME_POINTER_OF_CALLER) = frame_pointer;   \
+  frames++
+
+  // create first frame
+  frame_pointer = frame_pointer - frame_size;
+  FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) =
+      depth ? depth : number_of_disks;
+  FIELD_OF(frame_pointer, int32_t, SOURCE) = 1;
+  FIELD_OF(frame_pointer, int32_t, TEMP) = 2;
+  FIELD_OF(frame_pointer, int32_t, TARGET) = 3;
+  FIELD_OF(frame_pointer, void *, INSTRUCTION_OF_CALLER) = &&endMain;
+  FIELD_OF(frame_pointer, BYTE_ADDRESS, FRAME_POINTER_OF_CALLER) = NULL;
+  if (depth)
+    goto applyNestProcedure;
+
+applyHanoiProcedure:
+  if (FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) != 1)
+    goto notOne;
+  moves++;
+  if (print) {
+#ifdef BULK_OUTPUT
+    out_str("Move from ");
+    out_int(FIELD_OF(frame_pointer, int32_t, SOURCE));
+    out_str(" to ");
+    out_int(FIELD_OF(frame_pointer, int32_t, TARGET));
+    out_char('\n');
+#else
+    printf("Move from %d to %d\n", FIELD_OF(frame_pointer, int32_t, SOURCE),
+           FIELD_OF(frame_pointer, int32_t, TARGET));
+#endif
+  }
+  goto endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked;
+notOne : {
+  NEW_FRAME(stack_frame_of_callee, move1ToTarget);
+  FIELD_OF(stack_frame_of_callee, int32_t, NUMBER_OF_DISKS) =
+      FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) - 1;
+  FIELD_OF(stack_frame_of_callee, int32_t, SOURCE) =
+      FIELD_OF(frame_pointer, int32_t, SOURCE);
+  FIELD_OF(stack_frame_of_callee, int32_t, TEMP) =
+      FIELD_OF(frame_pointer, int32_t, TARGET);
+  FIELD_OF(stack_frame_of_callee, int32_t, TARGET) =
+      FIELD_OF(frame_pointer, int32_t, TEMP);
+  frame_pointer = stack_frame_of_callee;
+}
+  goto applyHanoiProcedure;
+move1ToTarget : {
+  NEW_FRAME(stack_frame_of_callee, moveNMinus1FromTempToTarget);
+  FIELD_OF(stack_frame_of_callee, int32_t, NUMBER_OF_DISKS) = 1;
+  FIELD_OF(stack_frame_of_callee, int32_t, SOURCE) =
+      FIELD_OF(frame_pointer, int32_t, SOURCE);
+  FIELD_OF(stack_frame_of_callee, int32_t, TEMP) =
+      FIELD_OF(frame_pointer, int32_t, TEMP);
+  FIELD_OF(stack_frame_of_callee, int32_t, TARGET) =
+      FIELD_OF(frame_pointer, int32_t, TARGET);
+  frame_pointer = stack_frame_of_callee;
+}
+  goto applyHanoiProcedure;
+moveNMinus1FromTempToTarget : {
+  NEW_FRAME(stack_frame_of_callee,
+            endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked);
+  FIELD_OF(stack_frame_of_callee, int32_t, NUMBER_OF_DISKS) =
+      FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) - 1;
+  FIELD_OF(stack_frame_of_callee, int32_t, SOURCE) =
+      FIELD_OF(frame_pointer, int32_t, TEMP);
+  FIELD_OF(stack_frame_of_callee, int32_t, TEMP) =
+      FIELD_OF(frame_pointer, int32_t, SOURCE);
+  FIELD_OF(stack_frame_of_callee, int32_t, TARGET) =
+      FIELD_OF(frame_pointer, int32_t, TARGET);
+  frame_pointer = stack_frame_of_callee;
+}
+  goto applyHanoiProcedure;
+
+  // nest(n): if n > 0, nest(n - 1)
+applyNestProcedure:
+  if (FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) == 0)
+    goto endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked;
+  {
+    NEW_FRAME(stack_frame_of_callee,
+              endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked);
+    FIELD_OF(stack_frame_of_callee, int32_t, NUMBER_OF_DISKS) =
+        FIELD_OF(frame_pointer, int32_t, NUMBER_OF_DISKS) - 1;
+    frame_pointer = stack_frame_of_callee;
+  }
+  goto applyNestProcedure;
+
+endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked : {
+  void *goBackToCaller =
+      FIELD_OF(frame_pointer, void *, INSTRUCTION_OF_CALLER);
+  frame_pointer = FIELD_OF(frame_pointer, BYTE_ADDRESS, FRAME_POINTER_OF_CALLER);
+  /* chunks are wherever mmap put them, not necessarily in order */
+  if ((frame_pointer < stack_low || frame_pointer >= stack_high) &&
+      stack->current->older != NULL) {
+    stack_shrink(stack);
+    stack_low = stack->current->low;
+    stack_high = stack->current->high;
+  }
+  goto *goBackToCaller;
+}
+#undef NEW_FRAME
+
+endMain:
+  stats->frames = frames;
+  stats->moves = moves;
+  stats->overflow = overflow;
+}
+
+/* hanoi from hanoi-recursive.c, counting instead of printing */
+static void hanoi(int32_t numberOfDisks, int32_t source, int32_t temp,
+                  int32_t target, struct run_stats *stats) {
+  stats->frames++;
+  if (numberOfDisks == 1) {
+    stats->moves++;
+  } else {
+    hanoi(numberOfDisks - 1, source, target, temp, stats);
+    hanoi(1, source, temp, target, stats);
+    hanoi(numberOfDisks - 1, temp, source, target, stats);
+  }
+}
+
+static void benchmark(int32_t disks, int32_t depth, size_t chunk_size,
+                      size_t max_size) {
+  struct run_stats recursive = {0, 0, false}, simulated;
+  double start = now_seconds();
+  hanoi(disks, 1, 2, 3, &recursive);
+  double recursive_time = now_seconds() - start;
+
+  struct segmented_stack stack;
+  if (!stack_init(&stack, chunk_size, max_size)) {
+    fprintf(stderr, "Cannot map the stack\n");
+    exit(EXIT_FAILURE);
+  }
+  start = now_seconds();
+  run_machine(&stack, disks, 0, false, &simulated);
+  double simulated_time = now_seconds() - start;
+  bool agree = !simulated.overflow && simulated.frames == recursive.frames &&
+               simulated.moves == recursive.moves;
+
+  printf("%d disks, %" PRIu64 " frames%s\n", disks, recursive.frames,
+         agree ? "" : ", RESULTS DIFFER");
+  printf("  hanoi-recursive:       %12.0f frames/sec\n",
+         recursive.frames / recursive_time);
+  printf("  segmented stack:       %12.0f frames/sec, %.2fx\n",
+         simulated.frames / simulated_time, recursive_time / simulated_time);
+
+  start = now_seconds();
+  run_machine(&stack, 0, depth, false, &simulated);
+  double nest_time = now_seconds() - start;
+  if (simulated.overflow)
+    printf("%d nested calls: stack limit of %zu MB reached\n", depth,
+           max_size / MEGABYTE);
+  else
+    printf("%d nested calls: %.0f frames/sec, at most %zu chunks of %zu KB, "
+           "%zu without a guard page\n",
+           depth, simulated.frames / nest_time, stack.peak_chunks,
+           stack.chunk_size / KILOBYTE, stack.unguarded);
+  stack_destroy(&stack);
+  if (!agree)
+    exit(EXIT_FAILURE);
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-b] [-q] [-c chunk_kb] [-m max_mb] [-d depth] "
+          "[disks]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+  bool bench = false, print = true;
+  size_t chunk_kb = DEFAULT_CHUNK_KB, max_mb = DEFAULT_MAX_MB;
+  int32_t depth = BENCH_DEPTH;
+  int opt;
+  while ((opt = getopt(argc, argv, "bqc:m:d:")) != -1) {
+    switch (opt) {
+    case 'b':
+      bench = true;
+      break;
+    case 'q':
+      print = false;
+      break;
+    case 'c':
+      chunk_kb = strtoull(optarg, NULL, 10);
+      break;
+    case 'm':
+      max_mb = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (chunk_kb < 1 || max_mb < 1 || depth < 1)
+    usage(argv[0]);
+
+  int32_t number_of_disks = BENCH_DISKS;
+  if (optind < argc)
+    number_of_disks = atoi(argv[optind]);
+  else if (!bench) {
+    printf("Enter the number of disks\n");
+    if (scanf("%d", &number_of_disks) != 1)
+      usage(argv[0]);
+  }
+  if (number_of_disks < 1 || number_of_disks > 62) {
+    fprintf(stderr, "Number of disks must be from 1 to 62\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (bench) {
+    benchmark(number_of_disks, depth, chunk_kb * KILOBYTE, max_mb * MEGABYTE);
+    exit(EXIT_SUCCESS);
+  }
+
+  struct segmented_stack stack;
+  if (!stack_init(&stack, chunk_kb * KILOBYTE, max_mb * MEGABYTE)) {
+    fprintf(stderr, "Cannot map the stack\n");
+    exit(EXIT_FAILURE);
+  }
+  struct run_stats stats;
+  run_machine(&stack, number_of_disks, 0, print, &stats);
+  stack_destroy(&stack);
+  if (stats.overflow) {
+    fprintf(stderr, "Stack overflow\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!print)
+    printf("%" PRIu64 " moves\n", stats.moves);
+  exit(EXIT_SUCCESS);
+}
@@ -2,6 +2,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef BULK_OUTPUT
+/* src/output/src/output.c */
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+#endif
+
 int main(int argc, char *argv[]) {
 
   int32_t source = 1;
@@ -44,8 +51,16 @@ applyHanoiProcedure:
 
   if (current_stack_frame->number_of_disks != 1)
     goto notOne;
+#ifdef BULK_OUTPUT
+  out_str("Move from ");
+  out_int(current_stack_frame->source);
+  out_str(" to ");
+  out_int(current_stack_frame->target);
+  out_char('\n');
+#else
   printf("Move from %d to %d\n", current_stack_frame->source,
          current_stack_frame->target);
+#endif
   goto endProcedureSoRestoreCallersLocalVarsAndContinueItWhereCallerBlocked;
 notOne:
 moveNMinus1FromSourceToTemp:
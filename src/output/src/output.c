@@ -0,0 +1,315 @@
+/*
+ *
+ * Printing lines without printf.
+ *
+ * Example 8.6 prints ten thousand lines, example 4.2 four hundred
+ * and forty-one, each with its own printf: the format string is
+ * parsed again for every line, the numbers are converted by the
+ * general-purpose code behind it, and the stream is locked and
+ * unlocked around each call.  Here each thread has a buffer of its
+ * own, OUT_BUFFER_SIZE bytes, so nothing is locked; text is copied
+ * straight into it, and numbers are converted by code that does
+ * only that, two digits at a time from a table of the pairs 00 to
+ * 99.  The buffer goes out in one write when it fills, when
+ * out_flush is called, and at exit.
+ *
+ * A piece of text too big to be worth copying is written together
+ * with what is buffered ahead of it, by one writev; out_writev is
+ * there for anything else with several buffers to write at once,
+ * the ranges formatted by a pool of threads, say, in order.
+ *
+ * Fixed-point numbers come out as printf's "%.*f" would print them.
+ * The value is scaled by a power of ten and rounded to an integer
+ * when that integer is exact in a double and the scaled value is
+ * not so close to halfway between two integers that the error of
+ * the scaling could change which way it rounds; the rest, huge
+ * values, near-halfway ones, infinities and NaNs, go to snprintf.
+ *
+ * Anything printf has left in stdout's buffer is flushed before
+ * this buffer is written to standard output, so lines printed with
+ * printf come out ahead of the out_ lines that follow them.  The
+ * other way round this cannot tell: a caller going back to printf
+ * after out_ must call out_flush first, or the printf lines, even
+ * those printed at exit, may come out ahead.  The buffer of the
+ * thread that calls exit is flushed by an atexit handler; any
+ * other thread should call out_release before it ends.
+ *
+ * Configured with -DBULK_OUTPUT=ON, examples 2.2, 4.2 and 8.6 and
+ * the hanoi solvers print their lines through this instead of
+ * printf, with the same output; hanoi-iterative and hanoi-multipeg,
+ * which format their moves into buffers of their own, hand those
+ * over to out_bytes.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OUT_BUFFER_SIZE (1024 * 1024)
+/* bigger than this, text is written out rather than copied */
+#define COPY_LIMIT (OUT_BUFFER_SIZE / 4)
+#define MAX_INT_LENGTH 20 /* "-9223372036854775808" */
+#define MAX_DECIMALS 9
+/* '-', the integer part of a number under 2^53, '.' and 9 decimals */
+#define MAX_FAST_FIXED_LENGTH 32
+/* "%.9f" of -DBL_MAX */
+#define MAX_FIXED_LENGTH 328
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+static const double scales[MAX_DECIMALS + 1] = {1e0, 1e1, 1e2, 1e3, 1e4,
+                                                1e5, 1e6, 1e7, 1e8, 1e9};
+static const uint64_t units[MAX_DECIMALS + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000};
+
+struct out_buffer {
+  char *data; /* NULL until first used, or if it could not be had */
+  size_t used;
+  int fd;
+};
+
+static _Thread_local struct out_buffer buffer = {NULL, 0, STDOUT_FILENO};
+static bool exit_handler_set;
+
+/* -------- formatting -------- */
+
+/* the number of decimal digits of value */
+static inline size_t decimal_length(uint64_t value) {
+  size_t length = 1;
+  for (; value >= 100; value /= 100)
+    length += 2;
+  return length + (value >= 10);
+}
+
+/* exactly 'length' digits of value, with leading zeros, ending at end */
+static inline void put_digits(char *end, uint64_t value, size_t length) {
+  for (; length >= 2; length -= 2) {
+    end -= 2;
+    memcpy(end, digit_pairs + 2 * (value % 100), 2);
+    value /= 100;
+  }
+  if (length == 1)
+    end[-1] = (char)('0' + value % 10);
+}
+
+/* the digits of value at to, which has room for 20; their number */
+size_t out_format_uint(char *to, uint64_t value) {
+  size_t length = decimal_length(value);
+  put_digits(to + length, value, length);
+  return length;
+}
+
+/* value at to, which has room for MAX_INT_LENGTH; the length */
+size_t out_format_int(char *to, int64_t value) {
+  if (value >= 0)
+    return out_format_uint(to, (uint64_t)value);
+  to[0] = '-';
+  return 1 + out_format_uint(to + 1, -(uint64_t)value);
+}
+
+/* the fixed-point digits of value, or 0 if snprintf must do it */
+static size_t format_fixed_fast(char *to, double value, int decimals) {
+  double scaled = fabs(value) * scales[decimals];
+  /* false for NaN, too */
+  if (!(scaled < 0x1p53))
+    return 0;
+  /*
+   * The product is within half a unit in its last place of the
+   * exact one, so unless it is that close to a half, it rounds to
+   * the same integer.
+   */
+  double below = floor(scaled);
+  if (fabs(scaled - below - 0.5) <= scaled * 0x1p-52)
+    return 0;
+  uint64_t count = (uint64_t)below + (scaled - below > 0.5);
+  size_t length = 0;
+  if (signbit(value))
+    to[length++] = '-';
+  length += out_format_uint(to + length, count / units[decimals]);
+  if (decimals > 0) {
+    to[length++] = '.';
+    length += (size_t)decimals;
+    put_digits(to + length, count % units[decimals], (size_t)decimals);
+  }
+  return length;
+}
+
+/*
+ * value with 'decimals' decimals, 0 to 9, as "%.*f" would print it,
+ * at to, which has room for MAX_FIXED_LENGTH; the length.
+ */
+size_t out_format_fixed(char *to, double value, int decimals) {
+  if (decimals < 0)
+    decimals = 0;
+  if (decimals > MAX_DECIMALS)
+    decimals = MAX_DECIMALS;
+  size_t length = format_fixed_fast(to, value, decimals);
+  if (length == 0)
+    length = (size_t)snprintf(to, MAX_FIXED_LENGTH, "%.*f", decimals, value);
+  return length;
+}
+
+/* -------- writing -------- */
+
+/*
+ * Write all of the 'count' buffers of iov to fd, IOV_MAX at a time,
+ * taking up again after a partial write or a signal.  iov is used
+ * up on the way.  0, or -1 with errno set.
+ */
+int out_writev(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t n = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    size_t written = (size_t)n;
+    while (count > 0 && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+/* what is buffered, and then the 'length' bytes of text */
+static bool write_out(const char *text, size_t length) {
+  if (buffer.fd == STDOUT_FILENO)
+    fflush(stdout);
+  struct iovec iov[2];
+  int count = 0;
+  if (buffer.used > 0) {
+    iov[count].iov_base = buffer.data;
+    iov[count++].iov_len = buffer.used;
+  }
+  if (length > 0) {
+    iov[count].iov_base = (void *)text;
+    iov[count++].iov_len = length;
+  }
+  buffer.used = 0;
+  return out_writev(buffer.fd, iov, count) == 0;
+}
+
+static void flush_at_exit(void) { write_out(NULL, 0); }
+
+/*
+ * Room for 'size' bytes at the end of the buffer, writing out what
+ * is in it if need be.  NULL if there is no buffer to be had.
+ */
+static inline char *room(size_t size) {
+  if (buffer.data == NULL) {
+    buffer.data = (char *)malloc(OUT_BUFFER_SIZE);
+    if (buffer.data == NULL)
+      return NULL;
+    if (!__atomic_exchange_n(&exit_handler_set, true, __ATOMIC_RELAXED))
+      atexit(flush_at_exit);
+  }
+  if (OUT_BUFFER_SIZE - buffer.used < size)
+    write_out(NULL, 0);
+  return buffer.data + buffer.used;
+}
+
+void out_bytes(const char *text, size_t length) {
+  if (length > COPY_LIMIT) {
+    write_out(text, length);
+    return;
+  }
+  char *to = room(length);
+  if (to == NULL) {
+    write_out(text, length);
+    return;
+  }
+  memcpy(to, text, length);
+  buffer.used += length;
+}
+
+void out_str(const char *s) { out_bytes(s, strlen(s)); }
+
+void out_char(char c) {
+  char *to = room(1);
+  if (to == NULL) {
+    write_out(&c, 1);
+    return;
+  }
+  *to = c;
+  buffer.used++;
+}
+
+void out_int(int64_t value) {
+  char digits[MAX_INT_LENGTH];
+  char *to = room(MAX_INT_LENGTH);
+  if (to == NULL) {
+    write_out(digits, out_format_int(digits, value));
+    return;
+  }
+  buffer.used += out_format_int(to, value);
+}
+
+void out_uint(uint64_t value) {
+  char digits[MAX_INT_LENGTH];
+  char *to = room(MAX_INT_LENGTH);
+  if (to == NULL) {
+    write_out(digits, out_format_uint(digits, value));
+    return;
+  }
+  buffer.used += out_format_uint(to, value);
+}
+
+/* value with 'decimals' decimals, 0 to 9, as "%.*f" prints it */
+void out_fixed(double value, int decimals) {
+  char digits[MAX_FIXED_LENGTH];
+  if (decimals >= 0 && decimals <= MAX_DECIMALS) {
+    char *to = room(MAX_FAST_FIXED_LENGTH);
+    if (to != NULL) {
+      size_t length = format_fixed_fast(to, value, decimals);
+      if (length != 0) {
+        buffer.used += length;
+        return;
+      }
+    }
+  }
+  out_bytes(digits, out_format_fixed(digits, value, decimals));
+}
+
+/* write out this thread's buffer; false, with errno set, if it fails */
+bool out_flush(void) { return write_out(NULL, 0); }
+
+/* flush, then send this thread's output to fd */
+bool out_set_fd(int fd) {
+  bool ok = write_out(NULL, 0);
+  buffer.fd = fd;
+  return ok;
+}
+
+/* flush and free this thread's buffer, as a thread ends */
+bool out_release(void) {
+  bool ok = write_out(NULL, 0);
+  free(buffer.data);
+  buffer.data = NULL;
+  return ok;
+}
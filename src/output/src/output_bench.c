@@ -0,0 +1,421 @@
+/*
+ *
+ * Example 8.6 on the output module of output.c.
+ *
+ * Prints example 8.6's ten thousand lines, a piece at a time into
+ * the buffer, with no printf.
+ *
+ * With -b, the module's numbers are first checked against
+ * snprintf's, and what it writes against what it was given.  Then
+ * 'lines' lines, ten million by default, are written to /dev/null:
+ * example 8.6's, by fprintf with stdio's own buffer and with one of
+ * a megabyte, and by the module; example 2.2's, with fixed-point
+ * numbers, both ways; and example 8.6's again from 'threads'
+ * threads at once, 4 by default, through one FILE and through a
+ * buffer per thread.  Each is reported in lines per second and in
+ * write system calls per million lines, as counted in
+ * /proc/self/io where there is one.
+ *
+ * usage: output-lines [-b] [-n lines] [-t threads]
+ */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LINES 10000000
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 256
+#define MAX_INT_LENGTH 20
+#define MAX_FIXED_LENGTH 328
+#define CHECK_NUMBERS 1000000
+#define CHECK_PIECES 5000
+#define CHECK_BUFFERS 3000
+#define STDIO_BUFFER_SIZE (1024 * 1024)
+#define MEGABYTE (1024 * 1024)
+
+size_t out_format_uint(char *to, uint64_t value);
+size_t out_format_int(char *to, int64_t value);
+size_t out_format_fixed(char *to, double value, int decimals);
+int out_writev(int fd, struct iovec *iov, int count);
+void out_bytes(const char *text, size_t length);
+void out_str(const char *s);
+void out_char(char c);
+void out_int(int64_t value);
+void out_uint(uint64_t value);
+void out_fixed(double value, int decimals);
+bool out_flush(void);
+bool out_set_fd(int fd);
+bool out_release(void);
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void fail(const char *what) {
+  perror(what);
+  exit(EXIT_FAILURE);
+}
+
+/* xorshift64 */
+static uint64_t random_state = 88172645463325252ULL;
+
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+/* -------- example 8.6 -------- */
+
+static void example(void) {
+  for (int i_var = 0; i_var != 10000; i_var++) {
+    out_str("in func, i_var is ");
+    out_int(i_var);
+    out_char('\n');
+  }
+}
+
+/* -------- checking -------- */
+
+static void differ(const char *what, const char *got, const char *expected) {
+  fprintf(stderr, "%s: results differ: %s, not %s\n", what, got, expected);
+  exit(EXIT_FAILURE);
+}
+
+/* a double of any sign and size, often a short decimal or near one */
+static double random_double(void) {
+  uint64_t r = next_random();
+  double value;
+  switch (r & 7) {
+  case 0: {
+    uint64_t bits = next_random();
+    memcpy(&value, &bits, sizeof(value));
+    break;
+  }
+  case 1:
+    /* a few decimals, and halfway for one fewer */
+    value = (double)(int64_t)(next_random() % 2000001 - 1000000) / 1000.0;
+    break;
+  case 2:
+    value = ldexp((double)(next_random() >> 11), -(int)(r >> 8 & 63));
+    break;
+  default:
+    value = (double)(int64_t)next_random() /
+            pow(10.0, (double)(r >> 8 & 31)) / 3.0;
+    break;
+  }
+  return r & 8 ? -value : value;
+}
+
+static void check_numbers(void) {
+  static const int64_t edges[] = {
+      0, 1, 9, 10, 99, 100, 999, 1000, 9999, 10000, 99999, 100000,
+      999999999, 1000000000, 9999999999, INT32_MAX, INT32_MIN,
+      INT64_MAX, INT64_MIN, INT64_MIN + 1, -1, -9, -10, -99, -100};
+  char got[MAX_FIXED_LENGTH + 1], expected[MAX_FIXED_LENGTH + 1];
+  size_t count = sizeof(edges) / sizeof(edges[0]);
+  for (size_t i = 0; i < count + CHECK_NUMBERS; i++) {
+    int64_t value = i < count ? edges[i]
+                              : (int64_t)(next_random() >>
+                                          (next_random() & 63));
+    if (i >= count && next_random() & 1)
+      value = -value;
+    got[out_format_int(got, value)] = 0;
+    snprintf(expected, sizeof(expected), "%" PRId64, value);
+    if (strcmp(got, expected) != 0)
+      differ("out_format_int", got, expected);
+    got[out_format_uint(got, (uint64_t)value)] = 0;
+    snprintf(expected, sizeof(expected), "%" PRIu64, (uint64_t)value);
+    if (strcmp(got, expected) != 0)
+      differ("out_format_uint", got, expected);
+  }
+
+  static const double special[] = {0.0,
+                                   -0.0,
+                                   0.5,
+                                   1.5,
+                                   2.5,
+                                   0.125,
+                                   0.375,
+                                   1e-300,
+                                   -1e-300,
+                                   1e300,
+                                   INFINITY,
+                                   -INFINITY,
+                                   NAN,
+                                   9007199254740993.0,
+                                   4503599627370495.5};
+  count = sizeof(special) / sizeof(special[0]);
+  for (size_t i = 0; i < count + CHECK_NUMBERS; i++) {
+    double value = i < count ? special[i] : random_double();
+    for (int decimals = 0; decimals <= 9; decimals++) {
+      got[out_format_fixed(got, value, decimals)] = 0;
+      snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+      if (strcmp(got, expected) != 0)
+        differ("out_format_fixed", got, expected);
+    }
+  }
+}
+
+/* pieces of every size, some bigger than the buffer, written to a file */
+static void check_writing(void) {
+  char path[] = "/tmp/output-check-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    fail("mkstemp");
+  unlink(path);
+  size_t size = 0, capacity = 64 * MEGABYTE;
+  char *expected = (char *)xmalloc(capacity);
+  char *piece = (char *)xmalloc(2 * MEGABYTE);
+  out_set_fd(fd);
+  for (size_t i = 0; i < CHECK_PIECES; i++) {
+    uint64_t r = next_random();
+    size_t length = r % 100 == 0 ? (size_t)(r >> 8) % (2 * MEGABYTE)
+                                 : (size_t)(r >> 8) % 200;
+    if (size + length + MAX_INT_LENGTH + 1 + CHECK_BUFFERS * 64 > capacity)
+      break;
+    for (size_t k = 0; k < length; k++)
+      piece[k] = (char)('a' + (i + k) % 26);
+    out_bytes(piece, length);
+    memcpy(expected + size, piece, length);
+    size += length;
+    int64_t value = (int64_t)next_random();
+    out_int(value);
+    size += out_format_int(expected + size, value);
+    out_char('\n');
+    expected[size++] = '\n';
+  }
+  out_set_fd(STDOUT_FILENO);
+
+  /* and some buffers at once, more than writev takes in one call */
+  struct iovec *iov = (struct iovec *)xmalloc(CHECK_BUFFERS * sizeof(*iov));
+  for (size_t i = 0; i < CHECK_BUFFERS; i++) {
+    size_t length = next_random() % 64;
+    iov[i].iov_base = expected + size - length;
+    iov[i].iov_len = length;
+    memmove(expected + size, expected + size - length, length);
+    size += length;
+  }
+  if (out_writev(fd, iov, CHECK_BUFFERS) != 0)
+    fail("writev");
+  free(iov);
+
+  char *got = (char *)xmalloc(size + 1);
+  if (pread(fd, got, size + 1, 0) != (ssize_t)size ||
+      memcmp(got, expected, size) != 0) {
+    fprintf(stderr, "out_bytes: results differ from what was written\n");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  free(got);
+  free(piece);
+  free(expected);
+  printf("checked on %d numbers and %.1f MB written\n", 2 * CHECK_NUMBERS,
+         (double)size / MEGABYTE);
+}
+
+/* -------- timing -------- */
+
+/* write system calls so far, or -1 if there is no /proc/self/io */
+static long long write_calls(void) {
+  FILE *io = fopen("/proc/self/io", "r");
+  if (io == NULL)
+    return -1;
+  char line[128];
+  long long calls = -1;
+  while (fgets(line, sizeof(line), io) != NULL)
+    if (sscanf(line, "syscw: %lld", &calls) == 1)
+      break;
+  fclose(io);
+  return calls;
+}
+
+struct run {
+  const char *name;
+  size_t lines;
+  double start;
+  long long calls;
+};
+
+static void begin(struct run *run, const char *name, size_t lines) {
+  run->name = name;
+  run->lines = lines;
+  run->calls = write_calls();
+  run->start = now_seconds();
+}
+
+static void end(struct run *run) {
+  double seconds = now_seconds() - run->start;
+  long long calls = write_calls();
+  printf("%-28s %8.3f s %10.2f M lines/s", run->name, seconds,
+         run->lines / seconds / 1e6);
+  if (calls >= 0 && run->calls >= 0)
+    printf(" %10.1f writes per M lines\n",
+           (double)(calls - run->calls) * 1e6 / run->lines);
+  else
+    printf("          - writes per M lines\n");
+}
+
+static int null_fd;
+static FILE *null_file;
+static size_t thread_lines;
+
+static void *stdio_lines(void *arg) {
+  int first = (int)(intptr_t)arg;
+  for (int i = first; i != first + (int)thread_lines; i++)
+    fprintf(null_file, "in func, i_var is %d\n", i);
+  return NULL;
+}
+
+static void *buffered_lines(void *arg) {
+  int first = (int)(intptr_t)arg;
+  out_set_fd(null_fd);
+  for (int i = first; i != first + (int)thread_lines; i++) {
+    out_str("in func, i_var is ");
+    out_int(i);
+    out_char('\n');
+  }
+  out_release();
+  return NULL;
+}
+
+static void run_threads(void *(*body)(void *), int threads) {
+  pthread_t thread[MAX_THREADS];
+  for (int t = 0; t < threads; t++)
+    if (pthread_create(&thread[t], NULL, body,
+                       (void *)(intptr_t)(t * (int)thread_lines)) != 0) {
+      fprintf(stderr, "Cannot create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  for (int t = 0; t < threads; t++)
+    pthread_join(thread[t], NULL);
+}
+
+static void bench(size_t lines, int threads) {
+  null_fd = open("/dev/null", O_WRONLY);
+  if (null_fd < 0)
+    fail("/dev/null");
+  null_file = fdopen(null_fd, "w");
+  if (null_file == NULL)
+    fail("fdopen");
+  struct run run;
+  int n = (int)lines;
+
+  printf("\nexample 8.6, \"in func, i_var is %%d\\n\"\n");
+  begin(&run, "fprintf", lines);
+  for (int i = 0; i != n; i++)
+    fprintf(null_file, "in func, i_var is %d\n", i);
+  fflush(null_file);
+  end(&run);
+
+  static char stdio_buffer[STDIO_BUFFER_SIZE];
+  setvbuf(null_file, stdio_buffer, _IOFBF, sizeof(stdio_buffer));
+  begin(&run, "fprintf, 1 MB buffer", lines);
+  for (int i = 0; i != n; i++)
+    fprintf(null_file, "in func, i_var is %d\n", i);
+  fflush(null_file);
+  end(&run);
+
+  out_set_fd(null_fd);
+  begin(&run, "out_str, out_int", lines);
+  for (int i = 0; i != n; i++) {
+    out_str("in func, i_var is ");
+    out_int(i);
+    out_char('\n');
+  }
+  out_flush();
+  end(&run);
+
+  printf("\nexample 2.2, \"%%d %%f %%f\\n\"\n");
+  begin(&run, "fprintf, 1 MB buffer", lines);
+  for (int i = 0; i != n; i++) {
+    double d_var = 5 * (i % 213 - 32) / 9.0;
+    fprintf(null_file, "%d %f %f\n", i, (float)d_var, d_var);
+  }
+  fflush(null_file);
+  end(&run);
+
+  begin(&run, "out_int, out_fixed", lines);
+  for (int i = 0; i != n; i++) {
+    double d_var = 5 * (i % 213 - 32) / 9.0;
+    out_int(i);
+    out_char(' ');
+    out_fixed((float)d_var, 6);
+    out_char(' ');
+    out_fixed(d_var, 6);
+    out_char('\n');
+  }
+  out_flush();
+  end(&run);
+  out_set_fd(STDOUT_FILENO);
+
+  thread_lines = lines / threads;
+  printf("\nexample 8.6 from %d threads\n", threads);
+  begin(&run, "fprintf, one FILE", thread_lines * threads);
+  run_threads(stdio_lines, threads);
+  fflush(null_file);
+  end(&run);
+
+  begin(&run, "a buffer per thread", thread_lines * threads);
+  run_threads(buffered_lines, threads);
+  end(&run);
+
+  fclose(null_file);
+}
+
+int main(int argc, char *argv[]) {
+  bool benchmark = false;
+  size_t lines = DEFAULT_LINES;
+  int threads = DEFAULT_THREADS;
+  int opt;
+  while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+    switch (opt) {
+    case 'b':
+      benchmark = true;
+      break;
+    case 'n':
+      lines = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b] [-n lines] [-t threads]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!benchmark) {
+    example();
+    exit(EXIT_SUCCESS);
+  }
+  if (lines == 0 || lines > INT32_MAX || threads < 1 ||
+      threads > MAX_THREADS || lines < (size_t)threads) {
+    fprintf(stderr, "Arguments out of range\n");
+    exit(EXIT_FAILURE);
+  }
+  check_numbers();
+  check_writing();
+  bench(lines, threads);
+  exit(EXIT_SUCCESS);
+}